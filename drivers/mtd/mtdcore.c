@@ -36,6 +36,7 @@
 #include <linux/idr.h>
 #include <linux/backing-dev.h>
 #include <linux/gfp.h>
+#include <linux/completion.h>
 
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
@@ -858,6 +859,112 @@ int mtd_panic_write(struct mtd_info *mtd, loff_t to, size_t len, size_t *retlen,
 }
 EXPORT_SYMBOL_GPL(mtd_panic_write);
 
+static void mtd_io_erase_callback(struct erase_info *ei)
+{
+	complete((struct completion *)ei->priv);
+}
+
+static int mtd_io_erase(struct mtd_io_req *req)
+{
+	struct completion done;
+	struct erase_info ei;
+	int err;
+
+	init_completion(&done);
+	memset(&ei, 0, sizeof(ei));
+	ei.mtd = req->mtd;
+	ei.addr = req->addr;
+	ei.len = req->len;
+	ei.callback = mtd_io_erase_callback;
+	ei.priv = (u_long)&done;
+
+	err = mtd_erase(req->mtd, &ei);
+	if (err)
+		return err;
+	wait_for_completion(&done);
+
+	if (ei.state == MTD_ERASE_FAILED) {
+		if (ei.fail_addr != MTD_FAIL_ADDR_UNKNOWN)
+			req->retlen = ei.fail_addr - req->addr;
+		return -EIO;
+	}
+	req->retlen = req->len;
+	return 0;
+}
+
+/**
+ * mtd_io_execute - execute an asynchronous I/O request synchronously
+ * @req: the request, already checked by mtd_submit_io()
+ *
+ * Performs the operation on @req->mtd and calls the completion callback.
+ * This emulates mtd_submit_io() for devices without a native implementation,
+ * and drivers which queue the requests to a thread of their own execute them
+ * with it.
+ */
+void mtd_io_execute(struct mtd_io_req *req)
+{
+	struct mtd_info *mtd = req->mtd;
+
+	switch (req->type) {
+	case MTD_IO_READ:
+		req->error = mtd_read(mtd, req->addr, req->len, &req->retlen,
+				      req->buf);
+		break;
+	case MTD_IO_WRITE:
+		req->error = mtd_write(mtd, req->addr, req->len, &req->retlen,
+				       req->buf);
+		break;
+	case MTD_IO_ERASE:
+		req->error = mtd_io_erase(req);
+		break;
+	}
+	req->done(req);
+}
+EXPORT_SYMBOL_GPL(mtd_io_execute);
+
+/**
+ * mtd_submit_io - submit an asynchronous I/O request
+ * @mtd: the device
+ * @req: the request
+ *
+ * Starts the read, write or erase described by @req. @req->done is called
+ * on completion, which may happen before this function returns, and in any
+ * case in a context which may sleep. Devices with a native implementation
+ * (see mtd_has_async_io()) may execute several requests concurrently and
+ * complete them in any order, so an operation which depends on another one
+ * must only be submitted after that one completed. Returns zero if the
+ * request was accepted and a negative error code if not, @req->done is not
+ * called then.
+ */
+int mtd_submit_io(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	req->mtd = mtd;
+	req->retlen = 0;
+	req->error = 0;
+
+	if (req->addr < 0 || req->addr > mtd->size ||
+	    req->len > mtd->size - req->addr)
+		return -EINVAL;
+	switch (req->type) {
+	case MTD_IO_READ:
+		break;
+	case MTD_IO_WRITE:
+	case MTD_IO_ERASE:
+		if (!(mtd->flags & MTD_WRITEABLE))
+			return -EROFS;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!mtd->_submit_io) {
+		mtd_io_execute(req);
+		return 0;
+	}
+	return mtd->_submit_io(mtd, req);
+}
+EXPORT_SYMBOL_GPL(mtd_submit_io);
+
 /*
  * Method to access the protection register area, present in some flash
  * devices. The user data is one time programmable but the factory data is read
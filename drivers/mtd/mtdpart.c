@@ -276,6 +276,16 @@ static void part_sync(struct mtd_info *mtd)
 	part->master->_sync(part->master);
 }
 
+/*
+ * The master executes the request on the partition, @req->mtd, so it does not
+ * need to know the offset.
+ */
+static int part_submit_io(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	struct mtd_part *part = PART(mtd);
+	return part->master->_submit_io(part->master, req);
+}
+
 static int part_suspend(struct mtd_info *mtd)
 {
 	struct mtd_part *part = PART(mtd);
@@ -407,6 +417,8 @@ static struct mtd_part *allocate_partition(struct mtd_info *master,
 		slave->mtd._get_fact_prot_info = part_get_fact_prot_info;
 	if (master->_sync)
 		slave->mtd._sync = part_sync;
+	if (master->_submit_io)
+		slave->mtd._submit_io = part_submit_io;
 	if (!partno && !master->dev.class && master->_suspend &&
 	    master->_resume) {
 			slave->mtd._suspend = part_suspend;
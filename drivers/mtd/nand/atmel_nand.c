@@ -134,9 +134,11 @@ struct atmel_nand_host {
 	void __iomem		*pmerrloc_base;
 	void __iomem		*pmecc_rom_base;
 
-	/* lookup table for alpha_to and index_of */
-	void __iomem		*pmecc_alpha_to;
-	void __iomem		*pmecc_index_of;
+	/* lookup table for alpha_to and index_of, copied from ROM to RAM */
+	int16_t			*pmecc_alpha_to;
+	int16_t			*pmecc_index_of;
+	/* odd syndrome substitution tables, see pmecc_build_subst_tab() */
+	int16_t			*pmecc_subst_tab;
 
 	/* data for pmecc computation */
 	int16_t			*pmecc_partial_syn;
@@ -260,66 +262,103 @@ static void dma_complete_func(void *completion)
 	complete(completion);
 }
 
-static int atmel_nand_dma_op(struct mtd_info *mtd, void *buf, int len,
+/* One buffer of a DMA transfer, see atmel_nand_dma_xfer() */
+struct atmel_nand_dma_buf {
+	void		*buf;
+	int		len;
+	dma_addr_t	phys;
+};
+
+/*
+ * Move @nbufs buffers from or to the NAND data port (or the NFC SRAM) in a
+ * single DMA transaction. One memcpy descriptor is prepared per buffer and
+ * all of them are queued before the transfer is started, only the last one
+ * raises an interrupt. This lets a page and its OOB area go through one
+ * transfer instead of one synchronous transfer per read_buf() call.
+ */
+static int atmel_nand_dma_xfer(struct mtd_info *mtd,
+			       struct atmel_nand_dma_buf *bufs, int nbufs,
 			       int is_read)
 {
 	struct dma_device *dma_dev;
 	enum dma_ctrl_flags flags;
-	dma_addr_t dma_src_addr, dma_dst_addr, phys_addr;
-	struct dma_async_tx_descriptor *tx = NULL;
+	dma_addr_t dev_addr;
+	struct dma_async_tx_descriptor *tx[2];
 	dma_cookie_t cookie;
 	struct nand_chip *chip = mtd->priv;
 	struct atmel_nand_host *host = chip->priv;
-	void *p = buf;
-	int err = -EIO;
+	int i, mapped = 0, total = 0, err = -EIO;
 	enum dma_data_direction dir = is_read ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
 
-	if (buf >= high_memory)
+	if (WARN_ON(nbufs > ARRAY_SIZE(tx)))
 		goto err_buf;
 
-	dma_dev = host->dma_chan->device;
+	for (i = 0; i < nbufs; i++)
+		if (bufs[i].buf >= high_memory)
+			goto err_buf;
 
-	flags = DMA_CTRL_ACK | DMA_PREP_INTERRUPT | DMA_COMPL_SKIP_SRC_UNMAP |
-		DMA_COMPL_SKIP_DEST_UNMAP;
+	dma_dev = host->dma_chan->device;
 
-	phys_addr = dma_map_single(dma_dev->dev, p, len, dir);
-	if (dma_mapping_error(dma_dev->dev, phys_addr)) {
-		dev_err(host->dev, "Failed to dma_map_single\n");
-		goto err_buf;
+	for (mapped = 0; mapped < nbufs; mapped++) {
+		bufs[mapped].phys = dma_map_single(dma_dev->dev,
+				bufs[mapped].buf, bufs[mapped].len, dir);
+		if (dma_mapping_error(dma_dev->dev, bufs[mapped].phys)) {
+			dev_err(host->dev, "Failed to dma_map_single\n");
+			goto err_dma;
+		}
 	}
 
 	if (is_read) {
 		if (host->nfc.data_in_sram)
-			dma_src_addr = get_bank_sram_phys(host) +
+			dev_addr = get_bank_sram_phys(host) +
 				(host->nfc.data_in_sram - get_bank_sram_base(host));
 		else
-			dma_src_addr = host->io_phys;
-
-		dma_dst_addr = phys_addr;
+			dev_addr = host->io_phys;
 	} else {
-		dma_src_addr = phys_addr;
-
 		if (host->use_nfc_sram)
-			dma_dst_addr = get_bank_sram_phys(host);
+			dev_addr = get_bank_sram_phys(host);
 		else
-			dma_dst_addr = host->io_phys;
+			dev_addr = host->io_phys;
 	}
 
-	tx = dma_dev->device_prep_dma_memcpy(host->dma_chan, dma_dst_addr,
-					     dma_src_addr, len, flags);
-	if (!tx) {
-		dev_err(host->dev, "Failed to prepare DMA memcpy\n");
-		goto err_dma;
+	/*
+	 * Prepare all descriptors first: the controller starts a transfer as
+	 * soon as it is submitted, a failure to prepare the next one would
+	 * leave a partially transferred page that PIO cannot complete.
+	 */
+	for (i = 0; i < nbufs; i++) {
+		flags = DMA_CTRL_ACK | DMA_COMPL_SKIP_SRC_UNMAP |
+			DMA_COMPL_SKIP_DEST_UNMAP;
+		if (i == nbufs - 1)
+			flags |= DMA_PREP_INTERRUPT;
+
+		if (is_read)
+			tx[i] = dma_dev->device_prep_dma_memcpy(host->dma_chan,
+					bufs[i].phys, dev_addr + total,
+					bufs[i].len, flags);
+		else
+			tx[i] = dma_dev->device_prep_dma_memcpy(host->dma_chan,
+					dev_addr + total, bufs[i].phys,
+					bufs[i].len, flags);
+		if (!tx[i]) {
+			dev_err(host->dev, "Failed to prepare DMA memcpy\n");
+			goto err_dma;
+		}
+		/* the NAND data port ignores the address, the SRAM does not */
+		if (dev_addr != host->io_phys)
+			total += bufs[i].len;
 	}
 
 	init_completion(&host->comp);
-	tx->callback = dma_complete_func;
-	tx->callback_param = &host->comp;
-
-	cookie = tx->tx_submit(tx);
-	if (dma_submit_error(cookie)) {
-		dev_err(host->dev, "Failed to do DMA tx_submit\n");
-		goto err_dma;
+	tx[nbufs - 1]->callback = dma_complete_func;
+	tx[nbufs - 1]->callback_param = &host->comp;
+
+	for (i = 0; i < nbufs; i++) {
+		cookie = tx[i]->tx_submit(tx[i]);
+		if (dma_submit_error(cookie)) {
+			dev_err(host->dev, "Failed to do DMA tx_submit\n");
+			goto err_dma;
+		}
 	}
 
 	dma_async_issue_pending(host->dma_chan);
@@ -327,18 +366,29 @@ static int atmel_nand_dma_op(struct mtd_info *mtd, void *buf, int len,
 
 	if (is_read && host->nfc.data_in_sram)
 		/* After read data from SRAM, need to increase the position */
-		host->nfc.data_in_sram += len;
+		for (i = 0; i < nbufs; i++)
+			host->nfc.data_in_sram += bufs[i].len;
 
 	err = 0;
 
 err_dma:
-	dma_unmap_single(dma_dev->dev, phys_addr, len, dir);
+	while (mapped--)
+		dma_unmap_single(dma_dev->dev, bufs[mapped].phys,
+				 bufs[mapped].len, dir);
 err_buf:
 	if (err != 0)
 		dev_dbg(host->dev, "Fall back to CPU I/O\n");
 	return err;
 }
 
+static int atmel_nand_dma_op(struct mtd_info *mtd, void *buf, int len,
+			       int is_read)
+{
+	struct atmel_nand_dma_buf dma_buf = { .buf = buf, .len = len };
+
+	return atmel_nand_dma_xfer(mtd, &dma_buf, 1, is_read);
+}
+
 static void atmel_read_buf(struct mtd_info *mtd, u8 *buf, int len)
 {
 	struct nand_chip *chip = mtd->priv;
@@ -371,6 +421,32 @@ static void atmel_write_buf(struct mtd_info *mtd, const u8 *buf, int len)
 		atmel_write_buf8(mtd, buf, len);
 }
 
+/*
+ * Read the page data and the OOB area that follows it, with a single DMA
+ * transaction if possible.
+ */
+static void atmel_nand_read_page_data(struct mtd_info *mtd, u8 *buf, int len)
+{
+	struct nand_chip *chip = mtd->priv;
+	struct atmel_nand_dma_buf dma_bufs[2] = {
+		{ .buf = buf,		.len = len },
+		{ .buf = chip->oob_poi,	.len = mtd->oobsize },
+	};
+
+	if (use_dma && atmel_nand_dma_xfer(mtd, dma_bufs, 2, 1) == 0)
+		return;
+
+	chip->read_buf(mtd, buf, len);
+	chip->read_buf(mtd, chip->oob_poi, mtd->oobsize);
+}
+
+static int atmel_nand_read_page_raw(struct mtd_info *mtd,
+		struct nand_chip *chip, uint8_t *buf, int oob_required, int page)
+{
+	atmel_nand_read_page_data(mtd, buf, mtd->writesize);
+	return 0;
+}
+
 /*
  * Return number of ecc bytes per sector according to sector size and
  * correction capability
@@ -406,15 +482,68 @@ static void __devinit pmecc_config_ecc_layout(struct nand_ecclayout *layout,
 		oobsize - ecc_len - layout->oobfree[0].offset;
 }
 
-static void __devinit __iomem *pmecc_get_alpha_to(struct atmel_nand_host *host)
+/*
+ * The error location code runs on the CPU for every dirty sector. Reading
+ * the Galois field tables from the ROM on each access is slow, so they are
+ * copied to RAM once. alpha_to is extended to twice its size, so that the sum
+ * of two logarithms can be looked up without reducing it modulo cw_len.
+ */
+static int __devinit pmecc_load_gf_tables(struct atmel_nand_host *host)
 {
-	int table_size;
+	int16_t __iomem *rom;
+	int i, table_size;
 
 	table_size = host->pmecc_sector_size == 512 ?
 		PMECC_LOOKUP_TABLE_SIZE_512 : PMECC_LOOKUP_TABLE_SIZE_1024;
 
-	return host->pmecc_rom_base + host->pmecc_lookup_table_offset +
-			table_size * sizeof(int16_t);
+	host->pmecc_index_of = devm_kzalloc(host->dev,
+			table_size * sizeof(int16_t), GFP_KERNEL);
+	host->pmecc_alpha_to = devm_kzalloc(host->dev,
+			2 * table_size * sizeof(int16_t), GFP_KERNEL);
+	if (!host->pmecc_index_of || !host->pmecc_alpha_to)
+		return -ENOMEM;
+
+	rom = host->pmecc_rom_base + host->pmecc_lookup_table_offset;
+	for (i = 0; i < table_size; i++) {
+		host->pmecc_index_of[i] = readw_relaxed(rom + i);
+		host->pmecc_alpha_to[i] = readw_relaxed(rom + table_size + i);
+	}
+	/* alpha^(cw_len + i) = alpha^i */
+	for (i = host->pmecc_cw_len; i < 2 * table_size; i++)
+		host->pmecc_alpha_to[i] =
+			host->pmecc_alpha_to[i - host->pmecc_cw_len];
+
+	return 0;
+}
+
+/*
+ * Odd syndrome S(i) is the sum of alpha^(i*j) over the bits j set in the
+ * partial syndrome. For each odd i, build two 256-entry tables with these sums
+ * for the low and high byte of the partial syndrome, so that
+ * pmecc_substitute() needs two lookups per syndrome instead of one per bit.
+ * The tables only depend on the field, they are shared by all sectors.
+ */
+static void __devinit pmecc_build_subst_tab(struct atmel_nand_host *host)
+{
+	const int cap = host->pmecc_corr_cap;
+	int16_t *alpha_to = host->pmecc_alpha_to;
+	int16_t *tab;
+	int i, j, b;
+
+	for (i = 1; i < 2 * cap; i += 2) {
+		tab = host->pmecc_subst_tab + (i >> 1) * 512;
+		for (b = 0; b < 256; b++) {
+			tab[b] = 0;
+			tab[256 + b] = 0;
+			for (j = 0; j < 8; j++) {
+				if (!(b & (1 << j)))
+					continue;
+				tab[b] ^= alpha_to[i * j];
+				if (j + 8 < host->pmecc_degree)
+					tab[256 + b] ^= alpha_to[i * (j + 8)];
+			}
+		}
+	}
 }
 
 static int __devinit pmecc_data_alloc(struct atmel_nand_host *host)
@@ -422,6 +551,15 @@ static int __devinit pmecc_data_alloc(struct atmel_nand_host *host)
 	const int cap = host->pmecc_corr_cap;
 	int size;
 
+	if (pmecc_load_gf_tables(host))
+		return -ENOMEM;
+
+	host->pmecc_subst_tab = devm_kzalloc(host->dev,
+			cap * 512 * sizeof(int16_t), GFP_KERNEL);
+	if (!host->pmecc_subst_tab)
+		return -ENOMEM;
+	pmecc_build_subst_tab(host);
+
 	size = (2 * cap + 1) * sizeof(int16_t);
 	host->pmecc_partial_syn = devm_kzalloc(host->dev, size, GFP_KERNEL);
 	host->pmecc_si = devm_kzalloc(host->dev, size, GFP_KERNEL);
@@ -467,10 +605,12 @@ static void pmecc_substitute(struct mtd_info *mtd)
 {
 	struct nand_chip *nand_chip = mtd->priv;
 	struct atmel_nand_host *host = nand_chip->priv;
-	int16_t __iomem *alpha_to = host->pmecc_alpha_to;
-	int16_t __iomem *index_of = host->pmecc_index_of;
+	int16_t *alpha_to = host->pmecc_alpha_to;
+	int16_t *index_of = host->pmecc_index_of;
 	int16_t *partial_syn = host->pmecc_partial_syn;
 	const int cap = host->pmecc_corr_cap;
+	const int16_t *tab;
+	uint16_t syn;
 	int16_t *si;
 	int i, j;
 
@@ -479,27 +619,19 @@ static void pmecc_substitute(struct mtd_info *mtd)
 	 */
 	si = host->pmecc_si;
 
-	memset(&si[1], 0, sizeof(int16_t) * (2 * cap - 1));
-
 	/* Computation 2t syndromes based on S(x) */
-	/* Odd syndromes */
+	/* Odd syndromes, a byte of the partial syndrome at a time */
 	for (i = 1; i < 2 * cap; i += 2) {
-		for (j = 0; j < host->pmecc_degree; j++) {
-			if (partial_syn[i] & ((unsigned short)0x1 << j))
-				si[i] = readw_relaxed(alpha_to + i * j) ^ si[i];
-		}
+		tab = host->pmecc_subst_tab + (i >> 1) * 512;
+		syn = partial_syn[i] & ((1 << host->pmecc_degree) - 1);
+		si[i] = tab[syn & 0xff] ^ tab[256 + (syn >> 8)];
 	}
 	/* Even syndrome = (Odd syndrome) ** 2 */
 	for (i = 2, j = 1; j <= cap; i = ++j << 1) {
-		if (si[j] == 0) {
+		if (si[j] == 0)
 			si[i] = 0;
-		} else {
-			int16_t tmp;
-
-			tmp = readw_relaxed(index_of + si[j]);
-			tmp = (tmp * 2) % host->pmecc_cw_len;
-			si[i] = readw_relaxed(alpha_to + tmp);
-		}
+		else
+			si[i] = alpha_to[index_of[si[j]] * 2];
 	}
 
 	return;
@@ -518,8 +650,8 @@ static void pmecc_get_sigma(struct mtd_info *mtd)
 	int cw_len = host->pmecc_cw_len;
 	const int16_t cap = host->pmecc_corr_cap;
 	const int num = 2 * cap + 1;
-	int16_t __iomem	*index_of = host->pmecc_index_of;
-	int16_t __iomem	*alpha_to = host->pmecc_alpha_to;
+	int16_t *index_of = host->pmecc_index_of;
+	int16_t *alpha_to = host->pmecc_alpha_to;
 	int i, j, k;
 	uint32_t dmu_0_count, tmp;
 	int16_t *smu = host->pmecc_smu;
@@ -616,18 +748,18 @@ static void pmecc_get_sigma(struct mtd_info *mtd)
 			for (k = 0; k < num; k++)
 				smu[(i + 1) * num + k] = 0;
 
-			/* Compute smu[i+1] */
+			/* Compute smu[i+1], the dmu[i] / dmu[ro] factor first */
+			tmp = index_of[dmu[i]] + (cw_len - index_of[dmu[ro]]);
+			if (tmp >= cw_len)
+				tmp -= cw_len;
 			for (k = 0; k <= lmu[ro] >> 1; k++) {
-				int16_t a, b, c;
+				int16_t c;
 
-				if (!(smu[ro * num + k] && dmu[i]))
+				c = smu[ro * num + k];
+				if (!c)
 					continue;
-				a = readw_relaxed(index_of + dmu[i]);
-				b = readw_relaxed(index_of + dmu[ro]);
-				c = readw_relaxed(index_of + smu[ro * num + k]);
-				tmp = a + (cw_len - b) + c;
-				a = readw_relaxed(alpha_to + tmp % cw_len);
-				smu[(i + 1) * num + (k + diff)] = a;
+				smu[(i + 1) * num + (k + diff)] =
+					alpha_to[tmp + index_of[c]];
 			}
 
 			for (k = 0; k <= lmu[i] >> 1; k++)
@@ -647,15 +779,9 @@ static void pmecc_get_sigma(struct mtd_info *mtd)
 			if (k == 0) {
 				dmu[i + 1] = si[tmp + 3];
 			} else if (smu[(i + 1) * num + k] && si[tmp + 3 - k]) {
-				int16_t a, b, c;
-				a = readw_relaxed(index_of +
-						smu[(i + 1) * num + k]);
-				b = si[2 * (i - 1) + 3 - k];
-				c = readw_relaxed(index_of + b);
-				tmp = a + c;
-				tmp %= cw_len;
-				dmu[i + 1] = readw_relaxed(alpha_to + tmp) ^
-					dmu[i + 1];
+				dmu[i + 1] ^= alpha_to[
+					index_of[smu[(i + 1) * num + k]] +
+					index_of[si[tmp + 3 - k]]];
 			}
 		}
 	}
@@ -833,8 +959,7 @@ static int atmel_nand_pmecc_read_page(struct mtd_info *mtd,
 	if (!host->use_nfc_sram)
 		pmecc_enable(host, PMECC_READ);
 
-	chip->read_buf(mtd, buf, eccsize);
-	chip->read_buf(mtd, oob, mtd->oobsize);
+	atmel_nand_read_page_data(mtd, buf, eccsize);
 
 	end_time = jiffies + msecs_to_jiffies(PMECC_MAX_TIMEOUT_MS);
 	while ((pmecc_readl_relaxed(host->ecc, SR) & PMECC_SR_BUSY)) {
@@ -853,6 +978,11 @@ static int atmel_nand_pmecc_read_page(struct mtd_info *mtd,
 	return 0;
 }
 
+/*
+ * Unlike on reads, the page data and the OOB area cannot go out in one DMA
+ * transaction: the ECC bytes in the OOB area are only known once PMECC has
+ * seen all the data. The data still go through write_buf(), with DMA.
+ */
 static int atmel_nand_pmecc_write_page(struct mtd_info *mtd,
 		struct nand_chip *chip, const uint8_t *buf, int oob_required)
 {
@@ -1100,9 +1230,6 @@ static int __init atmel_pmecc_nand_init_params(struct platform_device *pdev,
 		host->pmecc_sector_number = mtd->writesize / sector_size;
 		host->pmecc_bytes_per_sector = pmecc_get_ecc_bytes(
 			cap, sector_size);
-		host->pmecc_alpha_to = pmecc_get_alpha_to(host);
-		host->pmecc_index_of = host->pmecc_rom_base +
-			host->pmecc_lookup_table_offset;
 
 		nand_chip->ecc.steps = 1;
 		nand_chip->ecc.strength = cap;
@@ -1139,6 +1266,7 @@ static int __init atmel_pmecc_nand_init_params(struct platform_device *pdev,
 	}
 
 	nand_chip->ecc.read_page = atmel_nand_pmecc_read_page;
+	nand_chip->ecc.read_page_raw = atmel_nand_read_page_raw;
 	nand_chip->ecc.write_page = atmel_nand_pmecc_write_page;
 
 	atmel_pmecc_core_init(mtd);
@@ -19,7 +19,6 @@
  *	rework for 2K page size chips
  *
  *  TODO:
- *	Enable cached programming for 2k page size chips
  *	Check, if mtd->ecctype should be set to MTD_ECC_HW
  *	if we have HW ECC support.
  *	The AG-AND chips have nice features for speed improvement,
@@ -48,6 +47,7 @@
 #include <linux/leds.h>
 #include <linux/io.h>
 #include <linux/mtd/partitions.h>
+#include <linux/workqueue.h>
 
 /* Define default oob placement schemes for large and small page devices */
 static struct nand_ecclayout nand_oob_8 = {
@@ -96,6 +96,8 @@ static struct nand_ecclayout nand_oob_128 = {
 static int nand_get_device(struct nand_chip *chip, struct mtd_info *mtd,
 			   int new_state);
 
+static void nand_select_die(struct mtd_info *mtd, int chipnr);
+
 static int nand_do_write_oob(struct mtd_info *mtd, loff_t to,
 			     struct mtd_oob_ops *ops);
 
@@ -347,7 +349,7 @@ static int nand_block_bad(struct mtd_info *mtd, loff_t ofs, int getchip)
 		nand_get_device(chip, mtd, FL_READING);
 
 		/* Select the NAND device */
-		chip->select_chip(mtd, chipnr);
+		nand_select_die(mtd, chipnr);
 	}
 
 	do {
@@ -909,6 +911,106 @@ static int nand_wait(struct mtd_info *mtd, struct nand_chip *chip)
 	return status;
 }
 
+/**
+ * nand_finish_die - [INTERN] complete the operation running on a chip
+ * @mtd: MTD device structure
+ * @chip: NAND chip structure
+ * @chipnr: the chip, which must be selected
+ *
+ * Wait for the program or erase started by nand_wait_op() and hand the
+ * status over to its owner.
+ */
+static void nand_finish_die(struct mtd_info *mtd, struct nand_chip *chip,
+			    int chipnr)
+{
+	flstate_t state = chip->state;
+
+	/* The timeout of waitfunc depends on the operation */
+	chip->state = chip->die_state[chipnr];
+	*chip->die_status[chipnr] = chip->waitfunc(mtd, chip);
+	chip->state = state;
+
+	chip->die_state[chipnr] = FL_READY;
+	chip->die_status[chipnr] = NULL;
+}
+
+/**
+ * nand_select_die - [INTERN] select a chip for an operation
+ * @mtd: MTD device structure
+ * @chipnr: the chip to select
+ *
+ * With NAND_INTERLEAVE, the chip may still be busy with an operation of
+ * somebody who released the device meanwhile. That operation is completed
+ * first.
+ */
+static void nand_select_die(struct mtd_info *mtd, int chipnr)
+{
+	struct nand_chip *chip = mtd->priv;
+
+	chip->select_chip(mtd, chipnr);
+	chip->cur_die = chipnr;
+
+	if ((chip->options & NAND_INTERLEAVE) &&
+	    chip->die_state[chipnr] != FL_READY)
+		nand_finish_die(mtd, chip, chipnr);
+}
+
+/**
+ * nand_wait_op - [INTERN] wait until a program or erase is done
+ * @mtd: MTD device structure
+ * @chip: NAND chip structure
+ *
+ * Without NAND_INTERLEAVE, this is chip->waitfunc. With it, the device is
+ * released while the chip is busy, so that operations on the other chips of
+ * the array can be started meanwhile. The chip status is then polled until
+ * the chip is ready, or until somebody else selected it and completed the
+ * operation. Returns with the device held and the chip selected again.
+ */
+static int nand_wait_op(struct mtd_info *mtd, struct nand_chip *chip)
+{
+	int chipnr = chip->cur_die, status = -1;
+	flstate_t state = chip->state;
+	unsigned long timeo = jiffies, us;
+
+	if (!(chip->options & NAND_INTERLEAVE) || in_interrupt() ||
+	    oops_in_progress)
+		return chip->waitfunc(mtd, chip);
+
+	if (state == FL_ERASING) {
+		timeo += (HZ * 400) / 1000;
+		us = 500;
+	} else {
+		timeo += (HZ * 20) / 1000;
+		us = 100;
+	}
+
+	chip->die_state[chipnr] = state;
+	chip->die_status[chipnr] = &status;
+
+	for (;;) {
+		nand_release_device(mtd);
+		usleep_range(us, 2 * us);
+		nand_get_device(chip, mtd, state);
+
+		chip->select_chip(mtd, chipnr);
+		if (status >= 0)
+			break;
+
+		chip->cmdfunc(mtd, NAND_CMD_STATUS, -1, -1);
+		if ((chip->read_byte(mtd) & NAND_STATUS_READY) ||
+		    time_after(jiffies, timeo)) {
+			nand_finish_die(mtd, chip, chipnr);
+			break;
+		}
+	}
+	chip->cur_die = chipnr;
+
+	/* Others may have used the page buffer meanwhile */
+	chip->pagebuf = -1;
+
+	return status;
+}
+
 /**
  * __nand_unlock - [REPLACEABLE] unlocks specified locked blocks
  * @mtd: mtd info
@@ -978,7 +1080,7 @@ int nand_unlock(struct mtd_info *mtd, loff_t ofs, uint64_t len)
 	/* Shift to get chip number */
 	chipnr = ofs >> chip->chip_shift;
 
-	chip->select_chip(mtd, chipnr);
+	nand_select_die(mtd, chipnr);
 
 	/* Check, if it is write protected */
 	if (nand_check_wp(mtd)) {
@@ -1027,7 +1129,7 @@ int nand_lock(struct mtd_info *mtd, loff_t ofs, uint64_t len)
 	/* Shift to get chip number */
 	chipnr = ofs >> chip->chip_shift;
 
-	chip->select_chip(mtd, chipnr);
+	nand_select_die(mtd, chipnr);
 
 	/* Check, if it is write protected */
 	if (nand_check_wp(mtd)) {
@@ -1482,6 +1584,7 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 			    struct mtd_oob_ops *ops)
 {
 	int chipnr, page, realpage, col, bytes, aligned, oob_required;
+	int blockmask, cache = 0, next_cached;
 	struct nand_chip *chip = mtd->priv;
 	struct mtd_ecc_stats stats;
 	int ret = 0;
@@ -1496,10 +1599,11 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 	stats = mtd->ecc_stats;
 
 	chipnr = (int)(from >> chip->chip_shift);
-	chip->select_chip(mtd, chipnr);
+	nand_select_die(mtd, chipnr);
 
 	realpage = (int)(from >> chip->page_shift);
 	page = realpage & chip->pagemask;
+	blockmask = (1 << (chip->phys_erase_shift - chip->page_shift)) - 1;
 
 	col = (int)(from & (mtd->writesize - 1));
 
@@ -1512,10 +1616,29 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 		aligned = (bytes == mtd->writesize);
 
 		/* Is the current page in the buffer? */
-		if (realpage != chip->pagebuf || oob) {
+		if (realpage != chip->pagebuf || oob || cache) {
 			bufpoi = aligned ? buf : chip->buffers->databuf;
 
-			chip->cmdfunc(mtd, NAND_CMD_READ0, 0x00, page);
+			/*
+			 * If the next page of the block is read in full as
+			 * well, let the chip fetch it from the array while
+			 * this one is transferred (cache read). A sequence
+			 * started with READ0 is continued with READCACHESEQ
+			 * and terminated by READCACHEEND.
+			 */
+			next_cached = NAND_HAS_CACHEREAD(chip) && aligned &&
+				readlen >= 2 * mtd->writesize &&
+				(page & blockmask) != blockmask;
+
+			if (!cache)
+				chip->cmdfunc(mtd, NAND_CMD_READ0, 0x00, page);
+			if (next_cached)
+				chip->cmdfunc(mtd, NAND_CMD_READCACHESEQ,
+					      -1, -1);
+			else if (cache)
+				chip->cmdfunc(mtd, NAND_CMD_READCACHEEND,
+					      -1, -1);
+			cache = next_cached;
 
 			/*
 			 * Now read the page into the buffer.  Absent an error,
@@ -1535,6 +1658,10 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 				if (!aligned)
 					/* Invalidate page cache */
 					chip->pagebuf = -1;
+				if (cache)
+					chip->cmdfunc(mtd,
+						      NAND_CMD_READCACHEEND,
+						      -1, -1);
 				break;
 			}
 
@@ -1595,7 +1722,7 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 		if (!page) {
 			chipnr++;
 			chip->select_chip(mtd, -1);
-			chip->select_chip(mtd, chipnr);
+			nand_select_die(mtd, chipnr);
 		}
 	}
 
@@ -1819,7 +1946,7 @@ static int nand_do_read_oob(struct mtd_info *mtd, loff_t from,
 	}
 
 	chipnr = (int)(from >> chip->chip_shift);
-	chip->select_chip(mtd, chipnr);
+	nand_select_die(mtd, chipnr);
 
 	/* Shift to get page */
 	realpage = (int)(from >> chip->page_shift);
@@ -1857,7 +1984,7 @@ static int nand_do_read_oob(struct mtd_info *mtd, loff_t from,
 		if (!page) {
 			chipnr++;
 			chip->select_chip(mtd, -1);
-			chip->select_chip(mtd, chipnr);
+			nand_select_die(mtd, chipnr);
 		}
 	}
 
@@ -2099,8 +2226,9 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 			   const uint8_t *buf, int oob_required, int page,
 			   int cached, int raw)
 {
-	int status;
+	int status, prev_cached = chip->prev_cached;
 
+	chip->prev_cached = 0;
 	chip->cmdfunc(mtd, NAND_CMD_SEQIN, 0x00, page);
 
 	if (unlikely(raw))
@@ -2111,16 +2239,10 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 	if (status < 0)
 		return status;
 
-	/*
-	 * Cached progamming disabled for now. Not sure if it's worth the
-	 * trouble. The speed gain is not very impressive. (2.3->2.6Mib/s).
-	 */
-	cached = 0;
-
-	if (!cached || !(chip->options & NAND_CACHEPRG)) {
+	if (!cached || !(chip->options & NAND_USE_CACHEPRG)) {
 
 		chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
-		status = chip->waitfunc(mtd, chip);
+		status = nand_wait_op(mtd, chip);
 		/*
 		 * See if operation failed and additional status checks are
 		 * available.
@@ -2132,8 +2254,23 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 		if (status & NAND_STATUS_FAIL)
 			return -EIO;
 	} else {
+		/*
+		 * The chip is ready again as soon as the data moved on from
+		 * its cache register, and programs the page while the next
+		 * one is transferred.
+		 */
 		chip->cmdfunc(mtd, NAND_CMD_CACHEDPROG, -1, -1);
 		status = chip->waitfunc(mtd, chip);
+		chip->prev_cached = 1;
+	}
+
+	/*
+	 * After a cache program, the result of the previous page comes now.
+	 * FAILC is undefined otherwise.
+	 */
+	if (prev_cached && (status & NAND_STATUS_FAIL_N1)) {
+		chip->prev_cached = 0;
+		return -EIO;
 	}
 
 #ifdef CONFIG_MTD_NAND_VERIFY_WRITE
@@ -2249,7 +2386,7 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 		return -EINVAL;
 
 	chipnr = (int)(to >> chip->chip_shift);
-	chip->select_chip(mtd, chipnr);
+	nand_select_die(mtd, chipnr);
 
 	/* Check, if it is write protected */
 	if (nand_check_wp(mtd))
@@ -2270,7 +2407,13 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 
 	while (1) {
 		int bytes = mtd->writesize;
-		int cached = writelen > bytes && page != blockmask;
+		/*
+		 * The last page of a block, and thus of a chip, is programmed
+		 * normally, so that the status of all pages is known before
+		 * moving on to the next block or chip.
+		 */
+		int cached = writelen > bytes &&
+			     (page & blockmask) != blockmask;
 		uint8_t *wbuf = buf;
 
 		/* Partial page write? */
@@ -2310,7 +2453,7 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 		if (!page) {
 			chipnr++;
 			chip->select_chip(mtd, -1);
-			chip->select_chip(mtd, chipnr);
+			nand_select_die(mtd, chipnr);
 		}
 	}
 
@@ -2429,7 +2572,7 @@ static int nand_do_write_oob(struct mtd_info *mtd, loff_t to,
 	}
 
 	chipnr = (int)(to >> chip->chip_shift);
-	chip->select_chip(mtd, chipnr);
+	nand_select_die(mtd, chipnr);
 
 	/* Shift to get page */
 	page = (int)(to >> chip->page_shift);
@@ -2565,7 +2708,7 @@ static int nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 		    int allowbbt)
 {
-	int page, status, pages_per_block, ret, chipnr;
+	int page, status, pages_per_block, ret, chipnr, i, single = 0;
 	struct nand_chip *chip = mtd->priv;
 	loff_t rewrite_bbt[NAND_MAX_CHIPS] = {0};
 	unsigned int bbt_masked_page = 0xffffffff;
@@ -2589,7 +2732,7 @@ int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 	pages_per_block = 1 << (chip->phys_erase_shift - chip->page_shift);
 
 	/* Select the NAND device */
-	chip->select_chip(mtd, chipnr);
+	nand_select_die(mtd, chipnr);
 
 	/* Check, if it is write protected */
 	if (nand_check_wp(mtd)) {
@@ -2614,6 +2757,8 @@ int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 	instr->state = MTD_ERASING;
 
 	while (len) {
+		int blocks = 1;
+
 		/* Check if we have a bad block, we do not erase bad blocks! */
 		if (nand_block_checkbad(mtd, ((loff_t) page) <<
 					chip->page_shift, 0, allowbbt)) {
@@ -2623,17 +2768,35 @@ int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 			goto erase_exit;
 		}
 
+		/*
+		 * An even block and the next one are in different planes and
+		 * can be erased together.
+		 */
+		if (NAND_HAS_MULTIPLANE(chip) && !single &&
+		    !(page & pages_per_block) &&
+		    len >= (2 << chip->phys_erase_shift) &&
+		    !nand_block_checkbad(mtd, ((loff_t)(page + pages_per_block))
+					 << chip->page_shift, 0, allowbbt))
+			blocks = 2;
+
 		/*
 		 * Invalidate the page cache, if we erase the block which
 		 * contains the current cached page.
 		 */
 		if (page <= chip->pagebuf && chip->pagebuf <
-		    (page + pages_per_block))
+		    (page + blocks * pages_per_block))
 			chip->pagebuf = -1;
 
-		chip->erase_cmd(mtd, page & chip->pagemask);
+		if (blocks == 2) {
+			chip->cmdfunc(mtd, NAND_CMD_ERASE1, -1,
+				      page & chip->pagemask);
+			chip->cmdfunc(mtd, NAND_CMD_MULTIERASE, -1, -1);
+			chip->erase_cmd(mtd, (page + pages_per_block) &
+					chip->pagemask);
+		} else
+			chip->erase_cmd(mtd, page & chip->pagemask);
 
-		status = chip->waitfunc(mtd, chip);
+		status = nand_wait_op(mtd, chip);
 
 		/*
 		 * See if operation failed and additional status checks are
@@ -2643,6 +2806,12 @@ int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 			status = chip->errstat(mtd, chip, FL_ERASING,
 					       status, page);
 
+		/* Erase the blocks one by one to find the failing one */
+		if ((status & NAND_STATUS_FAIL) && blocks == 2) {
+			single = 2;
+			continue;
+		}
+
 		/* See if block erase succeeded */
 		if (status & NAND_STATUS_FAIL) {
 			pr_debug("%s: failed erase, page 0x%08x\n",
@@ -2657,20 +2826,21 @@ int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 		 * If BBT requires refresh, set the BBT rewrite flag to the
 		 * page being erased.
 		 */
-		if (bbt_masked_page != 0xffffffff &&
-		    (page & BBT_PAGE_MASK) == bbt_masked_page)
-			    rewrite_bbt[chipnr] =
+		for (i = 0; i < blocks; i++, page += pages_per_block) {
+			if (bbt_masked_page != 0xffffffff &&
+			    (page & BBT_PAGE_MASK) == bbt_masked_page)
+				rewrite_bbt[chipnr] =
 					((loff_t)page << chip->page_shift);
-
-		/* Increment page address and decrement length */
-		len -= (1 << chip->phys_erase_shift);
-		page += pages_per_block;
+			len -= (1 << chip->phys_erase_shift);
+		}
+		if (single)
+			single--;
 
 		/* Check, if we cross a chip boundary */
 		if (len && !(page & chip->pagemask)) {
 			chipnr++;
 			chip->select_chip(mtd, -1);
-			chip->select_chip(mtd, chipnr);
+			nand_select_die(mtd, chipnr);
 
 			/*
 			 * If BBT requires refresh and BBT-PERCHIP, set the BBT
@@ -2725,15 +2895,45 @@ erase_exit:
 static void nand_sync(struct mtd_info *mtd)
 {
 	struct nand_chip *chip = mtd->priv;
+	int i;
 
 	pr_debug("%s: called\n", __func__);
 
 	/* Grab the lock and see if the device is available */
 	nand_get_device(chip, mtd, FL_SYNCING);
+	/* Complete the operations still running on interleaved chips */
+	for (i = 0; i < chip->numchips; i++) {
+		if (chip->die_state[i] == FL_READY)
+			continue;
+		chip->select_chip(mtd, i);
+		nand_finish_die(mtd, chip, i);
+	}
 	/* Release it and go back */
 	nand_release_device(mtd);
 }
 
+static void nand_io_work(struct work_struct *work)
+{
+	mtd_io_execute(container_of(work, struct mtd_io_req, work));
+}
+
+/**
+ * nand_submit_io - [MTD Interface] queue an asynchronous I/O request
+ * @mtd: MTD device structure
+ * @req: the request, for @mtd or a partition of it
+ *
+ * The requests run in a workqueue, as many at a time as there are chips to
+ * work in parallel. Only used with %NAND_INTERLEAVE.
+ */
+static int nand_submit_io(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	struct nand_chip *chip = mtd->priv;
+
+	INIT_WORK(&req->work, nand_io_work);
+	queue_work(chip->io_wq, &req->work);
+	return 0;
+}
+
 /**
  * nand_block_isbad - [MTD Interface] Check if block at offset is bad
  * @mtd: MTD device structure
@@ -2922,10 +3122,14 @@ static int nand_flash_detect_onfi(struct mtd_info *mtd, struct nand_chip *chip,
 	chip->chipsize = le32_to_cpu(p->blocks_per_lun);
 	chip->chipsize *= (uint64_t)mtd->erasesize * p->lun_count;
 	*busw = 0;
-	if (le16_to_cpu(p->features) & 1)
+	if (le16_to_cpu(p->features) & ONFI_FEATURE_16_BIT_BUS)
 		*busw = NAND_BUSWIDTH_16;
 
 	chip->options |= NAND_NO_READRDY;
+	/* Two planes, selected by the lowest block address bit */
+	if ((le16_to_cpu(p->features) & ONFI_FEATURE_INTERLEAVED) &&
+	    p->interleaved_bits == 1)
+		chip->options |= NAND_MULTIPLANE;
 
 	pr_info("ONFI flash detected\n");
 	return 1;
@@ -3477,8 +3681,55 @@ int nand_scan_tail(struct mtd_info *mtd)
 	}
 	chip->subpagesize = mtd->writesize >> mtd->subpage_sft;
 
+	/* Cache program is used if the chip reports it in its parameters */
+	if (chip->onfi_version && (le16_to_cpu(chip->onfi_params.opt_cmd) &
+				   ONFI_OPT_CMD_PROG_CACHE))
+		chip->options |= NAND_USE_CACHEPRG;
+
+	/*
+	 * Cache read is used if the chip reports it and the page is read
+	 * with commands only issued by nand_do_read_ops(). Drivers with ECC
+	 * read methods which don't issue commands may set NAND_CACHERD.
+	 */
+	if (chip->onfi_version && (le16_to_cpu(chip->onfi_params.opt_cmd) &
+				   ONFI_OPT_CMD_READ_CACHE) &&
+	    (chip->ecc.mode == NAND_ECC_SOFT ||
+	     chip->ecc.mode == NAND_ECC_SOFT_BCH ||
+	     chip->ecc.mode == NAND_ECC_NONE))
+		chip->options |= NAND_CACHERD;
+
+	/*
+	 * The cache commands are only known to the generic large page
+	 * command function. Verifying a page right after a cache program
+	 * would read it before it is actually programmed.
+	 */
+	if (chip->cmdfunc != nand_command_lp)
+		chip->options &= ~(NAND_USE_CACHEPRG | NAND_CACHERD);
+#ifdef CONFIG_MTD_NAND_VERIFY_WRITE
+	chip->options &= ~NAND_USE_CACHEPRG;
+#endif
+
+	/*
+	 * Two-plane erase is only issued by the generic large page command
+	 * function, in place of the standard erase command.
+	 */
+	if (chip->cmdfunc != nand_command_lp ||
+	    chip->erase_cmd != single_erase_cmd)
+		chip->options &= ~NAND_MULTIPLANE;
+
+	/*
+	 * Interleaving needs several chips. The page buffer a write is
+	 * verified against may be reused while the device is released.
+	 */
+	if (chip->numchips < 2 || chip->numchips > NAND_MAX_CHIPS)
+		chip->options &= ~NAND_INTERLEAVE;
+#ifdef CONFIG_MTD_NAND_VERIFY_WRITE
+	chip->options &= ~NAND_INTERLEAVE;
+#endif
+
 	/* Initialize state */
 	chip->state = FL_READY;
+	chip->prev_cached = 0;
 
 	/* De-select the device */
 	chip->select_chip(mtd, -1);
@@ -3518,12 +3769,27 @@ int nand_scan_tail(struct mtd_info *mtd)
 	if (!mtd->bitflip_threshold)
 		mtd->bitflip_threshold = mtd->ecc_strength;
 
-	/* Check, if we should skip the bad block table scan */
-	if (chip->options & NAND_SKIP_BBTSCAN)
-		return 0;
+	/* Build bad block table, unless we should skip the scan */
+	if (!(chip->options & NAND_SKIP_BBTSCAN)) {
+		int ret = chip->scan_bbt(mtd);
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * A single chip executes one operation at a time, and queueing them to
+	 * a thread would only delay them. Without the workqueue, asynchronous
+	 * I/O is emulated by the core.
+	 */
+	chip->io_wq = NULL;
+	if (chip->options & NAND_INTERLEAVE) {
+		chip->io_wq = alloc_workqueue("nand_io",
+				WQ_UNBOUND | WQ_MEM_RECLAIM, chip->numchips);
+		if (chip->io_wq)
+			mtd->_submit_io = nand_submit_io;
+	}
 
-	/* Build bad block table */
-	return chip->scan_bbt(mtd);
+	return 0;
 }
 EXPORT_SYMBOL(nand_scan_tail);
 
@@ -3579,6 +3845,9 @@ void nand_release(struct mtd_info *mtd)
 
 	mtd_device_unregister(mtd);
 
+	if (chip->io_wq)
+		destroy_workqueue(chip->io_wq);
+
 	/* Free bad block table memory */
 	kfree(chip->bbt);
 	if (!(chip->options & NAND_OWN_BUFFERS))
@@ -42,6 +42,7 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/pagemap.h>
+#include <linux/ktime.h>
 
 /* Default simulator parameters values */
 #if !defined(CONFIG_NANDSIM_FIRST_ID_BYTE)  || \
@@ -60,6 +61,9 @@
 #ifndef CONFIG_NANDSIM_PROGRAMM_DELAY
 #define CONFIG_NANDSIM_PROGRAMM_DELAY 200
 #endif
+#ifndef CONFIG_NANDSIM_CACHE_DELAY
+#define CONFIG_NANDSIM_CACHE_DELAY 3
+#endif
 #ifndef CONFIG_NANDSIM_ERASE_DELAY
 #define CONFIG_NANDSIM_ERASE_DELAY 2
 #endif
@@ -92,6 +96,8 @@ static uint fourth_id_byte = CONFIG_NANDSIM_FOURTH_ID_BYTE;
 static uint access_delay   = CONFIG_NANDSIM_ACCESS_DELAY;
 static uint programm_delay = CONFIG_NANDSIM_PROGRAMM_DELAY;
 static uint erase_delay    = CONFIG_NANDSIM_ERASE_DELAY;
+static uint cache_delay    = CONFIG_NANDSIM_CACHE_DELAY;
+static uint cache_ops      = 1;
 static uint output_cycle   = CONFIG_NANDSIM_OUTPUT_CYCLE;
 static uint input_cycle    = CONFIG_NANDSIM_INPUT_CYCLE;
 static uint bus_width      = CONFIG_NANDSIM_BUS_WIDTH;
@@ -110,6 +116,7 @@ static unsigned int overridesize = 0;
 static char *cache_file = NULL;
 static unsigned int bbt;
 static unsigned int bch;
+static unsigned int dies = 1;
 
 module_param(first_id_byte,  uint, 0400);
 module_param(second_id_byte, uint, 0400);
@@ -118,6 +125,8 @@ module_param(fourth_id_byte, uint, 0400);
 module_param(access_delay,   uint, 0400);
 module_param(programm_delay, uint, 0400);
 module_param(erase_delay,    uint, 0400);
+module_param(cache_delay,    uint, 0400);
+module_param(cache_ops,      uint, 0400);
 module_param(output_cycle,   uint, 0400);
 module_param(input_cycle,    uint, 0400);
 module_param(bus_width,      uint, 0400);
@@ -135,6 +144,7 @@ module_param(overridesize,   uint, 0400);
 module_param(cache_file,     charp, 0400);
 module_param(bbt,	     uint, 0400);
 module_param(bch,	     uint, 0400);
+module_param(dies,	     uint, 0400);
 
 MODULE_PARM_DESC(first_id_byte,  "The first byte returned by NAND Flash 'read ID' command (manufacturer ID)");
 MODULE_PARM_DESC(second_id_byte, "The second byte returned by NAND Flash 'read ID' command (chip ID)");
@@ -143,6 +153,8 @@ MODULE_PARM_DESC(fourth_id_byte, "The fourth byte returned by NAND Flash 'read I
 MODULE_PARM_DESC(access_delay,   "Initial page access delay (microseconds)");
 MODULE_PARM_DESC(programm_delay, "Page programm delay (microseconds");
 MODULE_PARM_DESC(erase_delay,    "Sector erase delay (milliseconds)");
+MODULE_PARM_DESC(cache_delay,    "Cache program and cache read busy time (microseconds)");
+MODULE_PARM_DESC(cache_ops,      "Support cache program and cache read on large page chips if not zero");
 MODULE_PARM_DESC(output_cycle,   "Word output (from flash) time (nanoseconds)");
 MODULE_PARM_DESC(input_cycle,    "Word input (to flash) time (nanoseconds)");
 MODULE_PARM_DESC(bus_width,      "Chip's bus width (8- or 16-bit)");
@@ -170,6 +182,8 @@ MODULE_PARM_DESC(cache_file,     "File to use to cache nand pages instead of mem
 MODULE_PARM_DESC(bbt,		 "0 OOB, 1 BBT with marker in OOB, 2 BBT with marker in data area");
 MODULE_PARM_DESC(bch,		 "Enable BCH ecc and set how many bits should "
 				 "be correctable in 512-byte blocks");
+MODULE_PARM_DESC(dies,		 "Number of dies, each with its own chip select, "
+				 "which program and erase concurrently");
 
 /* The largest possible page size */
 #define NS_LARGEST_PAGE_SIZE	4096
@@ -211,6 +225,10 @@ MODULE_PARM_DESC(bch,		 "Enable BCH ecc and set how many bits should "
 /* Calculate the OOB offset in flash RAM image by (row, column) address */
 #define NS_RAW_OFFSET_OOB(ns) (NS_RAW_OFFSET(ns) + ns->geom.pgsz)
 
+/* The selected die and its first page */
+#define NS_DIE(ns) (&(ns)->dies[(ns)->die])
+#define NS_DIE_ROW(ns) ((ns)->die * (ns)->geom.pgdie)
+
 /* After a command is input, the simulator goes to one of the following states */
 #define STATE_CMD_READ0        0x00000001 /* read data from the beginning of page */
 #define STATE_CMD_READ1        0x00000002 /* read data from the second half of page */
@@ -226,6 +244,7 @@ MODULE_PARM_DESC(bch,		 "Enable BCH ecc and set how many bits should "
 #define STATE_CMD_RESET        0x0000000C /* reset */
 #define STATE_CMD_RNDOUT       0x0000000D /* random output command */
 #define STATE_CMD_RNDOUTSTART  0x0000000E /* random output start command */
+#define STATE_CMD_READCACHE    0x0000000F /* read cache sequential or end command */
 #define STATE_CMD_MASK         0x0000000F /* command states mask */
 
 /* After an address is input, the simulator goes to one of these states */
@@ -258,9 +277,10 @@ MODULE_PARM_DESC(bch,		 "Enable BCH ecc and set how many bits should "
 #define ACTION_ZEROOFF   0x00400000 /* don't add any offset to address */
 #define ACTION_HALFOFF   0x00500000 /* add to address half of page */
 #define ACTION_OOBOFF    0x00600000 /* add to address OOB offset */
+#define ACTION_CACHECPY  0x00700000 /* copy the page read by the array to the internal buffer */
 #define ACTION_MASK      0x00700000 /* action mask */
 
-#define NS_OPER_NUM      13 /* Number of operations supported by the simulator */
+#define NS_OPER_NUM      14 /* Number of operations supported by the simulator */
 #define NS_OPER_STATES   6  /* Maximum number of states in operation */
 
 #define OPT_ANY          0xFFFFFFFF /* any chip supports this operation */
@@ -331,6 +351,7 @@ struct nandsim {
 		uint pgszoob;       /* page size including OOB , bytes*/
 		uint secszoob;      /* sector size including OOB, bytes */
 		uint pgnum;         /* total number of pages */
+		uint pgdie;         /* number of pages per die */
 		uint pgsec;         /* number of pages per sector */
 		uint secshift;      /* bits number in sector size */
 		uint pgshift;       /* bits number in page size */
@@ -365,6 +386,17 @@ struct nandsim {
 	void *file_buf;
 	struct page *held_pages[NS_MAX_HELD_PAGES];
 	int held_cnt;
+
+	/*
+	 * Every die has its own array, which works in the background on
+	 * cache program and cache read, program and erase.
+	 */
+	struct {
+		int cache_row;       /* page the array reads for cache read, -1 if none */
+		ktime_t array_ready; /* time the array finishes the current operation */
+		int busy;            /* the die is busy until then, not only the array */
+	} dies[NAND_MAX_CHIPS];
+	uint die;                    /* the selected die */
 };
 
 /*
@@ -410,6 +442,8 @@ static struct nandsim_operations {
 	/* Large page devices random page read */
 	{OPT_LARGEPAGE, {STATE_CMD_RNDOUT, STATE_ADDR_COLUMN, STATE_CMD_RNDOUTSTART | ACTION_CPY,
 			       STATE_DATAOUT, STATE_READY}},
+	/* Large page devices cache read (sequential or end) */
+	{OPT_LARGEPAGE, {STATE_CMD_READCACHE | ACTION_CACHECPY, STATE_DATAOUT, STATE_READY}},
 };
 
 struct weak_block {
@@ -575,6 +609,7 @@ static int init_nandsim(struct mtd_info *mtd)
 	ns->geom.secsz    = mtd->erasesize;
 	ns->geom.pgszoob  = ns->geom.pgsz + ns->geom.oobsz;
 	ns->geom.pgnum    = div_u64(ns->geom.totsz, ns->geom.pgsz);
+	ns->geom.pgdie    = ns->geom.pgnum / chip->numchips;
 	ns->geom.totszoob = ns->geom.totsz + (uint64_t)ns->geom.pgnum * ns->geom.oobsz;
 	ns->geom.secshift = ffs(ns->geom.secsz) - 1;
 	ns->geom.pgshift  = chip->page_shift;
@@ -600,7 +635,7 @@ static int init_nandsim(struct mtd_info *mtd)
 	}
 
 	if (ns->options & OPT_SMALLPAGE) {
-		if (ns->geom.totsz <= (32 << 20)) {
+		if (chip->chipsize <= (32 << 20)) {
 			ns->geom.pgaddrbytes  = 3;
 			ns->geom.secaddrbytes = 2;
 		} else {
@@ -608,7 +643,7 @@ static int init_nandsim(struct mtd_info *mtd)
 			ns->geom.secaddrbytes = 3;
 		}
 	} else {
-		if (ns->geom.totsz <= (128 << 20)) {
+		if (chip->chipsize <= (128 << 20)) {
 			ns->geom.pgaddrbytes  = 4;
 			ns->geom.secaddrbytes = 2;
 		} else {
@@ -667,6 +702,7 @@ static int init_nandsim(struct mtd_info *mtd)
 	printk("OOB area size: %u bytes\n",     ns->geom.oobsz);
 	printk("sector size: %u KiB\n",         ns->geom.secsz >> 10);
 	printk("pages number: %u\n",            ns->geom.pgnum);
+	printk("dies: %d\n",                    chip->numchips);
 	printk("pages per sector: %u\n",        ns->geom.pgsec);
 	printk("bus width: %u\n",               ns->busw);
 	printk("bits in sector size: %u\n",     ns->geom.secshift);
@@ -1025,6 +1061,8 @@ static char *get_state_name(uint32_t state)
 			return "STATE_CMD_RNDOUT";
 		case STATE_CMD_RNDOUTSTART:
 			return "STATE_CMD_RNDOUTSTART";
+		case STATE_CMD_READCACHE:
+			return "STATE_CMD_READCACHE";
 		case STATE_ADDR_PAGE:
 			return "STATE_ADDR_PAGE";
 		case STATE_ADDR_SEC:
@@ -1075,6 +1113,9 @@ static int check_command(int cmd)
 	case NAND_CMD_RESET:
 	case NAND_CMD_RNDOUT:
 	case NAND_CMD_RNDOUTSTART:
+	case NAND_CMD_CACHEDPROG:
+	case NAND_CMD_READCACHESEQ:
+	case NAND_CMD_READCACHEEND:
 		return 0;
 
 	case NAND_CMD_STATUS_MULTI:
@@ -1094,6 +1135,7 @@ static uint32_t get_state_by_command(unsigned command)
 		case NAND_CMD_READ1:
 			return STATE_CMD_READ1;
 		case NAND_CMD_PAGEPROG:
+		case NAND_CMD_CACHEDPROG:
 			return STATE_CMD_PAGEPROG;
 		case NAND_CMD_READSTART:
 			return STATE_CMD_READSTART;
@@ -1117,6 +1159,9 @@ static uint32_t get_state_by_command(unsigned command)
 			return STATE_CMD_RNDOUT;
 		case NAND_CMD_RNDOUTSTART:
 			return STATE_CMD_RNDOUTSTART;
+		case NAND_CMD_READCACHESEQ:
+		case NAND_CMD_READCACHEEND:
+			return STATE_CMD_READCACHE;
 	}
 
 	NS_ERR("get_state_by_command: unknown command, BUG\n");
@@ -1572,6 +1617,41 @@ static int prog_page(struct nandsim *ns, int num)
 	return 0;
 }
 
+/*
+ * Busy-wait until the array of the selected die finished the operation
+ * started in the background.
+ */
+static void wait_array(struct nandsim *ns)
+{
+	s64 left;
+
+	if (!do_delays)
+		return;
+
+	left = ktime_us_delta(NS_DIE(ns)->array_ready, ktime_get());
+	for (; left > 1000; left -= 1000)
+		mdelay(1);
+	if (left > 0)
+		udelay(left);
+}
+
+/*
+ * Start an array operation in the background, taking @us microseconds. For
+ * program and erase, @busy is set and the die reports busy meanwhile.
+ */
+static void start_array(struct nandsim *ns, uint us, int busy)
+{
+	NS_DIE(ns)->array_ready = ktime_add_us(ktime_get(), us);
+	NS_DIE(ns)->busy = busy;
+}
+
+/* Whether the selected die is still busy with a program or erase */
+static int die_busy(struct nandsim *ns)
+{
+	return do_delays && NS_DIE(ns)->busy &&
+		ktime_us_delta(NS_DIE(ns)->array_ready, ktime_get()) > 0;
+}
+
 /*
  * If state has any action bit, perform this action.
  *
@@ -1604,7 +1684,11 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 			break;
 		}
 		num = ns->geom.pgszoob - ns->regs.off - ns->regs.column;
+		wait_array(ns);
 		read_page(ns, num);
+		/* A new page read ends any cache read sequence */
+		if (ns->regs.command != NAND_CMD_RNDOUTSTART)
+			NS_DIE(ns)->cache_row = -1;
 
 		NS_DBG("do_state_action: (ACTION_CPY:) copy %d bytes to int buf, raw offset %d\n",
 			num, NS_RAW_OFFSET(ns) + ns->regs.off);
@@ -1621,6 +1705,35 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 
 		break;
 
+	case ACTION_CACHECPY:
+		/*
+		 * Cache read. The page the array read in the background (none
+		 * right after READSTART, the buffer holds that page already)
+		 * is moved to the internal buffer. On READCACHESEQ, the array
+		 * then starts reading the next page, so only the short cache
+		 * busy time is spent here and the page access time overlaps
+		 * with the data output.
+		 */
+		if (NS_DIE(ns)->cache_row >= 0) {
+			wait_array(ns);
+			ns->regs.row = NS_DIE(ns)->cache_row;
+			read_page(ns, ns->geom.pgszoob);
+			NS_LOG("cache read page %d\n", ns->regs.row);
+			NS_UDELAY(input_cycle * ns->geom.pgsz / 1000 / busdiv);
+		}
+		NS_UDELAY(cache_delay);
+
+		NS_DIE(ns)->cache_row = -1;
+		if (ns->regs.command == NAND_CMD_READCACHESEQ) {
+			if (ns->regs.row + 1 >= NS_DIE_ROW(ns) + ns->geom.pgdie) {
+				NS_ERR("do_state_action: cache read beyond the last page\n");
+				return -1;
+			}
+			NS_DIE(ns)->cache_row = ns->regs.row + 1;
+			start_array(ns, access_delay, 0);
+		}
+		break;
+
 	case ACTION_SECERASE:
 		/*
 		 * Erase sector.
@@ -1639,6 +1752,7 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 
 		ns->regs.row = (ns->regs.row <<
 				8 * (ns->geom.pgaddrbytes - ns->geom.secaddrbytes)) | ns->regs.column;
+		ns->regs.row += NS_DIE_ROW(ns);
 		ns->regs.column = 0;
 
 		erase_block_no = ns->regs.row >> (ns->geom.secshift - ns->geom.pgshift);
@@ -1647,9 +1761,10 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 				ns->regs.row, NS_RAW_OFFSET(ns));
 		NS_LOG("erase sector %u\n", erase_block_no);
 
+		wait_array(ns);
 		erase_sector(ns);
 
-		NS_MDELAY(erase_delay);
+		start_array(ns, erase_delay * 1000, 1);
 
 		if (erase_block_wear)
 			update_wear(erase_block_no);
@@ -1687,7 +1802,16 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 			num, ns->regs.row, ns->regs.column, NS_RAW_OFFSET(ns) + ns->regs.off);
 		NS_LOG("programm page %d\n", ns->regs.row);
 
-		NS_UDELAY(programm_delay);
+		/*
+		 * Cache program only waits until the array finished the
+		 * previous page, and then programs this one in the background.
+		 */
+		wait_array(ns);
+		if (ns->regs.command == NAND_CMD_CACHEDPROG) {
+			NS_UDELAY(cache_delay);
+			start_array(ns, programm_delay, 0);
+		} else
+			start_array(ns, programm_delay, 1);
 		NS_UDELAY(output_cycle * ns->geom.pgsz / 1000 / busdiv);
 
 		if (write_error(page_no)) {
@@ -1895,8 +2019,11 @@ static u_char ns_nand_read_byte(struct mtd_info *mtd)
 
 	/* Status register may be read as many times as it is wanted */
 	if (NS_STATE(ns->state) == STATE_DATAOUT_STATUS) {
-		NS_DBG("read_byte: return %#x status\n", ns->regs.status);
-		return ns->regs.status;
+		outb = ns->regs.status;
+		if (die_busy(ns))
+			outb &= ~NAND_STATUS_READY;
+		NS_DBG("read_byte: return %#x status\n", outb);
+		return outb;
 	}
 
 	/* Check if there is any data in the internal buffer which may be read */
@@ -1969,9 +2096,15 @@ static void ns_nand_write_byte(struct mtd_info *mtd, u_char byte)
 			|| NS_STATE(ns->state) == STATE_DATAOUT_STATUS_M
 			|| NS_STATE(ns->state) == STATE_DATAOUT) {
 			int row = ns->regs.row;
-
-			switch_state(ns);
-			if (byte == NAND_CMD_RNDOUT)
+			int cache = byte == NAND_CMD_READCACHESEQ ||
+				    byte == NAND_CMD_READCACHEEND;
+
+			/* Cache read may follow READSTART without data output */
+			if (cache)
+				switch_to_ready_state(ns, NS_STATUS_OK(ns));
+			else
+				switch_state(ns);
+			if (byte == NAND_CMD_RNDOUT || cache)
 				ns->regs.row = row;
 		}
 
@@ -2053,6 +2186,9 @@ static void ns_nand_write_byte(struct mtd_info *mtd, u_char byte)
 
 		if (ns->regs.count == ns->regs.num) {
 			NS_DBG("address (%#x, %#x) is accepted\n", ns->regs.row, ns->regs.column);
+			/* Page addresses are relative to the selected die */
+			if (NS_STATE(ns->nxstate) == STATE_ADDR_PAGE)
+				ns->regs.row += NS_DIE_ROW(ns);
 			switch_state(ns);
 		}
 
@@ -2103,8 +2239,26 @@ static void ns_hwcontrol(struct mtd_info *mtd, int cmd, unsigned int bitmask)
 
 static int ns_device_ready(struct mtd_info *mtd)
 {
+	struct nandsim *ns = ((struct nand_chip *)mtd->priv)->priv;
+
 	NS_DBG("device_ready\n");
-	return 1;
+	return !die_busy(ns);
+}
+
+static void ns_nand_select_chip(struct mtd_info *mtd, int chipnr)
+{
+	struct nand_chip *chip = mtd->priv;
+	struct nandsim *ns = chip->priv;
+
+	if (chipnr < 0) {
+		chip->cmd_ctrl(mtd, NAND_CMD_NONE, NAND_CTRL_CHANGE);
+		return;
+	}
+	if (chipnr >= dies) {
+		NS_ERR("select_chip: there is no die %d\n", chipnr);
+		return;
+	}
+	ns->die = chipnr;
 }
 
 static uint16_t ns_nand_read_word(struct mtd_info *mtd)
@@ -2238,6 +2392,7 @@ static int __init ns_init_module(void)
 	chip->read_buf   = ns_nand_read_buf;
 	chip->verify_buf = ns_nand_verify_buf;
 	chip->read_word  = ns_nand_read_word;
+	chip->select_chip = ns_nand_select_chip;
 	chip->ecc.mode   = NAND_ECC_SOFT;
 	/* The NAND_SKIP_BBTSCAN option is necessary for 'overridesize' */
 	/* and 'badblocks' parameters to work */
@@ -2265,6 +2420,8 @@ static int __init ns_init_module(void)
 		nand->geom.idbytes = 2;
 	nand->regs.status = NS_STATUS_OK(nand);
 	nand->nxstate = STATE_UNKNOWN;
+	for (i = 0; i < ARRAY_SIZE(nand->dies); i++)
+		nand->dies[i].cache_row = -1;
 	nand->options |= OPT_PAGE256; /* temporary value */
 	nand->ids[0] = first_id_byte;
 	nand->ids[1] = second_id_byte;
@@ -2286,7 +2443,16 @@ static int __init ns_init_module(void)
 	if ((retval = parse_gravepages()) != 0)
 		goto error;
 
-	retval = nand_scan_ident(nsmtd, 1, NULL);
+	if (!dies || dies > NAND_MAX_CHIPS) {
+		NS_ERR("dies has to be 1..%d\n", NAND_MAX_CHIPS);
+		retval = -EINVAL;
+		goto error;
+	}
+	/* The dies program and erase concurrently */
+	if (dies > 1)
+		chip->options |= NAND_INTERLEAVE;
+
+	retval = nand_scan_ident(nsmtd, dies, NULL);
 	if (retval) {
 		NS_ERR("cannot scan NAND Simulator device\n");
 		if (retval > 0)
@@ -2294,6 +2460,12 @@ static int __init ns_init_module(void)
 		goto error;
 	}
 
+	/* Large page chips are simulated with cache program and cache read */
+	if (cache_ops && nsmtd->writesize > 512)
+		chip->options |= NAND_USE_CACHEPRG | NAND_CACHERD;
+	else
+		chip->options &= ~(NAND_USE_CACHEPRG | NAND_CACHERD);
+
 	if (bch) {
 		unsigned int eccsteps, eccbytes;
 		if (!mtd_nand_has_bch()) {
@@ -2337,7 +2509,7 @@ static int __init ns_init_module(void)
 			goto err_exit;
 		}
 		/* N.B. This relies on nand_scan not doing anything with the size before we change it */
-		nsmtd->size = new_size;
+		nsmtd->size = new_size * chip->numchips;
 		chip->chipsize = new_size;
 		chip->chip_shift = ffs(nsmtd->erasesize) + overridesize - 1;
 		chip->pagemask = (chip->chipsize >> chip->page_shift) - 1;
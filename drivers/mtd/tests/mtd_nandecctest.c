@@ -5,8 +5,27 @@
 #include <linux/string.h>
 #include <linux/bitops.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/bch.h>
 #include <linux/mtd/nand_ecc.h>
 
+static int iterations = 4096;
+module_param(iterations, int, S_IRUGO);
+MODULE_PARM_DESC(iterations, "Number of iterations for the throughput tests "
+			     "(0 to skip them)");
+
+/* Throughput in KiB/s of @count blocks of @size bytes processed since @start */
+static long calc_speed(ktime_t start, int count, size_t size)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+
+	if (us <= 0)
+		return 0;
+	return div64_u64((u64)count * size * 1000000, (u64)us * 1024);
+}
+
 #if defined(CONFIG_MTD_NAND) || defined(CONFIG_MTD_NAND_MODULE)
 
 static void inject_single_bit_error(void *data, size_t size)
@@ -55,6 +74,35 @@ static int nand_ecc_test(const size_t size)
 	return -1;
 }
 
+static void nand_ecc_bench(const size_t size)
+{
+	unsigned char code[3];
+	unsigned char error_code[3];
+	ktime_t start;
+	int i;
+
+	get_random_bytes(data, size);
+	__nand_calculate_ecc(data, size, code);
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++)
+		__nand_calculate_ecc(data, size, error_code);
+	printk(KERN_INFO "mtd_nandecctest: nand-ecc-%zu encode: %ld KiB/s\n",
+	       size, calc_speed(start, iterations, size));
+
+	memcpy(error_data, data, size);
+	inject_single_bit_error(error_data, size);
+	__nand_calculate_ecc(error_data, size, error_code);
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++) {
+		/* correction flips the bit back and forth */
+		__nand_correct_data(error_data, code, error_code, size);
+	}
+	printk(KERN_INFO "mtd_nandecctest: nand-ecc-%zu correct: %ld KiB/s\n",
+	       size, calc_speed(start, iterations, size));
+}
+
 #else
 
 static int nand_ecc_test(const size_t size)
@@ -62,6 +110,127 @@ static int nand_ecc_test(const size_t size)
 	return 0;
 }
 
+static void nand_ecc_bench(const size_t size)
+{
+}
+
+#endif
+
+#if defined(CONFIG_BCH) || defined(CONFIG_BCH_MODULE)
+
+static unsigned char bch_data[1024];
+static unsigned char bch_error_data[1024];
+
+static void inject_bit_errors(void *data, size_t size, unsigned int count)
+{
+	unsigned long offset;
+
+	while (count) {
+		offset = random32() % (size * BITS_PER_BYTE);
+		if (!__test_and_change_bit(offset, data))
+			count--;
+	}
+}
+
+/*
+ * Correct @t errors in a @size bytes block, then measure encoding, decoding
+ * of an error-free block and decoding of a block with @t errors.
+ */
+static int bch_ecc_test(int m, int t, const size_t size)
+{
+	struct bch_control *bch;
+	unsigned char *code, *error_code;
+	unsigned int *errloc;
+	char testname[30];
+	ktime_t start;
+	int i, count, err = -ENOMEM;
+
+	BUG_ON(sizeof(bch_data) < size);
+
+	sprintf(testname, "bch-%d-%d-%zu", m, t, size);
+
+	bch = init_bch(m, t, 0);
+	if (!bch) {
+		printk(KERN_ERR "mtd_nandecctest: not ok - %s: init_bch "
+		       "failed\n", testname);
+		return -EINVAL;
+	}
+	code = kzalloc(bch->ecc_bytes, GFP_KERNEL);
+	error_code = kzalloc(bch->ecc_bytes, GFP_KERNEL);
+	errloc = kmalloc(t * sizeof(*errloc), GFP_KERNEL);
+	if (!code || !error_code || !errloc)
+		goto out;
+
+	get_random_bytes(bch_data, size);
+	memcpy(bch_error_data, bch_data, size);
+	inject_bit_errors(bch_error_data, size, t);
+
+	encode_bch(bch, bch_data, size, code);
+	encode_bch(bch, bch_error_data, size, error_code);
+	count = decode_bch(bch, NULL, size, code, error_code, NULL, errloc);
+	for (i = 0; i < count; i++)
+		if (errloc[i] < size * BITS_PER_BYTE)
+			bch_error_data[errloc[i] >> 3] ^= 1 << (errloc[i] & 7);
+
+	if (count != t || memcmp(bch_data, bch_error_data, size)) {
+		printk(KERN_ERR "mtd_nandecctest: not ok - %s: %d errors "
+		       "corrected\n", testname, count);
+		err = -EBADMSG;
+		goto out;
+	}
+	printk(KERN_INFO "mtd_nandecctest: ok - %s\n", testname);
+	err = 0;
+
+	if (iterations <= 0)
+		goto out;
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++) {
+		memset(code, 0, bch->ecc_bytes);
+		encode_bch(bch, bch_data, size, code);
+	}
+	printk(KERN_INFO "mtd_nandecctest: %s encode: %ld KiB/s\n",
+	       testname, calc_speed(start, iterations, size));
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++)
+		decode_bch(bch, NULL, size, code, code, NULL, errloc);
+	printk(KERN_INFO "mtd_nandecctest: %s decode, no error: %ld KiB/s\n",
+	       testname, calc_speed(start, iterations, size));
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++)
+		decode_bch(bch, NULL, size, code, error_code, NULL, errloc);
+	printk(KERN_INFO "mtd_nandecctest: %s decode, %d errors: %ld KiB/s\n",
+	       testname, t, calc_speed(start, iterations, size));
+
+out:
+	kfree(errloc);
+	kfree(error_code);
+	kfree(code);
+	free_bch(bch);
+	return err;
+}
+
+static void bch_ecc_tests(void)
+{
+#if defined(CONFIG_BCH_CONST_PARAMS)
+	bch_ecc_test(CONFIG_BCH_CONST_M, CONFIG_BCH_CONST_T, 512);
+#else
+	/* usual 1-bit/4-bit/8-bit per 512 bytes NAND configurations */
+	bch_ecc_test(13, 1, 512);
+	bch_ecc_test(13, 4, 512);
+	bch_ecc_test(13, 8, 512);
+	bch_ecc_test(14, 24, 1024);
+#endif
+}
+
+#else
+
+static void bch_ecc_tests(void)
+{
+}
+
 #endif
 
 static int __init ecc_test_init(void)
@@ -71,6 +240,13 @@ static int __init ecc_test_init(void)
 	nand_ecc_test(256);
 	nand_ecc_test(512);
 
+	if (iterations > 0) {
+		nand_ecc_bench(256);
+		nand_ecc_bench(512);
+	}
+
+	bch_ecc_tests();
+
 	return 0;
 }
 
@@ -81,6 +257,6 @@ static void __exit ecc_test_exit(void)
 module_init(ecc_test_init);
 module_exit(ecc_test_exit);
 
-MODULE_DESCRIPTION("NAND ECC function test module");
+MODULE_DESCRIPTION("NAND ECC function and throughput test module");
 MODULE_AUTHOR("Akinobu Mita");
 MODULE_LICENSE("GPL");
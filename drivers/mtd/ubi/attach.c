@@ -991,6 +991,26 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 	}
 
 	vol_id = be32_to_cpu(vidh->vol_id);
+	if (vol_id == UBI_FM_SB_VOLUME_ID || vol_id == UBI_FM_DATA_VOLUME_ID) {
+		int lnum = be32_to_cpu(vidh->lnum);
+		unsigned long long sqnum = be64_to_cpu(vidh->sqnum);
+
+		/*
+		 * Fastmap PEBs are always erased. If the fastmap is used, the
+		 * scanning results are thrown away anyway.
+		 */
+		if (vol_id == UBI_FM_SB_VOLUME_ID &&
+		    (ai->fm_anchor < 0 || sqnum > ai->fm_sqnum)) {
+			ai->fm_anchor = pnum;
+			ai->fm_sqnum = sqnum;
+		}
+
+		err = add_to_list(ai, pnum, vol_id, lnum, ec, 1, &ai->erase);
+		if (err)
+			return err;
+		goto adjust_mean_ec;
+	}
+
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
 		int lnum = be32_to_cpu(vidh->lnum);
 
@@ -1123,69 +1143,52 @@ static int late_analysis(struct ubi_device *ubi, struct ubi_attach_info *ai)
 }
 
 /**
- * scan_all - scan entire MTD device.
- * @ubi: UBI device description object
+ * alloc_ai - allocate attaching information.
+ * @slab_name: name of the slab cache for &struct ubi_ainf_peb objects
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it in form of a "struct ubi_attach_info" object. In case
- * of failure, an error code is returned.
+ * Returns the allocated object or %NULL in case of failure.
  */
-static struct ubi_attach_info *scan_all(struct ubi_device *ubi)
+static struct ubi_attach_info *alloc_ai(const char *slab_name)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_ainf_volume *av;
-	struct ubi_ainf_peb *aeb;
 	struct ubi_attach_info *ai;
 
 	ai = kzalloc(sizeof(struct ubi_attach_info), GFP_KERNEL);
 	if (!ai)
-		return ERR_PTR(-ENOMEM);
+		return ai;
 
 	INIT_LIST_HEAD(&ai->corr);
 	INIT_LIST_HEAD(&ai->free);
 	INIT_LIST_HEAD(&ai->erase);
 	INIT_LIST_HEAD(&ai->alien);
 	ai->volumes = RB_ROOT;
-
-	err = -ENOMEM;
-	ai->aeb_slab_cache = kmem_cache_create("ubi_aeb_slab_cache",
+	ai->fm_anchor = -1;
+	ai->aeb_slab_cache = kmem_cache_create(slab_name,
 					       sizeof(struct ubi_ainf_peb),
 					       0, 0, NULL);
-	if (!ai->aeb_slab_cache)
-		goto out_ai;
-
-	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
-	if (!ech)
-		goto out_ai;
-
-	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
-	if (!vidh)
-		goto out_ech;
-
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
-		cond_resched();
-
-		dbg_gen("process PEB %d", pnum);
-		err = scan_peb(ubi, ai, pnum);
-		if (err < 0)
-			goto out_vidh;
+	if (!ai->aeb_slab_cache) {
+		kfree(ai);
+		ai = NULL;
 	}
 
-	dbg_msg("scanning is finished");
+	return ai;
+}
+
+/**
+ * set_unknown_ec - set unknown erase counters to the mean erase counter.
+ * @ai: attaching information
+ *
+ * This function calculates the mean erase counter and uses it for all PEBs
+ * whose erase counter is unknown.
+ */
+static void set_unknown_ec(struct ubi_attach_info *ai)
+{
+	struct rb_node *rb1, *rb2;
+	struct ubi_ainf_volume *av;
+	struct ubi_ainf_peb *aeb;
 
-	/* Calculate mean erase counter */
 	if (ai->ec_count)
 		ai->mean_ec = div_u64(ai->ec_sum, ai->ec_count);
 
-	err = late_analysis(ubi, ai);
-	if (err)
-		goto out_vidh;
-
-	/*
-	 * In case of unknown erase counter we use the mean erase counter
-	 * value.
-	 */
 	ubi_rb_for_each_entry(rb1, av, &ai->volumes, rb) {
 		ubi_rb_for_each_entry(rb2, aeb, &av->root, u.rb)
 			if (aeb->ec == UBI_UNKNOWN)
@@ -1204,23 +1207,174 @@ static struct ubi_attach_info *scan_all(struct ubi_device *ubi)
 	list_for_each_entry(aeb, &ai->erase, u.list)
 		if (aeb->ec == UBI_UNKNOWN)
 			aeb->ec = ai->mean_ec;
+}
 
-	err = self_check_ai(ubi, ai);
+/**
+ * scan_all - scan entire MTD device.
+ * @ubi: UBI device description object
+ * @ai: attaching information to fill
+ * @start: the first physical eraseblock to scan
+ *
+ * This function does full scanning of an MTD device starting from PEB @start
+ * and adds the information about the scanned PEBs to @ai. PEBs below @start
+ * have to be already in @ai. Returns zero in case of success and a negative
+ * error code in case of failure.
+ */
+static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		    int start)
+{
+	int err, pnum;
+
+	err = -ENOMEM;
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ech)
+		return err;
+
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh)
+		goto out_ech;
+
+	ubi_io_ra_start(ubi, start);
+	for (pnum = start; pnum < ubi->peb_count; pnum++) {
+		cond_resched();
+
+		dbg_gen("process PEB %d", pnum);
+		err = scan_peb(ubi, ai, pnum);
+		if (err < 0) {
+			ubi_io_ra_stop(ubi);
+			goto out_vidh;
+		}
+	}
+	ubi_io_ra_stop(ubi);
+
+	dbg_msg("scanning is finished");
+
+	err = late_analysis(ubi, ai);
 	if (err)
 		goto out_vidh;
 
+	set_unknown_ec(ai);
+
+	err = self_check_ai(ubi, ai);
+
+out_vidh:
 	ubi_free_vid_hdr(ubi, vidh);
+out_ech:
 	kfree(ech);
+	return err;
+}
 
-	return ai;
+/**
+ * peb_in_list - check whether a physical eraseblock is on a list.
+ * @list: the list of &struct ubi_ainf_peb objects to look at
+ * @pnum: the physical eraseblock to look for
+ */
+static int peb_in_list(struct list_head *list, int pnum)
+{
+	struct ubi_ainf_peb *aeb;
+
+	list_for_each_entry(aeb, list, u.list)
+		if (aeb->pnum == pnum)
+			return 1;
+
+	return 0;
+}
+
+/**
+ * scan_fast - try to attach an MTD device using the fastmap.
+ * @ubi: UBI device description object
+ * @ai: attaching information
+ *
+ * This function scans the first %UBI_FM_MAX_START PEBs looking for the newest
+ * fastmap anchor. If there is one, the device is attached from the fastmap,
+ * which requires scanning only the PEBs of the fastmap pool, and @ai is
+ * replaced. Returns zero in case of success, %UBI_NO_FASTMAP if there is no
+ * fastmap, %UBI_BAD_FASTMAP if the fastmap cannot be used, and a negative
+ * error code in case of failure. Unless the fastmap is used, @ai contains the
+ * information about the scanned PEBs.
+ */
+static int scan_fast(struct ubi_device *ubi, struct ubi_attach_info **ai)
+{
+	int err, pnum, i, pool_size;
+	int *pool;
+	struct ubi_attach_info *scan_ai = *ai, *fm_ai;
+	struct ubi_ainf_peb *aeb, *tmp;
+
+	err = -ENOMEM;
+	pool = kmalloc(UBI_FM_MAX_POOL_SIZE * sizeof(int), GFP_KERNEL);
+	if (!pool)
+		return err;
+
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ech)
+		goto out_pool;
 
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh)
+		goto out_ech;
+
+	for (pnum = 0; pnum < UBI_FM_MAX_START; pnum++) {
+		cond_resched();
+
+		dbg_gen("process PEB %d", pnum);
+		err = scan_peb(ubi, scan_ai, pnum);
+		if (err < 0)
+			goto out_vidh;
+	}
+
+	err = UBI_NO_FASTMAP;
+	if (scan_ai->fm_anchor < 0)
+		goto out_vidh;
+
+	err = -ENOMEM;
+	fm_ai = alloc_ai("ubi_aeb_slab_cache_fastmap");
+	if (!fm_ai)
+		goto out_vidh;
+
+	err = ubi_scan_fastmap(ubi, fm_ai, scan_ai->fm_anchor, pool,
+			       &pool_size);
+	if (err)
+		goto out_fm_ai;
+
+	/* The pool PEBs may have been written after the fastmap */
+	for (i = 0; i < pool_size; i++) {
+		cond_resched();
+
+		dbg_gen("process pool PEB %d", pool[i]);
+		err = scan_peb(ubi, fm_ai, pool[i]);
+		if (err < 0)
+			goto out_fm_ai;
+	}
+
+	/*
+	 * The first PEBs were scanned anyway, so double-check what the fastmap
+	 * says about them. A PEB which is "free" but not empty, e.g. because
+	 * of an interrupted fastmap write, has to be erased.
+	 */
+	list_for_each_entry_safe(aeb, tmp, &fm_ai->free, u.list)
+		if (aeb->pnum < UBI_FM_MAX_START &&
+		    !peb_in_list(&scan_ai->free, aeb->pnum))
+			list_move_tail(&aeb->u.list, &fm_ai->erase);
+
+	set_unknown_ec(fm_ai);
+
+	ubi_destroy_ai(scan_ai);
+	*ai = fm_ai;
+	err = 0;
+	goto out_vidh;
+
+out_fm_ai:
+	ubi_destroy_ai(fm_ai);
+	/* Inconsistencies between the fastmap and the pool */
+	if (err == -EINVAL)
+		err = UBI_BAD_FASTMAP;
 out_vidh:
 	ubi_free_vid_hdr(ubi, vidh);
 out_ech:
 	kfree(ech);
-out_ai:
-	ubi_destroy_ai(ai);
-	return ERR_PTR(err);
+out_pool:
+	kfree(pool);
+	return err;
 }
 
 /**
@@ -1235,9 +1389,28 @@ int ubi_attach(struct ubi_device *ubi)
 	int err;
 	struct ubi_attach_info *ai;
 
-	ai = scan_all(ubi);
-	if (IS_ERR(ai))
-		return PTR_ERR(ai);
+	ai = alloc_ai("ubi_aeb_slab_cache");
+	if (!ai)
+		return -ENOMEM;
+
+	if (ubi->fm_disabled)
+		err = scan_all(ubi, ai, 0);
+	else {
+		err = scan_fast(ubi, &ai);
+		if (err == UBI_BAD_FASTMAP) {
+			ubi_warn("fastmap cannot be used, scan the device");
+			ubi_destroy_ai(ai);
+			ai = alloc_ai("ubi_aeb_slab_cache");
+			if (!ai)
+				return -ENOMEM;
+			err = scan_all(ubi, ai, 0);
+		} else if (err == UBI_NO_FASTMAP)
+			err = scan_all(ubi, ai, UBI_FM_MAX_START);
+		else if (!err)
+			ubi_msg("attached by fastmap");
+	}
+	if (err)
+		goto out_ai;
 
 	ubi->bad_peb_count = ai->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
@@ -1259,6 +1432,12 @@ int ubi_attach(struct ubi_device *ubi)
 		goto out_wl;
 
 	ubi_destroy_ai(ai);
+
+	/*
+	 * Write a fastmap describing the attached device. Failing to do so is
+	 * not fatal, the device is just scanned next time.
+	 */
+	ubi_update_fastmap(ubi);
 	return 0;
 
 out_wl:
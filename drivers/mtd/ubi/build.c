@@ -800,6 +800,22 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
 	return 0;
 }
 
+/**
+ * stop_threads - stop the background threads of an UBI device.
+ * @ubi: UBI device description object
+ */
+static void stop_threads(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < UBI_ERASE_THREADS; i++)
+		if (ubi->erase_thread[i])
+			kthread_stop(ubi->erase_thread[i]);
+
+	if (ubi->bgt_thread)
+		kthread_stop(ubi->bgt_thread);
+}
+
 /**
  * ubi_attach_mtd_dev - attach an MTD device.
  * @mtd: MTD device description object
@@ -901,10 +917,14 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	if (err)
 		goto out_free;
 
+	err = ubi_fastmap_init(ubi);
+	if (err)
+		goto out_debugging;
+
 	err = ubi_attach(ubi);
 	if (err) {
 		ubi_err("failed to attach mtd%d, error %d", mtd->index, err);
-		goto out_debugging;
+		goto out_fastmap;
 	}
 
 	if (ubi->autoresize_vol_id != -1) {
@@ -929,6 +949,19 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		goto out_debugfs;
 	}
 
+	for (i = 0; i < UBI_ERASE_THREADS; i++) {
+		ubi->erase_thread[i] = kthread_run(ubi_erase_thread, ubi,
+						   UBI_ERASE_NAME_PATTERN,
+						   ubi_num, i);
+		if (IS_ERR(ubi->erase_thread[i])) {
+			err = PTR_ERR(ubi->erase_thread[i]);
+			ubi->erase_thread[i] = NULL;
+			ubi_err("cannot spawn erase thread %d, error %d",
+				i, err);
+			goto out_threads;
+		}
+	}
+
 	ubi_msg("attached mtd%d to ubi%d", mtd->index, ubi_num);
 	ubi_msg("MTD device name:            \"%s\"", mtd->name);
 	ubi_msg("MTD device size:            %llu MiB", ubi->flash_size >> 20);
@@ -937,6 +970,7 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	ubi_msg("number of corrupted PEBs:   %d", ubi->corr_peb_count);
 	ubi_msg("max. allowed volumes:       %d", ubi->vtbl_slots);
 	ubi_msg("wear-leveling threshold:    %d", CONFIG_MTD_UBI_WL_THRESHOLD);
+	ubi_msg("background erase threads:   %d", UBI_ERASE_THREADS);
 	ubi_msg("number of internal volumes: %d", UBI_INT_VOL_COUNT);
 	ubi_msg("number of user volumes:     %d",
 		ubi->vol_count - UBI_INT_VOL_COUNT);
@@ -954,12 +988,15 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	spin_lock(&ubi->wl_lock);
 	ubi->thread_enabled = 1;
 	wake_up_process(ubi->bgt_thread);
+	wake_up(&ubi->erase_wq);
 	spin_unlock(&ubi->wl_lock);
 
 	ubi_devices[ubi_num] = ubi;
 	ubi_notify_all(ubi, UBI_VOLUME_ADDED, NULL);
 	return ubi_num;
 
+out_threads:
+	stop_threads(ubi);
 out_debugfs:
 	ubi_debugfs_exit_dev(ubi);
 out_uif:
@@ -970,6 +1007,8 @@ out_detach:
 	ubi_wl_close(ubi);
 	ubi_free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
+out_fastmap:
+	ubi_fastmap_close(ubi);
 out_debugging:
 	ubi_debugging_exit_dev(ubi);
 out_free:
@@ -1025,11 +1064,14 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	dbg_msg("detaching mtd%d from ubi%d", ubi->mtd->index, ubi_num);
 
 	/*
-	 * Before freeing anything, we have to stop the background thread to
-	 * prevent it from doing anything on this device while we are freeing.
+	 * Before freeing anything, we have to stop the background threads to
+	 * prevent them from doing anything on this device while we are
+	 * freeing.
 	 */
-	if (ubi->bgt_thread)
-		kthread_stop(ubi->bgt_thread);
+	stop_threads(ubi);
+
+	/* Store the final state so that the next attach is fast */
+	ubi_update_fastmap(ubi);
 
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
@@ -1040,6 +1082,7 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	ubi_debugfs_exit_dev(ubi);
 	uif_close(ubi);
 	ubi_wl_close(ubi);
+	ubi_fastmap_close(ubi);
 	ubi_free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 	put_mtd_device(ubi->mtd);
@@ -0,0 +1,1008 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ */
+
+/*
+ * UBI fastmap sub-system.
+ *
+ * Attaching an MTD device normally means reading the EC and VID headers of
+ * every physical eraseblock, which takes time proportional to the flash size.
+ * The fastmap stores the result of attaching on the flash instead: the erase
+ * counters of all PEBs, which of them are free, used, to be scrubbed or to be
+ * erased, and the EBA tables of all volumes.
+ *
+ * The fastmap consists of up to %UBI_FM_MAX_BLOCKS PEBs belonging to two
+ * internal volumes. The first PEB, the anchor, belongs to the
+ * %UBI_FM_SB_VOLUME_ID volume and is always among the first
+ * %UBI_FM_MAX_START PEBs, so only these have to be scanned to find it. It
+ * starts with &struct ubi_fm_sb, which lists the other fastmap PEBs. Those
+ * belong to the %UBI_FM_DATA_VOLUME_ID volume. The data stored in the fastmap
+ * PEBs is:
+ *
+ *	&struct ubi_fm_sb
+ *	&struct ubi_fm_hdr
+ *	&struct ubi_fm_scan_pool
+ *	&struct ubi_fm_ec records of free PEBs
+ *	&struct ubi_fm_ec records of used PEBs
+ *	&struct ubi_fm_ec records of PEBs to be scrubbed
+ *	&struct ubi_fm_ec records of PEBs to be erased
+ *	&struct ubi_fm_volhdr and &struct ubi_fm_eba for each volume
+ *
+ * The fastmap is a snapshot and the flash keeps changing afterwards. Two rules
+ * keep the snapshot valid until the next one is written:
+ *
+ * o New data is written only to the PEBs of the pool. The pool is refilled
+ *   from the free PEBs each time a fastmap is written, and the pool PEBs are
+ *   scanned when attaching, so everything written since the fastmap was
+ *   written is found. The wear-leveling worker takes its target PEBs from the
+ *   pool as well.
+ *
+ * o PEBs the fastmap describes as used are not erased until the next fastmap
+ *   is written, see 'erase_worker()'. If such a PEB is still referred to by the
+ *   fastmap, so is its data, and newer copies of the LEB are in the pool.
+ *
+ * The @ubi->fm_eba_sem is held in read mode while a PEB is handed out and
+ * stored in an EBA table, so a new fastmap never misses a PEB which has been
+ * taken from the pool but not mapped yet.
+ *
+ * When the fastmap cannot be written, the old one is invalidated by erasing
+ * its anchor. Without a valid fastmap the device is simply scanned when
+ * attaching next time.
+ */
+
+#include <linux/crc32.h>
+#include "ubi.h"
+
+/* States of PEBs used when writing and reading a fastmap */
+enum {
+	FM_PEB_NONE = 0,
+	FM_PEB_FREE,
+	FM_PEB_POOL,
+	FM_PEB_USED,
+	FM_PEB_SCRUB,
+	FM_PEB_ERASE,
+	FM_PEB_FM,
+	FM_PEB_MAPPED,
+};
+
+/**
+ * ubi_fastmap_init - initialize the fastmap sub-system.
+ * @ubi: UBI device description object
+ *
+ * This function calculates how large a fastmap may become and allocates the
+ * memory needed to read and write it. If the fastmap would be too large, or
+ * the device is so small that scanning it is as fast as looking for the
+ * fastmap, fastmap is disabled for this device. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_fastmap_init(struct ubi_device *ubi)
+{
+	size_t size;
+
+	mutex_init(&ubi->fm_mutex);
+
+	size = sizeof(struct ubi_fm_sb) + sizeof(struct ubi_fm_hdr) +
+	       sizeof(struct ubi_fm_scan_pool) +
+	       ubi->peb_count * (sizeof(struct ubi_fm_ec) + sizeof(__be32)) +
+	       (UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) *
+	       (sizeof(struct ubi_fm_volhdr) + sizeof(struct ubi_fm_eba));
+	ubi->fm_blocks = DIV_ROUND_UP(size, ubi->leb_size);
+
+	if (ubi->peb_count <= UBI_FM_MAX_START ||
+	    ubi->fm_blocks > UBI_FM_MAX_BLOCKS) {
+		ubi_msg("fastmap is not used for %d PEBs of %d bytes",
+			ubi->peb_count, ubi->peb_size);
+		ubi->fm_disabled = 1;
+		return 0;
+	}
+
+	ubi->fm_size = ubi->fm_blocks * ubi->leb_size;
+	ubi->fm_pool.max_size = clamp_t(int, ubi->peb_count / 20,
+					UBI_FM_MIN_POOL_SIZE,
+					UBI_FM_MAX_POOL_SIZE - 1);
+
+	ubi->fm_buf = vmalloc(ubi->fm_size);
+	ubi->fm_peb_state = vmalloc(ubi->peb_count);
+	ubi->fm_used = kcalloc(BITS_TO_LONGS(ubi->peb_count),
+			       sizeof(unsigned long), GFP_KERNEL);
+	ubi->fm_next_used = kcalloc(BITS_TO_LONGS(ubi->peb_count),
+				    sizeof(unsigned long), GFP_KERNEL);
+	if (!ubi->fm_buf || !ubi->fm_peb_state || !ubi->fm_used ||
+	    !ubi->fm_next_used) {
+		ubi_fastmap_close(ubi);
+		return -ENOMEM;
+	}
+
+	dbg_gen("fastmap: up to %d PEBs, pool size %d",
+		ubi->fm_blocks, ubi->fm_pool.max_size);
+	return 0;
+}
+
+/**
+ * ubi_fastmap_close - close the fastmap sub-system.
+ * @ubi: UBI device description object
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	vfree(ubi->fm_buf);
+	vfree(ubi->fm_peb_state);
+	kfree(ubi->fm_used);
+	kfree(ubi->fm_next_used);
+	ubi->fm_buf = NULL;
+	ubi->fm_peb_state = NULL;
+	ubi->fm_used = ubi->fm_next_used = NULL;
+}
+
+/**
+ * add_ec - account an erase counter in the attaching information.
+ * @ai: attaching information
+ * @ec: the erase counter
+ */
+static void add_ec(struct ubi_attach_info *ai, int ec)
+{
+	ai->ec_sum += ec;
+	ai->ec_count += 1;
+	if (ec > ai->max_ec)
+		ai->max_ec = ec;
+	if (ec < ai->min_ec)
+		ai->min_ec = ec;
+}
+
+/**
+ * add_aeb - add a physical eraseblock to one of the attaching lists.
+ * @ai: attaching information
+ * @list: the list to add to
+ * @pnum: physical eraseblock number
+ * @ec: erase counter
+ * @vol_id: the volume the PEB belongs to, or %UBI_UNKNOWN
+ * @lnum: the logical eraseblock number, or %UBI_UNKNOWN
+ *
+ * Returns zero in case of success and %-ENOMEM in case of failure.
+ */
+static int add_aeb(struct ubi_attach_info *ai, struct list_head *list,
+		   int pnum, int ec, int vol_id, int lnum)
+{
+	struct ubi_ainf_peb *aeb;
+
+	aeb = kmem_cache_alloc(ai->aeb_slab_cache, GFP_KERNEL);
+	if (!aeb)
+		return -ENOMEM;
+
+	aeb->pnum = pnum;
+	aeb->ec = ec;
+	aeb->vol_id = vol_id;
+	aeb->lnum = lnum;
+	aeb->scrub = aeb->copy_flag = aeb->sqnum = 0;
+	list_add_tail(&aeb->u.list, list);
+	add_ec(ai, ec);
+	return 0;
+}
+
+/**
+ * add_vol - add a volume described by the fastmap to the attaching info.
+ * @ai: attaching information
+ * @fmvhdr: the fastmap volume header
+ *
+ * Returns a pointer to the new volume attaching information, or an error
+ * pointer in case of failure.
+ */
+static struct ubi_ainf_volume *add_vol(struct ubi_attach_info *ai,
+				       const struct ubi_fm_volhdr *fmvhdr)
+{
+	struct ubi_ainf_volume *av;
+	struct rb_node **p = &ai->volumes.rb_node, *parent = NULL;
+	int vol_id = be32_to_cpu(fmvhdr->vol_id);
+
+	while (*p) {
+		parent = *p;
+		av = rb_entry(parent, struct ubi_ainf_volume, rb);
+
+		if (vol_id == av->vol_id) {
+			ubi_err("volume %d is described twice", vol_id);
+			return ERR_PTR(-EINVAL);
+		}
+
+		if (vol_id > av->vol_id)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	av = kmalloc(sizeof(struct ubi_ainf_volume), GFP_KERNEL);
+	if (!av)
+		return ERR_PTR(-ENOMEM);
+
+	av->highest_lnum = av->leb_count = 0;
+	av->vol_id = vol_id;
+	av->root = RB_ROOT;
+	av->vol_type = fmvhdr->vol_type;
+	av->used_ebs = be32_to_cpu(fmvhdr->used_ebs);
+	av->last_data_size = be32_to_cpu(fmvhdr->last_eb_bytes);
+	av->data_pad = be32_to_cpu(fmvhdr->data_pad);
+	av->compat = vol_id == UBI_LAYOUT_VOLUME_ID ?
+		     UBI_LAYOUT_VOLUME_COMPAT : 0;
+	if (vol_id > ai->highest_vol_id)
+		ai->highest_vol_id = vol_id;
+
+	rb_link_node(&av->rb, parent, p);
+	rb_insert_color(&av->rb, &ai->volumes);
+	ai->vols_found += 1;
+	dbg_bld("added volume %d", vol_id);
+	return av;
+}
+
+/**
+ * add_leb - add a logical eraseblock described by the fastmap.
+ * @ai: attaching information
+ * @av: the volume the logical eraseblock belongs to
+ * @lnum: logical eraseblock number
+ * @pnum: physical eraseblock number
+ * @ec: erase counter
+ * @scrub: if the physical eraseblock has to be scrubbed
+ *
+ * The sequence number is unknown and set to zero, so any copy of the LEB
+ * found in the pool is newer. Returns zero in case of success and %-ENOMEM
+ * in case of failure.
+ */
+static int add_leb(struct ubi_attach_info *ai, struct ubi_ainf_volume *av,
+		   int lnum, int pnum, int ec, int scrub)
+{
+	struct ubi_ainf_peb *aeb;
+	struct rb_node **p = &av->root.rb_node, *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		aeb = rb_entry(parent, struct ubi_ainf_peb, u.rb);
+		if (lnum < aeb->lnum)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	aeb = kmem_cache_alloc(ai->aeb_slab_cache, GFP_KERNEL);
+	if (!aeb)
+		return -ENOMEM;
+
+	aeb->pnum = pnum;
+	aeb->ec = ec;
+	aeb->vol_id = av->vol_id;
+	aeb->lnum = lnum;
+	aeb->scrub = scrub;
+	aeb->copy_flag = aeb->sqnum = 0;
+
+	if (av->highest_lnum <= lnum)
+		av->highest_lnum = lnum;
+	av->leb_count += 1;
+
+	rb_link_node(&aeb->u.rb, parent, p);
+	rb_insert_color(&aeb->u.rb, &av->root);
+	add_ec(ai, ec);
+	return 0;
+}
+
+/**
+ * read_fm_blocks - read the fastmap into @ubi->fm_buf.
+ * @ubi: UBI device description object
+ * @ai: attaching information
+ * @fm_anchor: the fastmap anchor PEB
+ * @used_blocks: returns the number of fastmap PEBs
+ *
+ * This function reads and checks the fastmap PEBs and adds them to the erase
+ * list of @ai, because the fastmap is invalid as soon as anything changes.
+ * Returns zero in case of success, %UBI_BAD_FASTMAP if the fastmap is not
+ * valid, and a negative error code in case of failure.
+ */
+static int read_fm_blocks(struct ubi_device *ubi, struct ubi_attach_info *ai,
+			  int fm_anchor, int *used_blocks)
+{
+	struct ubi_fm_sb *fmsb = ubi->fm_buf;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_hdr *vh;
+	unsigned long long sqnum = 0;
+	int i, ret, pnum, ec, vol_id;
+	u32 crc;
+
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ech)
+		return -ENOMEM;
+
+	vh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vh) {
+		kfree(ech);
+		return -ENOMEM;
+	}
+
+	*used_blocks = 1;
+	for (i = 0; i < *used_blocks; i++) {
+		pnum = i ? be32_to_cpu(fmsb->block_loc[i]) : fm_anchor;
+		vol_id = i ? UBI_FM_DATA_VOLUME_ID : UBI_FM_SB_VOLUME_ID;
+
+		ret = UBI_BAD_FASTMAP;
+		if (pnum < 0 || pnum >= ubi->peb_count ||
+		    ubi->fm_peb_state[pnum] != FM_PEB_NONE) {
+			ubi_err("bad fastmap PEB %d", pnum);
+			goto out;
+		}
+		ubi->fm_peb_state[pnum] = FM_PEB_FM;
+
+		ret = ubi_io_read_ec_hdr(ubi, pnum, ech, 0);
+		if (ret && ret != UBI_IO_BITFLIPS) {
+			ubi_err("cannot read EC header of fastmap PEB %d", pnum);
+			if (ret > 0)
+				ret = UBI_BAD_FASTMAP;
+			goto out;
+		}
+		ec = be64_to_cpu(ech->ec);
+
+		ret = ubi_io_read_vid_hdr(ubi, pnum, vh, 0);
+		if (ret && ret != UBI_IO_BITFLIPS) {
+			ubi_err("cannot read VID header of fastmap PEB %d",
+				pnum);
+			if (ret > 0)
+				ret = UBI_BAD_FASTMAP;
+			goto out;
+		}
+
+		ret = UBI_BAD_FASTMAP;
+		if (be32_to_cpu(vh->vol_id) != vol_id ||
+		    be32_to_cpu(vh->lnum) != i ||
+		    (i && be64_to_cpu(vh->sqnum) <= sqnum)) {
+			ubi_err("fastmap PEB %d does not belong to the fastmap",
+				pnum);
+			goto out;
+		}
+		sqnum = be64_to_cpu(vh->sqnum);
+		if (sqnum > ai->max_sqnum)
+			ai->max_sqnum = sqnum;
+
+		ret = ubi_io_read_data(ubi, ubi->fm_buf + i * ubi->leb_size,
+				       pnum, 0, ubi->leb_size);
+		if (ret && ret != UBI_IO_BITFLIPS) {
+			ubi_err("cannot read fastmap PEB %d, error %d",
+				pnum, ret);
+			if (ret == -EBADMSG)
+				ret = UBI_BAD_FASTMAP;
+			goto out;
+		}
+
+		ret = UBI_BAD_FASTMAP;
+		if (i == 0) {
+			if (be32_to_cpu(fmsb->magic) != UBI_FM_SB_MAGIC ||
+			    fmsb->version != UBI_FM_FMT_VERSION ||
+			    be64_to_cpu(fmsb->sqnum) != sqnum) {
+				ubi_err("bad fastmap super block");
+				goto out;
+			}
+
+			*used_blocks = be32_to_cpu(fmsb->used_blocks);
+			if (*used_blocks < 1 ||
+			    *used_blocks > ubi->fm_blocks) {
+				ubi_err("bad number of fastmap PEBs %d",
+					*used_blocks);
+				goto out;
+			}
+		}
+
+		if (be32_to_cpu(fmsb->block_ec[i]) != ec) {
+			ubi_err("fastmap PEB %d was erased meanwhile", pnum);
+			goto out;
+		}
+
+		ret = add_aeb(ai, &ai->erase, pnum, ec, vol_id, i);
+		if (ret)
+			goto out;
+	}
+
+	crc = be32_to_cpu(fmsb->data_crc);
+	fmsb->data_crc = 0;
+	if (crc != crc32(UBI_CRC32_INIT, ubi->fm_buf,
+			 *used_blocks * ubi->leb_size)) {
+		ubi_err("fastmap data CRC is invalid");
+		ret = UBI_BAD_FASTMAP;
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	ubi_free_vid_hdr(ubi, vh);
+	kfree(ech);
+	return ret;
+}
+
+/**
+ * ubi_scan_fastmap - attach an MTD device from the fastmap.
+ * @ubi: UBI device description object
+ * @ai: attaching information to fill
+ * @fm_anchor: the fastmap anchor PEB
+ * @pool: returns the PEBs of the pool
+ * @pool_size: returns the number of PEBs in @pool
+ *
+ * This function reads the fastmap and builds the attaching information from
+ * it. The PEBs of the pool have to be scanned by the caller. Returns zero in
+ * case of success, %UBI_BAD_FASTMAP if the fastmap cannot be used, and a
+ * negative error code in case of failure.
+ */
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		     int fm_anchor, int *pool, int *pool_size)
+{
+	struct ubi_fm_hdr *fmhdr;
+	struct ubi_fm_scan_pool *fmpl;
+	struct ubi_fm_volhdr *fmvhdr;
+	struct ubi_fm_eba *fm_eba;
+	struct ubi_fm_ec *fmec;
+	struct ubi_ainf_volume *av;
+	u8 *state = ubi->fm_peb_state;
+	size_t fm_pos, fm_size;
+	int i, j, k, ret, pnum, ec, used_blocks, vol_id, reserved_pebs;
+	int counts[4], *ecs;
+
+	memset(state, FM_PEB_NONE, ubi->peb_count);
+	ecs = vmalloc(ubi->peb_count * sizeof(int));
+	if (!ecs)
+		return -ENOMEM;
+
+	ret = read_fm_blocks(ubi, ai, fm_anchor, &used_blocks);
+	if (ret)
+		goto out;
+
+	ret = UBI_BAD_FASTMAP;
+	fm_size = used_blocks * ubi->leb_size;
+	fm_pos = sizeof(struct ubi_fm_sb);
+
+	fmhdr = ubi->fm_buf + fm_pos;
+	fm_pos += sizeof(struct ubi_fm_hdr);
+	fmpl = ubi->fm_buf + fm_pos;
+	fm_pos += sizeof(struct ubi_fm_scan_pool);
+	if (fm_pos > fm_size)
+		goto out_bad;
+
+	if (be32_to_cpu(fmhdr->magic) != UBI_FM_HDR_MAGIC ||
+	    be32_to_cpu(fmpl->magic) != UBI_FM_POOL_MAGIC)
+		goto out_bad;
+
+	*pool_size = be16_to_cpu(fmpl->size);
+	if (*pool_size > UBI_FM_MAX_POOL_SIZE)
+		goto out_bad;
+
+	for (i = 0; i < *pool_size; i++) {
+		pnum = be32_to_cpu(fmpl->pebs[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count ||
+		    state[pnum] != FM_PEB_NONE)
+			goto out_bad;
+		state[pnum] = FM_PEB_POOL;
+		pool[i] = pnum;
+	}
+
+	/* Free, used, scrub and erase PEBs, in this order */
+	counts[0] = be32_to_cpu(fmhdr->free_peb_count);
+	counts[1] = be32_to_cpu(fmhdr->used_peb_count);
+	counts[2] = be32_to_cpu(fmhdr->scrub_peb_count);
+	counts[3] = be32_to_cpu(fmhdr->erase_peb_count);
+	for (k = 0; k < 4; k++) {
+		if (counts[k] < 0 || counts[k] > ubi->peb_count)
+			goto out_bad;
+
+		for (i = 0; i < counts[k]; i++) {
+			fmec = ubi->fm_buf + fm_pos;
+			fm_pos += sizeof(struct ubi_fm_ec);
+			if (fm_pos > fm_size)
+				goto out_bad;
+
+			pnum = be32_to_cpu(fmec->pnum);
+			ec = be32_to_cpu(fmec->ec);
+			if (pnum < 0 || pnum >= ubi->peb_count ||
+			    state[pnum] != FM_PEB_NONE ||
+			    ec < 0 || ec > UBI_MAX_ERASECOUNTER)
+				goto out_bad;
+
+			ret = 0;
+			if (k == 0) {
+				state[pnum] = FM_PEB_FREE;
+				ret = add_aeb(ai, &ai->free, pnum, ec,
+					      UBI_UNKNOWN, UBI_UNKNOWN);
+			} else if (k == 3) {
+				state[pnum] = FM_PEB_ERASE;
+				ret = add_aeb(ai, &ai->erase, pnum, ec,
+					      UBI_UNKNOWN, UBI_UNKNOWN);
+			} else {
+				state[pnum] = k == 1 ? FM_PEB_USED :
+						       FM_PEB_SCRUB;
+				ecs[pnum] = ec;
+			}
+			if (ret)
+				goto out;
+			ret = UBI_BAD_FASTMAP;
+		}
+	}
+
+	for (i = 0; i < be32_to_cpu(fmhdr->vol_count); i++) {
+		fmvhdr = ubi->fm_buf + fm_pos;
+		fm_pos += sizeof(struct ubi_fm_volhdr);
+		fm_eba = ubi->fm_buf + fm_pos;
+		fm_pos += sizeof(struct ubi_fm_eba);
+		if (fm_pos > fm_size ||
+		    be32_to_cpu(fmvhdr->magic) != UBI_FM_VHDR_MAGIC ||
+		    be32_to_cpu(fm_eba->magic) != UBI_FM_EBA_MAGIC)
+			goto out_bad;
+
+		vol_id = be32_to_cpu(fmvhdr->vol_id);
+		reserved_pebs = be32_to_cpu(fm_eba->reserved_pebs);
+		fm_pos += reserved_pebs * sizeof(__be32);
+		if ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+		    vol_id != UBI_LAYOUT_VOLUME_ID)
+			goto out_bad;
+		if (fmvhdr->vol_type != UBI_DYNAMIC_VOLUME &&
+		    fmvhdr->vol_type != UBI_STATIC_VOLUME)
+			goto out_bad;
+		if (reserved_pebs < 0 || reserved_pebs > ubi->peb_count ||
+		    fm_pos > fm_size)
+			goto out_bad;
+
+		/*
+		 * Like when scanning, a volume without mapped LEBs is not
+		 * present in the attaching information.
+		 */
+		av = NULL;
+		for (j = 0; j < reserved_pebs; j++) {
+			pnum = be32_to_cpu(fm_eba->pnum[j]);
+			if (pnum < 0)
+				continue;
+			if (pnum >= ubi->peb_count ||
+			    (state[pnum] != FM_PEB_USED &&
+			     state[pnum] != FM_PEB_SCRUB))
+				goto out_bad;
+
+			if (!av) {
+				av = add_vol(ai, fmvhdr);
+				if (IS_ERR(av)) {
+					ret = PTR_ERR(av);
+					if (ret == -EINVAL)
+						ret = UBI_BAD_FASTMAP;
+					goto out;
+				}
+			}
+
+			ret = add_leb(ai, av, j, pnum, ecs[pnum],
+				      state[pnum] == FM_PEB_SCRUB);
+			if (ret)
+				goto out;
+			state[pnum] = FM_PEB_MAPPED;
+			ret = UBI_BAD_FASTMAP;
+		}
+	}
+
+	/* Used PEBs which no LEB is mapped to are not needed any longer */
+	for (pnum = 0; pnum < ubi->peb_count; pnum++)
+		if (state[pnum] == FM_PEB_USED || state[pnum] == FM_PEB_SCRUB) {
+			ret = add_aeb(ai, &ai->erase, pnum, ecs[pnum],
+				      UBI_UNKNOWN, UBI_UNKNOWN);
+			if (ret)
+				goto out;
+		}
+
+	ai->bad_peb_count = be32_to_cpu(fmhdr->bad_peb_count);
+	ai->corr_peb_count = be32_to_cpu(fmhdr->corr_peb_count);
+	ret = 0;
+	goto out;
+
+out_bad:
+	ubi_err("fastmap at PEB %d is corrupted", fm_anchor);
+	ret = UBI_BAD_FASTMAP;
+out:
+	vfree(ecs);
+	return ret;
+}
+
+/**
+ * fm_needed_blocks - calculate how many PEBs the next fastmap needs.
+ * @ubi: UBI device description object
+ */
+static int fm_needed_blocks(struct ubi_device *ubi)
+{
+	int i;
+	size_t size;
+
+	size = sizeof(struct ubi_fm_sb) + sizeof(struct ubi_fm_hdr) +
+	       sizeof(struct ubi_fm_scan_pool) +
+	       ubi->peb_count * sizeof(struct ubi_fm_ec);
+
+	spin_lock(&ubi->volumes_lock);
+	for (i = 0; i < UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT; i++)
+		if (ubi->volumes[i])
+			size += sizeof(struct ubi_fm_volhdr) +
+				sizeof(struct ubi_fm_eba) +
+				ubi->volumes[i]->reserved_pebs * sizeof(__be32);
+	spin_unlock(&ubi->volumes_lock);
+
+	return DIV_ROUND_UP(size, ubi->leb_size);
+}
+
+/**
+ * fm_serialize - serialize the current state into @ubi->fm_buf.
+ * @ubi: UBI device description object
+ * @new_fm: the PEBs the fastmap is going to be written to
+ * @pool_size: the size the pool will have once the fastmap is written
+ * @len: returns the length of the serialized data
+ *
+ * This function also prepares @ubi->fm_next_used. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+static int fm_serialize(struct ubi_device *ubi,
+			struct ubi_fastmap_layout *new_fm, int pool_size,
+			size_t *len)
+{
+	struct ubi_fm_sb *fmsb;
+	struct ubi_fm_hdr *fmhdr;
+	struct ubi_fm_scan_pool *fmpl;
+	struct ubi_fm_volhdr *fmvhdr;
+	struct ubi_fm_eba *fm_eba;
+	struct ubi_fm_ec *fmec;
+	struct ubi_volume *vol;
+	struct ubi_wl_entry *e;
+	struct rb_node *rb;
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+	static const u8 ec_order[4] = {
+		FM_PEB_FREE, FM_PEB_USED, FM_PEB_SCRUB, FM_PEB_NONE
+	};
+	u8 *state = ubi->fm_peb_state;
+	size_t fm_pos = 0, fm_size = new_fm->used_blocks * ubi->leb_size;
+	int i, j, k, pnum, ret = 0, counts[4] = {}, vol_count = 0;
+
+	memset(ubi->fm_buf, 0, fm_size);
+	memset(state, FM_PEB_NONE, ubi->peb_count);
+	bitmap_zero(ubi->fm_next_used, ubi->peb_count);
+
+	fmsb = ubi->fm_buf;
+	fm_pos += sizeof(struct ubi_fm_sb);
+	fmhdr = ubi->fm_buf + fm_pos;
+	fm_pos += sizeof(struct ubi_fm_hdr);
+	fmpl = ubi->fm_buf + fm_pos;
+	fm_pos += sizeof(struct ubi_fm_scan_pool);
+
+	fmsb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	fmsb->version = UBI_FM_FMT_VERSION;
+	fmsb->used_blocks = cpu_to_be32(new_fm->used_blocks);
+	for (i = 0; i < new_fm->used_blocks; i++) {
+		fmsb->block_loc[i] = cpu_to_be32(new_fm->e[i]->pnum);
+		fmsb->block_ec[i] = cpu_to_be32(new_fm->e[i]->ec);
+		state[new_fm->e[i]->pnum] = FM_PEB_FM;
+	}
+
+	spin_lock(&ubi->volumes_lock);
+	spin_lock(&ubi->wl_lock);
+
+	/* PEBs of the pool which have not been handed out yet */
+	j = 0;
+	for (i = pool->used; i < pool_size; i++) {
+		state[pool->pebs[i]] = FM_PEB_POOL;
+		fmpl->pebs[j++] = cpu_to_be32(pool->pebs[i]);
+	}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		state[e->pnum] = FM_PEB_FREE;
+
+	for (i = 0; i < UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		for (j = 0; j < vol->reserved_pebs; j++) {
+			pnum = vol->eba_tbl[j];
+			if (pnum < 0)
+				continue;
+			if (state[pnum] != FM_PEB_NONE) {
+				ubi_err("PEB %d is mapped, but in state %d",
+					pnum, state[pnum]);
+				ret = -EINVAL;
+				goto out_unlock;
+			}
+			state[pnum] = FM_PEB_USED;
+			__set_bit(pnum, ubi->fm_next_used);
+		}
+	}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->scrub, u.rb)
+		if (state[e->pnum] == FM_PEB_USED)
+			state[e->pnum] = FM_PEB_SCRUB;
+
+	/*
+	 * The target of a data move is written to and has to be scanned, just
+	 * like a pool PEB.
+	 */
+	if (ubi->move_to && state[ubi->move_to->pnum] == FM_PEB_NONE) {
+		state[ubi->move_to->pnum] = FM_PEB_POOL;
+		fmpl->pebs[j++] = cpu_to_be32(ubi->move_to->pnum);
+	}
+
+	fmpl->magic = cpu_to_be32(UBI_FM_POOL_MAGIC);
+	fmpl->size = cpu_to_be16(j);
+	fmpl->max_size = cpu_to_be16(pool->max_size);
+
+	/*
+	 * Any other PEB UBI knows about is to be erased. These are PEBs which
+	 * are waiting for erasure, the old fastmap PEBs, etc.
+	 */
+	for (k = 0; k < 4; k++)
+		for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+			e = ubi->lookuptbl[pnum];
+			if (!e || state[pnum] != ec_order[k])
+				continue;
+
+			fmec = ubi->fm_buf + fm_pos;
+			fm_pos += sizeof(struct ubi_fm_ec);
+			fmec->pnum = cpu_to_be32(pnum);
+			fmec->ec = cpu_to_be32(e->ec);
+			counts[k] += 1;
+		}
+
+	for (i = 0; i < UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		if (fm_pos + sizeof(struct ubi_fm_volhdr) +
+		    sizeof(struct ubi_fm_eba) +
+		    vol->reserved_pebs * sizeof(__be32) > fm_size) {
+			ret = -ENOSPC;
+			goto out_unlock;
+		}
+
+		fmvhdr = ubi->fm_buf + fm_pos;
+		fm_pos += sizeof(struct ubi_fm_volhdr);
+		fmvhdr->magic = cpu_to_be32(UBI_FM_VHDR_MAGIC);
+		fmvhdr->vol_id = cpu_to_be32(vol->vol_id);
+		fmvhdr->vol_type = vol->vol_type;
+		fmvhdr->data_pad = cpu_to_be32(vol->data_pad);
+		if (vol->vol_type == UBI_STATIC_VOLUME) {
+			fmvhdr->used_ebs = cpu_to_be32(vol->used_ebs);
+			fmvhdr->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		}
+
+		fm_eba = ubi->fm_buf + fm_pos;
+		fm_pos += sizeof(struct ubi_fm_eba);
+		fm_eba->magic = cpu_to_be32(UBI_FM_EBA_MAGIC);
+		fm_eba->reserved_pebs = cpu_to_be32(vol->reserved_pebs);
+		for (j = 0; j < vol->reserved_pebs; j++)
+			fm_eba->pnum[j] = cpu_to_be32(vol->eba_tbl[j]);
+		fm_pos += vol->reserved_pebs * sizeof(__be32);
+		vol_count += 1;
+	}
+
+	fmhdr->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+	fmhdr->free_peb_count = cpu_to_be32(counts[0]);
+	fmhdr->used_peb_count = cpu_to_be32(counts[1]);
+	fmhdr->scrub_peb_count = cpu_to_be32(counts[2]);
+	fmhdr->erase_peb_count = cpu_to_be32(counts[3]);
+	fmhdr->bad_peb_count = cpu_to_be32(ubi->bad_peb_count);
+	fmhdr->corr_peb_count = cpu_to_be32(ubi->corr_peb_count);
+	fmhdr->vol_count = cpu_to_be32(vol_count);
+	*len = fm_pos;
+
+out_unlock:
+	spin_unlock(&ubi->wl_lock);
+	spin_unlock(&ubi->volumes_lock);
+	return ret;
+}
+
+/**
+ * fm_write - write the serialized fastmap to the flash.
+ * @ubi: UBI device description object
+ * @new_fm: the PEBs to write the fastmap to
+ * @len: length of the serialized data in @ubi->fm_buf
+ *
+ * The anchor is written first, so that an interrupted write leaves an anchor
+ * whose data PEBs are missing or do not match the CRC, and the fastmap is
+ * not used. Returns zero in case of success and a negative error code in case
+ * of failure.
+ */
+static int fm_write(struct ubi_device *ubi, struct ubi_fastmap_layout *new_fm,
+		    size_t len)
+{
+	struct ubi_fm_sb *fmsb = ubi->fm_buf;
+	struct ubi_vid_hdr *vid_hdr;
+	size_t fm_size = new_fm->used_blocks * ubi->leb_size;
+	unsigned long long sqnum;
+	int i, ret = 0, size;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	/*
+	 * Only the used part of the fastmap PEBs is written, the rest reads
+	 * back as 0xFF bytes and is covered by the CRC this way.
+	 */
+	memset(ubi->fm_buf + len, 0xFF, fm_size - len);
+
+	sqnum = ubi_next_sqnum(ubi);
+	fmsb->sqnum = cpu_to_be64(sqnum);
+	fmsb->data_crc = 0;
+	fmsb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, ubi->fm_buf,
+					   fm_size));
+
+	vid_hdr->vol_type = UBI_VID_DYNAMIC;
+	vid_hdr->compat = UBI_FM_VOLUME_COMPAT;
+	for (i = 0; i < new_fm->used_blocks; i++) {
+		int pnum = new_fm->e[i]->pnum;
+
+		vid_hdr->vol_id = cpu_to_be32(i ? UBI_FM_DATA_VOLUME_ID :
+						  UBI_FM_SB_VOLUME_ID);
+		vid_hdr->lnum = cpu_to_be32(i);
+		vid_hdr->sqnum = cpu_to_be64(i ? ubi_next_sqnum(ubi) : sqnum);
+		ret = ubi_io_write_vid_hdr(ubi, pnum, vid_hdr);
+		if (ret) {
+			ubi_err("cannot write VID header to fastmap PEB %d",
+				pnum);
+			break;
+		}
+
+		size = min_t(int, ubi->leb_size,
+			     (int)len - i * ubi->leb_size);
+		if (size <= 0)
+			continue;
+		size = ALIGN(size, ubi->min_io_size);
+		ret = ubi_io_write_data(ubi, ubi->fm_buf + i * ubi->leb_size,
+					pnum, 0, size);
+		if (ret) {
+			ubi_err("cannot write fastmap to PEB %d", pnum);
+			break;
+		}
+	}
+
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return ret;
+}
+
+/**
+ * refill_pool - prepare the pool for the next fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function drops the PEBs which were handed out from the pool and adds
+ * free PEBs after the end of the pool. The new PEBs become usable only when
+ * @ubi->fm_pool.size is set to the returned value, which must not happen
+ * before the fastmap describing them is written. The @ubi->wl_lock has to be
+ * locked.
+ */
+static int refill_pool(struct ubi_device *ubi)
+{
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+	struct ubi_wl_entry *e;
+	int size;
+
+	memmove(pool->pebs, pool->pebs + pool->used,
+		(pool->size - pool->used) * sizeof(int));
+	pool->size -= pool->used;
+	pool->used = 0;
+
+	size = pool->size;
+	while (size < pool->max_size) {
+		e = ubi_wl_get_fm_peb(ubi, 0);
+		if (!e)
+			break;
+		pool->pebs[size++] = e->pnum;
+	}
+
+	return size;
+}
+
+/**
+ * ubi_update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function refills the pool, writes a new fastmap describing the current
+ * state of the device and returns the PEBs of the old one. If the new fastmap
+ * cannot be written, the old one is invalidated and the device will be
+ * scanned when attaching next time. In both cases the erasures which were
+ * deferred because of the old fastmap may proceed. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int i, ret, needed, pool_size;
+	size_t len;
+	struct ubi_fastmap_layout *new_fm, *old_fm;
+
+	if (ubi->fm_disabled)
+		return 0;
+	if (ubi->ro_mode)
+		return -EROFS;
+
+	new_fm = kzalloc(sizeof(struct ubi_fastmap_layout), GFP_KERNEL);
+	if (!new_fm)
+		return -ENOMEM;
+
+	mutex_lock(&ubi->fm_mutex);
+	down_write(&ubi->fm_eba_sem);
+
+	needed = fm_needed_blocks(ubi);
+	ubi_assert(needed <= ubi->fm_blocks);
+
+	spin_lock(&ubi->wl_lock);
+	for (i = 0; i < needed; i++) {
+		new_fm->e[i] = ubi_wl_get_fm_peb(ubi, i == 0);
+		if (!new_fm->e[i])
+			break;
+		new_fm->used_blocks += 1;
+	}
+	pool_size = refill_pool(ubi);
+	spin_unlock(&ubi->wl_lock);
+
+	ret = -ENOSPC;
+	if (new_fm->used_blocks < needed || pool_size == 0) {
+		dbg_gen("no free PEBs for fastmap (%d of %d), pool size %d",
+			new_fm->used_blocks, needed, pool_size);
+		goto out_invalidate;
+	}
+
+	ret = fm_serialize(ubi, new_fm, pool_size, &len);
+	if (ret)
+		goto out_invalidate;
+
+	ret = fm_write(ubi, new_fm, len);
+	if (ret)
+		goto out_invalidate;
+
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_pool.size = pool_size;
+	old_fm = ubi->fm;
+	ubi->fm = new_fm;
+	swap(ubi->fm_used, ubi->fm_next_used);
+	spin_unlock(&ubi->wl_lock);
+	up_write(&ubi->fm_eba_sem);
+
+	dbg_gen("fastmap written to PEB %d, %d PEBs, pool size %d",
+		new_fm->e[0]->pnum, new_fm->used_blocks, pool_size);
+
+	if (old_fm) {
+		for (i = 0; i < old_fm->used_blocks; i++)
+			ubi_wl_put_fm_peb(ubi, old_fm->e[i], i, 0);
+		kfree(old_fm);
+	}
+	ubi_wl_release_deferred(ubi);
+	mutex_unlock(&ubi->fm_mutex);
+	return 0;
+
+out_invalidate:
+	spin_lock(&ubi->wl_lock);
+	old_fm = ubi->fm;
+	ubi->fm = NULL;
+	spin_unlock(&ubi->wl_lock);
+
+	/*
+	 * Erase the old anchor before anything which is not described by the
+	 * old fastmap may be written, i.e., before the pool is extended.
+	 */
+	if (old_fm) {
+		if (ubi_wl_put_fm_peb(ubi, old_fm->e[0], 0, 1)) {
+			ubi_err("cannot invalidate fastmap at PEB %d",
+				old_fm->e[0]->pnum);
+			ubi_ro_mode(ubi);
+		}
+		for (i = 1; i < old_fm->used_blocks; i++)
+			ubi_wl_put_fm_peb(ubi, old_fm->e[i], i, 0);
+		kfree(old_fm);
+	}
+
+	for (i = 0; i < new_fm->used_blocks; i++)
+		ubi_wl_put_fm_peb(ubi, new_fm->e[i], i, 0);
+	kfree(new_fm);
+
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_pool.size = pool_size;
+	spin_unlock(&ubi->wl_lock);
+	up_write(&ubi->fm_eba_sem);
+
+	ubi_wl_release_deferred(ubi);
+	mutex_unlock(&ubi->fm_mutex);
+	if (ret != -ENOSPC)
+		ubi_err("cannot write fastmap, error %d", ret);
+	return ret;
+}
@@ -89,6 +89,7 @@
 #include <linux/crc32.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/completion.h>
 #include "ubi.h"
 
 static int self_check_not_bad(const struct ubi_device *ubi, int pnum);
@@ -101,6 +102,189 @@ static int self_check_vid_hdr(const struct ubi_device *ubi, int pnum,
 static int self_check_write(struct ubi_device *ubi, const void *buf, int pnum,
 			    int offset, int len);
 
+/* How many physical eraseblocks are read ahead while attaching */
+#define UBI_IO_RA_SLOTS 8
+
+/**
+ * struct ubi_io_ra_slot - a physical eraseblock being read ahead.
+ * @pnum: the physical eraseblock, %-1 if the slot is unused
+ * @buf: the EC and VID headers area of @pnum
+ * @req: the read request
+ * @done: completed when @req finishes
+ */
+struct ubi_io_ra_slot {
+	int pnum;
+	void *buf;
+	struct mtd_io_req req;
+	struct completion done;
+};
+
+/**
+ * struct ubi_io_ra - read-ahead of the headers while attaching.
+ * @next: next physical eraseblock to read ahead
+ * @len: how many bytes are read from each physical eraseblock
+ * @slots: the physical eraseblocks being read ahead
+ */
+struct ubi_io_ra {
+	int next;
+	int len;
+	struct ubi_io_ra_slot slots[UBI_IO_RA_SLOTS];
+};
+
+static void io_done(struct mtd_io_req *req)
+{
+	complete(req->priv);
+}
+
+/**
+ * ra_fill - read ahead the physical eraseblocks following @pnum.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock being processed
+ *
+ * Slots of physical eraseblocks before @pnum are not needed anymore and are
+ * reused for the next good physical eraseblocks.
+ */
+static void ra_fill(const struct ubi_device *ubi, int pnum)
+{
+	struct ubi_io_ra *ra = ubi->ra;
+	struct ubi_io_ra_slot *slot;
+	int i;
+
+	for (i = 0; i < UBI_IO_RA_SLOTS; i++) {
+		slot = &ra->slots[i];
+		if (slot->pnum >= pnum)
+			continue;
+		if (slot->pnum != -1)
+			wait_for_completion(&slot->done);
+		slot->pnum = -1;
+
+		while (ra->next < ubi->peb_count &&
+		       ubi_io_is_bad(ubi, ra->next))
+			ra->next += 1;
+		if (ra->next >= ubi->peb_count)
+			continue;
+
+		init_completion(&slot->done);
+		slot->req.type = MTD_IO_READ;
+		slot->req.addr = (loff_t)ra->next * ubi->peb_size;
+		slot->req.len = ra->len;
+		slot->req.buf = slot->buf;
+		slot->req.done = io_done;
+		slot->req.priv = &slot->done;
+		if (!mtd_submit_io(ubi->mtd, &slot->req))
+			slot->pnum = ra->next;
+		ra->next += 1;
+	}
+}
+
+/**
+ * ra_read - serve a read from the read-ahead buffers.
+ * @ubi: UBI device description object
+ * @buf: buffer where to store the read data
+ * @pnum: physical eraseblock number to read from
+ * @offset: offset within the physical eraseblock from where to read
+ * @len: how many bytes to read
+ *
+ * Returns %0 or %UBI_IO_BITFLIPS like ubi_io_read() if the data were read
+ * ahead, and %-EAGAIN if not, or if reading them failed. The data have to be
+ * read from the flash then.
+ */
+static int ra_read(const struct ubi_device *ubi, void *buf, int pnum,
+		   int offset, int len)
+{
+	struct ubi_io_ra_slot *slot;
+	int i;
+
+	ra_fill(ubi, pnum);
+	if (offset + len > ubi->ra->len)
+		return -EAGAIN;
+
+	for (i = 0; i < UBI_IO_RA_SLOTS; i++) {
+		slot = &ubi->ra->slots[i];
+		if (slot->pnum != pnum)
+			continue;
+
+		wait_for_completion(&slot->done);
+		if (slot->req.error && !mtd_is_bitflip(slot->req.error))
+			return -EAGAIN;
+
+		memcpy(buf, slot->buf + offset, len);
+		if (slot->req.error || ubi_dbg_is_bitflip(ubi)) {
+			dbg_msg("fixable bit-flip detected at PEB %d", pnum);
+			return UBI_IO_BITFLIPS;
+		}
+		return 0;
+	}
+
+	return -EAGAIN;
+}
+
+/**
+ * ubi_io_ra_start - start reading ahead the headers of all PEBs.
+ * @ubi: UBI device description object
+ * @start: the first physical eraseblock to read
+ *
+ * When the MTD device executes I/O requests asynchronously, the EC and VID
+ * headers of the next few physical eraseblocks are read while the current one
+ * is processed, and ubi_io_read() serves the header reads from them. This is
+ * meant for scanning the physical eraseblocks in ascending order, nothing may
+ * be written to them before ubi_io_ra_stop() is called. If there is no memory
+ * for the buffers, the headers are just read as usual.
+ */
+void ubi_io_ra_start(struct ubi_device *ubi, int start)
+{
+	struct ubi_io_ra *ra;
+	int i;
+
+	if (!mtd_has_async_io(ubi->mtd))
+		return;
+
+	ra = kzalloc(sizeof(struct ubi_io_ra), GFP_KERNEL);
+	if (!ra)
+		return;
+
+	ra->next = start;
+	ra->len = ubi->vid_hdr_aloffset + ubi->vid_hdr_alsize;
+	for (i = 0; i < UBI_IO_RA_SLOTS; i++) {
+		ra->slots[i].pnum = -1;
+		ra->slots[i].buf = kmalloc(ra->len, GFP_KERNEL);
+		if (!ra->slots[i].buf)
+			goto out_free;
+	}
+
+	ubi->ra = ra;
+	return;
+
+out_free:
+	while (i--)
+		kfree(ra->slots[i].buf);
+	kfree(ra);
+}
+
+/**
+ * ubi_io_ra_stop - stop reading ahead.
+ * @ubi: UBI device description object
+ *
+ * This function waits for the reads in flight and frees the read-ahead
+ * buffers.
+ */
+void ubi_io_ra_stop(struct ubi_device *ubi)
+{
+	struct ubi_io_ra *ra = ubi->ra;
+	int i;
+
+	if (!ra)
+		return;
+
+	for (i = 0; i < UBI_IO_RA_SLOTS; i++) {
+		if (ra->slots[i].pnum != -1)
+			wait_for_completion(&ra->slots[i].done);
+		kfree(ra->slots[i].buf);
+	}
+	kfree(ra);
+	ubi->ra = NULL;
+}
+
 /**
  * ubi_io_read - read data from a physical eraseblock.
  * @ubi: UBI device description object
@@ -140,6 +324,12 @@ int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
 	if (err)
 		return err;
 
+	if (ubi->ra) {
+		err = ra_read(ubi, buf, pnum, offset, len);
+		if (err != -EAGAIN)
+			return err;
+	}
+
 	/*
 	 * Deliberately corrupt the buffer to improve robustness. Indeed, if we
 	 * do not do this, the following may happen:
@@ -215,6 +405,45 @@ retry:
 	return err;
 }
 
+/**
+ * io_write - write data through the I/O queue of the MTD device.
+ * @ubi: UBI device description object
+ * @addr: where to write
+ * @len: how many bytes to write
+ * @written: how many bytes were written is returned here
+ * @buf: buffer with the data to write
+ *
+ * The write is queued behind the read-ahead and the erasures submitted to the
+ * MTD device, which may execute it in parallel with erasures of other chips.
+ * This function waits for the write to finish, and returns like mtd_write().
+ */
+static int io_write(const struct ubi_device *ubi, loff_t addr, int len,
+		    size_t *written, const void *buf)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct mtd_io_req req;
+	int err;
+
+	req.type = MTD_IO_WRITE;
+	req.addr = addr;
+	req.len = len;
+	req.buf = (u_char *)buf;
+	req.done = io_done;
+	req.priv = &done;
+	INIT_WORK_ONSTACK(&req.work, NULL);
+	err = mtd_submit_io(ubi->mtd, &req);
+	if (err) {
+		*written = 0;
+	} else {
+		wait_for_completion(&done);
+		*written = req.retlen;
+		err = req.error;
+	}
+	destroy_work_on_stack(&req.work);
+
+	return err;
+}
+
 /**
  * ubi_io_write - write data to a physical eraseblock.
  * @ubi: UBI device description object
@@ -281,7 +510,7 @@ int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
 	}
 
 	addr = (loff_t)pnum * ubi->peb_size + offset;
-	err = mtd_write(ubi->mtd, addr, len, &written, buf);
+	err = io_write(ubi, addr, len, &written, buf);
 	if (err) {
 		ubi_err("error %d while writing %d bytes to PEB %d:%d, written "
 			"%zd bytes", err, len, pnum, offset, written);
@@ -608,6 +837,114 @@ int ubi_io_sync_erase(struct ubi_device *ubi, int pnum, int torture)
 	return ret + 1;
 }
 
+/**
+ * struct erase_batch - parallel erasure of several physical eraseblocks.
+ * @pending: count of requests in flight
+ * @done: completed when the last request finishes
+ * @reqs: the erase requests
+ */
+struct erase_batch {
+	atomic_t pending;
+	struct completion done;
+	struct mtd_io_req reqs[0];
+};
+
+static void erase_batch_done(struct mtd_io_req *req)
+{
+	struct erase_batch *batch = req->priv;
+
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/**
+ * ubi_io_erase_batch - erase several physical eraseblocks in parallel.
+ * @ubi: UBI device description object
+ * @pnums: the physical eraseblocks to erase
+ * @errs: the results are returned here
+ * @cnt: count of physical eraseblocks in @pnums
+ *
+ * This function submits the erasures of all the physical eraseblocks at once,
+ * so that an MTD device which can erase several eraseblocks at a time (e.g.,
+ * on different NAND chips) does so, and waits for them. The result for
+ * @pnums[i] is stored in @errs[i], it is zero if the physical eraseblock was
+ * erased and a negative error code if not. Unlike ubi_io_sync_erase(), this
+ * function neither retries failed erasures nor tortures physical eraseblocks,
+ * so the caller has to erase the ones which failed with ubi_io_sync_erase().
+ * Returns zero in case of success and %-ENOMEM if there was no memory, nothing
+ * was erased then.
+ */
+int ubi_io_erase_batch(struct ubi_device *ubi, const int *pnums, int *errs,
+		       int cnt)
+{
+	struct erase_batch *batch;
+	struct mtd_io_req *req;
+	int i, err;
+
+	ubi_assert(!ubi->nor_flash);
+
+	batch = kzalloc(sizeof(struct erase_batch) +
+			cnt * sizeof(struct mtd_io_req), GFP_NOFS);
+	if (!batch)
+		return -ENOMEM;
+
+	/* One extra count, so that nothing completes while submitting */
+	atomic_set(&batch->pending, 1);
+	init_completion(&batch->done);
+
+	for (i = 0; i < cnt; i++) {
+		ubi_assert(pnums[i] >= 0 && pnums[i] < ubi->peb_count);
+		dbg_io("erase PEB %d", pnums[i]);
+
+		errs[i] = self_check_not_bad(ubi, pnums[i]);
+		if (errs[i])
+			continue;
+		if (ubi->ro_mode) {
+			errs[i] = -EROFS;
+			continue;
+		}
+
+		req = &batch->reqs[i];
+		req->type = MTD_IO_ERASE;
+		req->addr = (loff_t)pnums[i] * ubi->peb_size;
+		req->len = ubi->peb_size;
+		req->done = erase_batch_done;
+		req->priv = batch;
+		atomic_inc(&batch->pending);
+		errs[i] = mtd_submit_io(ubi->mtd, req);
+		if (errs[i])
+			atomic_dec(&batch->pending);
+		else
+			errs[i] = 1;
+	}
+	if (!atomic_dec_and_test(&batch->pending))
+		wait_for_completion(&batch->done);
+
+	for (i = 0; i < cnt; i++) {
+		/* Only the submitted ones are positive at this point */
+		if (errs[i] <= 0)
+			continue;
+
+		errs[i] = batch->reqs[i].error;
+		if (errs[i]) {
+			ubi_warn("error %d while erasing PEB %d", errs[i],
+				 pnums[i]);
+			continue;
+		}
+
+		err = ubi_self_check_all_ff(ubi, pnums[i], 0, ubi->peb_size);
+		if (err)
+			errs[i] = err;
+		else if (ubi_dbg_is_erase_failure(ubi)) {
+			ubi_err("cannot erase PEB %d (emulated)", pnums[i]);
+			errs[i] = -EIO;
+		}
+	}
+
+	kfree(batch);
+	return 0;
+}
+
 /**
  * ubi_io_is_bad - check if a physical eraseblock is bad.
  * @ubi: UBI device description object
@@ -375,4 +375,164 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __packed;
 
+/* fastmap on-flash data structure format version */
+#define UBI_FM_FMT_VERSION	1
+
+/*
+ * The fastmap consists of an anchor PEB holding the fastmap super block and of
+ * up to %UBI_FM_MAX_BLOCKS - 1 data PEBs. Both use internal volume IDs, and
+ * UBI implementations without fastmap support simply erase them.
+ *
+ * Other fastmap implementations store a different on-flash format under the
+ * first internal volume IDs after the layout volume. The volume IDs and magic
+ * numbers of this format are taken from the end of the internal range and are
+ * unique, so that such implementations erase this fastmap instead of
+ * misparsing it, and this one never accepts theirs.
+ */
+#define UBI_FM_SB_VOLUME_ID	(UBI_INTERNAL_VOL_START + 4094)
+#define UBI_FM_DATA_VOLUME_ID	(UBI_INTERNAL_VOL_START + 4095)
+#define UBI_FM_VOLUME_COMPAT	UBI_COMPAT_DELETE
+
+#define UBI_FM_SB_MAGIC		0x3C5A91E6
+#define UBI_FM_HDR_MAGIC	0x8D27F04B
+#define UBI_FM_VHDR_MAGIC	0x51E6B3A9
+#define UBI_FM_POOL_MAGIC	0xA49D5C72
+#define UBI_FM_EBA_MAGIC	0x6F0B28D5
+
+/*
+ * The fastmap anchor PEB has to be among the first %UBI_FM_MAX_START PEBs,
+ * because only these are scanned when looking for it.
+ */
+#define UBI_FM_MAX_START	64
+
+/* A fastmap may occupy at most %UBI_FM_MAX_BLOCKS PEBs */
+#define UBI_FM_MAX_BLOCKS	32
+
+/* Minimum and maximum number of PEBs in the fastmap pool */
+#define UBI_FM_MIN_POOL_SIZE	8
+#define UBI_FM_MAX_POOL_SIZE	256
+
+/**
+ * struct ubi_fm_sb - UBI fastmap super block
+ * @magic: fastmap super block magic number (%UBI_FM_SB_MAGIC)
+ * @version: format version of this fastmap
+ * @padding1: reserved, zeroes
+ * @data_crc: CRC over the whole fastmap with this field set to zero
+ * @used_blocks: number of PEBs used by this fastmap
+ * @block_loc: an array containing the location of all PEBs of the fastmap
+ * @block_ec: the erase counter of each used PEB
+ * @sqnum: sequence number of the anchor PEB when the fastmap was written
+ * @padding2: reserved, zeroes
+ *
+ * The super block is stored at the beginning of the anchor PEB, the rest of
+ * the fastmap follows it and continues in the data PEBs, in the order given by
+ * @block_loc.
+ */
+struct ubi_fm_sb {
+	__be32 magic;
+	__u8 version;
+	__u8 padding1[3];
+	__be32 data_crc;
+	__be32 used_blocks;
+	__be32 block_loc[UBI_FM_MAX_BLOCKS];
+	__be32 block_ec[UBI_FM_MAX_BLOCKS];
+	__be64 sqnum;
+	__u8 padding2[32];
+} __packed;
+
+/**
+ * struct ubi_fm_hdr - header of the fastmap data set
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @free_peb_count: number of free PEBs known by this fastmap
+ * @used_peb_count: number of used PEBs known by this fastmap
+ * @scrub_peb_count: number of to be scrubbed PEBs known by this fastmap
+ * @bad_peb_count: number of bad PEBs
+ * @erase_peb_count: number of PEBs which have to be erased
+ * @vol_count: number of UBI volumes known by this fastmap
+ * @corr_peb_count: number of corrupted PEBs, which are preserved
+ *
+ * The header is followed by a &struct ubi_fm_scan_pool object, then by
+ * @free_peb_count, @used_peb_count, @scrub_peb_count and @erase_peb_count
+ * &struct ubi_fm_ec objects, in this order, and then by @vol_count
+ * &struct ubi_fm_volhdr objects, each followed by a &struct ubi_fm_eba object.
+ */
+struct ubi_fm_hdr {
+	__be32 magic;
+	__be32 free_peb_count;
+	__be32 used_peb_count;
+	__be32 scrub_peb_count;
+	__be32 bad_peb_count;
+	__be32 erase_peb_count;
+	__be32 vol_count;
+	__be32 corr_peb_count;
+} __packed;
+
+/**
+ * struct ubi_fm_scan_pool - fastmap pool PEBs to be scanned while attaching
+ * @magic: pool magic number (%UBI_FM_POOL_MAGIC)
+ * @size: current pool size
+ * @max_size: maximal pool size
+ * @pebs: an array containing the location of all PEBs in this pool
+ * @padding: reserved, zeroes
+ *
+ * Free PEBs are handed out only from the pool, so the pool contains all PEBs
+ * which may have been written after the fastmap was written. These PEBs have
+ * to be scanned when the device is attached by means of the fastmap.
+ */
+struct ubi_fm_scan_pool {
+	__be32 magic;
+	__be16 size;
+	__be16 max_size;
+	__be32 pebs[UBI_FM_MAX_POOL_SIZE];
+	__be32 padding[4];
+} __packed;
+
+/**
+ * struct ubi_fm_ec - stores the erase counter of a PEB
+ * @pnum: PEB number
+ * @ec: erase counter of this PEB
+ */
+struct ubi_fm_ec {
+	__be32 pnum;
+	__be32 ec;
+} __packed;
+
+/**
+ * struct ubi_fm_volhdr - fastmap volume header
+ * @magic: fastmap volume header magic number (%UBI_FM_VHDR_MAGIC)
+ * @vol_id: volume ID of the fastmapped volume
+ * @vol_type: type of the fastmapped volume (%UBI_DYNAMIC_VOLUME or
+ *            %UBI_STATIC_VOLUME)
+ * @padding1: reserved, zeroes
+ * @data_pad: data_pad value of the fastmapped volume
+ * @used_ebs: number of used LEBs within this volume
+ * @last_eb_bytes: number of bytes used in the last LEB
+ * @padding2: reserved, zeroes
+ */
+struct ubi_fm_volhdr {
+	__be32 magic;
+	__be32 vol_id;
+	__u8 vol_type;
+	__u8 padding1[3];
+	__be32 data_pad;
+	__be32 used_ebs;
+	__be32 last_eb_bytes;
+	__u8 padding2[8];
+} __packed;
+
+/* struct ubi_fm_volhdr is followed by one struct ubi_fm_eba record */
+
+/**
+ * struct ubi_fm_eba - the EBA table of a fastmapped volume
+ * @magic: EBA table magic number (%UBI_FM_EBA_MAGIC)
+ * @reserved_pebs: number of table entries
+ * @pnum: PEB number of each LEB (the LEB number is the index), or %-1 if the
+ *        LEB is not mapped
+ */
+struct ubi_fm_eba {
+	__be32 magic;
+	__be32 reserved_pebs;
+	__be32 pnum[0];
+} __packed;
+
 #endif /* !__UBI_MEDIA_H__ */
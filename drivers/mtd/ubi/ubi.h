@@ -65,6 +65,12 @@
 /* Background thread name pattern */
 #define UBI_BGT_NAME_PATTERN "ubi_bgt%dd"
 
+/* Background erase thread name pattern */
+#define UBI_ERASE_NAME_PATTERN "ubi_erase%d_%d"
+
+/* Number of background erase threads per UBI device */
+#define UBI_ERASE_THREADS CONFIG_MTD_UBI_ERASE_THREADS
+
 /*
  * This marker in the EBA table means that the LEB is um-mapped.
  * NOTE! It has to have the same value as %UBI_ALL.
@@ -136,6 +142,18 @@ enum {
 	MOVE_RETRY,
 };
 
+/*
+ * Return codes of the fastmap sub-system
+ *
+ * UBI_NO_FASTMAP: No fastmap anchor was found among the first PEBs
+ * UBI_BAD_FASTMAP: A fastmap was found but it is not consistent, the device
+ *                  has to be scanned
+ */
+enum {
+	UBI_NO_FASTMAP = 1,
+	UBI_BAD_FASTMAP,
+};
+
 /**
  * struct ubi_wl_entry - wear-leveling entry.
  * @u.rb: link in the corresponding (free/used) RB-tree
@@ -156,6 +174,34 @@ struct ubi_wl_entry {
 	int pnum;
 };
 
+/**
+ * struct ubi_fm_pool - pool of free PEBs described by the fastmap.
+ * @pebs: physical eraseblock numbers of the pool
+ * @used: number of PEBs from @pebs which were handed out already
+ * @size: total number of PEBs in @pebs
+ * @max_size: maximum size of the pool
+ *
+ * While a fastmap is in use, free PEBs are handed out only from the pool, so
+ * that the fastmap knows which PEBs may contain data it does not describe.
+ * Entries between @used and @size are still unused.
+ */
+struct ubi_fm_pool {
+	int pebs[UBI_FM_MAX_POOL_SIZE];
+	int used;
+	int size;
+	int max_size;
+};
+
+/**
+ * struct ubi_fastmap_layout - in-memory fastmap data structure.
+ * @e: PEBs used by the current fastmap, @e[0] is the anchor
+ * @used_blocks: number of used PEBs
+ */
+struct ubi_fastmap_layout {
+	struct ubi_wl_entry *e[UBI_FM_MAX_BLOCKS];
+	int used_blocks;
+};
+
 /**
  * struct ubi_ltree_entry - an entry in the lock tree.
  * @rb: links RB-tree nodes
@@ -345,7 +391,9 @@ struct ubi_wl_entry;
  * @pq_head: protection queue head
  * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
  *	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- *	     @erroneous, and @erroneous_peb_count fields
+ *	     @erase_works, @works_count, @erase_works_count, @works_done,
+ *	     @erroneous, @erroneous_peb_count, @fm, @fm_pool, @fm_used and
+ *	     @fm_deferred fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -354,11 +402,31 @@ struct ubi_wl_entry;
  * @move_from: physical eraseblock from where the data is being moved
  * @move_to: physical eraseblock where the data is being moved to
  * @move_to_put: if the "to" PEB was put
- * @works: list of pending works
- * @works_count: count of pending works
+ * @works: list of pending works other than erasures
+ * @erase_works: list of pending erase works
+ * @works_count: count of pending works, including the works being executed
+ * @erase_works_count: count of works in @erase_works
+ * @works_done: count of executed works, used to wait for works in flight
+ * @works_wq: wait queue woken up every time a work is done
  * @bgt_thread: background thread description object
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
+ * @erase_thread: background erase thread description objects
+ * @erase_wq: wait queue the erase threads sleep on
+ *
+ * @fm: the fastmap currently stored on the flash, %NULL if there is none
+ * @fm_pool: the pool free PEBs are handed out from while @fm is valid
+ * @fm_eba_sem: held in read mode while a PEB is being handed out and mapped,
+ *              in write mode while a fastmap is being written
+ * @fm_mutex: serializes fastmap updates
+ * @fm_buf: buffer the fastmap is serialized to
+ * @fm_size: size of @fm_buf
+ * @fm_blocks: maximum number of PEBs a fastmap may occupy
+ * @fm_used: bitmap of PEBs @fm describes as used, their erasure is deferred
+ * @fm_next_used: the same bitmap for the fastmap being written
+ * @fm_peb_state: per-PEB scratch space used when writing a fastmap
+ * @fm_deferred: erase works deferred because of @fm_used
+ * @fm_disabled: non-zero if fastmap is not used on this device
  *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
@@ -388,6 +456,8 @@ struct ubi_wl_entry;
  * @max_write_size: maximum amount of bytes the underlying flash can write at a
  *                  time (MTD write buffer size)
  * @mtd: MTD device descriptor
+ * @ra: read-ahead of the headers while attaching, %NULL otherwise (see
+ *      ubi_io_ra_start())
  *
  * @peb_buf: a buffer of PEB size used for different purposes
  * @buf_mutex: protects @peb_buf
@@ -443,10 +513,30 @@ struct ubi_device {
 	struct ubi_wl_entry *move_to;
 	int move_to_put;
 	struct list_head works;
+	struct list_head erase_works;
 	int works_count;
+	int erase_works_count;
+	int works_done;
+	wait_queue_head_t works_wq;
 	struct task_struct *bgt_thread;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
+	struct task_struct *erase_thread[UBI_ERASE_THREADS];
+	wait_queue_head_t erase_wq;
+
+	/* Fastmap stuff */
+	struct ubi_fastmap_layout *fm;
+	struct ubi_fm_pool fm_pool;
+	struct rw_semaphore fm_eba_sem;
+	struct mutex fm_mutex;
+	void *fm_buf;
+	size_t fm_size;
+	int fm_blocks;
+	unsigned long *fm_used;
+	unsigned long *fm_next_used;
+	u8 *fm_peb_state;
+	struct list_head fm_deferred;
+	int fm_disabled;
 
 	/* I/O sub-system's stuff */
 	long long flash_size;
@@ -471,6 +561,7 @@ struct ubi_device {
 	unsigned int nor_flash:1;
 	int max_write_size;
 	struct mtd_info *mtd;
+	struct ubi_io_ra *ra;
 
 	void *peb_buf;
 	struct mutex buf_mutex;
@@ -569,6 +660,8 @@ struct ubi_ainf_volume {
  * @ec_sum: a temporary variable used when calculating @mean_ec
  * @ec_count: a temporary variable used when calculating @mean_ec
  * @aeb_slab_cache: slab cache for &struct ubi_ainf_peb objects
+ * @fm_anchor: the newest fastmap anchor PEB found, %-1 if there is none
+ * @fm_sqnum: sequence number of @fm_anchor
  *
  * This data structure contains the result of attaching an MTD device and may
  * be used by other UBI sub-systems to build final UBI data structures, further
@@ -595,6 +688,8 @@ struct ubi_attach_info {
 	uint64_t ec_sum;
 	int ec_count;
 	struct kmem_cache *aeb_slab_cache;
+	int fm_anchor;
+	unsigned long long fm_sqnum;
 };
 
 #include "debug.h"
@@ -652,6 +747,7 @@ void ubi_calculate_reserved(struct ubi_device *ubi);
 int ubi_check_pattern(const void *buf, uint8_t patt, int size);
 
 /* eba.c */
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 int ubi_eba_unmap_leb(struct ubi_device *ubi, struct ubi_volume *vol,
 		      int lnum);
 int ubi_eba_read_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
@@ -675,6 +771,11 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+int ubi_erase_thread(void *u);
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor);
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int lnum, int sync);
+void ubi_wl_release_deferred(struct ubi_device *ubi);
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -682,6 +783,10 @@ int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
 int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
 		 int len);
 int ubi_io_sync_erase(struct ubi_device *ubi, int pnum, int torture);
+int ubi_io_erase_batch(struct ubi_device *ubi, const int *pnums, int *errs,
+		       int cnt);
+void ubi_io_ra_start(struct ubi_device *ubi, int start);
+void ubi_io_ra_stop(struct ubi_device *ubi);
 int ubi_io_is_bad(const struct ubi_device *ubi, int pnum);
 int ubi_io_mark_bad(const struct ubi_device *ubi, int pnum);
 int ubi_io_read_ec_hdr(struct ubi_device *ubi, int pnum,
@@ -707,6 +812,29 @@ int ubi_notify_all(struct ubi_device *ubi, int ntype,
 int ubi_enumerate_volumes(struct notifier_block *nb);
 void ubi_free_internal_volumes(struct ubi_device *ubi);
 
+/* fastmap.c */
+#ifdef CONFIG_MTD_UBI_FASTMAP
+int ubi_fastmap_init(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+int ubi_update_fastmap(struct ubi_device *ubi);
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		     int fm_anchor, int *pool, int *pool_size);
+#else
+static inline int ubi_fastmap_init(struct ubi_device *ubi)
+{
+	ubi->fm_disabled = 1;
+	return 0;
+}
+static inline void ubi_fastmap_close(struct ubi_device *ubi) {}
+static inline int ubi_update_fastmap(struct ubi_device *ubi) { return 0; }
+static inline int ubi_scan_fastmap(struct ubi_device *ubi,
+				   struct ubi_attach_info *ai, int fm_anchor,
+				   int *pool, int *pool_size)
+{
+	return UBI_BAD_FASTMAP;
+}
+#endif
+
 /* kapi.c */
 void ubi_do_get_device_info(struct ubi_device *ubi, struct ubi_device_info *di);
 void ubi_do_get_volume_info(struct ubi_device *ubi, struct ubi_volume *vol,
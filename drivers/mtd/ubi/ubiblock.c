@@ -0,0 +1,552 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * This is a small driver which implements read-only block devices on top of
+ * UBI volumes, which is what read-only file systems like squashfs need. It is
+ * a replacement for gluebi + mtdblock: the volumes are read with the UBI
+ * kernel API directly, and without breaking the requests into small pieces.
+ *
+ * A block device named "ubiblockX_Y" is created for volume Y of UBI device X.
+ * Whole logical eraseblocks are read into a small LRU cache, and the requests
+ * (which the block layer merges as usual) are served from it. This way,
+ * sequential reads read every logical eraseblock just once, with one UBI read
+ * operation. The cache is only allocated while the block device is open.
+ */
+
+#include <linux/err.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/workqueue.h>
+#include <linux/mtd/ubi.h>
+#include "ubi-media.h"
+
+#define err_msg(fmt, ...)                                     \
+	printk(KERN_ERR "ubiblock (pid %d): %s: " fmt "\n",   \
+	       current->pid, __func__, ##__VA_ARGS__)
+
+/* Maximum number of cached logical eraseblocks per block device */
+#define UBIBLOCK_MAX_CACHE 64
+
+static int cache_lebs = 4;
+module_param(cache_lebs, int, S_IRUGO);
+MODULE_PARM_DESC(cache_lebs, "Number of logical eraseblocks cached per "
+			     "block device (default 4)");
+
+/**
+ * struct ubiblock_leb - a cached logical eraseblock.
+ * @list: link in the LRU list of the block device
+ * @lnum: logical eraseblock number, %-1 if the entry is unused
+ * @buf: the contents of the logical eraseblock
+ */
+struct ubiblock_leb {
+	struct list_head list;
+	int lnum;
+	void *buf;
+};
+
+/**
+ * struct ubiblock - a UBI block device description data structure.
+ * @desc: UBI volume descriptor, only valid while @refcnt is not zero
+ * @ubi_num: UBI device number this block device works on
+ * @vol_id: ID of UBI volume this block device works on
+ * @refcnt: count of openers of the block device
+ * @leb_size: usable logical eraseblock size of the volume
+ * @size: size of the block device in bytes
+ * @gd: the gendisk
+ * @rq: the request queue
+ * @queue_lock: protects @rq
+ * @work: executes the requests
+ * @dev_mutex: protects @desc, @refcnt, @size and the cache
+ * @lru: cached logical eraseblocks, most recently used first
+ * @lebs: the cache entries, @cache_lebs of them
+ * @list: link in the list of UBI block devices
+ */
+struct ubiblock {
+	struct ubi_volume_desc *desc;
+	int ubi_num;
+	int vol_id;
+	int refcnt;
+	int leb_size;
+	long long size;
+	struct gendisk *gd;
+	struct request_queue *rq;
+	spinlock_t queue_lock;
+	struct work_struct work;
+	struct mutex dev_mutex;
+	struct list_head lru;
+	struct ubiblock_leb *lebs;
+	struct list_head list;
+};
+
+static int ubiblock_major;
+static struct workqueue_struct *ubiblock_wq;
+
+/* List of all UBI block devices */
+static LIST_HEAD(ubiblock_devices);
+static DEFINE_MUTEX(devices_mutex);
+
+/**
+ * find_dev_nolock - find a UBI block device.
+ * @ubi_num: UBI device number
+ * @vol_id: volume ID
+ *
+ * Returns the block device corresponding to UBI device @ubi_num and volume
+ * @vol_id, or %NULL if there is none. The caller has to have @devices_mutex
+ * locked.
+ */
+static struct ubiblock *find_dev_nolock(int ubi_num, int vol_id)
+{
+	struct ubiblock *dev;
+
+	list_for_each_entry(dev, &ubiblock_devices, list)
+		if (dev->ubi_num == ubi_num && dev->vol_id == vol_id)
+			return dev;
+	return NULL;
+}
+
+static long long volume_size(const struct ubi_volume_info *vi)
+{
+	/* Static volumes cannot be read past the data they contain */
+	if (vi->vol_type == UBI_DYNAMIC_VOLUME)
+		return (long long)vi->usable_leb_size * vi->size;
+	return vi->used_bytes;
+}
+
+static void free_cache(struct ubiblock *dev)
+{
+	int i;
+
+	for (i = 0; i < cache_lebs; i++)
+		vfree(dev->lebs[i].buf);
+	kfree(dev->lebs);
+	dev->lebs = NULL;
+	INIT_LIST_HEAD(&dev->lru);
+}
+
+static int alloc_cache(struct ubiblock *dev)
+{
+	int i;
+
+	dev->lebs = kcalloc(cache_lebs, sizeof(struct ubiblock_leb),
+			    GFP_KERNEL);
+	if (!dev->lebs)
+		return -ENOMEM;
+
+	for (i = 0; i < cache_lebs; i++) {
+		dev->lebs[i].lnum = -1;
+		dev->lebs[i].buf = vmalloc(dev->leb_size);
+		if (!dev->lebs[i].buf) {
+			free_cache(dev);
+			return -ENOMEM;
+		}
+		list_add_tail(&dev->lebs[i].list, &dev->lru);
+	}
+	return 0;
+}
+
+/**
+ * get_leb - get a logical eraseblock from the cache.
+ * @dev: the UBI block device
+ * @lnum: the logical eraseblock number
+ *
+ * The logical eraseblock is read into the least recently used cache entry
+ * unless it is cached already. Only the bytes which belong to the block
+ * device are read. Returns the cache entry in case of success and an error
+ * pointer in case of failure.
+ */
+static struct ubiblock_leb *get_leb(struct ubiblock *dev, int lnum)
+{
+	struct ubiblock_leb *leb;
+	long long offs = (long long)lnum * dev->leb_size;
+	int len, err;
+
+	list_for_each_entry(leb, &dev->lru, list)
+		if (leb->lnum == lnum)
+			goto out;
+
+	leb = list_entry(dev->lru.prev, struct ubiblock_leb, list);
+	leb->lnum = -1;
+	len = min_t(long long, dev->leb_size, dev->size - offs);
+	err = ubi_leb_read(dev->desc, lnum, leb->buf, 0, len, 0);
+	if (err) {
+		err_msg("error %d reading LEB %d of UBI device %d volume %d",
+			err, lnum, dev->ubi_num, dev->vol_id);
+		return ERR_PTR(err);
+	}
+	leb->lnum = lnum;
+
+out:
+	list_move(&leb->list, &dev->lru);
+	return leb;
+}
+
+/**
+ * do_request - execute a read request.
+ * @dev: the UBI block device
+ * @req: the request
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure. The caller has to have @dev->dev_mutex locked.
+ */
+static int do_request(struct ubiblock *dev, struct request *req)
+{
+	struct req_iterator iter;
+	struct bio_vec *bvec;
+	struct ubiblock_leb *leb;
+	loff_t pos = (loff_t)blk_rq_pos(req) << 9;
+	int len, done;
+	u32 offs;
+	char *p;
+
+	if (req->cmd_type != REQ_TYPE_FS)
+		return -EIO;
+	if (rq_data_dir(req) != READ)
+		return -EROFS;
+	if (pos + blk_rq_bytes(req) > dev->size)
+		return -EIO;
+
+	rq_for_each_segment(bvec, req, iter) {
+		for (done = 0; done < bvec->bv_len; done += len) {
+			leb = get_leb(dev, div_u64_rem(pos, dev->leb_size,
+						       &offs));
+			if (IS_ERR(leb))
+				return -EIO;
+
+			len = min_t(int, bvec->bv_len - done,
+				    dev->leb_size - offs);
+			p = kmap_atomic(bvec->bv_page);
+			memcpy(p + bvec->bv_offset + done, leb->buf + offs,
+			       len);
+			kunmap_atomic(p);
+			pos += len;
+		}
+		flush_dcache_page(bvec->bv_page);
+	}
+
+	return 0;
+}
+
+static void ubiblock_do_work(struct work_struct *work)
+{
+	struct ubiblock *dev = container_of(work, struct ubiblock, work);
+	struct request_queue *rq = dev->rq;
+	struct request *req;
+	int err;
+
+	spin_lock_irq(rq->queue_lock);
+	while ((req = blk_fetch_request(rq))) {
+		spin_unlock_irq(rq->queue_lock);
+
+		mutex_lock(&dev->dev_mutex);
+		err = do_request(dev, req);
+		mutex_unlock(&dev->dev_mutex);
+
+		spin_lock_irq(rq->queue_lock);
+		__blk_end_request_all(req, err);
+	}
+	spin_unlock_irq(rq->queue_lock);
+}
+
+static void ubiblock_request(struct request_queue *rq)
+{
+	struct ubiblock *dev = rq->queuedata;
+
+	queue_work(ubiblock_wq, &dev->work);
+}
+
+static int ubiblock_open(struct block_device *bdev, fmode_t mode)
+{
+	struct ubiblock *dev = bdev->bd_disk->private_data;
+	int err;
+
+	if (mode & FMODE_WRITE)
+		return -EROFS;
+
+	mutex_lock(&dev->dev_mutex);
+	if (dev->refcnt > 0) {
+		/* Just one more reader, the volume is open already */
+		dev->refcnt += 1;
+		mutex_unlock(&dev->dev_mutex);
+		return 0;
+	}
+
+	dev->desc = ubi_open_volume(dev->ubi_num, dev->vol_id, UBI_READONLY);
+	if (IS_ERR(dev->desc)) {
+		err = PTR_ERR(dev->desc);
+		goto out_unlock;
+	}
+
+	err = alloc_cache(dev);
+	if (err) {
+		ubi_close_volume(dev->desc);
+		goto out_unlock;
+	}
+	dev->refcnt += 1;
+
+out_unlock:
+	mutex_unlock(&dev->dev_mutex);
+	return err;
+}
+
+static int ubiblock_release(struct gendisk *gd, fmode_t mode)
+{
+	struct ubiblock *dev = gd->private_data;
+
+	mutex_lock(&dev->dev_mutex);
+	dev->refcnt -= 1;
+	if (dev->refcnt == 0) {
+		free_cache(dev);
+		ubi_close_volume(dev->desc);
+		dev->desc = NULL;
+	}
+	mutex_unlock(&dev->dev_mutex);
+	return 0;
+}
+
+static const struct block_device_operations ubiblock_ops = {
+	.owner = THIS_MODULE,
+	.open = ubiblock_open,
+	.release = ubiblock_release,
+};
+
+/**
+ * ubiblock_create - create a block device for an UBI volume.
+ * @vi: UBI volume description object
+ *
+ * This function is called when a new UBI volume is created in order to create
+ * the corresponding block device. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static int ubiblock_create(struct ubi_volume_info *vi)
+{
+	struct ubiblock *dev;
+	struct gendisk *gd;
+	int err = -ENOMEM;
+
+	dev = kzalloc(sizeof(struct ubiblock), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+
+	dev->ubi_num = vi->ubi_num;
+	dev->vol_id = vi->vol_id;
+	dev->leb_size = vi->usable_leb_size;
+	dev->size = volume_size(vi);
+	spin_lock_init(&dev->queue_lock);
+	INIT_WORK(&dev->work, ubiblock_do_work);
+	mutex_init(&dev->dev_mutex);
+	INIT_LIST_HEAD(&dev->lru);
+
+	gd = alloc_disk(1);
+	if (!gd)
+		goto out_free_dev;
+
+	gd->fops = &ubiblock_ops;
+	gd->major = ubiblock_major;
+	gd->first_minor = dev->ubi_num * UBI_MAX_VOLUMES + dev->vol_id;
+	gd->private_data = dev;
+	sprintf(gd->disk_name, "ubiblock%d_%d", dev->ubi_num, dev->vol_id);
+	set_capacity(gd, dev->size >> 9);
+	set_disk_ro(gd, 1);
+
+	dev->rq = blk_init_queue(ubiblock_request, &dev->queue_lock);
+	if (!dev->rq)
+		goto out_put_disk;
+	dev->rq->queuedata = dev;
+	gd->queue = dev->rq;
+	dev->gd = gd;
+
+	mutex_lock(&devices_mutex);
+	if (find_dev_nolock(dev->ubi_num, dev->vol_id)) {
+		mutex_unlock(&devices_mutex);
+		err_msg("block device for UBI device %d volume %d already "
+			"exists", dev->ubi_num, dev->vol_id);
+		err = -EEXIST;
+		goto out_cleanup_queue;
+	}
+	list_add_tail(&dev->list, &ubiblock_devices);
+	mutex_unlock(&devices_mutex);
+
+	add_disk(gd);
+	return 0;
+
+out_cleanup_queue:
+	blk_cleanup_queue(dev->rq);
+out_put_disk:
+	put_disk(gd);
+out_free_dev:
+	kfree(dev);
+	return err;
+}
+
+static void ubiblock_destroy(struct ubiblock *dev)
+{
+	del_gendisk(dev->gd);
+	blk_cleanup_queue(dev->rq);
+	flush_work(&dev->work);
+	put_disk(dev->gd);
+	kfree(dev);
+}
+
+/**
+ * ubiblock_remove - remove a UBI block device.
+ * @vi: UBI volume description object
+ *
+ * This function is called when an UBI volume is removed and it removes the
+ * corresponding block device. The volume cannot be removed while it is
+ * open, so the block device is not in use. Returns zero in case of success
+ * and a negative error code in case of failure.
+ */
+static int ubiblock_remove(struct ubi_volume_info *vi)
+{
+	struct ubiblock *dev;
+
+	mutex_lock(&devices_mutex);
+	dev = find_dev_nolock(vi->ubi_num, vi->vol_id);
+	if (!dev) {
+		mutex_unlock(&devices_mutex);
+		err_msg("got remove notification for unknown UBI device %d "
+			"volume %d", vi->ubi_num, vi->vol_id);
+		return -ENOENT;
+	}
+	list_del(&dev->list);
+	mutex_unlock(&devices_mutex);
+
+	ubiblock_destroy(dev);
+	return 0;
+}
+
+/**
+ * ubiblock_resized - UBI volume was re-sized or updated notifier.
+ * @vi: volume info structure
+ *
+ * This function changes the size of the block device, the contents of the
+ * volume may have changed as well. Returns zero in case of success and a
+ * negative error code in case of error.
+ */
+static int ubiblock_resized(struct ubi_volume_info *vi)
+{
+	struct ubiblock *dev;
+	struct ubiblock_leb *leb;
+
+	mutex_lock(&devices_mutex);
+	dev = find_dev_nolock(vi->ubi_num, vi->vol_id);
+	if (!dev) {
+		mutex_unlock(&devices_mutex);
+		err_msg("got update notification for unknown UBI device %d "
+			"volume %d", vi->ubi_num, vi->vol_id);
+		return -ENOENT;
+	}
+
+	mutex_lock(&dev->dev_mutex);
+	dev->size = volume_size(vi);
+	set_capacity(dev->gd, dev->size >> 9);
+	list_for_each_entry(leb, &dev->lru, list)
+		leb->lnum = -1;
+	mutex_unlock(&dev->dev_mutex);
+	mutex_unlock(&devices_mutex);
+	return 0;
+}
+
+/**
+ * ubiblock_notify - UBI notification handler.
+ * @nb: registered notifier block
+ * @l: notification type
+ * @ptr: pointer to the &struct ubi_notification object
+ */
+static int ubiblock_notify(struct notifier_block *nb, unsigned long l,
+			   void *ns_ptr)
+{
+	struct ubi_notification *nt = ns_ptr;
+
+	switch (l) {
+	case UBI_VOLUME_ADDED:
+		ubiblock_create(&nt->vi);
+		break;
+	case UBI_VOLUME_REMOVED:
+		ubiblock_remove(&nt->vi);
+		break;
+	case UBI_VOLUME_RESIZED:
+	case UBI_VOLUME_UPDATED:
+		ubiblock_resized(&nt->vi);
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block ubiblock_notifier = {
+	.notifier_call	= ubiblock_notify,
+};
+
+static int __init ubiblock_init(void)
+{
+	int err;
+
+	if (cache_lebs < 1 || cache_lebs > UBIBLOCK_MAX_CACHE) {
+		err_msg("cache_lebs has to be between 1 and %d",
+			UBIBLOCK_MAX_CACHE);
+		return -EINVAL;
+	}
+
+	ubiblock_major = register_blkdev(0, "ubiblock");
+	if (ubiblock_major < 0)
+		return ubiblock_major;
+
+	ubiblock_wq = alloc_workqueue("ubiblock",
+				      WQ_NON_REENTRANT | WQ_MEM_RECLAIM, 0);
+	if (!ubiblock_wq) {
+		err = -ENOMEM;
+		goto out_unreg;
+	}
+
+	err = ubi_register_volume_notifier(&ubiblock_notifier, 0);
+	if (err)
+		goto out_wq;
+	return 0;
+
+out_wq:
+	destroy_workqueue(ubiblock_wq);
+out_unreg:
+	unregister_blkdev(ubiblock_major, "ubiblock");
+	return err;
+}
+
+static void __exit ubiblock_exit(void)
+{
+	struct ubiblock *dev, *d;
+
+	ubi_unregister_volume_notifier(&ubiblock_notifier);
+	list_for_each_entry_safe(dev, d, &ubiblock_devices, list) {
+		list_del(&dev->list);
+		ubiblock_destroy(dev);
+	}
+	destroy_workqueue(ubiblock_wq);
+	unregister_blkdev(ubiblock_major, "ubiblock");
+}
+
+module_init(ubiblock_init);
+module_exit(ubiblock_exit);
+MODULE_DESCRIPTION("Read-only block devices on top of UBI volumes");
+MODULE_LICENSE("GPL");
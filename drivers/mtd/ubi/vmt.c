@@ -555,6 +555,8 @@ int ubi_resize_volume(struct ubi_volume_desc *desc, int reserved_pebs)
 			new_mapping[i] = vol->eba_tbl[i];
 		kfree(vol->eba_tbl);
 		vol->eba_tbl = new_mapping;
+		/* The fastmap code walks @vol->eba_tbl under @ubi->volumes_lock */
+		vol->reserved_pebs = reserved_pebs;
 		spin_unlock(&ubi->volumes_lock);
 	}
 
@@ -85,6 +85,13 @@
  * Depending on the sub-state, wear-leveling entries of the used physical
  * eraseblocks may be kept in one of those structures.
  *
+ * When fastmap is used, free physical eraseblocks are not handed out from the
+ * @wl->free tree directly, but from a small pool which is refilled each time a
+ * new fastmap is written. And physical eraseblocks the fastmap on the flash
+ * refers to as used are not erased until the next fastmap is written. This way
+ * the fastmap stays valid while the flash is being changed, and only the pool
+ * has to be scanned when attaching. See fastmap.c for details.
+ *
  * Note, in this implementation, we keep a small in-RAM object for each physical
  * eraseblock. This is surely not a scalable solution. But it appears to be good
  * enough for moderately large flashes and it is simple. In future, one may
@@ -108,6 +115,11 @@
 /* Number of physical eraseblocks reserved for wear-leveling purposes */
 #define WL_RESERVED_PEBS 1
 
+/*
+ * Maximum number of erase works an erase thread takes off the queue at once.
+ */
+#define WL_ERASE_BATCH 8
+
 /*
  * Maximum difference between two erase counters. If this threshold is
  * exceeded, the WL sub-system starts moving data from used physical
@@ -143,6 +155,8 @@
  * @vol_id: the volume ID on which this erasure is being performed
  * @lnum: the logical eraseblock number
  * @torture: if the physical eraseblock has to be tortured
+ * @erased: if the physical eraseblock was already erased (see
+ *          erase_in_parallel())
  *
  * The @func pointer points to the worker function. If the @cancel argument is
  * not zero, the worker has to free the resources and exit immediately. The
@@ -157,8 +171,11 @@ struct ubi_work {
 	int vol_id;
 	int lnum;
 	int torture;
+	int erased;
 };
 
+static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
+			int cancel);
 static int self_check_ec(struct ubi_device *ubi, int pnum, int ec);
 static int self_check_in_wl_tree(const struct ubi_device *ubi,
 				 struct ubi_wl_entry *e, struct rb_root *root);
@@ -201,6 +218,52 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 	rb_insert_color(&e->u.rb, root);
 }
 
+/**
+ * next_work - take the next pending work off the work queues.
+ * @ubi: UBI device description object
+ * @erase_only: take only erase works
+ *
+ * Erase works are preferred over the other works, because they produce free
+ * physical eraseblocks which foreground writers may be waiting for, while
+ * wear-leveling and scrubbing works consume them. Returns %NULL if there is
+ * no suitable pending work. Note, @ubi->wl_lock has to be locked.
+ */
+static struct ubi_work *next_work(struct ubi_device *ubi, int erase_only)
+{
+	struct ubi_work *wrk;
+
+	if (!list_empty(&ubi->erase_works)) {
+		wrk = list_entry(ubi->erase_works.next, struct ubi_work, list);
+		ubi->erase_works_count -= 1;
+		ubi_assert(ubi->erase_works_count >= 0);
+	} else if (!erase_only && !list_empty(&ubi->works))
+		wrk = list_entry(ubi->works.next, struct ubi_work, list);
+	else
+		return NULL;
+
+	list_del(&wrk->list);
+	return wrk;
+}
+
+/**
+ * work_done - account a finished work.
+ * @ubi: UBI device description object
+ *
+ * A work stays accounted in @ubi->works_count while it is being executed, so
+ * that 'ubi_wl_get_peb()' does not give up while erasures are in flight. This
+ * function drops the work from the count and wakes up the tasks waiting in
+ * 'produce_free_peb()'.
+ */
+static void work_done(struct ubi_device *ubi)
+{
+	spin_lock(&ubi->wl_lock);
+	ubi->works_count -= 1;
+	ubi->works_done += 1;
+	ubi_assert(ubi->works_count >= 0);
+	spin_unlock(&ubi->wl_lock);
+	wake_up(&ubi->works_wq);
+}
+
 /**
  * do_work - do one pending work.
  * @ubi: UBI device description object
@@ -223,18 +286,13 @@ static int do_work(struct ubi_device *ubi)
 	 */
 	down_read(&ubi->work_sem);
 	spin_lock(&ubi->wl_lock);
-	if (list_empty(&ubi->works)) {
-		spin_unlock(&ubi->wl_lock);
+	wrk = next_work(ubi, 0);
+	spin_unlock(&ubi->wl_lock);
+	if (!wrk) {
 		up_read(&ubi->work_sem);
 		return 0;
 	}
 
-	wrk = list_entry(ubi->works.next, struct ubi_work, list);
-	list_del(&wrk->list);
-	ubi->works_count -= 1;
-	ubi_assert(ubi->works_count >= 0);
-	spin_unlock(&ubi->wl_lock);
-
 	/*
 	 * Call the worker function. Do not touch the work structure
 	 * after this call as it will have been freed or reused by that
@@ -243,6 +301,94 @@ static int do_work(struct ubi_device *ubi)
 	err = wrk->func(ubi, wrk, 0);
 	if (err)
 		ubi_err("work failed with error code %d", err);
+	work_done(ubi);
+	up_read(&ubi->work_sem);
+
+	return err;
+}
+
+/**
+ * erase_in_parallel - erase the PEBs of a batch of erase works at once.
+ * @ubi: UBI device description object
+ * @batch: the erase works
+ * @cnt: count of erase works in @batch
+ *
+ * This function erases the PEBs of the erase works which need neither
+ * torturing nor any other special care in parallel, and marks the works whose
+ * PEB was erased, so that the erase worker does the rest of the job only.
+ * The PEBs which were not erased are left to the erase worker as they are.
+ */
+static void erase_in_parallel(struct ubi_device *ubi, struct ubi_work **batch,
+			      int cnt)
+{
+	int i, n = 0;
+	int pnums[WL_ERASE_BATCH], errs[WL_ERASE_BATCH];
+	struct ubi_work *wrks[WL_ERASE_BATCH];
+
+	if (ubi->nor_flash)
+		return;
+
+	for (i = 0; i < cnt; i++) {
+		struct ubi_wl_entry *e = batch[i]->e;
+		int in_fm;
+
+		if (batch[i]->func != erase_worker || batch[i]->torture)
+			continue;
+
+		spin_lock(&ubi->wl_lock);
+		in_fm = ubi->fm && test_bit(e->pnum, ubi->fm_used);
+		spin_unlock(&ubi->wl_lock);
+		if (in_fm || self_check_ec(ubi, e->pnum, e->ec))
+			continue;
+
+		pnums[n] = e->pnum;
+		wrks[n++] = batch[i];
+	}
+
+	if (n < 2 || ubi_io_erase_batch(ubi, pnums, errs, n))
+		return;
+
+	for (i = 0; i < n; i++)
+		wrks[i]->erased = !errs[i];
+}
+
+/**
+ * do_erase_batch - do a batch of pending erase works.
+ * @ubi: UBI device description object
+ *
+ * This function is used by the erase threads. It takes up to %WL_ERASE_BATCH
+ * erase works off the queue at once, but not more than a fair share of the
+ * pending erasures, so that the other erase threads have something to do as
+ * well. Returns zero in case of success and the first error code in case of
+ * failure.
+ */
+static int do_erase_batch(struct ubi_device *ubi)
+{
+	int i, cnt, err = 0;
+	struct ubi_work *batch[WL_ERASE_BATCH];
+
+	down_read(&ubi->work_sem);
+	spin_lock(&ubi->wl_lock);
+	cnt = DIV_ROUND_UP(ubi->erase_works_count, max(UBI_ERASE_THREADS, 1));
+	cnt = min(cnt, WL_ERASE_BATCH);
+	for (i = 0; i < cnt; i++)
+		batch[i] = next_work(ubi, 1);
+	spin_unlock(&ubi->wl_lock);
+
+	if (cnt > 1 && mtd_has_async_io(ubi->mtd))
+		erase_in_parallel(ubi, batch, cnt);
+
+	for (i = 0; i < cnt; i++) {
+		int ret;
+
+		ret = batch[i]->func(ubi, batch[i], 0);
+		if (ret) {
+			ubi_err("erase work failed with error code %d", ret);
+			if (!err)
+				err = ret;
+		}
+		work_done(ubi);
+	}
 	up_read(&ubi->work_sem);
 
 	return err;
@@ -253,22 +399,33 @@ static int do_work(struct ubi_device *ubi)
  * @ubi: UBI device description object
  *
  * This function tries to make a free PEB by means of synchronous execution of
- * pending works. This may be needed if, for example the background thread is
- * disabled. Returns zero in case of success and a negative error code in case
+ * pending works, erasures first. This may be needed if, for example the
+ * background thread is disabled. If all pending works are already being
+ * executed by the background threads, this function waits for one of them to
+ * finish. Returns zero in case of success and a negative error code in case
  * of failure.
  */
 static int produce_free_peb(struct ubi_device *ubi)
 {
-	int err;
+	int err, done;
 
 	spin_lock(&ubi->wl_lock);
-	while (!ubi->free.rb_node) {
-		spin_unlock(&ubi->wl_lock);
+	while (!ubi->free.rb_node && ubi->works_count) {
+		if (list_empty(&ubi->erase_works) && list_empty(&ubi->works)) {
+			done = ubi->works_done;
+			spin_unlock(&ubi->wl_lock);
 
-		dbg_wl("do one work synchronously");
-		err = do_work(ubi);
-		if (err)
-			return err;
+			dbg_wl("wait for a work in flight");
+			wait_event(ubi->works_wq,
+				   ACCESS_ONCE(ubi->works_done) != done);
+		} else {
+			spin_unlock(&ubi->wl_lock);
+
+			dbg_wl("do one work synchronously");
+			err = do_work(ubi);
+			if (err)
+				return err;
+		}
 
 		spin_lock(&ubi->wl_lock);
 	}
@@ -371,63 +528,193 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int diff)
 }
 
 /**
- * ubi_wl_get_peb - get a physical eraseblock.
+ * wl_get_wle - get a mean wear-leveled free physical eraseblock.
  * @ubi: UBI device description object
  *
- * This function returns a physical eraseblock in case of success and a
- * negative error code in case of failure. Might sleep.
+ * This function removes a free physical eraseblock with a medium erase
+ * counter from the @ubi->free tree and returns it. The @ubi->wl_lock has to
+ * be locked and @ubi->free must not be empty.
  */
-int ubi_wl_get_peb(struct ubi_device *ubi)
+static struct ubi_wl_entry *wl_get_wle(struct ubi_device *ubi)
 {
-	int err;
 	struct ubi_wl_entry *e, *first, *last;
 
+	first = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry, u.rb);
+	last = rb_entry(rb_last(&ubi->free), struct ubi_wl_entry, u.rb);
+
+	if (last->ec - first->ec < WL_FREE_MAX_DIFF)
+		e = rb_entry(ubi->free.rb_node, struct ubi_wl_entry, u.rb);
+	else
+		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF/2);
+
+	self_check_in_wl_tree(ubi, e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
+	return e;
+}
+
+/**
+ * get_peb_from_free - get a physical eraseblock from the free tree.
+ * @ubi: UBI device description object
+ *
+ * This function returns a wear-leveling entry in case of success and an error
+ * pointer in case of failure. In case of success @ubi->fm_eba_sem is held in
+ * read mode.
+ */
+static struct ubi_wl_entry *get_peb_from_free(struct ubi_device *ubi)
+{
+	int err;
+	struct ubi_wl_entry *e;
+
 retry:
+	down_read(&ubi->fm_eba_sem);
 	spin_lock(&ubi->wl_lock);
 	if (!ubi->free.rb_node) {
 		if (ubi->works_count == 0) {
 			ubi_assert(list_empty(&ubi->works));
 			ubi_err("no free eraseblocks");
 			spin_unlock(&ubi->wl_lock);
-			return -ENOSPC;
+			up_read(&ubi->fm_eba_sem);
+			return ERR_PTR(-ENOSPC);
 		}
 		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->fm_eba_sem);
 
 		err = produce_free_peb(ubi);
 		if (err < 0)
-			return err;
+			return ERR_PTR(err);
 		goto retry;
 	}
 
-	first = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry, u.rb);
-	last = rb_entry(rb_last(&ubi->free), struct ubi_wl_entry, u.rb);
-
-	if (last->ec - first->ec < WL_FREE_MAX_DIFF)
-		e = rb_entry(ubi->free.rb_node, struct ubi_wl_entry, u.rb);
-	else
-		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF/2);
-
-	self_check_in_wl_tree(ubi, e, &ubi->free);
+	e = wl_get_wle(ubi);
 
 	/*
 	 * Move the physical eraseblock to the protection queue where it will
 	 * be protected from being moved for some time.
 	 */
-	rb_erase(&e->u.rb, &ubi->free);
-	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
 	prot_queue_add(ubi, e);
 	spin_unlock(&ubi->wl_lock);
+	return e;
+}
+
+/**
+ * get_peb_from_pool - get a physical eraseblock from the fastmap pool.
+ * @ubi: UBI device description object
+ *
+ * While a fastmap is in use, free physical eraseblocks are handed out only
+ * from the pool, because the pool is the only place where the fastmap expects
+ * PEBs it does not describe. When the pool is exhausted, it is refilled and a
+ * new fastmap is written. Returns the same as 'get_peb_from_free()'.
+ */
+static struct ubi_wl_entry *get_peb_from_pool(struct ubi_device *ubi)
+{
+	int err, retry;
+	struct ubi_wl_entry *e;
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+
+	while (1) {
+		down_read(&ubi->fm_eba_sem);
+		spin_lock(&ubi->wl_lock);
+		if (pool->used < pool->size) {
+			e = ubi->lookuptbl[pool->pebs[pool->used++]];
+			dbg_wl("PEB %d EC %d", e->pnum, e->ec);
+			prot_queue_add(ubi, e);
+			spin_unlock(&ubi->wl_lock);
+			return e;
+		}
+		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->fm_eba_sem);
+
+		err = produce_free_peb(ubi);
+		if (err < 0)
+			return ERR_PTR(err);
+
+		err = ubi_update_fastmap(ubi);
+		if (err == -EROFS)
+			return ERR_PTR(err);
+
+		/*
+		 * If writing the fastmap failed, it was invalidated and all the
+		 * deferred erasures were released, so there is more work to
+		 * do. Otherwise the pool has been refilled.
+		 */
+		spin_lock(&ubi->wl_lock);
+		retry = pool->used < pool->size || ubi->works_count;
+		spin_unlock(&ubi->wl_lock);
+		if (!retry) {
+			ubi_err("no free eraseblocks");
+			return ERR_PTR(err ? err : -ENOSPC);
+		}
+	}
+}
+
+/**
+ * ubi_wl_get_peb - get a physical eraseblock.
+ * @ubi: UBI device description object
+ *
+ * This function returns a physical eraseblock in case of success and a
+ * negative error code in case of failure. Might sleep.
+ *
+ * In case of success, @ubi->fm_eba_sem is held in read mode and the caller has
+ * to release it once the PEB is stored in the EBA table or put back. This
+ * makes sure a fastmap is never written while a PEB is in flight.
+ */
+int ubi_wl_get_peb(struct ubi_device *ubi)
+{
+	int err;
+	struct ubi_wl_entry *e;
+
+	if (ubi->fm_disabled)
+		e = get_peb_from_free(ubi);
+	else
+		e = get_peb_from_pool(ubi);
+	if (IS_ERR(e))
+		return PTR_ERR(e);
 
 	err = ubi_self_check_all_ff(ubi, e->pnum, ubi->vid_hdr_aloffset,
 				    ubi->peb_size - ubi->vid_hdr_aloffset);
 	if (err) {
 		ubi_err("new PEB %d does not contain all 0xFF bytes", e->pnum);
+		up_read(&ubi->fm_eba_sem);
 		return err;
 	}
 
 	return e->pnum;
 }
 
+/**
+ * ubi_wl_get_fm_peb - get a free physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @anchor: non-zero if the PEB will hold the fastmap anchor
+ *
+ * This function removes a free PEB from the @ubi->free tree and returns it,
+ * or %NULL if there is no suitable one. The anchor has to be found quickly
+ * when attaching, so it has to be among the first %UBI_FM_MAX_START PEBs. The
+ * @ubi->wl_lock has to be locked.
+ */
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor)
+{
+	struct rb_node *p;
+	struct ubi_wl_entry *e;
+
+	if (!ubi->free.rb_node)
+		return NULL;
+
+	if (!anchor)
+		return wl_get_wle(ubi);
+
+	for (p = rb_first(&ubi->free); p; p = rb_next(p)) {
+		e = rb_entry(p, struct ubi_wl_entry, u.rb);
+		if (e->pnum < UBI_FM_MAX_START) {
+			rb_erase(&e->u.rb, &ubi->free);
+			dbg_wl("anchor PEB %d EC %d", e->pnum, e->ec);
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
 /**
  * prot_queue_del - remove a physical eraseblock from the protection queue.
  * @ubi: UBI device description object
@@ -457,12 +744,14 @@ static int prot_queue_del(struct ubi_device *ubi, int pnum)
  * @ubi: UBI device description object
  * @e: the the physical eraseblock to erase
  * @torture: if the physical eraseblock has to be tortured
+ * @erased: if the physical eraseblock was erased already, only the EC header
+ *          is written then
  *
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  */
 static int sync_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
-		      int torture)
+		      int torture, int erased)
 {
 	int err;
 	struct ubi_ec_hdr *ec_hdr;
@@ -470,7 +759,8 @@ static int sync_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 
 	dbg_wl("erase PEB %d, old EC %llu", e->pnum, ec);
 
-	err = self_check_ec(ubi, e->pnum, e->ec);
+	/* The EC header is gone already if the PEB was erased */
+	err = erased ? 0 : self_check_ec(ubi, e->pnum, e->ec);
 	if (err)
 		return -EINVAL;
 
@@ -478,7 +768,10 @@ static int sync_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	if (!ec_hdr)
 		return -ENOMEM;
 
-	err = ubi_io_sync_erase(ubi, e->pnum, torture);
+	if (erased)
+		err = 1;
+	else
+		err = ubi_io_sync_erase(ubi, e->pnum, torture);
 	if (err < 0)
 		goto out_free;
 
@@ -563,22 +856,27 @@ repeat:
  * @wrk: the work to schedule
  *
  * This function adds a work defined by @wrk to the tail of the pending works
- * list.
+ * list. Erase works go to a separate list which is also served by the erase
+ * threads.
  */
 static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 {
 	spin_lock(&ubi->wl_lock);
-	list_add_tail(&wrk->list, &ubi->works);
+	if (wrk->func == &erase_worker) {
+		list_add_tail(&wrk->list, &ubi->erase_works);
+		ubi->erase_works_count += 1;
+	} else
+		list_add_tail(&wrk->list, &ubi->works);
 	ubi_assert(ubi->works_count >= 0);
 	ubi->works_count += 1;
-	if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi))
+	if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi)) {
 		wake_up_process(ubi->bgt_thread);
+		if (wrk->func == &erase_worker)
+			wake_up(&ubi->erase_wq);
+	}
 	spin_unlock(&ubi->wl_lock);
 }
 
-static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
-			int cancel);
-
 /**
  * schedule_erase - schedule an erase work.
  * @ubi: UBI device description object
@@ -607,11 +905,70 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	wl_wrk->vol_id = vol_id;
 	wl_wrk->lnum = lnum;
 	wl_wrk->torture = torture;
+	wl_wrk->erased = 0;
 
 	schedule_ubi_work(ubi, wl_wrk);
 	return 0;
 }
 
+/**
+ * find_wl_target - find a free physical eraseblock to move data to.
+ * @ubi: UBI device description object
+ *
+ * Data is moved to a highly worn-out free physical eraseblock. While fastmap
+ * is used, the target has to come from the pool like any other new PEB, see
+ * 'get_peb_from_pool()'. Returns %NULL if there is no free physical
+ * eraseblock. The @ubi->wl_lock has to be locked.
+ */
+static struct ubi_wl_entry *find_wl_target(struct ubi_device *ubi)
+{
+	int i;
+	struct ubi_wl_entry *e, *max = NULL;
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+
+	if (ubi->fm_disabled) {
+		if (!ubi->free.rb_node)
+			return NULL;
+		return find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+	}
+
+	for (i = pool->used; i < pool->size; i++) {
+		e = ubi->lookuptbl[pool->pebs[i]];
+		if (!max || e->ec > max->ec)
+			max = e;
+	}
+
+	return max;
+}
+
+/**
+ * take_wl_target - take the physical eraseblock found by 'find_wl_target()'.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock to take
+ *
+ * The @ubi->wl_lock has to be locked.
+ */
+static void take_wl_target(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	int i;
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+
+	if (ubi->fm_disabled) {
+		self_check_in_wl_tree(ubi, e, &ubi->free);
+		rb_erase(&e->u.rb, &ubi->free);
+		return;
+	}
+
+	for (i = pool->used; i < pool->size; i++)
+		if (pool->pebs[i] == e->pnum) {
+			pool->pebs[i] = pool->pebs[pool->used];
+			pool->pebs[pool->used++] = e->pnum;
+			return;
+		}
+
+	ubi_assert(0);
+}
+
 /**
  * wear_leveling_worker - wear-leveling worker function.
  * @ubi: UBI device description object
@@ -643,8 +1000,8 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	ubi_assert(!ubi->move_from && !ubi->move_to);
 	ubi_assert(!ubi->move_to_put);
 
-	if (!ubi->free.rb_node ||
-	    (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
+	e2 = find_wl_target(ubi);
+	if (!e2 || (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
 		/*
 		 * No free physical eraseblocks? Well, they must be waiting in
 		 * the queue to be erased. Cancel movement - it will be
@@ -656,7 +1013,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * triggered again.
 		 */
 		dbg_wl("cancel WL, a list is empty: free %d, used %d",
-		       !ubi->free.rb_node, !ubi->used.rb_node);
+		       !e2, !ubi->used.rb_node);
 		goto out_cancel;
 	}
 
@@ -667,7 +1024,6 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -682,14 +1038,12 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 		self_check_in_wl_tree(ubi, e1, &ubi->scrub);
 		rb_erase(&e1->u.rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	self_check_in_wl_tree(ubi, e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	take_wl_target(ubi, e2);
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -923,7 +1277,8 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	 * the WL worker has to be scheduled anyway.
 	 */
 	if (!ubi->scrub.rb_node) {
-		if (!ubi->used.rb_node || !ubi->free.rb_node)
+		e2 = find_wl_target(ubi);
+		if (!ubi->used.rb_node || !e2)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
 
@@ -934,7 +1289,6 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		 * %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -989,10 +1343,23 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 		return 0;
 	}
 
+	spin_lock(&ubi->wl_lock);
+	if (!wl_wrk->erased && ubi->fm && test_bit(pnum, ubi->fm_used)) {
+		/*
+		 * The fastmap on the flash still refers to this PEB, so its
+		 * contents has to survive until the next fastmap is written.
+		 */
+		dbg_wl("defer erasure of PEB %d", pnum);
+		list_add_tail(&wl_wrk->list, &ubi->fm_deferred);
+		spin_unlock(&ubi->wl_lock);
+		return 0;
+	}
+	spin_unlock(&ubi->wl_lock);
+
 	dbg_wl("erase PEB %d EC %d LEB %d:%d",
 	       pnum, e->ec, wl_wrk->vol_id, wl_wrk->lnum);
 
-	err = sync_erase(ubi, e, wl_wrk->torture);
+	err = sync_erase(ubi, e, wl_wrk->torture, wl_wrk->erased);
 	if (!err) {
 		/* Fine, we've erased it successfully */
 		kfree(wl_wrk);
@@ -1028,6 +1395,9 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 		return err;
 	}
 
+	spin_lock(&ubi->wl_lock);
+	ubi->lookuptbl[pnum] = NULL;
+	spin_unlock(&ubi->wl_lock);
 	kmem_cache_free(ubi_wl_entry_slab, e);
 	if (err != -EIO)
 		/*
@@ -1175,6 +1545,68 @@ retry:
 	return err;
 }
 
+/**
+ * ubi_wl_put_fm_peb - return a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock to return
+ * @lnum: the logical eraseblock number of the fastmap block
+ * @sync: erase the physical eraseblock synchronously
+ *
+ * This function returns a physical eraseblock which was taken by
+ * 'ubi_wl_get_fm_peb()'. Normally it is just scheduled for erasure, but an
+ * old fastmap anchor may have to be erased right away to make sure the
+ * fastmap is not used on the next attach. Returns zero in case of success and
+ * a negative error code in case of failure.
+ */
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int lnum, int sync)
+{
+	int err;
+
+	dbg_wl("fastmap PEB %d", e->pnum);
+	if (!sync)
+		return schedule_erase(ubi, e, lnum ? UBI_FM_DATA_VOLUME_ID :
+				      UBI_FM_SB_VOLUME_ID, lnum, 0);
+
+	err = sync_erase(ubi, e, 0, 0);
+	if (err) {
+		/* Let the erase worker deal with it, but report the failure */
+		if (schedule_erase(ubi, e, UBI_FM_SB_VOLUME_ID, lnum, 1))
+			kmem_cache_free(ubi_wl_entry_slab, e);
+		return err;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	wl_tree_add(e, &ubi->free);
+	spin_unlock(&ubi->wl_lock);
+	return 0;
+}
+
+/**
+ * ubi_wl_release_deferred - re-schedule deferred erasures.
+ * @ubi: UBI device description object
+ *
+ * This function is called when a new fastmap was written or the fastmap was
+ * invalidated. It schedules the deferred erasures of all PEBs the current
+ * fastmap does not refer to any longer.
+ */
+void ubi_wl_release_deferred(struct ubi_device *ubi)
+{
+	struct ubi_work *wrk, *tmp;
+	LIST_HEAD(release);
+
+	spin_lock(&ubi->wl_lock);
+	list_for_each_entry_safe(wrk, tmp, &ubi->fm_deferred, list)
+		if (!ubi->fm || !test_bit(wrk->e->pnum, ubi->fm_used))
+			list_move_tail(&wrk->list, &release);
+	spin_unlock(&ubi->wl_lock);
+
+	list_for_each_entry_safe(wrk, tmp, &release, list) {
+		list_del(&wrk->list);
+		schedule_ubi_work(ubi, wrk);
+	}
+}
+
 /**
  * ubi_wl_scrub_peb - schedule a physical eraseblock for scrubbing.
  * @ubi: UBI device description object
@@ -1238,6 +1670,30 @@ retry:
 	return ensure_wear_leveling(ubi);
 }
 
+/**
+ * find_work - find a pending work for a LEB.
+ * @ubi: UBI device description object
+ * @list: the work list to look at
+ * @vol_id: the volume id to look for
+ * @lnum: the logical eraseblock number to look for
+ *
+ * This function returns the first work on @list which matches @vol_id and
+ * @lnum, where %UBI_ALL matches anything, or %NULL if there is no such work.
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static struct ubi_work *find_work(struct ubi_device *ubi,
+				  struct list_head *list, int vol_id, int lnum)
+{
+	struct ubi_work *wrk;
+
+	list_for_each_entry(wrk, list, list)
+		if ((vol_id == UBI_ALL || wrk->vol_id == vol_id) &&
+		    (lnum == UBI_ALL || wrk->lnum == lnum))
+			return wrk;
+
+	return NULL;
+}
+
 /**
  * ubi_wl_flush - flush all pending works.
  * @ubi: UBI device description object
@@ -1255,6 +1711,24 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 	int err = 0;
 	int found = 1;
 
+	/*
+	 * Erasures deferred because of the fastmap are re-scheduled only when
+	 * a new fastmap is written, so write one if any of them matches.
+	 */
+	spin_lock(&ubi->wl_lock);
+	found = !!find_work(ubi, &ubi->fm_deferred, vol_id, lnum);
+	spin_unlock(&ubi->wl_lock);
+	if (found) {
+		err = ubi_update_fastmap(ubi);
+		spin_lock(&ubi->wl_lock);
+		found = !!find_work(ubi, &ubi->fm_deferred, vol_id, lnum);
+		spin_unlock(&ubi->wl_lock);
+		if (found)
+			return err ? err : -EBUSY;
+		err = 0;
+		found = 1;
+	}
+
 	/*
 	 * Erase while the pending works queue is not empty, but not more than
 	 * the number of currently pending works.
@@ -1268,26 +1742,24 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 
 		down_read(&ubi->work_sem);
 		spin_lock(&ubi->wl_lock);
-		list_for_each_entry(wrk, &ubi->works, list) {
-			if ((vol_id == UBI_ALL || wrk->vol_id == vol_id) &&
-			    (lnum == UBI_ALL || wrk->lnum == lnum)) {
-				list_del(&wrk->list);
-				ubi->works_count -= 1;
-				ubi_assert(ubi->works_count >= 0);
-				spin_unlock(&ubi->wl_lock);
-
-				err = wrk->func(ubi, wrk, 0);
-				if (err) {
-					up_read(&ubi->work_sem);
-					return err;
-				}
+		wrk = find_work(ubi, &ubi->erase_works, vol_id, lnum);
+		if (wrk)
+			ubi->erase_works_count -= 1;
+		else
+			wrk = find_work(ubi, &ubi->works, vol_id, lnum);
+		if (wrk)
+			list_del(&wrk->list);
+		spin_unlock(&ubi->wl_lock);
 
-				spin_lock(&ubi->wl_lock);
-				found = 1;
-				break;
+		if (wrk) {
+			err = wrk->func(ubi, wrk, 0);
+			work_done(ubi);
+			if (err) {
+				up_read(&ubi->work_sem);
+				return err;
 			}
+			found = 1;
 		}
-		spin_unlock(&ubi->wl_lock);
 		up_read(&ubi->work_sem);
 	}
 
@@ -1355,8 +1827,9 @@ int ubi_thread(void *u)
 			continue;
 
 		spin_lock(&ubi->wl_lock);
-		if (list_empty(&ubi->works) || ubi->ro_mode ||
-		    !ubi->thread_enabled || ubi_dbg_is_bgt_disabled(ubi)) {
+		if ((list_empty(&ubi->works) && list_empty(&ubi->erase_works)) ||
+		    ubi->ro_mode || !ubi->thread_enabled ||
+		    ubi_dbg_is_bgt_disabled(ubi)) {
 			set_current_state(TASK_INTERRUPTIBLE);
 			spin_unlock(&ubi->wl_lock);
 			schedule();
@@ -1389,21 +1862,78 @@ int ubi_thread(void *u)
 	return 0;
 }
 
+/**
+ * erase_thread_has_work - check if an erase thread has something to do.
+ * @ubi: UBI device description object
+ */
+static int erase_thread_has_work(struct ubi_device *ubi)
+{
+	return !list_empty(&ubi->erase_works) && !ubi->ro_mode &&
+	       ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi);
+}
+
+/**
+ * ubi_erase_thread - UBI background erase thread.
+ * @u: the UBI device description object pointer
+ *
+ * Besides the main background thread, each UBI device has
+ * %UBI_ERASE_THREADS threads which only execute erase works. This keeps
+ * several erasures in flight, so the free PEB pool is refilled quickly after
+ * bursts of 'ubi_wl_put_peb()' calls, and erasures are not delayed by
+ * wear-leveling and scrubbing works.
+ */
+int ubi_erase_thread(void *u)
+{
+	int failures = 0;
+	struct ubi_device *ubi = u;
+
+	set_freezable();
+	for (;;) {
+		wait_event_freezable(ubi->erase_wq, kthread_should_stop() ||
+				     erase_thread_has_work(ubi));
+		if (kthread_should_stop())
+			break;
+
+		if (do_erase_batch(ubi)) {
+			if (failures++ > WL_MAX_FAILURES) {
+				/*
+				 * Too many failures, disable the background
+				 * threads and switch to read-only mode.
+				 */
+				ubi_msg("%s: %d consecutive erase failures",
+					ubi->bgt_name, WL_MAX_FAILURES);
+				ubi_ro_mode(ubi);
+				ubi->thread_enabled = 0;
+				continue;
+			}
+		} else
+			failures = 0;
+
+		cond_resched();
+	}
+
+	return 0;
+}
+
 /**
  * cancel_pending - cancel all pending works.
  * @ubi: UBI device description object
  */
 static void cancel_pending(struct ubi_device *ubi)
 {
-	while (!list_empty(&ubi->works)) {
-		struct ubi_work *wrk;
+	struct ubi_work *wrk, *tmp;
 
-		wrk = list_entry(ubi->works.next, struct ubi_work, list);
-		list_del(&wrk->list);
+	while ((wrk = next_work(ubi, 0))) {
 		wrk->func(ubi, wrk, 1);
 		ubi->works_count -= 1;
 		ubi_assert(ubi->works_count >= 0);
 	}
+
+	/* Deferred erasures are not accounted in @ubi->works_count */
+	list_for_each_entry_safe(wrk, tmp, &ubi->fm_deferred, list) {
+		list_del(&wrk->list);
+		wrk->func(ubi, wrk, 1);
+	}
 }
 
 /**
@@ -1428,6 +1958,11 @@ int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = ai->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
+	INIT_LIST_HEAD(&ubi->erase_works);
+	init_waitqueue_head(&ubi->erase_wq);
+	init_waitqueue_head(&ubi->works_wq);
+	init_rwsem(&ubi->fm_eba_sem);
+	INIT_LIST_HEAD(&ubi->fm_deferred);
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
 
@@ -1450,6 +1985,18 @@ int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai)
 		e->pnum = aeb->pnum;
 		e->ec = aeb->ec;
 		ubi->lookuptbl[e->pnum] = e;
+
+		if (!ubi->ro_mode && aeb->vol_id == UBI_FM_SB_VOLUME_ID &&
+		    !sync_erase(ubi, e, 0, 0)) {
+			/*
+			 * An old fastmap anchor must be gone before anything is
+			 * changed on the flash, otherwise the outdated fastmap
+			 * could be used when attaching next time.
+			 */
+			wl_tree_add(e, &ubi->free);
+			continue;
+		}
+
 		if (schedule_erase(ubi, e, aeb->vol_id, aeb->lnum, 0)) {
 			kmem_cache_free(ubi_wl_entry_slab, e);
 			goto out_free;
@@ -1504,6 +2051,18 @@ int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	ubi->avail_pebs -= WL_RESERVED_PEBS;
 	ubi->rsvd_pebs += WL_RESERVED_PEBS;
 
+	if (!ubi->fm_disabled) {
+		/* The old and the new fastmap may exist at the same time */
+		if (ubi->avail_pebs < 2 * ubi->fm_blocks) {
+			ubi_warn("no PEBs for fastmap (%d, need %d), disable it",
+				 ubi->avail_pebs, 2 * ubi->fm_blocks);
+			ubi->fm_disabled = 1;
+		} else {
+			ubi->avail_pebs -= 2 * ubi->fm_blocks;
+			ubi->rsvd_pebs += 2 * ubi->fm_blocks;
+		}
+	}
+
 	/* Schedule wear-leveling if needed */
 	err = ensure_wear_leveling(ubi);
 	if (err)
@@ -1543,8 +2102,20 @@ static void protection_queue_destroy(struct ubi_device *ubi)
  */
 void ubi_wl_close(struct ubi_device *ubi)
 {
+	int i;
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+
 	dbg_wl("close the WL sub-system");
 	cancel_pending(ubi);
+	for (i = pool->used; i < pool->size; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->lookuptbl[pool->pebs[i]]);
+	pool->used = pool->size = 0;
+	if (ubi->fm) {
+		for (i = 0; i < ubi->fm->used_blocks; i++)
+			kmem_cache_free(ubi_wl_entry_slab, ubi->fm->e[i]);
+		kfree(ubi->fm);
+		ubi->fm = NULL;
+	}
 	protection_queue_destroy(ubi);
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->erroneous);
@@ -13,6 +13,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/netdevice.h>
@@ -24,6 +25,7 @@
 #include <linux/platform_device.h>
 #include <linux/clk.h>
 #include <linux/gfp.h>
+#include <linux/log2.h>
 #include <linux/phy.h>
 #include <linux/io.h>
 #include <linux/of.h>
@@ -35,47 +37,68 @@
 
 /* 1518 rounded up */
 #define MAX_RBUFF_SZ	0x600
-/* max number of receive buffers */
-#define MAX_RX_DESCR	9
+/* number of receive buffers, must be a power of 2 */
+#define DEFAULT_RX_RING_SIZE	64
+#define MIN_RX_RING_SIZE	16
+#define MAX_RX_RING_SIZE	512
+/* bytes copied into the linear part of an skb for a large frame */
+#define AT91ETHER_RX_HDR_LEN	128
+
+/* Interrupts which are masked while the poll routine is scheduled */
+#define AT91ETHER_RX_INT_FLAGS	(MACB_BIT(RCOMP) | MACB_BIT(RXUBR)	\
+				 | MACB_BIT(ISR_ROVR))
+
+/*
+ * Received frames up to this size are copied into a new skb, so that their
+ * buffer can stay in the ring. Of larger frames, only the headers are
+ * copied and the rest of the buffer is attached to the skb as a page
+ * fragment, like on the MACB.
+ */
+static unsigned int rx_copybreak = 256;
+module_param(rx_copybreak, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rx_copybreak, "Maximum size of received frames to copy");
+
+static void at91ether_free_rx(struct macb *lp)
+{
+	macb_free_rx_buffers(lp);
+
+	if (lp->rx_ring) {
+		dma_free_coherent(&lp->pdev->dev,
+				lp->rx_ring_size * sizeof(struct macb_dma_desc),
+				lp->rx_ring, lp->rx_ring_dma);
+		lp->rx_ring = NULL;
+	}
+}
 
 /* Initialize and start the Receiver and Transmit subsystems */
 static int at91ether_start(struct net_device *dev)
 {
 	struct macb *lp = netdev_priv(dev);
-	dma_addr_t addr;
 	u32 ctl;
 	int i;
 
 	lp->rx_ring = dma_alloc_coherent(&lp->pdev->dev,
-					MAX_RX_DESCR * sizeof(struct macb_dma_desc),
-					&lp->rx_ring_dma, GFP_KERNEL);
+				lp->rx_ring_size * sizeof(struct macb_dma_desc),
+				&lp->rx_ring_dma, GFP_KERNEL);
 	if (!lp->rx_ring) {
 		netdev_err(dev, "unable to alloc rx ring DMA buffer\n");
 		return -ENOMEM;
 	}
 
-	lp->rx_buffers = dma_alloc_coherent(&lp->pdev->dev,
-					MAX_RX_DESCR * MAX_RBUFF_SZ,
-					&lp->rx_buffers_dma, GFP_KERNEL);
-	if (!lp->rx_buffers) {
+	lp->rx_buffer_size = MAX_RBUFF_SZ;
+	if (macb_alloc_rx_buffers(lp)) {
 		netdev_err(dev, "unable to alloc rx data DMA buffer\n");
-
-		dma_free_coherent(&lp->pdev->dev,
-					MAX_RX_DESCR * sizeof(struct macb_dma_desc),
-					lp->rx_ring, lp->rx_ring_dma);
-		lp->rx_ring = NULL;
+		at91ether_free_rx(lp);
 		return -ENOMEM;
 	}
 
-	addr = lp->rx_buffers_dma;
-	for (i = 0; i < MAX_RX_DESCR; i++) {
-		lp->rx_ring[i].addr = addr;
+	for (i = 0; i < lp->rx_ring_size; i++) {
+		lp->rx_ring[i].addr = lp->rx_page[i].mapping;
 		lp->rx_ring[i].ctrl = 0;
-		addr += MAX_RBUFF_SZ;
 	}
 
 	/* Set the Wrap bit on the last descriptor */
-	lp->rx_ring[MAX_RX_DESCR - 1].addr |= MACB_BIT(RX_WRAP);
+	lp->rx_ring[lp->rx_ring_size - 1].addr |= MACB_BIT(RX_WRAP);
 
 	/* Reset buffer index */
 	lp->rx_tail = 0;
@@ -107,6 +130,8 @@ static int at91ether_open(struct net_device *dev)
 	if (ret)
 		return ret;
 
+	napi_enable(&lp->napi);
+
 	/* Enable MAC interrupts */
 	macb_writel(lp, IER, MACB_BIT(RCOMP)	|
 			     MACB_BIT(RXUBR)	|
@@ -144,16 +169,9 @@ static int at91ether_close(struct net_device *dev)
 			     MACB_BIT(HRESP));
 
 	netif_stop_queue(dev);
+	napi_disable(&lp->napi);
 
-	dma_free_coherent(&lp->pdev->dev,
-				MAX_RX_DESCR * sizeof(struct macb_dma_desc),
-				lp->rx_ring, lp->rx_ring_dma);
-	lp->rx_ring = NULL;
-
-	dma_free_coherent(&lp->pdev->dev,
-				MAX_RX_DESCR * MAX_RBUFF_SZ,
-				lp->rx_buffers, lp->rx_buffers_dma);
-	lp->rx_buffers = NULL;
+	at91ether_free_rx(lp);
 
 	return 0;
 }
@@ -185,45 +203,97 @@ static int at91ether_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	return NETDEV_TX_OK;
 }
 
-/* Extract received frame from buffer descriptors and sent to upper layers.
- * (Called from interrupt context)
- */
-static void at91ether_rx(struct net_device *dev)
+/* Pass a received frame to the stack and give the buffer back */
+static void at91ether_rx_frame(struct macb *lp, unsigned int entry,
+			       unsigned int len)
 {
-	struct macb *lp = netdev_priv(dev);
-	unsigned char *p_recv;
+	struct macb_dma_desc *desc = macb_rx_desc(lp, entry);
+	unsigned int hdr_len = len;
 	struct sk_buff *skb;
-	unsigned int pktlen;
-
-	while (lp->rx_ring[lp->rx_tail].addr & MACB_BIT(RX_USED)) {
-		p_recv = lp->rx_buffers + lp->rx_tail * MAX_RBUFF_SZ;
-		pktlen = MACB_BF(RX_FRMLEN, lp->rx_ring[lp->rx_tail].ctrl);
-		skb = netdev_alloc_skb(dev, pktlen + 2);
-		if (skb) {
-			skb_reserve(skb, 2);
-			memcpy(skb_put(skb, pktlen), p_recv, pktlen);
-
-			skb->protocol = eth_type_trans(skb, dev);
-			lp->stats.rx_packets++;
-			lp->stats.rx_bytes += pktlen;
-			netif_rx(skb);
-		} else {
-			lp->stats.rx_dropped++;
-			netdev_notice(dev, "Memory squeeze, dropping packet.\n");
+
+	if (len > rx_copybreak)
+		hdr_len = min_t(unsigned int, len, AT91ETHER_RX_HDR_LEN);
+
+	skb = netdev_alloc_skb_ip_align(lp->dev, hdr_len);
+	if (!skb)
+		goto drop;
+
+	macb_rx_copy(lp, skb, entry, hdr_len);
+	if (hdr_len < len) {
+		/* On success, the descriptor now has a fresh buffer */
+		if (macb_rx_attach(lp, skb, entry, hdr_len, len - hdr_len)) {
+			dev_kfree_skb_any(skb);
+			goto drop;
 		}
+	} else {
+		desc->addr &= ~MACB_BIT(RX_USED);
+	}
+
+	skb_checksum_none_assert(skb);
+	skb->protocol = eth_type_trans(skb, lp->dev);
+	lp->stats.rx_packets++;
+	lp->stats.rx_bytes += len;
+	netif_receive_skb(skb);
+	return;
+
+drop:
+	lp->stats.rx_dropped++;
+	desc->addr &= ~MACB_BIT(RX_USED);
+}
+
+/* Extract received frames from buffer descriptors and send them to upper
+ * layers, returns the number of frames processed.
+ * (Called from the NAPI poll routine)
+ */
+static int at91ether_rx(struct net_device *dev, int budget)
+{
+	struct macb *lp = netdev_priv(dev);
+	struct macb_dma_desc *desc;
+	int received = 0;
+	u32 ctrl;
+
+	while (received < budget) {
+		desc = macb_rx_desc(lp, lp->rx_tail);
+
+		/* Make hw descriptor updates visible to CPU */
+		rmb();
 
-		if (lp->rx_ring[lp->rx_tail].ctrl & MACB_BIT(RX_MHASH_MATCH))
+		if (!(desc->addr & MACB_BIT(RX_USED)))
+			break;
+
+		ctrl = desc->ctrl;
+		if (ctrl & MACB_BIT(RX_MHASH_MATCH))
 			lp->stats.multicast++;
 
-		/* reset ownership bit */
-		lp->rx_ring[lp->rx_tail].addr &= ~MACB_BIT(RX_USED);
+		at91ether_rx_frame(lp, lp->rx_tail,
+				   MACB_BFEXT(RX_FRMLEN, ctrl));
+		lp->rx_tail++;
+		received++;
+	}
+
+	/* Make descriptor updates visible to hardware */
+	wmb();
 
-		/* wrap after last buffer */
-		if (lp->rx_tail == MAX_RX_DESCR - 1)
-			lp->rx_tail = 0;
-		else
-			lp->rx_tail++;
+	return received;
+}
+
+static int at91ether_poll(struct napi_struct *napi, int budget)
+{
+	struct macb *lp = container_of(napi, struct macb, napi);
+	int work_done;
+
+	work_done = at91ether_rx(lp->dev, budget);
+	if (work_done < budget) {
+		napi_complete(napi);
+		macb_writel(lp, IER, AT91ETHER_RX_INT_FLAGS);
+
+		/* Frames received while interrupts were disabled */
+		rmb();
+		if (macb_rx_desc(lp, lp->rx_tail)->addr & MACB_BIT(RX_USED))
+			napi_reschedule(napi);
 	}
+
+	return work_done;
 }
 
 /* MAC interrupt handler */
@@ -238,9 +308,15 @@ static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 	 */
 	intstatus = macb_readl(lp, ISR);
 
-	/* Receive complete */
-	if (intstatus & MACB_BIT(RCOMP))
-		at91ether_rx(dev);
+	/*
+	 * Leave the frames to the poll routine. Until it has drained the ring,
+	 * each frame received or dropped would raise another interrupt, so
+	 * these stay masked.
+	 */
+	if (intstatus & AT91ETHER_RX_INT_FLAGS) {
+		macb_writel(lp, IDR, AT91ETHER_RX_INT_FLAGS);
+		napi_schedule(&lp->napi);
+	}
 
 	/* Transmit complete */
 	if (intstatus & MACB_BIT(TCOMP)) {
@@ -265,8 +341,7 @@ static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 		macb_writel(lp, NCR, ctl | MACB_BIT(RE));
 	}
 
-	if (intstatus & MACB_BIT(ISR_ROVR))
-		netdev_err(dev, "ROVR error\n");
+	/* ROVR is counted by the hardware, see macb_get_stats() */
 
 	return IRQ_HANDLED;
 }
@@ -282,6 +357,50 @@ static void at91ether_poll_controller(struct net_device *dev)
 }
 #endif
 
+static void at91ether_get_ringparam(struct net_device *dev,
+				    struct ethtool_ringparam *ring)
+{
+	struct macb *lp = netdev_priv(dev);
+
+	ring->rx_max_pending = MAX_RX_RING_SIZE;
+	ring->rx_pending = lp->rx_ring_size;
+	/* There is a single transmit buffer */
+	ring->tx_max_pending = 1;
+	ring->tx_pending = 1;
+}
+
+static int at91ether_set_ringparam(struct net_device *dev,
+				   struct ethtool_ringparam *ring)
+{
+	struct macb *lp = netdev_priv(dev);
+	u32 size;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending ||
+	    ring->tx_pending != 1)
+		return -EINVAL;
+
+	/* The ring is set up in open() */
+	if (netif_running(dev))
+		return -EBUSY;
+
+	size = clamp_t(u32, ring->rx_pending,
+		       MIN_RX_RING_SIZE, MAX_RX_RING_SIZE);
+	lp->rx_ring_size = roundup_pow_of_two(size);
+
+	return 0;
+}
+
+static const struct ethtool_ops at91ether_ethtool_ops = {
+	.get_settings		= macb_get_settings,
+	.set_settings		= macb_set_settings,
+	.get_regs_len		= macb_get_regs_len,
+	.get_regs		= macb_get_regs,
+	.get_link		= ethtool_op_get_link,
+	.get_ts_info		= ethtool_op_get_ts_info,
+	.get_ringparam		= at91ether_get_ringparam,
+	.set_ringparam		= at91ether_set_ringparam,
+};
+
 static const struct net_device_ops at91ether_netdev_ops = {
 	.ndo_open		= at91ether_open,
 	.ndo_stop		= at91ether_close,
@@ -373,6 +492,7 @@ static int __init at91ether_probe(struct platform_device *pdev)
 	lp = netdev_priv(dev);
 	lp->pdev = pdev;
 	lp->dev = dev;
+	lp->rx_ring_size = DEFAULT_RX_RING_SIZE;
 	spin_lock_init(&lp->lock);
 
 	/* physical base address */
@@ -399,7 +519,8 @@ static int __init at91ether_probe(struct platform_device *pdev)
 
 	ether_setup(dev);
 	dev->netdev_ops = &at91ether_netdev_ops;
-	dev->ethtool_ops = &macb_ethtool_ops;
+	dev->ethtool_ops = &at91ether_ethtool_ops;
+	netif_napi_add(dev, &lp->napi, at91ether_poll, 64);
 	platform_set_drvdata(pdev, dev);
 	SET_NETDEV_DEV(dev, &pdev->dev);
 
@@ -18,9 +18,11 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/gpio.h>
+#include <linux/hrtimer.h>
 #include <linux/interrupt.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
+#include <linux/tcp.h>
 #include <linux/dma-mapping.h>
 #include <linux/platform_data/macb.h>
 #include <linux/platform_device.h>
@@ -34,14 +36,30 @@
 
 #define MACB_RX_BUFFER_SIZE	128
 #define RX_BUFFER_MULTIPLE	64  /* bytes */
-#define RX_RING_SIZE		512 /* must be power of 2 */
-#define RX_RING_BYTES		(sizeof(struct macb_dma_desc) * RX_RING_SIZE)
-
-#define TX_RING_SIZE		128 /* must be power of 2 */
-#define TX_RING_BYTES		(sizeof(struct macb_dma_desc) * TX_RING_SIZE)
+#define DEFAULT_RX_RING_SIZE	512 /* must be power of 2 */
+#define MIN_RX_RING_SIZE	64
+#define MAX_RX_RING_SIZE	8192
+#define RX_RING_BYTES(bp)	(sizeof(struct macb_dma_desc)	\
+				 * (bp)->rx_ring_size)
+
+#define DEFAULT_TX_RING_SIZE	128 /* must be power of 2 */
+#define MIN_TX_RING_SIZE	64
+#define MAX_TX_RING_SIZE	4096
+#define TX_RING_BYTES(bp)	(sizeof(struct macb_dma_desc)	\
+				 * (bp)->tx_ring_size)
 
 /* level of occupied TX descriptors under which we wake up TX process */
-#define MACB_TX_WAKEUP_THRESH	(3 * TX_RING_SIZE / 4)
+#define MACB_TX_WAKEUP_THRESH(bp)	(3 * (bp)->tx_ring_size / 4)
+
+/*
+ * On GEM, TSO frames are segmented by the driver so that all segments can
+ * be queued with a single TSTART. Every segment needs a descriptor for its
+ * headers, and one more when it starts within a page fragment. Limit the
+ * number of segments so that a frame always fits into the smallest ring.
+ * Larger rings hold several frames of this size.
+ */
+#define MACB_TX_GSO_SEGS	8
+#define MACB_TX_MAX_DESC	(2 * MACB_TX_GSO_SEGS + MAX_SKB_FRAGS)
 
 #define MACB_RX_INT_FLAGS	(MACB_BIT(RCOMP) | MACB_BIT(RXUBR)	\
 				 | MACB_BIT(ISR_ROVR))
@@ -50,52 +68,55 @@
 					| MACB_BIT(TXERR))
 #define MACB_TX_INT_FLAGS	(MACB_TX_ERR_FLAGS | MACB_BIT(TCOMP))
 
+/* Interrupts which are masked while the poll routine is scheduled */
+#define MACB_NAPI_INT_FLAGS	(MACB_RX_INT_FLAGS | MACB_BIT(TCOMP))
+
+/* Longest interrupt holdoff which can be set with ethtool -C */
+#define MACB_MAX_COALESCE_USECS	1000
+
+/* NCR while the device is up, it holds no other state */
+#define MACB_NCR_UP		(MACB_BIT(RE) | MACB_BIT(TE) | MACB_BIT(MPE))
+
 /*
  * Graceful stop timeouts in us. We should allow up to
  * 1 frame time (10 Mbits/s, full-duplex, ignoring collisions)
  */
 #define MACB_HALT_TIMEOUT	1230
 
+/*
+ * Received frames up to this size are copied into a new skb, so that their
+ * buffers can stay in the ring. Larger frames get their buffers attached to
+ * the skb as page fragments (MACB only, GEM always receives into skbs).
+ */
+static unsigned int rx_copybreak = 256;
+module_param(rx_copybreak, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rx_copybreak, "Maximum size of received frames to copy");
+
 /* Ring buffer accessors */
-static unsigned int macb_tx_ring_wrap(unsigned int index)
+static unsigned int macb_tx_ring_wrap(struct macb *bp, unsigned int index)
 {
-	return index & (TX_RING_SIZE - 1);
+	return index & (bp->tx_ring_size - 1);
 }
 
 static struct macb_dma_desc *macb_tx_desc(struct macb *bp, unsigned int index)
 {
-	return &bp->tx_ring[macb_tx_ring_wrap(index)];
+	return &bp->tx_ring[macb_tx_ring_wrap(bp, index)];
 }
 
 static struct macb_tx_skb *macb_tx_skb(struct macb *bp, unsigned int index)
 {
-	return &bp->tx_skb[macb_tx_ring_wrap(index)];
+	return &bp->tx_skb[macb_tx_ring_wrap(bp, index)];
 }
 
 static dma_addr_t macb_tx_dma(struct macb *bp, unsigned int index)
 {
 	dma_addr_t offset;
 
-	offset = macb_tx_ring_wrap(index) * sizeof(struct macb_dma_desc);
+	offset = macb_tx_ring_wrap(bp, index) * sizeof(struct macb_dma_desc);
 
 	return bp->tx_ring_dma + offset;
 }
 
-static unsigned int macb_rx_ring_wrap(unsigned int index)
-{
-	return index & (RX_RING_SIZE - 1);
-}
-
-static struct macb_dma_desc *macb_rx_desc(struct macb *bp, unsigned int index)
-{
-	return &bp->rx_ring[macb_rx_ring_wrap(index)];
-}
-
-static void *macb_rx_buffer(struct macb *bp, unsigned int index)
-{
-	return bp->rx_buffers + bp->rx_buffer_size * macb_rx_ring_wrap(index);
-}
-
 void macb_set_hwaddr(struct macb *bp)
 {
 	u32 bottom;
@@ -401,18 +422,53 @@ static int macb_halt_tx(struct macb *bp)
 	return -ETIMEDOUT;
 }
 
+static void macb_tx_unmap(struct macb *bp, struct macb_tx_skb *tx_skb)
+{
+	if (tx_skb->mapping) {
+		if (tx_skb->mapped_as_page)
+			dma_unmap_page(&bp->pdev->dev, tx_skb->mapping,
+				       tx_skb->size, DMA_TO_DEVICE);
+		else
+			dma_unmap_single(&bp->pdev->dev, tx_skb->mapping,
+					 tx_skb->size, DMA_TO_DEVICE);
+		tx_skb->mapping = 0;
+	}
+
+	if (tx_skb->skb) {
+		dev_kfree_skb_any(tx_skb->skb);
+		tx_skb->skb = NULL;
+	}
+}
+
+/* Number of free descriptors the next frame may need */
+static unsigned int macb_tx_max_desc(struct macb *bp)
+{
+	BUILD_BUG_ON(MACB_TX_MAX_DESC >= MIN_TX_RING_SIZE);
+
+	if (bp->dev->features & NETIF_F_SG)
+		return MACB_TX_MAX_DESC;
+	return 1;
+}
+
 static void macb_tx_error_task(struct work_struct *work)
 {
 	struct macb	*bp = container_of(work, struct macb, tx_error_task);
 	struct macb_tx_skb	*tx_skb;
+	struct macb_dma_desc	*desc;
 	struct sk_buff		*skb;
 	unsigned int		tail;
 
 	netdev_vdbg(bp->dev, "macb_tx_error_task: t = %u, h = %u\n",
 		    bp->tx_tail, bp->tx_head);
 
-	/* Make sure nobody is trying to queue up new packets */
-	netif_stop_queue(bp->dev);
+	/*
+	 * Make sure nobody is trying to queue up new packets. The poll
+	 * routine checks tx_error_pending under the lock before it wakes
+	 * the queue, so once we got the lock, it can't restart it anymore.
+	 */
+	spin_lock_bh(&bp->lock);
+	spin_unlock_bh(&bp->lock);
+	netif_tx_disable(bp->dev);
 
 	/*
 	 * Stop transmission now
@@ -422,14 +478,14 @@ static void macb_tx_error_task(struct work_struct *work)
 		/* Just complain for now, reinitializing TX path can be good */
 		netdev_err(bp->dev, "BUG: halt tx timed out\n");
 
-	/* No need for the lock here as nobody will interrupt us anymore */
+	/* Keep the poll routine away from the ring */
+	spin_lock_bh(&bp->lock);
 
 	/*
 	 * Treat frames in TX queue including the ones that caused the error.
 	 * Free transmit buffers in upper layer.
 	 */
 	for (tail = bp->tx_tail; tail != bp->tx_head; tail++) {
-		struct macb_dma_desc	*desc;
 		u32			ctrl;
 
 		desc = macb_tx_desc(bp, tail);
@@ -438,8 +494,16 @@ static void macb_tx_error_task(struct work_struct *work)
 		skb = tx_skb->skb;
 
 		if (ctrl & MACB_BIT(TX_USED)) {
+			/* skb is set for the last buffer of the frame */
+			while (!skb) {
+				macb_tx_unmap(bp, tx_skb);
+				tail++;
+				tx_skb = macb_tx_skb(bp, tail);
+				skb = tx_skb->skb;
+			}
+
 			netdev_vdbg(bp->dev, "txerr skb %u (data %p) TX complete\n",
-				    macb_tx_ring_wrap(tail), skb->data);
+				    macb_tx_ring_wrap(bp, tail), skb->data);
 			bp->stats.tx_packets++;
 			bp->stats.tx_bytes += skb->len;
 		} else {
@@ -455,12 +519,14 @@ static void macb_tx_error_task(struct work_struct *work)
 			desc->ctrl = ctrl | MACB_BIT(TX_USED);
 		}
 
-		dma_unmap_single(&bp->pdev->dev, tx_skb->mapping, skb->len,
-				 DMA_TO_DEVICE);
-		tx_skb->skb = NULL;
-		dev_kfree_skb(skb);
+		macb_tx_unmap(bp, tx_skb);
 	}
 
+	/* Set end of TX queue */
+	desc = macb_tx_desc(bp, 0);
+	desc->addr = 0;
+	desc->ctrl = MACB_BIT(TX_USED);
+
 	/* Make descriptor updates visible to hardware */
 	wmb();
 
@@ -468,28 +534,44 @@ static void macb_tx_error_task(struct work_struct *work)
 	macb_writel(bp, TBQP, bp->tx_ring_dma);
 	/* Make TX ring reflect state of hardware */
 	bp->tx_head = bp->tx_tail = 0;
+	netdev_reset_queue(bp->dev);
+	bp->tx_error_pending = false;
 
-	/* Now we are ready to start transmission again */
-	netif_wake_queue(bp->dev);
+	spin_unlock_bh(&bp->lock);
 
 	/* Housework before enabling TX IRQ */
 	macb_writel(bp, TSR, macb_readl(bp, TSR));
 	macb_writel(bp, IER, MACB_TX_INT_FLAGS);
+
+	/* Now we are ready to start transmission again */
+	netif_wake_queue(bp->dev);
 }
 
-static void macb_tx_interrupt(struct macb *bp)
+/*
+ * Reclaim transmitted frames, called from the poll routine. Returns the
+ * number of frames reclaimed. Transmission
+ * does not take any lock; bp->lock only keeps us away from the error task,
+ * which also must not find the queue woken up while it stops the hardware.
+ */
+static unsigned int macb_tx_complete(struct macb *bp)
 {
 	unsigned int tail;
 	unsigned int head;
+	unsigned int packets = 0, bytes = 0;
 	u32 status;
 
 	status = macb_readl(bp, TSR);
 	macb_writel(bp, TSR, status);
 
-	netdev_vdbg(bp->dev, "macb_tx_interrupt status = 0x%03lx\n",
+	netdev_vdbg(bp->dev, "macb_tx_complete status = 0x%03lx\n",
 		(unsigned long)status);
 
-	head = bp->tx_head;
+	spin_lock(&bp->lock);
+
+	head = ACCESS_ONCE(bp->tx_head);
+	/* Pairs with the smp_wmb() in macb_tx_map() */
+	smp_rmb();
+
 	for (tail = bp->tx_tail; tail != head; tail++) {
 		struct macb_tx_skb	*tx_skb;
 		struct sk_buff		*skb;
@@ -503,27 +585,69 @@ static void macb_tx_interrupt(struct macb *bp)
 
 		ctrl = desc->ctrl;
 
+		/*
+		 * The hardware only sets TX_USED in the first buffer
+		 * descriptor of a frame.
+		 */
 		if (!(ctrl & MACB_BIT(TX_USED)))
 			break;
 
-		tx_skb = macb_tx_skb(bp, tail);
-		skb = tx_skb->skb;
+		/* Release all buffers of the frame, skb is on the last one */
+		for (;; tail++) {
+			tx_skb = macb_tx_skb(bp, tail);
+			skb = tx_skb->skb;
+
+			if (skb) {
+				netdev_vdbg(bp->dev,
+					    "skb %u (data %p) TX complete\n",
+					    macb_tx_ring_wrap(bp, tail),
+					    skb->data);
+				packets++;
+				bytes += skb->len;
+			}
 
-		netdev_vdbg(bp->dev, "skb %u (data %p) TX complete\n",
-			macb_tx_ring_wrap(tail), skb->data);
-		dma_unmap_single(&bp->pdev->dev, tx_skb->mapping, skb->len,
-				 DMA_TO_DEVICE);
-		bp->stats.tx_packets++;
-		bp->stats.tx_bytes += skb->len;
-		tx_skb->skb = NULL;
-		dev_kfree_skb_irq(skb);
+			macb_tx_unmap(bp, tx_skb);
+
+			if (skb)
+				break;
+		}
 	}
 
+	/* The descriptors must be released before the new tail is seen */
+	smp_wmb();
 	bp->tx_tail = tail;
-	if (netif_queue_stopped(bp->dev)
-			&& CIRC_CNT(bp->tx_head, bp->tx_tail,
-				    TX_RING_SIZE) <= MACB_TX_WAKEUP_THRESH)
+
+	bp->stats.tx_packets += packets;
+	bp->stats.tx_bytes += bytes;
+	netdev_completed_queue(bp->dev, packets, bytes);
+
+	/* Pairs with the smp_mb() in macb_start_xmit() */
+	smp_mb();
+
+	if (netif_queue_stopped(bp->dev) && !bp->tx_error_pending
+			&& CIRC_CNT(bp->tx_head, tail, bp->tx_ring_size)
+				<= MACB_TX_WAKEUP_THRESH(bp)
+			&& CIRC_SPACE(bp->tx_head, tail, bp->tx_ring_size)
+				>= macb_tx_max_desc(bp))
 		netif_wake_queue(bp->dev);
+
+	spin_unlock(&bp->lock);
+
+	return packets;
+}
+
+/* Did the hardware finish a frame that has not been reclaimed yet? */
+static bool macb_tx_complete_pending(struct macb *bp)
+{
+	unsigned int tail = bp->tx_tail;
+
+	if (tail == ACCESS_ONCE(bp->tx_head))
+		return false;
+
+	/* Make hw descriptor updates visible to CPU */
+	rmb();
+
+	return macb_tx_desc(bp, tail)->ctrl & MACB_BIT(TX_USED);
 }
 
 static void gem_rx_refill(struct macb *bp)
@@ -533,10 +657,11 @@ static void gem_rx_refill(struct macb *bp)
 	struct macb_dma_desc	*desc;
 	dma_addr_t		paddr;
 
-	while (CIRC_SPACE(bp->rx_prepared_head, bp->rx_tail, RX_RING_SIZE) > 0) {
+	while (CIRC_SPACE(bp->rx_prepared_head, bp->rx_tail,
+			  bp->rx_ring_size) > 0) {
 		u32 addr, ctrl;
 
-		entry = macb_rx_ring_wrap(bp->rx_prepared_head);
+		entry = macb_rx_ring_wrap(bp, bp->rx_prepared_head);
 		desc = &bp->rx_ring[entry];
 
 		/* Make hw descriptor updates visible to CPU */
@@ -562,7 +687,7 @@ static void gem_rx_refill(struct macb *bp)
 			paddr = dma_map_single(&bp->pdev->dev, skb->data,
 					       bp->rx_buffer_size, DMA_FROM_DEVICE);
 
-			if (entry == RX_RING_SIZE - 1)
+			if (entry == bp->rx_ring_size - 1)
 				paddr |= MACB_BIT(RX_WRAP);
 			bp->rx_ring[entry].addr = paddr;
 			bp->rx_ring[entry].ctrl = 0;
@@ -614,7 +739,7 @@ static int gem_rx(struct macb *bp, int budget)
 	while (count < budget) {
 		u32 addr, ctrl;
 
-		entry = macb_rx_ring_wrap(bp->rx_tail);
+		entry = macb_rx_ring_wrap(bp, bp->rx_tail);
 		desc = &bp->rx_ring[entry];
 
 		/* Make hw descriptor updates visible to CPU */
@@ -676,12 +801,101 @@ static int gem_rx(struct macb *bp, int budget)
 	return count;
 }
 
+/*
+ * Take the next MACB_RX_BUFFER_SIZE slice from the RX page pool and map it
+ * for the hardware. The pool is a ring of pages which are carved up in
+ * order; when we get back to a page that the stack has released all its
+ * slices of, the page is reused, otherwise it is left to the stack and
+ * replaced by a new one.
+ */
+static int macb_rx_page_get(struct macb *bp, struct macb_rx_page *rx_page,
+			    gfp_t gfp)
+{
+	struct page **slot;
+	dma_addr_t mapping;
+
+	if (bp->rx_pool_offset + bp->rx_buffer_size > PAGE_SIZE) {
+		bp->rx_pool_next = (bp->rx_pool_next + 1) % bp->rx_pool_size;
+		bp->rx_pool_offset = 0;
+
+		slot = &bp->rx_page_pool[bp->rx_pool_next];
+		if (*slot && page_count(*slot) != 1) {
+			put_page(*slot);
+			*slot = NULL;
+		}
+	}
+
+	slot = &bp->rx_page_pool[bp->rx_pool_next];
+	if (!*slot) {
+		*slot = alloc_page(gfp);
+		if (!*slot)
+			return -ENOMEM;
+	}
+
+	mapping = dma_map_page(&bp->pdev->dev, *slot, bp->rx_pool_offset,
+			       bp->rx_buffer_size, DMA_FROM_DEVICE);
+	if (dma_mapping_error(&bp->pdev->dev, mapping))
+		return -ENOMEM;
+
+	get_page(*slot);
+	rx_page->page = *slot;
+	rx_page->offset = bp->rx_pool_offset;
+	rx_page->mapping = mapping;
+	bp->rx_pool_offset += bp->rx_buffer_size;
+
+	return 0;
+}
+
+/*
+ * Copy the first len bytes of an RX buffer into skb. The buffer stays in
+ * the ring, it is up to the caller to give it back to the hardware.
+ */
+void macb_rx_copy(struct macb *bp, struct sk_buff *skb,
+		  unsigned int index, unsigned int len)
+{
+	struct macb_rx_page *rx_page = macb_rx_page(bp, index);
+
+	dma_sync_single_for_cpu(&bp->pdev->dev, rx_page->mapping, len,
+				DMA_FROM_DEVICE);
+	memcpy(skb_put(skb, len),
+	       page_address(rx_page->page) + rx_page->offset, len);
+	dma_sync_single_for_device(&bp->pdev->dev, rx_page->mapping, len,
+				   DMA_FROM_DEVICE);
+}
+EXPORT_SYMBOL_GPL(macb_rx_copy);
+
+/*
+ * Attach len bytes at offset of an RX buffer to skb as a page fragment and
+ * put a fresh buffer from the page pool into its place in the ring.
+ */
+int macb_rx_attach(struct macb *bp, struct sk_buff *skb, unsigned int index,
+		   unsigned int offset, unsigned int len)
+{
+	struct macb_rx_page *rx_page = macb_rx_page(bp, index);
+	struct macb_dma_desc *desc = macb_rx_desc(bp, index);
+	struct macb_rx_page old = *rx_page;
+
+	if (macb_rx_page_get(bp, rx_page, GFP_ATOMIC))
+		return -ENOMEM;
+
+	dma_unmap_page(&bp->pdev->dev, old.mapping, bp->rx_buffer_size,
+		       DMA_FROM_DEVICE);
+	skb_add_rx_frag(skb, skb_shinfo(skb)->nr_frags, old.page,
+			old.offset + offset, len, bp->rx_buffer_size);
+
+	desc->addr = rx_page->mapping | (desc->addr & MACB_BIT(RX_WRAP));
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(macb_rx_attach);
+
 static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 			 unsigned int last_frag)
 {
 	unsigned int len;
 	unsigned int frag;
 	unsigned int offset;
+	bool copy;
 	struct sk_buff *skb;
 	struct macb_dma_desc *desc;
 
@@ -689,8 +903,16 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 	len = MACB_BFEXT(RX_FRMLEN, desc->ctrl);
 
 	netdev_vdbg(bp->dev, "macb_rx_frame frags %u - %u (len %u)\n",
-		macb_rx_ring_wrap(first_frag),
-		macb_rx_ring_wrap(last_frag), len);
+		macb_rx_ring_wrap(bp, first_frag),
+		macb_rx_ring_wrap(bp, last_frag), len);
+
+	/*
+	 * Small frames are copied and all their buffers stay in the
+	 * ring. Of larger frames, only the first buffer, which holds
+	 * the headers, is copied; the others are handed to the stack
+	 * as page fragments.
+	 */
+	copy = len <= rx_copybreak || last_frag - first_frag > MAX_SKB_FRAGS;
 
 	/*
 	 * The ethernet header starts NET_IP_ALIGN bytes into the
@@ -701,26 +923,16 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 	 * the two padding bytes into the skb so that we avoid hitting
 	 * the slowpath in memcpy(), and pull them off afterwards.
 	 */
-	skb = netdev_alloc_skb(bp->dev, len + NET_IP_ALIGN);
+	len += NET_IP_ALIGN;
+	skb = netdev_alloc_skb(bp->dev, copy ? len : bp->rx_buffer_size);
 	if (!skb) {
 		bp->stats.rx_dropped++;
-		for (frag = first_frag; ; frag++) {
-			desc = macb_rx_desc(bp, frag);
-			desc->addr &= ~MACB_BIT(RX_USED);
-			if (frag == last_frag)
-				break;
-		}
-
-		/* Make descriptor updates visible to hardware */
-		wmb();
-
+		discard_partial_frame(bp, first_frag, last_frag + 1);
 		return 1;
 	}
 
 	offset = 0;
-	len += NET_IP_ALIGN;
 	skb_checksum_none_assert(skb);
-	skb_put(skb, len);
 
 	for (frag = first_frag; ; frag++) {
 		unsigned int frag_len = bp->rx_buffer_size;
@@ -729,11 +941,18 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 			BUG_ON(frag != last_frag);
 			frag_len = len - offset;
 		}
-		skb_copy_to_linear_data_offset(skb, offset,
-				macb_rx_buffer(bp, frag), frag_len);
-		offset += bp->rx_buffer_size;
-		desc = macb_rx_desc(bp, frag);
-		desc->addr &= ~MACB_BIT(RX_USED);
+		if (copy || frag == first_frag) {
+			macb_rx_copy(bp, skb, frag, frag_len);
+			desc = macb_rx_desc(bp, frag);
+			desc->addr &= ~MACB_BIT(RX_USED);
+		} else if (macb_rx_attach(bp, skb, frag, 0, frag_len)) {
+			/* Out of pages, the remaining buffers stay put */
+			bp->stats.rx_dropped++;
+			discard_partial_frame(bp, frag, last_frag + 1);
+			dev_kfree_skb_any(skb);
+			return 1;
+		}
+		offset += frag_len;
 
 		if (frag == last_frag)
 			break;
@@ -803,9 +1022,12 @@ static int macb_rx(struct macb *bp, int budget)
 static int macb_poll(struct napi_struct *napi, int budget)
 {
 	struct macb *bp = container_of(napi, struct macb, napi);
+	unsigned int tx_done;
 	int work_done;
 	u32 status;
 
+	tx_done = macb_tx_complete(bp);
+
 	status = macb_readl(bp, RSR);
 	macb_writel(bp, RSR, status);
 
@@ -816,15 +1038,28 @@ static int macb_poll(struct napi_struct *napi, int budget)
 	if (work_done < budget) {
 		napi_complete(napi);
 
+		/*
+		 * With interrupt coalescing, keep the interrupts off and
+		 * poll again after the holdoff time as long as there is
+		 * traffic.
+		 */
+		if (bp->coalesce_usecs && (work_done || tx_done)) {
+			hrtimer_start(&bp->coalesce_timer,
+				      ns_to_ktime(bp->coalesce_usecs *
+						  NSEC_PER_USEC),
+				      HRTIMER_MODE_REL);
+			return work_done;
+		}
+
 		/*
 		 * We've done what we can to clean the buffers. Make sure we
-		 * get notified when new packets arrive.
+		 * get notified when new packets arrive or have been sent.
 		 */
-		macb_writel(bp, IER, MACB_RX_INT_FLAGS);
+		macb_writel(bp, IER, MACB_NAPI_INT_FLAGS);
 
-		/* Packets received while interrupts were disabled */
+		/* Packets received or sent while interrupts were disabled */
 		status = macb_readl(bp, RSR);
-		if (unlikely(status))
+		if (unlikely(status) || macb_tx_complete_pending(bp))
 			napi_reschedule(napi);
 	}
 
@@ -833,6 +1068,15 @@ static int macb_poll(struct napi_struct *napi, int budget)
 	return work_done;
 }
 
+static enum hrtimer_restart macb_coalesce_timer(struct hrtimer *timer)
+{
+	struct macb *bp = container_of(timer, struct macb, coalesce_timer);
+
+	napi_schedule(&bp->napi);
+
+	return HRTIMER_NORESTART;
+}
+
 static irqreturn_t macb_interrupt(int irq, void *dev_id)
 {
 	struct net_device *dev = dev_id;
@@ -844,36 +1088,41 @@ static irqreturn_t macb_interrupt(int irq, void *dev_id)
 	if (unlikely(!status))
 		return IRQ_NONE;
 
-	spin_lock(&bp->lock);
-
 	while (status) {
 		netdev_vdbg(bp->dev, "isr = 0x%08lx\n", (unsigned long)status);
 
-		if (status & MACB_RX_INT_FLAGS) {
+		if (status & MACB_RX_INT_FLAGS)
+			bp->queue_stats.rx_irqs++;
+		if (status & MACB_BIT(RXUBR))
+			bp->queue_stats.rx_no_buffer++;
+		if (status & MACB_BIT(TCOMP))
+			bp->queue_stats.tx_irqs++;
+
+		if (status & MACB_NAPI_INT_FLAGS) {
 			/*
-			 * There's no point taking any more interrupts
-			 * until we have processed the buffers. The
-			 * scheduling call may fail if the poll routine
-			 * is already scheduled, so disable interrupts
-			 * now.
+			 * Both received and transmitted frames are
+			 * handled by the poll routine, so there's no
+			 * point taking any more interrupts until it has
+			 * processed the buffers. The scheduling call may
+			 * fail if the poll routine is already scheduled,
+			 * so disable interrupts now.
 			 */
-			macb_writel(bp, IDR, MACB_RX_INT_FLAGS);
+			macb_writel(bp, IDR, MACB_NAPI_INT_FLAGS);
 
 			if (napi_schedule_prep(&bp->napi)) {
-				netdev_vdbg(bp->dev, "scheduling RX softirq\n");
+				netdev_vdbg(bp->dev, "scheduling softirq\n");
 				__napi_schedule(&bp->napi);
 			}
 		}
 
 		if (unlikely(status & (MACB_TX_ERR_FLAGS))) {
 			macb_writel(bp, IDR, MACB_TX_INT_FLAGS);
+			/* The poll routine must not wake the queue anymore */
+			bp->tx_error_pending = true;
 			schedule_work(&bp->tx_error_task);
 			break;
 		}
 
-		if (status & MACB_BIT(TCOMP))
-			macb_tx_interrupt(bp);
-
 		/*
 		 * Link change detection isn't possible with RMII, so we'll
 		 * add that if/when we get our hands on a full-blown MII PHY.
@@ -899,8 +1148,6 @@ static irqreturn_t macb_interrupt(int irq, void *dev_id)
 		status = macb_readl(bp, ISR);
 	}
 
-	spin_unlock(&bp->lock);
-
 	return IRQ_HANDLED;
 }
 
@@ -919,15 +1166,166 @@ static void macb_poll_controller(struct net_device *dev)
 }
 #endif
 
-static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
+/*
+ * Map the linear part and the page fragments of skb to descriptors
+ * starting at tx_head. The descriptors are written backwards so that the
+ * hardware, which may still be running, never sees a partial frame.
+ * Returns the number of descriptors used, or 0 if mapping failed.
+ */
+static unsigned int macb_tx_map(struct macb *bp, struct sk_buff *skb)
 {
-	struct macb *bp = netdev_priv(dev);
-	dma_addr_t mapping;
-	unsigned int len, entry;
-	struct macb_dma_desc *desc;
+	unsigned int nr_frags = skb_shinfo(skb)->nr_frags;
+	unsigned int entry, f, i, tx_head = bp->tx_head;
 	struct macb_tx_skb *tx_skb;
+	struct macb_dma_desc *desc;
+	dma_addr_t mapping;
 	u32 ctrl;
-	unsigned long flags;
+
+	/* First, map non-paged data */
+	tx_skb = macb_tx_skb(bp, tx_head);
+	mapping = dma_map_single(&bp->pdev->dev, skb->data,
+				 skb_headlen(skb), DMA_TO_DEVICE);
+	if (dma_mapping_error(&bp->pdev->dev, mapping))
+		goto dma_error;
+
+	tx_skb->skb = NULL;
+	tx_skb->mapping = mapping;
+	tx_skb->size = skb_headlen(skb);
+	tx_skb->mapped_as_page = false;
+	tx_head++;
+
+	/* Then, map paged data from fragments */
+	for (f = 0; f < nr_frags; f++) {
+		const skb_frag_t *frag = &skb_shinfo(skb)->frags[f];
+
+		tx_skb = macb_tx_skb(bp, tx_head);
+		mapping = skb_frag_dma_map(&bp->pdev->dev, frag, 0,
+					   skb_frag_size(frag), DMA_TO_DEVICE);
+		if (dma_mapping_error(&bp->pdev->dev, mapping))
+			goto dma_error;
+
+		tx_skb->skb = NULL;
+		tx_skb->mapping = mapping;
+		tx_skb->size = skb_frag_size(frag);
+		tx_skb->mapped_as_page = true;
+		tx_head++;
+	}
+
+	/* The last buffer of the frame owns the skb */
+	tx_skb->skb = skb;
+
+	/*
+	 * Once the hardware has seen the first descriptor, the frame may
+	 * be sent and reclaimed at any time.
+	 */
+	skb_tx_timestamp(skb);
+	netdev_sent_queue(bp->dev, skb->len);
+
+	/* Stop the hardware at the descriptor following the frame */
+	desc = macb_tx_desc(bp, tx_head);
+	desc->ctrl = MACB_BIT(TX_USED);
+
+	i = tx_head;
+	ctrl = MACB_BIT(TX_LAST);
+	do {
+		i--;
+		entry = macb_tx_ring_wrap(bp, i);
+		tx_skb = &bp->tx_skb[entry];
+		desc = &bp->tx_ring[entry];
+
+		ctrl |= MACB_BF(TX_FRMLEN, tx_skb->size);
+		if (entry == (bp->tx_ring_size - 1))
+			ctrl |= MACB_BIT(TX_WRAP);
+
+		desc->addr = tx_skb->mapping;
+		/* The address must be set before TX_USED is cleared */
+		wmb();
+		desc->ctrl = ctrl;
+
+		ctrl = 0;
+	} while (i != bp->tx_head);
+
+	netdev_vdbg(bp->dev, "Mapped skb data %p to entries %u - %u\n",
+		    skb->data, macb_tx_ring_wrap(bp, bp->tx_head),
+		    macb_tx_ring_wrap(bp, tx_head - 1));
+
+	i = tx_head - bp->tx_head;
+
+	/* Pairs with the smp_rmb() in macb_tx_complete() */
+	smp_wmb();
+	bp->tx_head = tx_head;
+
+	return i;
+
+dma_error:
+	netdev_err(bp->dev, "TX DMA map failed\n");
+
+	for (i = bp->tx_head; i != tx_head; i++)
+		macb_tx_unmap(bp, macb_tx_skb(bp, i));
+
+	return 0;
+}
+
+/*
+ * GEM computes the checksums itself, but some revisions get them wrong
+ * unless the checksum field is cleared first.
+ */
+static int macb_clear_csum(struct sk_buff *skb)
+{
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		return 0;
+
+	if (unlikely(skb_cow_head(skb, 0)))
+		return -1;
+
+	*(__sum16 *)(skb->head + skb->csum_start + skb->csum_offset) = 0;
+	return 0;
+}
+
+/* Queue one frame, returns false if it had to be dropped */
+static bool macb_tx_frame(struct macb *bp, struct sk_buff *skb)
+{
+	if (macb_clear_csum(skb) || !macb_tx_map(bp, skb)) {
+		bp->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Segment a TSO frame and queue all segments, so that the hardware only
+ * needs to be started once for all of them.
+ */
+static bool macb_tx_gso(struct macb *bp, struct sk_buff *skb)
+{
+	struct sk_buff *segs, *next;
+	bool queued = false;
+
+	segs = skb_gso_segment(skb, bp->dev->features & ~NETIF_F_ALL_TSO);
+	if (IS_ERR_OR_NULL(segs)) {
+		bp->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
+		return false;
+	}
+	dev_kfree_skb_any(skb);
+
+	for (; segs; segs = next) {
+		next = segs->next;
+		segs->next = NULL;
+		if (macb_tx_frame(bp, segs))
+			queued = true;
+	}
+
+	return queued;
+}
+
+static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	struct macb *bp = netdev_priv(dev);
+	unsigned int count;
+	bool queued;
 
 #if defined(DEBUG) && defined(VERBOSE_DEBUG)
 	netdev_vdbg(bp->dev,
@@ -938,41 +1336,57 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		       skb->data, 16, true);
 #endif
 
-	len = skb->len;
-	spin_lock_irqsave(&bp->lock, flags);
-
-	entry = macb_tx_ring_wrap(bp->tx_head);
-	bp->tx_head++;
-	netdev_vdbg(bp->dev, "Allocated ring entry %u\n", entry);
-	mapping = dma_map_single(&bp->pdev->dev, skb->data,
-				 len, DMA_TO_DEVICE);
+	/*
+	 * Descriptors needed in the worst case: one for the headers of
+	 * each segment, plus the page fragments, which may be split at
+	 * each segment boundary. The segments are counted from the length
+	 * rather than taken from gso_segs, which is set by the sender.
+	 */
+	count = 1 + skb_shinfo(skb)->nr_frags;
+	if (skb_is_gso(skb)) {
+		unsigned int hdr_len = skb_transport_offset(skb) +
+				       tcp_hdrlen(skb);
+
+		count = 2 * DIV_ROUND_UP(skb->len - hdr_len,
+					 skb_shinfo(skb)->gso_size) +
+			skb_shinfo(skb)->nr_frags;
+	}
 
-	tx_skb = &bp->tx_skb[entry];
-	tx_skb->skb = skb;
-	tx_skb->mapping = mapping;
-	netdev_vdbg(bp->dev, "Mapped skb data %p to DMA addr %08lx\n",
-		   skb->data, (unsigned long)mapping);
+	/* Never fits, even into the empty ring */
+	if (unlikely(count >= bp->tx_ring_size)) {
+		bp->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
+	}
 
-	ctrl = MACB_BF(TX_FRMLEN, len);
-	ctrl |= MACB_BIT(TX_LAST);
-	if (entry == (TX_RING_SIZE - 1))
-		ctrl |= MACB_BIT(TX_WRAP);
+	if (CIRC_SPACE(bp->tx_head, bp->tx_tail, bp->tx_ring_size) < count) {
+		netif_stop_queue(dev);
+		netdev_err(bp->dev, "BUG! Tx Ring full when queue awake!\n");
+		return NETDEV_TX_BUSY;
+	}
 
-	desc = &bp->tx_ring[entry];
-	desc->addr = mapping;
-	desc->ctrl = ctrl;
+	if (skb_is_gso(skb))
+		queued = macb_tx_gso(bp, skb);
+	else
+		queued = macb_tx_frame(bp, skb);
 
-	/* Make newly initialized descriptor visible to hardware */
+	/* Make newly initialized descriptors visible to hardware */
 	wmb();
 
-	skb_tx_timestamp(skb);
-
-	macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TSTART));
+	if (queued)
+		macb_writel(bp, NCR, MACB_NCR_UP | MACB_BIT(TSTART));
 
-	if (CIRC_SPACE(bp->tx_head, bp->tx_tail, TX_RING_SIZE) < 1)
+	if (CIRC_SPACE(bp->tx_head, bp->tx_tail, bp->tx_ring_size) <
+	    macb_tx_max_desc(bp)) {
 		netif_stop_queue(dev);
+		bp->queue_stats.tx_stopped++;
 
-	spin_unlock_irqrestore(&bp->lock, flags);
+		/* Frames may have been reclaimed since we looked */
+		smp_mb();
+		if (CIRC_SPACE(bp->tx_head, bp->tx_tail, bp->tx_ring_size) >=
+		    macb_tx_max_desc(bp))
+			netif_start_queue(dev);
+	}
 
 	return NETDEV_TX_OK;
 }
@@ -1004,26 +1418,8 @@ static void macb_free_tx_buffers(struct macb *bp)
 	if (!bp->tx_skb)
 		return;
 
-	for (tail = bp->tx_tail; tail != bp->tx_head; tail++) {
-		unsigned int		entry = macb_tx_ring_wrap(tail);
-		struct macb_dma_desc	*desc = &bp->tx_ring[entry];
-		struct macb_tx_skb	*tx_skb = &bp->tx_skb[entry];
-		unsigned int		len;
-
-		/* Make hw descriptor updates visible to CPU */
-		rmb();
-
-		len = MACB_BFEXT(TX_FRMLEN, desc->ctrl);
-
-		if (tx_skb->mapping)
-			dma_unmap_single(&bp->pdev->dev, tx_skb->mapping, len,
-					 DMA_TO_DEVICE);
-
-		if (tx_skb->skb) {
-			dev_kfree_skb(tx_skb->skb);
-			tx_skb->skb = NULL;
-		}
-	}
+	for (tail = bp->tx_tail; tail != bp->tx_head; tail++)
+		macb_tx_unmap(bp, macb_tx_skb(bp, tail));
 
 	kfree(bp->tx_skb);
 	bp->tx_skb = NULL;
@@ -1039,7 +1435,7 @@ static void gem_free_rx_buffers(struct macb *bp)
 	if (!bp->rx_skbuff)
 		return;
 
-	for (i = 0; i < RX_RING_SIZE; i++) {
+	for (i = 0; i < bp->rx_ring_size; i++) {
 		skb = bp->rx_skbuff[i];
 
 		if (skb == NULL)
@@ -1057,27 +1453,48 @@ static void gem_free_rx_buffers(struct macb *bp)
 	bp->rx_skbuff = NULL;
 }
 
-static void macb_free_rx_buffers(struct macb *bp)
+void macb_free_rx_buffers(struct macb *bp)
 {
-	if (bp->rx_buffers) {
-		dma_free_coherent(&bp->pdev->dev,
-				  RX_RING_SIZE * bp->rx_buffer_size,
-				  bp->rx_buffers, bp->rx_buffers_dma);
-		bp->rx_buffers = NULL;
+	struct macb_rx_page *rx_page;
+	int i;
+
+	if (bp->rx_page) {
+		for (i = 0; i < bp->rx_ring_size; i++) {
+			rx_page = &bp->rx_page[i];
+			if (!rx_page->page)
+				continue;
+
+			dma_unmap_page(&bp->pdev->dev, rx_page->mapping,
+				       bp->rx_buffer_size, DMA_FROM_DEVICE);
+			put_page(rx_page->page);
+		}
+
+		kfree(bp->rx_page);
+		bp->rx_page = NULL;
+	}
+
+	if (bp->rx_page_pool) {
+		for (i = 0; i < bp->rx_pool_size; i++)
+			if (bp->rx_page_pool[i])
+				put_page(bp->rx_page_pool[i]);
+
+		kfree(bp->rx_page_pool);
+		bp->rx_page_pool = NULL;
 	}
 }
+EXPORT_SYMBOL_GPL(macb_free_rx_buffers);
 
 static void macb_free_consistent(struct macb *bp)
 {
 	macb_free_tx_buffers(bp);
 	bp->macbgem_ops.mog_free_rx_buffers(bp);
 	if (bp->rx_ring) {
-		dma_free_coherent(&bp->pdev->dev, RX_RING_BYTES,
+		dma_free_coherent(&bp->pdev->dev, RX_RING_BYTES(bp),
 				  bp->rx_ring, bp->rx_ring_dma);
 		bp->rx_ring = NULL;
 	}
 	if (bp->tx_ring) {
-		dma_free_coherent(&bp->pdev->dev, TX_RING_BYTES,
+		dma_free_coherent(&bp->pdev->dev, TX_RING_BYTES(bp),
 				  bp->tx_ring, bp->tx_ring_dma);
 		bp->tx_ring = NULL;
 	}
@@ -1087,43 +1504,66 @@ static int gem_alloc_rx_buffers(struct macb *bp)
 {
 	int size;
 
-	size = RX_RING_SIZE * sizeof(struct sk_buff *);
+	size = bp->rx_ring_size * sizeof(struct sk_buff *);
 	bp->rx_skbuff = kzalloc(size, GFP_KERNEL);
 	if (!bp->rx_skbuff)
 		return -ENOMEM;
 	else
 		netdev_dbg(bp->dev,
 			   "Allocated %d RX struct sk_buff entries at %p\n",
-			   RX_RING_SIZE, bp->rx_skbuff);
+			   bp->rx_ring_size, bp->rx_skbuff);
 	return 0;
 }
 
-static int macb_alloc_rx_buffers(struct macb *bp)
+/*
+ * Allocate the RX page pool and a buffer of rx_buffer_size for each of the
+ * rx_ring_size descriptors. On failure, macb_free_rx_buffers() cleans up.
+ */
+int macb_alloc_rx_buffers(struct macb *bp)
 {
 	int size;
+	int i;
 
-	size = RX_RING_SIZE * bp->rx_buffer_size;
-	bp->rx_buffers = dma_alloc_coherent(&bp->pdev->dev, size,
-					    &bp->rx_buffers_dma, GFP_KERNEL);
-	if (!bp->rx_buffers)
+	size = bp->rx_ring_size * sizeof(struct macb_rx_page);
+	bp->rx_page = kzalloc(size, GFP_KERNEL);
+	if (!bp->rx_page)
 		return -ENOMEM;
-	else
-		netdev_dbg(bp->dev,
-			   "Allocated RX buffers of %d bytes at %08lx (mapped %p)\n",
-			   size, (unsigned long)bp->rx_buffers_dma, bp->rx_buffers);
+
+	/*
+	 * Twice the pages the ring needs, so that a page the stack
+	 * still holds fragments of does not have to be replaced right
+	 * away.
+	 */
+	size = bp->rx_ring_size * bp->rx_buffer_size;
+	bp->rx_pool_size = 2 * DIV_ROUND_UP(bp->rx_ring_size,
+					    PAGE_SIZE / bp->rx_buffer_size);
+	bp->rx_pool_next = 0;
+	bp->rx_pool_offset = 0;
+	bp->rx_page_pool = kcalloc(bp->rx_pool_size, sizeof(struct page *),
+				   GFP_KERNEL);
+	if (!bp->rx_page_pool)
+		return -ENOMEM;
+
+	for (i = 0; i < bp->rx_ring_size; i++)
+		if (macb_rx_page_get(bp, &bp->rx_page[i], GFP_KERNEL))
+			return -ENOMEM;
+
+	netdev_dbg(bp->dev, "Allocated RX buffers of %d bytes in %u pages\n",
+		   size, bp->rx_pool_next + 1);
 	return 0;
 }
+EXPORT_SYMBOL_GPL(macb_alloc_rx_buffers);
 
 static int macb_alloc_consistent(struct macb *bp)
 {
 	int size;
 
-	size = TX_RING_SIZE * sizeof(struct macb_tx_skb);
-	bp->tx_skb = kmalloc(size, GFP_KERNEL);
+	size = bp->tx_ring_size * sizeof(struct macb_tx_skb);
+	bp->tx_skb = kzalloc(size, GFP_KERNEL);
 	if (!bp->tx_skb)
 		goto out_err;
 
-	size = RX_RING_BYTES;
+	size = RX_RING_BYTES(bp);
 	bp->rx_ring = dma_alloc_coherent(&bp->pdev->dev, size,
 					 &bp->rx_ring_dma, GFP_KERNEL);
 	if (!bp->rx_ring)
@@ -1132,7 +1572,7 @@ static int macb_alloc_consistent(struct macb *bp)
 		   "Allocated RX ring of %d bytes at %08lx (mapped %p)\n",
 		   size, (unsigned long)bp->rx_ring_dma, bp->rx_ring);
 
-	size = TX_RING_BYTES;
+	size = TX_RING_BYTES(bp);
 	bp->tx_ring = dma_alloc_coherent(&bp->pdev->dev, size,
 					 &bp->tx_ring_dma, GFP_KERNEL);
 	if (!bp->tx_ring)
@@ -1155,13 +1595,15 @@ static void gem_init_rings(struct macb *bp)
 {
 	int i;
 
-	for (i = 0; i < TX_RING_SIZE; i++) {
+	for (i = 0; i < bp->tx_ring_size; i++) {
 		bp->tx_ring[i].addr = 0;
 		bp->tx_ring[i].ctrl = MACB_BIT(TX_USED);
 	}
-	bp->tx_ring[TX_RING_SIZE - 1].ctrl |= MACB_BIT(TX_WRAP);
+	bp->tx_ring[bp->tx_ring_size - 1].ctrl |= MACB_BIT(TX_WRAP);
 
 	bp->rx_tail = bp->rx_prepared_head = bp->tx_head = bp->tx_tail = 0;
+	netdev_reset_queue(bp->dev);
+	bp->tx_error_pending = false;
 
 	gem_rx_refill(bp);
 }
@@ -1169,23 +1611,22 @@ static void gem_init_rings(struct macb *bp)
 static void macb_init_rings(struct macb *bp)
 {
 	int i;
-	dma_addr_t addr;
 
-	addr = bp->rx_buffers_dma;
-	for (i = 0; i < RX_RING_SIZE; i++) {
-		bp->rx_ring[i].addr = addr;
+	for (i = 0; i < bp->rx_ring_size; i++) {
+		bp->rx_ring[i].addr = bp->rx_page[i].mapping;
 		bp->rx_ring[i].ctrl = 0;
-		addr += bp->rx_buffer_size;
 	}
-	bp->rx_ring[RX_RING_SIZE - 1].addr |= MACB_BIT(RX_WRAP);
+	bp->rx_ring[bp->rx_ring_size - 1].addr |= MACB_BIT(RX_WRAP);
 
-	for (i = 0; i < TX_RING_SIZE; i++) {
+	for (i = 0; i < bp->tx_ring_size; i++) {
 		bp->tx_ring[i].addr = 0;
 		bp->tx_ring[i].ctrl = MACB_BIT(TX_USED);
 	}
-	bp->tx_ring[TX_RING_SIZE - 1].ctrl |= MACB_BIT(TX_WRAP);
+	bp->tx_ring[bp->tx_ring_size - 1].ctrl |= MACB_BIT(TX_WRAP);
 
 	bp->rx_tail = bp->tx_head = bp->tx_tail = 0;
+	netdev_reset_queue(bp->dev);
+	bp->tx_error_pending = false;
 }
 
 static void macb_reset_hw(struct macb *bp)
@@ -1287,6 +1728,10 @@ static void macb_configure_dma(struct macb *bp)
 		dmacfg |= GEM_BF(FBLDO, 16);
 		dmacfg |= GEM_BIT(TXPBMS) | GEM_BF(RXBMS, -1L);
 		dmacfg |= GEM_BIT(DDRP);
+		if (bp->dev->features & (NETIF_F_IP_CSUM | NETIF_F_IPV6_CSUM))
+			dmacfg |= GEM_BIT(TXCOEN);
+		else
+			dmacfg &= ~GEM_BIT(TXCOEN);
 		gem_writel(bp, DMACFG, dmacfg);
 	}
 }
@@ -1319,10 +1764,10 @@ static void macb_init_hw(struct macb *bp)
 	macb_writel(bp, TBQP, bp->tx_ring_dma);
 
 	/* Enable TX and RX */
-	macb_writel(bp, NCR, MACB_BIT(RE) | MACB_BIT(TE) | MACB_BIT(MPE));
+	macb_writel(bp, NCR, MACB_NCR_UP);
 
 	/* Enable interrupts */
-	macb_writel(bp, IER, (MACB_RX_INT_FLAGS
+	macb_writel(bp, IER, (MACB_NAPI_INT_FLAGS
 			      | MACB_TX_INT_FLAGS
 			      | MACB_BIT(HRESP)));
 
@@ -1489,6 +1934,7 @@ static int macb_close(struct net_device *dev)
 
 	netif_stop_queue(dev);
 	napi_disable(&bp->napi);
+	hrtimer_cancel(&bp->coalesce_timer);
 
 	/*
 	 * Disable interrupts. Since processing is stopped, we don't
@@ -1610,7 +2056,7 @@ struct net_device_stats *macb_get_stats(struct net_device *dev)
 }
 EXPORT_SYMBOL_GPL(macb_get_stats);
 
-static int macb_get_settings(struct net_device *dev, struct ethtool_cmd *cmd)
+int macb_get_settings(struct net_device *dev, struct ethtool_cmd *cmd)
 {
 	struct macb *bp = netdev_priv(dev);
 	struct phy_device *phydev = bp->phy_dev;
@@ -1620,8 +2066,9 @@ static int macb_get_settings(struct net_device *dev, struct ethtool_cmd *cmd)
 
 	return phy_ethtool_gset(phydev, cmd);
 }
+EXPORT_SYMBOL_GPL(macb_get_settings);
 
-static int macb_set_settings(struct net_device *dev, struct ethtool_cmd *cmd)
+int macb_set_settings(struct net_device *dev, struct ethtool_cmd *cmd)
 {
 	struct macb *bp = netdev_priv(dev);
 	struct phy_device *phydev = bp->phy_dev;
@@ -1631,14 +2078,16 @@ static int macb_set_settings(struct net_device *dev, struct ethtool_cmd *cmd)
 
 	return phy_ethtool_sset(phydev, cmd);
 }
+EXPORT_SYMBOL_GPL(macb_set_settings);
 
-static int macb_get_regs_len(struct net_device *netdev)
+int macb_get_regs_len(struct net_device *netdev)
 {
 	return MACB_GREGS_NBR * sizeof(u32);
 }
+EXPORT_SYMBOL_GPL(macb_get_regs_len);
 
-static void macb_get_regs(struct net_device *dev, struct ethtool_regs *regs,
-			  void *p)
+void macb_get_regs(struct net_device *dev, struct ethtool_regs *regs,
+		   void *p)
 {
 	struct macb *bp = netdev_priv(dev);
 	unsigned int tail, head;
@@ -1647,8 +2096,8 @@ static void macb_get_regs(struct net_device *dev, struct ethtool_regs *regs,
 	regs->version = (macb_readl(bp, MID) & ((1 << MACB_REV_SIZE) - 1))
 			| MACB_GREGS_VERSION;
 
-	tail = macb_tx_ring_wrap(bp->tx_tail);
-	head = macb_tx_ring_wrap(bp->tx_head);
+	tail = macb_tx_ring_wrap(bp, bp->tx_tail);
+	head = macb_tx_ring_wrap(bp, bp->tx_head);
 
 	regs_buff[0]  = macb_readl(bp, NCR);
 	regs_buff[1]  = macb_or_gem_readl(bp, NCFGR);
@@ -1669,16 +2118,201 @@ static void macb_get_regs(struct net_device *dev, struct ethtool_regs *regs,
 		regs_buff[13] = gem_readl(bp, DMACFG);
 	}
 }
+EXPORT_SYMBOL_GPL(macb_get_regs);
+
+static void macb_get_ringparam(struct net_device *dev,
+			       struct ethtool_ringparam *ring)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	ring->rx_max_pending = MAX_RX_RING_SIZE;
+	ring->tx_max_pending = MAX_TX_RING_SIZE;
+	ring->rx_pending = bp->rx_ring_size;
+	ring->tx_pending = bp->tx_ring_size;
+}
 
-const struct ethtool_ops macb_ethtool_ops = {
+/*
+ * Quiesce the device so that the rings can be reallocated, without
+ * touching the PHY or the MAC configuration.
+ */
+static void macb_stop_rings(struct macb *bp)
+{
+	netif_tx_disable(bp->dev);
+	napi_disable(&bp->napi);
+	hrtimer_cancel(&bp->coalesce_timer);
+
+	macb_writel(bp, IDR, -1);
+	macb_readl(bp, ISR);
+	synchronize_irq(bp->dev->irq);
+
+	/*
+	 * The interrupt handler can't queue the TX error task anymore. If it
+	 * is still pending or running, it re-enables the TX interrupts and
+	 * wakes the queue when it is done, so disable them once more.
+	 */
+	cancel_work_sync(&bp->tx_error_task);
+	macb_writel(bp, IDR, -1);
+	netif_tx_disable(bp->dev);
+
+	macb_writel(bp, NCR, macb_readl(bp, NCR) & ~MACB_BIT(RE));
+	if (macb_halt_tx(bp))
+		netdev_err(bp->dev, "BUG: halt tx timed out\n");
+}
+
+static void macb_start_rings(struct macb *bp)
+{
+	bp->macbgem_ops.mog_init_rings(bp);
+	macb_writel(bp, RBQP, bp->rx_ring_dma);
+	macb_writel(bp, TBQP, bp->tx_ring_dma);
+	macb_writel(bp, NCR, MACB_NCR_UP);
+
+	napi_enable(&bp->napi);
+	macb_writel(bp, IER, (MACB_NAPI_INT_FLAGS
+			      | MACB_TX_INT_FLAGS
+			      | MACB_BIT(HRESP)));
+	netif_wake_queue(bp->dev);
+}
+
+static int macb_set_ringparam(struct net_device *dev,
+			      struct ethtool_ringparam *ring)
+{
+	struct macb *bp = netdev_priv(dev);
+	unsigned int rx_size, tx_size, old_rx_size, old_tx_size;
+	int err;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+
+	/* The ring sizes must be powers of 2 */
+	rx_size = clamp_t(u32, ring->rx_pending,
+			  MIN_RX_RING_SIZE, MAX_RX_RING_SIZE);
+	rx_size = roundup_pow_of_two(rx_size);
+	tx_size = clamp_t(u32, ring->tx_pending,
+			  MIN_TX_RING_SIZE, MAX_TX_RING_SIZE);
+	tx_size = roundup_pow_of_two(tx_size);
+
+	if (rx_size == bp->rx_ring_size && tx_size == bp->tx_ring_size)
+		return 0;
+
+	old_rx_size = bp->rx_ring_size;
+	old_tx_size = bp->tx_ring_size;
+
+	if (!netif_running(dev)) {
+		bp->rx_ring_size = rx_size;
+		bp->tx_ring_size = tx_size;
+		return 0;
+	}
+
+	macb_stop_rings(bp);
+	macb_free_consistent(bp);
+
+	bp->rx_ring_size = rx_size;
+	bp->tx_ring_size = tx_size;
+	err = macb_alloc_consistent(bp);
+	if (err) {
+		netdev_err(dev, "Unable to allocate rings, keeping %u/%u\n",
+			   old_rx_size, old_tx_size);
+		bp->rx_ring_size = old_rx_size;
+		bp->tx_ring_size = old_tx_size;
+		if (macb_alloc_consistent(bp)) {
+			napi_enable(&bp->napi);
+			dev_close(dev);
+			return err;
+		}
+	}
+
+	macb_start_rings(bp);
+
+	return err;
+}
+
+/*
+ * The MAC has no interrupt moderation. Instead, the interrupts stay off
+ * for coalesce_usecs after a poll which found work, and the poll routine
+ * is run from a timer. RX and TX share the poll routine, so rx-usecs and
+ * tx-usecs are the same setting.
+ */
+static int macb_get_coalesce(struct net_device *dev,
+			     struct ethtool_coalesce *ec)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	ec->rx_coalesce_usecs = bp->coalesce_usecs;
+	ec->tx_coalesce_usecs = bp->coalesce_usecs;
+
+	return 0;
+}
+
+static int macb_set_coalesce(struct net_device *dev,
+			     struct ethtool_coalesce *ec)
+{
+	struct macb *bp = netdev_priv(dev);
+	u32 usecs = ec->rx_coalesce_usecs;
+
+	if (usecs == bp->coalesce_usecs)
+		usecs = ec->tx_coalesce_usecs;
+	if (usecs > MACB_MAX_COALESCE_USECS)
+		return -EINVAL;
+
+	bp->coalesce_usecs = usecs;
+
+	return 0;
+}
+
+static const char macb_queue_stats_strings[][ETH_GSTRING_LEN] = {
+	"rx_queue_0_irqs",
+	"rx_queue_0_drops",
+	"rx_queue_0_no_buffer",
+	"tx_queue_0_irqs",
+	"tx_queue_0_drops",
+	"tx_queue_0_stopped",
+};
+
+static int macb_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return ARRAY_SIZE(macb_queue_stats_strings);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void macb_get_strings(struct net_device *dev, u32 sset, u8 *p)
+{
+	if (sset == ETH_SS_STATS)
+		memcpy(p, macb_queue_stats_strings,
+		       sizeof(macb_queue_stats_strings));
+}
+
+static void macb_get_ethtool_stats(struct net_device *dev,
+				   struct ethtool_stats *stats, u64 *data)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	data[0] = bp->queue_stats.rx_irqs;
+	data[1] = bp->stats.rx_dropped;
+	data[2] = bp->queue_stats.rx_no_buffer;
+	data[3] = bp->queue_stats.tx_irqs;
+	data[4] = bp->stats.tx_dropped;
+	data[5] = bp->queue_stats.tx_stopped;
+}
+
+static const struct ethtool_ops macb_ethtool_ops = {
 	.get_settings		= macb_get_settings,
 	.set_settings		= macb_set_settings,
 	.get_regs_len		= macb_get_regs_len,
 	.get_regs		= macb_get_regs,
 	.get_link		= ethtool_op_get_link,
 	.get_ts_info		= ethtool_op_get_ts_info,
+	.get_ringparam		= macb_get_ringparam,
+	.set_ringparam		= macb_set_ringparam,
+	.get_coalesce		= macb_get_coalesce,
+	.set_coalesce		= macb_set_coalesce,
+	.get_sset_count		= macb_get_sset_count,
+	.get_strings		= macb_get_strings,
+	.get_ethtool_stats	= macb_get_ethtool_stats,
 };
-EXPORT_SYMBOL_GPL(macb_ethtool_ops);
 
 int macb_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 {
@@ -1695,6 +2329,22 @@ int macb_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 }
 EXPORT_SYMBOL_GPL(macb_ioctl);
 
+static int macb_set_features(struct net_device *dev,
+			     netdev_features_t features)
+{
+	struct macb *bp = netdev_priv(dev);
+	netdev_features_t changed = features ^ dev->features;
+
+	dev->features = features;
+
+	/* TX checksum offload */
+	if (macb_is_gem(bp) &&
+	    (changed & (NETIF_F_IP_CSUM | NETIF_F_IPV6_CSUM)))
+		macb_configure_dma(bp);
+
+	return 0;
+}
+
 static const struct net_device_ops macb_netdev_ops = {
 	.ndo_open		= macb_open,
 	.ndo_stop		= macb_close,
@@ -1705,6 +2355,7 @@ static const struct net_device_ops macb_netdev_ops = {
 	.ndo_validate_addr	= eth_validate_addr,
 	.ndo_change_mtu		= eth_change_mtu,
 	.ndo_set_mac_address	= eth_mac_addr,
+	.ndo_set_features	= macb_set_features,
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller	= macb_poll_controller,
 #endif
@@ -1789,15 +2440,17 @@ static int __init macb_probe(struct platform_device *pdev)
 
 	SET_NETDEV_DEV(dev, &pdev->dev);
 
-	/* TODO: Actually, we have some interesting features... */
-	dev->features |= 0;
-
 	bp = netdev_priv(dev);
 	bp->pdev = pdev;
 	bp->dev = dev;
 
 	spin_lock_init(&bp->lock);
 	INIT_WORK(&bp->tx_error_task, macb_tx_error_task);
+	hrtimer_init(&bp->coalesce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	bp->coalesce_timer.function = macb_coalesce_timer;
+
+	bp->rx_ring_size = DEFAULT_RX_RING_SIZE;
+	bp->tx_ring_size = DEFAULT_TX_RING_SIZE;
 
 	bp->pclk = clk_get(&pdev->dev, "pclk");
 	if (IS_ERR(bp->pclk)) {
@@ -1847,6 +2500,14 @@ static int __init macb_probe(struct platform_device *pdev)
 		bp->macbgem_ops.mog_rx = macb_rx;
 	}
 
+	/* Scatter-gather and checksum offload are only available on GEM */
+	if (macb_is_gem(bp)) {
+		dev->hw_features |= NETIF_F_SG | NETIF_F_IP_CSUM |
+			NETIF_F_IPV6_CSUM | NETIF_F_TSO | NETIF_F_TSO6;
+		dev->gso_max_segs = MACB_TX_GSO_SEGS;
+	}
+	dev->features |= dev->hw_features;
+
 	/* Set MII management clock divider */
 	config = macb_mdc_clk_div(bp);
 	config |= macb_dbw(bp);
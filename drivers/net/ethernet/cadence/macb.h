@@ -454,12 +454,18 @@ struct macb_dma_desc {
 
 /**
  * struct macb_tx_skb - data about an skb which is being transmitted
- * @skb: skb currently being transmitted
- * @mapping: DMA address of the skb's data buffer
+ * @skb: skb currently being transmitted, only set for the last buffer
+ *       of the frame
+ * @mapping: DMA address of the skb's fragment buffer
+ * @size: size of the DMA mapped buffer
+ * @mapped_as_page: true when buffer was mapped with skb_frag_dma_map(),
+ *                  false when buffer was mapped with dma_map_single()
  */
 struct macb_tx_skb {
 	struct sk_buff		*skb;
 	dma_addr_t		mapping;
+	size_t			size;
+	bool			mapped_as_page;
 };
 
 /*
@@ -538,6 +544,24 @@ struct gem_stats {
 	u32	rx_udp_checksum_errors;
 };
 
+/*
+ * Receive buffer of the MACB: a slice of a page from the RX page pool,
+ * mapped for DMA from the device.
+ */
+struct macb_rx_page {
+	struct page		*page;
+	unsigned int		offset;
+	dma_addr_t		mapping;
+};
+
+/* Driver statistics of the RX and TX queue, reported through ethtool -S */
+struct macb_queue_stats {
+	unsigned long	rx_irqs;
+	unsigned long	rx_no_buffer;
+	unsigned long	tx_irqs;
+	unsigned long	tx_stopped;
+};
+
 struct macb;
 
 struct macb_or_gem_ops {
@@ -553,21 +577,29 @@ struct macb {
 
 	unsigned int		tx_head;
 	unsigned int		tx_tail;
+	unsigned int		tx_ring_size;
 	struct macb_dma_desc	*tx_ring;
 	struct macb_tx_skb	*tx_skb;
 	dma_addr_t		tx_ring_dma;
 	struct work_struct	tx_error_task;
+	bool			tx_error_pending;
 
 	struct napi_struct	napi;
+	struct hrtimer		coalesce_timer;
+	unsigned int		coalesce_usecs;
 
 	unsigned int		rx_tail;
+	unsigned int		rx_ring_size;
 	unsigned int		rx_prepared_head;
 	struct macb_dma_desc	*rx_ring;
 	struct sk_buff		**rx_skbuff;
-	void			*rx_buffers;
 	size_t			rx_buffer_size;
 	dma_addr_t		rx_ring_dma;
-	dma_addr_t		rx_buffers_dma;
+	struct macb_rx_page	*rx_page;
+	struct page		**rx_page_pool;
+	unsigned int		rx_pool_size;
+	unsigned int		rx_pool_next;
+	unsigned int		rx_pool_offset;
 
 	struct macb_or_gem_ops	macbgem_ops;
 
@@ -576,6 +608,7 @@ struct macb {
 	struct clk		*hclk;
 	struct net_device	*dev;
 	struct net_device_stats	stats;
+	struct macb_queue_stats	queue_stats;
 	union {
 		struct macb_stats	macb;
 		struct gem_stats	gem;
@@ -595,7 +628,24 @@ struct macb {
 	int skb_length;				/* saved skb length for pci_unmap_single */
 };
 
-extern const struct ethtool_ops macb_ethtool_ops;
+/* RX ring accessors, shared with at91_ether */
+static inline unsigned int macb_rx_ring_wrap(struct macb *bp,
+					     unsigned int index)
+{
+	return index & (bp->rx_ring_size - 1);
+}
+
+static inline struct macb_dma_desc *macb_rx_desc(struct macb *bp,
+						 unsigned int index)
+{
+	return &bp->rx_ring[macb_rx_ring_wrap(bp, index)];
+}
+
+static inline struct macb_rx_page *macb_rx_page(struct macb *bp,
+						unsigned int index)
+{
+	return &bp->rx_page[macb_rx_ring_wrap(bp, index)];
+}
 
 int macb_mii_init(struct macb *bp);
 int macb_ioctl(struct net_device *dev, struct ifreq *rq, int cmd);
@@ -603,6 +653,17 @@ struct net_device_stats *macb_get_stats(struct net_device *dev);
 void macb_set_rx_mode(struct net_device *dev);
 void macb_set_hwaddr(struct macb *bp);
 void macb_get_hwaddr(struct macb *bp);
+int macb_get_settings(struct net_device *dev, struct ethtool_cmd *cmd);
+int macb_set_settings(struct net_device *dev, struct ethtool_cmd *cmd);
+int macb_get_regs_len(struct net_device *dev);
+void macb_get_regs(struct net_device *dev, struct ethtool_regs *regs,
+		   void *p);
+int macb_alloc_rx_buffers(struct macb *bp);
+void macb_free_rx_buffers(struct macb *bp);
+void macb_rx_copy(struct macb *bp, struct sk_buff *skb,
+		  unsigned int index, unsigned int len);
+int macb_rx_attach(struct macb *bp, struct sk_buff *skb, unsigned int index,
+		   unsigned int offset, unsigned int len);
 
 static inline bool macb_is_gem(struct macb *bp)
 {
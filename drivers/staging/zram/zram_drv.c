@@ -23,6 +23,7 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
@@ -32,6 +33,7 @@
 #include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/percpu.h>
 
 #include "zram_drv.h"
 
@@ -89,21 +91,56 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * The entry lock serializes all users of a table entry, including the swap
+ * slot free notification, which runs in atomic context and can take neither
+ * zram->lock nor sleep. The other flags are only changed with it held.
+ */
+static void zram_lock_entry(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_LOCK, &zram->table[index].flags);
+}
+
+static void zram_unlock_entry(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_LOCK, &zram->table[index].flags);
+}
+
+/*
+ * Check if the page consists of a single repeated word, and return the word
+ * in @element if it does. Such pages are kept in the table only.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page) - 1; pos++) {
+		if (page[pos] != page[pos + 1])
 			return 0;
 	}
 
+	*element = page[pos];
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned int len, unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	if (likely(!element)) {
+		memset(ptr, 0, len);
+		return;
+	}
+
+	page = (unsigned long *)ptr;
+	for (pos = 0; pos < len / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,11 +170,148 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void zram_touch(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = jiffies;
+}
+
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long blk = 1;
+
+	/* Block 0 is never handed out, so that a handle of 0 stays empty */
+	do {
+		blk = find_next_zero_bit(zram->bitmap, zram->nr_blocks, blk);
+		if (blk == zram->nr_blocks)
+			return 0;
+	} while (test_and_set_bit(blk, zram->bitmap));
+
+	return blk;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long blk)
+{
+	WARN_ON_ONCE(!test_and_clear_bit(blk, zram->bitmap));
+}
+
+static void zram_kick_writeback(struct zram *zram)
+{
+	if (zram->bdev)
+		queue_work(zram->wb_wq, &zram->wb_work);
+}
+
+struct zram_bdev_io {
+	struct work_struct work;
+	struct completion done;
+	struct bio *bio;
+	int rw;
+	int error;
+};
+
+static void zram_bdev_end_io(struct bio *bio, int error)
+{
+	struct zram_bdev_io *io = bio->bi_private;
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags) && !error)
+		error = -EIO;
+	io->error = error;
+	complete(&io->done);
+}
+
+static void zram_bdev_submit(struct work_struct *work)
+{
+	struct zram_bdev_io *io = container_of(work, struct zram_bdev_io, work);
+
+	submit_bio(io->rw, io->bio);
+}
+
+/*
+ * Synchronously read or write one page of the backing device. Bios submitted
+ * from within zram_make_request() are queued on current->bio_list and only
+ * issued once it returns, so waiting for them there would never finish. In
+ * that case the bio is submitted from the writeback workqueue instead, which
+ * has a rescuer and thus makes progress under memory pressure.
+ */
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long blk, int rw)
+{
+	struct zram_bdev_io io;
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &io;
+	if (bio_add_page(bio, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	io.bio = bio;
+	io.rw = rw;
+	io.error = 0;
+	init_completion(&io.done);
+
+	if (current->bio_list) {
+		INIT_WORK_ONSTACK(&io.work, zram_bdev_submit);
+		queue_work(zram->wb_wq, &io.work);
+		wait_for_completion(&io.done);
+		flush_work(&io.work);
+		destroy_work_on_stack(&io.work);
+	} else {
+		submit_bio(rw, bio);
+		wait_for_completion(&io.done);
+	}
+	bio_put(bio);
+
+	if (!io.error)
+		zram_stat64_inc(zram, rw == READ ? &zram->stats.bd_reads :
+				&zram->stats.bd_writes);
+
+	return io.error;
+}
+#else
+static inline void zram_touch(struct zram *zram, u32 index) {}
+static inline void zram_free_block(struct zram *zram, unsigned long blk) {}
+static inline void zram_kick_writeback(struct zram *zram) {}
+
+static inline int zram_bdev_rw(struct zram *zram, struct page *page,
+			       unsigned long blk, int rw)
+{
+	return -EIO;
+}
+#endif
+
+/* Called with the table entry locked */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	unsigned long handle = zram->table[index].handle;
 	u16 size = zram->table[index].size;
 
+	/* Tell a concurrent writeback that the page is gone */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, handle);
+		zram_stat_dec(&zram->stats.pages_wb);
+		zram->table[index].handle = 0;
+		return;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		/* The handle is the fill word, no memory is allocated */
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(&zram->stats.pages_same);
+		zram->table[index].handle = 0;
+		return;
+	}
+
 	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -166,13 +340,13 @@ static void zram_free_page(struct zram *zram, size_t index)
 	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
@@ -183,29 +357,56 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+static int zram_bvec_read_bdev(struct zram *zram, struct bio_vec *bvec,
+			       unsigned long blk, u32 index, int offset)
+{
+	int ret;
+	struct page *page = bvec->bv_page;
+	unsigned char *user_mem, *uncmem;
+
+	if (is_partial_io(bvec)) {
+		page = alloc_page(GFP_NOIO);
+		if (!page)
+			return -ENOMEM;
+	}
+
+	ret = zram_bdev_rw(zram, page, blk, READ);
+
+	if (is_partial_io(bvec)) {
+		if (!ret) {
+			user_mem = kmap_atomic(bvec->bv_page);
+			uncmem = kmap_atomic(page);
+			memcpy(user_mem + bvec->bv_offset, uncmem + offset,
+			       bvec->bv_len);
+			kunmap_atomic(uncmem);
+			kunmap_atomic(user_mem);
+		}
+		__free_page(page);
+	}
+
+	if (unlikely(ret)) {
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+		       ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
+
+	flush_dcache_page(bvec->bv_page);
+
+	return 0;
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
 	size_t clen;
+	unsigned long handle;
 	struct page *page;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
-		return 0;
-	}
-
-	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].handle)) {
-		pr_debug("Read before write: sector=%lu, size=%u",
-			 (ulong)(bio->bi_sector), bio->bi_size);
-		handle_zero_page(bvec);
-		return 0;
-	}
-
 	if (is_partial_io(bvec)) {
 		/* Use  a temporary buffer to decompress the page */
 		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
@@ -215,13 +416,34 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		}
 	}
 
+	zram_lock_entry(zram, index);
+	zram_touch(zram, index);
+	handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		/* Swap does not free a slot while it is being read */
+		zram_unlock_entry(zram, index);
+		kfree(uncmem);
+		return zram_bvec_read_bdev(zram, bvec, handle, index, offset);
+	}
+
+	/* Zero and same filled pages, or not present in compressed area */
+	if (!handle || zram_test_flag(zram, index, ZRAM_SAME)) {
+		if (!handle && !zram_test_flag(zram, index, ZRAM_ZERO))
+			pr_debug("Read before write: sector=%lu, size=%u",
+				 (ulong)(bio->bi_sector), bio->bi_size);
+		zram_unlock_entry(zram, index);
+		kfree(uncmem);
+		handle_same_page(bvec, handle);
+		return 0;
+	}
+
 	user_mem = kmap_atomic(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
 	clen = PAGE_SIZE;
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle,
-				ZS_MM_RO);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 	if (zram->table[index].size == PAGE_SIZE) {
 		memcpy(uncmem, cmem, PAGE_SIZE);
@@ -237,8 +459,9 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		kfree(uncmem);
 	}
 
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem);
+	zram_unlock_entry(zram, index);
 
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret != LZO_E_OK)) {
@@ -252,21 +475,32 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	return 0;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+/* Called with the table entry locked, for pages not on the backing device */
+static int __zram_read_page(struct zram *zram, char *mem, u32 index)
 {
 	int ret;
 	size_t clen = PAGE_SIZE;
 	unsigned char *cmem;
 	unsigned long handle = zram->table[index].handle;
 
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_fill_page(mem, PAGE_SIZE, handle);
+		return 0;
+	}
+
 	if (zram_test_flag(zram, index, ZRAM_ZERO) || !handle) {
 		memset(mem, 0, PAGE_SIZE);
 		return 0;
 	}
 
 	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
-	ret = lzo1x_decompress_safe(cmem, zram->table[index].size,
-				    mem, &clen);
+	if (zram->table[index].size == PAGE_SIZE) {
+		memcpy(mem, cmem, PAGE_SIZE);
+		ret = LZO_E_OK;
+	} else {
+		ret = lzo1x_decompress_safe(cmem, zram->table[index].size,
+					    mem, &clen);
+	}
 	zs_unmap_object(zram->mem_pool, handle);
 
 	/* Should NEVER happen. Return bio error if it does. */
@@ -279,17 +513,68 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+{
+	int ret;
+	unsigned long blk;
+	struct page *page;
+	unsigned char *src;
+
+	zram_lock_entry(zram, index);
+	if (!zram_test_flag(zram, index, ZRAM_WB)) {
+		ret = __zram_read_page(zram, mem, index);
+		zram_unlock_entry(zram, index);
+		return ret;
+	}
+	blk = zram->table[index].handle;
+	zram_unlock_entry(zram, index);
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+	ret = zram_bdev_rw(zram, page, blk, READ);
+	if (!ret) {
+		src = kmap_atomic(page);
+		memcpy(mem, src, PAGE_SIZE);
+		kunmap_atomic(src);
+	} else
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+	__free_page(page);
+
+	return ret;
+}
+
+static struct zram_workspace *zram_get_workspace(struct zram *zram)
+{
+	struct zram_workspace *ws;
+
+	ws = per_cpu_ptr(zram->workspaces, raw_smp_processor_id());
+	mutex_lock(&ws->lock);
+	return ws;
+}
+
+static void zram_put_workspace(struct zram_workspace *ws)
+{
+	mutex_unlock(&ws->lock);
+}
+
+/*
+ * Full page writes compress the page without zram->lock, using the workspace
+ * of the current CPU, and only take the lock for writing to update the table.
+ * Partial writes have to read-modify-write the page, so the caller holds
+ * zram->lock for writing across the whole operation (see zram_bvec_rw()).
+ */
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
-	int ret;
-	size_t clen;
-	unsigned long handle;
+	int ret, same = 0;
+	size_t clen = 0;
+	unsigned long handle = 0, element = 0;
 	struct page *page;
-	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
+	struct zram_workspace *ws;
+	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -307,79 +592,109 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			kfree(uncmem);
 			goto out;
 		}
-	}
-
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
-	user_mem = kmap_atomic(page);
 
-	if (is_partial_io(bvec))
+		user_mem = kmap_atomic(page);
 		memcpy(uncmem + offset, user_mem + bvec->bv_offset,
 		       bvec->bv_len);
-	else
-		uncmem = user_mem;
-
-	if (page_zero_filled(uncmem)) {
 		kunmap_atomic(user_mem);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
-		zram_stat_inc(&zram->stats.pages_zero);
-		zram_set_flag(zram, index, ZRAM_ZERO);
-		ret = 0;
-		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	ws = zram_get_workspace(zram);
+
+	user_mem = kmap_atomic(page);
+	if (page_same_filled(uncmem ? uncmem : user_mem, &element)) {
+		kunmap_atomic(user_mem);
+		zram_put_workspace(ws);
+		same = 1;
+		goto store;
+	}
 
+	ret = lzo1x_1_compress(uncmem ? uncmem : user_mem, PAGE_SIZE,
+			       ws->buffer, &clen, ws->mem);
 	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
 
 	if (unlikely(ret != LZO_E_OK)) {
+		zram_put_workspace(ws);
 		pr_err("Compression failed! err=%d\n", ret);
-		goto out;
+		goto out_free;
 	}
 
-	if (unlikely(clen > max_zpage_size)) {
-		zram_stat_inc(&zram->stats.bad_compress);
-		src = uncmem;
+	if (unlikely(clen > max_zpage_size))
 		clen = PAGE_SIZE;
-	}
 
 	handle = zs_malloc(zram->mem_pool, clen);
 	if (!handle) {
+		zram_put_workspace(ws);
 		pr_info("Error allocating memory for compressed "
 			"page: %u, size=%zu\n", index, clen);
 		ret = -ENOMEM;
-		goto out;
+		goto out_free;
 	}
 	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
 
-	memcpy(cmem, src, clen);
+	if (clen == PAGE_SIZE) {
+		/* Store incompressible pages as they are */
+		user_mem = kmap_atomic(page);
+		memcpy(cmem, uncmem ? uncmem : user_mem, PAGE_SIZE);
+		kunmap_atomic(user_mem);
+	} else
+		memcpy(cmem, ws->buffer, clen);
 
 	zs_unmap_object(zram->mem_pool, handle);
+	zram_put_workspace(ws);
+
+store:
+	kfree(uncmem);
+
+	if (!is_partial_io(bvec))
+		down_write(&zram->lock);
 
-	zram->table[index].handle = handle;
-	zram->table[index].size = clen;
+	zram_lock_entry(zram, index);
 
-	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
-	zram_stat_inc(&zram->stats.pages_stored);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_inc(&zram->stats.good_compress);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	if (zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_free_page(zram, index);
+
+	if (same && !element) {
+		zram_stat_inc(&zram->stats.pages_zero);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+	} else if (same) {
+		zram->table[index].handle = element;
+		zram_stat_inc(&zram->stats.pages_same);
+		zram_set_flag(zram, index, ZRAM_SAME);
+	} else {
+		zram->table[index].handle = handle;
+		zram->table[index].size = clen;
+
+		/* Update stats */
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+		zram_stat_inc(&zram->stats.pages_stored);
+		if (clen <= PAGE_SIZE / 2)
+			zram_stat_inc(&zram->stats.good_compress);
+		if (unlikely(clen == PAGE_SIZE))
+			zram_stat_inc(&zram->stats.bad_compress);
+	}
+	zram_touch(zram, index);
+
+	zram_unlock_entry(zram, index);
+
+	if (!is_partial_io(bvec))
+		up_write(&zram->lock);
+
+	/* Incompressible pages are better kept on the backing device */
+	if (unlikely(clen == PAGE_SIZE))
+		zram_kick_writeback(zram);
 
 	return 0;
 
+out_free:
+	kfree(uncmem);
 out:
-	if (ret)
-		zram_stat64_inc(zram, &zram->stats.failed_writes);
+	zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
 }
 
@@ -392,11 +707,12 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 		down_read(&zram->lock);
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
 		up_read(&zram->lock);
-	} else {
+	} else if (is_partial_io(bvec)) {
 		down_write(&zram->lock);
 		ret = zram_bvec_write(zram, bvec, index, offset);
 		up_write(&zram->lock);
-	}
+	} else
+		ret = zram_bvec_write(zram, bvec, index, offset);
 
 	return ret;
 }
@@ -510,6 +826,260 @@ error:
 	bio_io_error(bio);
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static int zram_wb_candidate(struct zram *zram, size_t index,
+			     unsigned long idle)
+{
+	struct table *t = &zram->table[index];
+
+	if (!t->handle || (t->flags & ~BIT(ZRAM_LOCK)))
+		return 0;
+	if (t->size == PAGE_SIZE)
+		return 1;
+	return idle && time_after(jiffies, t->ac_time + idle);
+}
+
+/*
+ * Move incompressible pages, and pages which were not accessed for @idle
+ * jiffies if that is not zero, to the backing device. The page is copied out
+ * under zram->lock and the entry lock, written without them, and the table is
+ * only switched over if the page was neither overwritten nor freed meanwhile:
+ * zram_free_page() clears ZRAM_UNDER_WB, and the block is then freed here.
+ */
+static void zram_writeback(struct zram *zram, unsigned long idle)
+{
+	int ret;
+	size_t index, nr_pages;
+	unsigned long blk;
+	struct page *page;
+	void *mem;
+
+	/* Returning early is fine while the device is being reset */
+	if (!down_read_trylock(&zram->init_lock))
+		return;
+	if (!zram->init_done || !zram->bdev)
+		goto out;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		goto out;
+
+	mutex_lock(&zram->wb_mutex);
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		/* Unlocked check first, most pages are not candidates */
+		if (!zram_wb_candidate(zram, index, idle))
+			continue;
+
+		down_write(&zram->lock);
+		zram_lock_entry(zram, index);
+		if (!zram_wb_candidate(zram, index, idle)) {
+			zram_unlock_entry(zram, index);
+			up_write(&zram->lock);
+			continue;
+		}
+		mem = kmap_atomic(page);
+		ret = __zram_read_page(zram, mem, index);
+		kunmap_atomic(mem);
+		if (!ret)
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		zram_unlock_entry(zram, index);
+		up_write(&zram->lock);
+		if (ret)
+			continue;
+
+		blk = zram_alloc_block(zram);
+		if (blk) {
+			ret = zram_bdev_rw(zram, page, blk, WRITE);
+			if (ret) {
+				pr_err("Backing device write failed! err=%d\n",
+				       ret);
+				zram_free_block(zram, blk);
+				blk = 0;
+			}
+		}
+
+		down_write(&zram->lock);
+		zram_lock_entry(zram, index);
+		if (blk && zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index);
+			zram->table[index].handle = blk;
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram_stat_inc(&zram->stats.pages_wb);
+		} else {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			if (blk)
+				zram_free_block(zram, blk);
+		}
+		zram_unlock_entry(zram, index);
+		up_write(&zram->lock);
+
+		/* Backing device is full or failing, try again later */
+		if (!blk)
+			break;
+
+		cond_resched();
+	}
+	mutex_unlock(&zram->wb_mutex);
+
+	__free_page(page);
+out:
+	up_read(&zram->init_lock);
+}
+
+static void zram_wb_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, wb_work);
+
+	zram_writeback(zram, 0);
+}
+
+static void zram_idle_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(to_delayed_work(work), struct zram,
+					 idle_work);
+	unsigned long idle = zram->wb_idle_secs * HZ;
+
+	if (!idle)
+		return;
+
+	zram_writeback(zram, idle);
+	queue_delayed_work(zram->wb_wq, &zram->idle_work, idle);
+}
+
+void zram_set_wb_idle(struct zram *zram, unsigned int secs)
+{
+	zram->wb_idle_secs = secs;
+	if (!zram->bdev)
+		return;
+
+	/* Re-arm a pending run with the new delay */
+	cancel_delayed_work(&zram->idle_work);
+	if (secs)
+		queue_delayed_work(zram->wb_wq, &zram->idle_work, secs * HZ);
+}
+
+/* Called with init_lock held for writing */
+void zram_put_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	cancel_work_sync(&zram->wb_work);
+	cancel_delayed_work_sync(&zram->idle_work);
+	destroy_workqueue(zram->wb_wq);
+	zram->wb_wq = NULL;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+	kfree(zram->bdev_path);
+	zram->bdev_path = NULL;
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_blocks = 0;
+}
+
+/* Called with init_lock held for writing, before the device is initialized */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	char *bdev_path;
+	unsigned long nr_blocks, *bitmap = NULL;
+	struct workqueue_struct *wq = NULL;
+	struct block_device *bdev;
+
+	bdev_path = kstrdup(path, GFP_KERNEL);
+	if (!bdev_path)
+		return -ENOMEM;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev)) {
+		kfree(bdev_path);
+		return PTR_ERR(bdev);
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto fail;
+
+	ret = -ENOMEM;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap)
+		goto fail;
+	set_bit(0, bitmap);
+
+	wq = alloc_workqueue("%s_wb", WQ_MEM_RECLAIM | WQ_NON_REENTRANT, 0,
+			     zram->disk->disk_name);
+	if (!wq)
+		goto fail;
+
+	zram_put_backing_dev(zram);
+	zram->bdev = bdev;
+	zram->bdev_path = bdev_path;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_blocks;
+	zram->wb_wq = wq;
+	zram_set_wb_idle(zram, zram->wb_idle_secs);
+
+	pr_info("%s: using %s as backing device, %lu pages\n",
+		zram->disk->disk_name, path, nr_blocks - 1);
+	return 0;
+
+fail:
+	vfree(bitmap);
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	kfree(bdev_path);
+	return ret;
+}
+#endif
+
+static void zram_free_workspaces(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->workspaces)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_workspace *ws = per_cpu_ptr(zram->workspaces, cpu);
+
+		kfree(ws->mem);
+		free_pages((unsigned long)ws->buffer, 1);
+	}
+
+	free_percpu(zram->workspaces);
+	zram->workspaces = NULL;
+}
+
+static int zram_alloc_workspaces(struct zram *zram)
+{
+	int cpu;
+
+	zram->workspaces = alloc_percpu(struct zram_workspace);
+	if (!zram->workspaces)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_workspace *ws = per_cpu_ptr(zram->workspaces, cpu);
+
+		mutex_init(&ws->lock);
+		ws->mem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		ws->buffer =
+			(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+		if (!ws->mem || !ws->buffer)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
 void __zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -517,16 +1087,13 @@ void __zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_free_workspaces(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
 		unsigned long handle = zram->table[index].handle;
-		if (!handle)
+		if (!handle || zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
 		zs_free(zram->mem_pool, handle);
@@ -548,6 +1115,10 @@ void zram_reset_device(struct zram *zram)
 {
 	down_write(&zram->init_lock);
 	__zram_reset_device(zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Its contents are gone together with the table */
+	zram_put_backing_dev(zram);
+#endif
 	up_write(&zram->init_lock);
 }
 
@@ -565,18 +1136,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_alloc_workspaces(zram);
+	if (ret) {
+		pr_err("Error allocating compressor workspaces!\n");
 		goto fail_no_table;
 	}
 
@@ -622,7 +1184,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_lock_entry(zram, index);
 	zram_free_page(zram, index);
+	zram_unlock_entry(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -638,6 +1202,11 @@ static int create_device(struct zram *zram, int device_id)
 	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	mutex_init(&zram->wb_mutex);
+	INIT_WORK(&zram->wb_work, zram_wb_work);
+	INIT_DELAYED_WORK(&zram->idle_work, zram_idle_work);
+#endif
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -774,6 +1343,9 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+		zram_put_backing_dev(zram);
+#endif
 	}
 
 	unregister_blkdev(zram_major, "zram");
@@ -17,6 +17,7 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "../zsmalloc/zsmalloc.h"
 
@@ -58,6 +59,14 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
+	/* Page is filled with one repeated word, kept in table[].handle */
+	ZRAM_SAME,
+	/* Page is on the backing device, table[].handle is its block */
+	ZRAM_WB,
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+	/* Bit spinlock protecting the table entry */
+	ZRAM_LOCK,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -67,9 +76,12 @@ enum zram_pageflags {
 /* Allocated for each disk page */
 struct table {
 	unsigned long handle;
+	unsigned long flags;	/* zram_pageflags, a long for bit_spin_lock */
 	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	unsigned long ac_time;	/* jiffies of the last access */
+#endif
 } __aligned(4);
 
 struct zram_stats {
@@ -80,19 +92,33 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 bd_reads;		/* no. of pages read from backing device */
+	u64 bd_writes;		/* no. of pages written to backing device */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of other same filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
+	u32 pages_wb;		/* no. of pages on the backing device */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 bad_compress;	/* % of pages with compression ratio>=75% */
 };
 
+/*
+ * Compression workspace. There is one per CPU, so that pages written from
+ * different CPUs are compressed concurrently. The mutex is only contended
+ * when a writer is preempted or migrated while using the workspace.
+ */
+struct zram_workspace {
+	struct mutex lock;
+	void *mem;		/* LZO working memory */
+	void *buffer;		/* compressed page */
+};
+
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zram_workspace __percpu *workspaces;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
+	struct rw_semaphore lock; /* protect table and the 32-bit stats
 				   * against concurrent read and writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
@@ -106,6 +132,22 @@ struct zram {
 	u64 disksize;	/* bytes */
 
 	struct zram_stats stats;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/*
+	 * Optional backing device, incompressible and idle pages are moved
+	 * there. Set and cleared under init_lock held for writing.
+	 */
+	struct block_device *bdev;
+	char *bdev_path;
+	unsigned long *bitmap;		/* allocated blocks, 0 is reserved */
+	unsigned long nr_blocks;
+	struct workqueue_struct *wb_wq;
+	struct work_struct wb_work;	/* write back incompressible pages */
+	struct delayed_work idle_work;	/* write back idle pages */
+	struct mutex wb_mutex;		/* serialize the two above */
+	unsigned int wb_idle_secs;	/* 0: do not write back idle pages */
+#endif
 };
 
 extern struct zram *zram_devices;
@@ -116,5 +158,10 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void __zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_put_backing_dev(struct zram *zram);
+extern void zram_set_wb_idle(struct zram *zram, unsigned int secs);
+#endif
 
 #endif
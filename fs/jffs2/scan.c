@@ -18,12 +18,21 @@
 #include <linux/pagemap.h>
 #include <linux/crc32.h>
 #include <linux/compiler.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 #include "nodelist.h"
 #include "summary.h"
 #include "debug.h"
 
 #define DEFAULT_EMPTY_SCAN_SIZE 256
 
+/*
+ * With summaries, the scan mostly waits for the flash to deliver the summary
+ * nodes. This many eraseblocks ahead of the one being scanned have their
+ * summary nodes read and checked in parallel by workqueue workers.
+ */
+#define SCAN_RA_BLOCKS 8
+
 #define noisy_printk(noise, fmt, ...)					\
 do {									\
 	if (*(noise)) {							\
@@ -36,8 +45,36 @@ do {									\
 
 static uint32_t pseudo_random;
 
+/**
+ * struct jffs2_scan_ra - summary node read ahead for one eraseblock.
+ * @work: reads and checks the summary node
+ * @done: completed when @work is done
+ * @c: the file system
+ * @jeb: the eraseblock
+ * @buf: buffer holding the summary node (or %NULL)
+ * @sumptr: the summary node in @buf, %NULL if the eraseblock has none
+ * @sumlen: length of the summary node
+ * @valid: if zero, the summary node could not be read ahead and the scan has
+ *         to read the eraseblock as usual
+ * @sum_ok: non-zero if the summary node CRCs are correct
+ * @queued: non-zero if @work has been queued and @done not waited for yet
+ */
+struct jffs2_scan_ra {
+	struct work_struct work;
+	struct completion done;
+	struct jffs2_sb_info *c;
+	struct jffs2_eraseblock *jeb;
+	void *buf;
+	void *sumptr;
+	uint32_t sumlen;
+	int valid;
+	int sum_ok;
+	int queued;
+};
+
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s);
+				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+				  struct jffs2_scan_ra *ra);
 
 /* These helper functions _must_ increase ofs and also do the dirty/used space accounting.
  * Returning an error will abort the mount - bad checksums etc. should just mark the space
@@ -66,6 +103,139 @@ static inline uint32_t EMPTY_SCAN_SIZE(uint32_t sector_size) {
 		return DEFAULT_EMPTY_SCAN_SIZE;
 }
 
+static int jffs2_fill_scan_buf(struct jffs2_sb_info *c, void *buf,
+			       uint32_t ofs, uint32_t len);
+
+/* Read the summary node of an eraseblock, like jffs2_scan_eraseblock() does */
+static void jffs2_scan_ra_work(struct work_struct *work)
+{
+	struct jffs2_scan_ra *ra = container_of(work, struct jffs2_scan_ra, work);
+	struct jffs2_sb_info *c = ra->c;
+	struct jffs2_eraseblock *jeb = ra->jeb;
+	struct jffs2_sum_marker *sm;
+	uint32_t buf_len, sumofs;
+	void *buf;
+
+	if (jffs2_cleanmarker_oob(c) && mtd_block_isbad(c->mtd, jeb->offset))
+		goto out;
+
+	if (c->wbuf_pagesize)
+		buf_len = c->wbuf_pagesize;
+	else
+		buf_len = sizeof(*sm);
+
+	buf = kmalloc(buf_len, GFP_KERNEL);
+	if (!buf)
+		goto out;
+	/* On errors, leave it to the scan to read again and report them */
+	if (jffs2_fill_scan_buf(c, buf, jeb->offset + c->sector_size - buf_len,
+				buf_len))
+		goto out_free;
+
+	sm = buf + buf_len - sizeof(*sm);
+	if (je32_to_cpu(sm->magic) != JFFS2_SUM_MAGIC) {
+		kfree(buf);
+		ra->valid = 1;
+		goto out;
+	}
+
+	sumofs = je32_to_cpu(sm->offset);
+	if (sumofs > c->sector_size - sizeof(struct jffs2_raw_summary))
+		goto out_free;
+	ra->sumlen = c->sector_size - sumofs;
+
+	if (ra->sumlen > buf_len) {
+		void *sumbuf = kmalloc(ra->sumlen, GFP_KERNEL);
+
+		if (!sumbuf)
+			goto out_free;
+		memcpy(sumbuf + ra->sumlen - buf_len, buf, buf_len);
+		kfree(buf);
+		buf = sumbuf;
+		if (jffs2_fill_scan_buf(c, buf, jeb->offset + sumofs,
+					ra->sumlen - buf_len))
+			goto out_free;
+		ra->sumptr = buf;
+	} else
+		ra->sumptr = buf + buf_len - ra->sumlen;
+
+	ra->buf = buf;
+	ra->sum_ok = !jffs2_sum_check_sumnode(ra->sumptr, ra->sumlen);
+	ra->valid = 1;
+	goto out;
+
+out_free:
+	kfree(buf);
+out:
+	complete(&ra->done);
+}
+
+static void jffs2_scan_ra_queue(struct jffs2_sb_info *c,
+				struct jffs2_scan_ra *ra, int block)
+{
+	if (block >= c->nr_blocks)
+		return;
+
+	ra->jeb = &c->blocks[block];
+	ra->buf = ra->sumptr = NULL;
+	ra->valid = ra->sum_ok = 0;
+	INIT_COMPLETION(ra->done);
+	ra->queued = 1;
+	queue_work(system_unbound_wq, &ra->work);
+}
+
+/* Wait for the read ahead of an eraseblock, returns %NULL if there is none */
+static struct jffs2_scan_ra *jffs2_scan_ra_wait(struct jffs2_scan_ra *ras,
+						int block)
+{
+	struct jffs2_scan_ra *ra;
+
+	if (!ras)
+		return NULL;
+	ra = &ras[block % SCAN_RA_BLOCKS];
+	if (!ra->queued)
+		return NULL;
+	wait_for_completion(&ra->done);
+	ra->queued = 0;
+	return ra;
+}
+
+static struct jffs2_scan_ra *jffs2_scan_ra_start(struct jffs2_sb_info *c)
+{
+	struct jffs2_scan_ra *ras;
+	int i;
+
+	if (!jffs2_sum_active())
+		return NULL;
+
+	ras = kcalloc(SCAN_RA_BLOCKS, sizeof(*ras), GFP_KERNEL);
+	if (!ras)
+		return NULL;
+
+	for (i = 0; i < SCAN_RA_BLOCKS; i++) {
+		INIT_WORK(&ras[i].work, jffs2_scan_ra_work);
+		init_completion(&ras[i].done);
+		ras[i].c = c;
+		jffs2_scan_ra_queue(c, &ras[i], i);
+	}
+	return ras;
+}
+
+static void jffs2_scan_ra_stop(struct jffs2_scan_ra *ras)
+{
+	struct jffs2_scan_ra *ra;
+	int i;
+
+	if (!ras)
+		return;
+	for (i = 0; i < SCAN_RA_BLOCKS; i++) {
+		ra = jffs2_scan_ra_wait(ras, i);
+		if (ra)
+			kfree(ra->buf);
+	}
+	kfree(ras);
+}
+
 static int file_dirty(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
 {
 	int ret;
@@ -95,6 +265,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	unsigned char *flashbuf = NULL;
 	uint32_t buf_size = 0;
 	struct jffs2_summary *s = NULL; /* summary info collected by the scan process */
+	struct jffs2_scan_ra *ras = NULL, *ra;
 #ifndef __ECOS
 	size_t pointlen, try_size;
 
@@ -140,6 +311,10 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		}
 	}
 
+	/* Only summaries are read ahead, and not when the flash is mapped */
+	if (jffs2_sum_active() && buf_size)
+		ras = jffs2_scan_ra_start(c);
+
 	for (i=0; i<c->nr_blocks; i++) {
 		struct jffs2_eraseblock *jeb = &c->blocks[i];
 
@@ -148,8 +323,13 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		/* reset summary info for next eraseblock scan */
 		jffs2_sum_reset_collected(s);
 
+		ra = jffs2_scan_ra_wait(ras, i);
 		ret = jffs2_scan_eraseblock(c, jeb, buf_size?flashbuf:(flashbuf+jeb->offset),
-						buf_size, s);
+						buf_size, s, ra);
+		if (ra) {
+			kfree(ra->buf);
+			jffs2_scan_ra_queue(c, ra, i + SCAN_RA_BLOCKS);
+		}
 
 		if (ret < 0)
 			goto out;
@@ -274,6 +454,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	}
 	ret = 0;
  out:
+	jffs2_scan_ra_stop(ras);
 	if (buf_size)
 		kfree(flashbuf);
 #ifndef __ECOS
@@ -440,7 +621,8 @@ static int jffs2_scan_xref_node(struct jffs2_sb_info *c, struct jffs2_eraseblock
 /* Called with 'buf_size == 0' if buf is in fact a pointer _directly_ into
    the flash, XIP-style */
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s) {
+				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+				  struct jffs2_scan_ra *ra) {
 	struct jffs2_unknown_node *node;
 	struct jffs2_unknown_node crcnode;
 	uint32_t ofs, prevofs, max_ofs;
@@ -491,6 +673,10 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 				sumptr = buf + je32_to_cpu(sm->offset);
 				sumlen = c->sector_size - je32_to_cpu(sm->offset);
 			}
+		} else if (ra && ra->valid) {
+			/* Already read and checked by jffs2_scan_ra_work() */
+			sumptr = ra->sumptr;
+			sumlen = ra->sumlen;
 		} else {
 			/* If NAND flash, read a whole page of it. Else just the end */
 			if (c->wbuf_pagesize)
@@ -530,7 +716,16 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 
 		}
 
-		if (sumptr) {
+		if (sumptr && ra && ra->valid) {
+			if (ra->sum_ok)
+				err = jffs2_sum_process_sumnode(c, jeb, sumptr, sumlen,
+								&pseudo_random);
+			else
+				err = jffs2_sum_scan_sumnode(c, jeb, sumptr, sumlen,
+							     &pseudo_random);
+			if (err)
+				return err;
+		} else if (sumptr) {
 			err = jffs2_sum_scan_sumnode(c, jeb, sumptr, sumlen, &pseudo_random);
 
 			if (buf_size && sumlen > buf_size)
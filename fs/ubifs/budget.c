@@ -78,11 +78,13 @@ static void shrink_liability(struct ubifs_info *c, int nr_to_write)
 static int run_gc(struct ubifs_info *c)
 {
 	int err, lnum;
+	unsigned long start = jiffies;
 
 	/* Make some free space by garbage-collecting dirty space */
 	down_read(&c->commit_sem);
 	lnum = ubifs_garbage_collect(c, 1);
 	up_read(&c->commit_sem);
+	ubifs_fg_gc_done(c, start);
 	if (lnum < 0)
 		return lnum;
 
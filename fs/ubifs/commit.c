@@ -276,6 +276,54 @@ out:
 	return 0;
 }
 
+/**
+ * bg_gc_timeout - calculate when background garbage collection has to run.
+ * @c: UBIFS file-system description object
+ *
+ * Background GC runs when the journal has been idle for @c->bg_gc_idle
+ * milliseconds, and not more often than every @c->bg_gc_interval
+ * milliseconds. This function returns how long the background thread may
+ * sleep before that, or %MAX_SCHEDULE_TIMEOUT if background GC is disabled or
+ * found nothing to do and nothing was written since then. In the latter case,
+ * the thread is woken up by the next journal write (see 'make_reservation()')
+ * or when the background GC knobs change.
+ */
+static long bg_gc_timeout(struct ubifs_info *c)
+{
+	unsigned long idle_end, next, now = jiffies;
+
+	if (!c->bg_gc_lebs || c->ro_error)
+		return MAX_SCHEDULE_TIMEOUT;
+	if (c->bg_gc_done && !time_after(c->jnl_time, c->bg_gc_time))
+		return MAX_SCHEDULE_TIMEOUT;
+
+	idle_end = c->jnl_time + msecs_to_jiffies(c->bg_gc_idle);
+	next = c->bg_gc_time + msecs_to_jiffies(c->bg_gc_interval);
+	if (time_after(idle_end, next))
+		next = idle_end;
+	if (!time_after(next, now))
+		return 1;
+	return next - now;
+}
+
+/**
+ * run_bg_gc - run background garbage collection if the journal is idle.
+ * @c: UBIFS file-system description object
+ */
+static void run_bg_gc(struct ubifs_info *c)
+{
+	int err;
+
+	if (time_before(jiffies, c->jnl_time + msecs_to_jiffies(c->bg_gc_idle)))
+		return;
+
+	err = ubifs_bg_gc(c);
+	c->bg_gc_time = jiffies;
+	if (err < 0)
+		ubifs_ro_mode(c, err);
+	c->bg_gc_done = err <= 0;
+}
+
 /**
  * ubifs_bg_thread - UBIFS background thread function.
  * @info: points to the file-system description object
@@ -283,10 +331,9 @@ out:
  * This function implements various file-system background activities:
  * o when a write-buffer timer expires it synchronizes the appropriate
  *   write-buffer;
- * o when the journal is about to be full, it starts in-advance commit.
- *
- * Note, other stuff like background garbage collection may be added here in
- * future.
+ * o when the journal is about to be full, it starts in-advance commit;
+ * o when the journal has been idle for a while, it garbage collects LEBs in
+ *   background (see 'ubifs_bg_gc()').
  */
 int ubifs_bg_thread(void *info)
 {
@@ -314,7 +361,8 @@ int ubifs_bg_thread(void *info)
 			 */
 			if (kthread_should_stop())
 				break;
-			schedule();
+			if (!schedule_timeout(bg_gc_timeout(c)))
+				run_bg_gc(c);
 			continue;
 		} else
 			__set_current_state(TASK_RUNNING);
@@ -38,11 +38,11 @@ static struct ubifs_compressor none_compr = {
 };
 
 #ifdef CONFIG_UBIFS_FS_LZO
-static DEFINE_MUTEX(lzo_mutex);
+static struct ubifs_compr_pool lzo_comp_pool;
 
 static struct ubifs_compressor lzo_compr = {
 	.compr_type = UBIFS_COMPR_LZO,
-	.comp_mutex = &lzo_mutex,
+	.comp_pool = &lzo_comp_pool,
 	.name = "lzo",
 	.capi_name = "lzo",
 };
@@ -54,13 +54,13 @@ static struct ubifs_compressor lzo_compr = {
 #endif
 
 #ifdef CONFIG_UBIFS_FS_ZLIB
-static DEFINE_MUTEX(deflate_mutex);
-static DEFINE_MUTEX(inflate_mutex);
+/* Each "deflate" handle has both the deflate and the inflate workspace */
+static struct ubifs_compr_pool zlib_pool;
 
 static struct ubifs_compressor zlib_compr = {
 	.compr_type = UBIFS_COMPR_ZLIB,
-	.comp_mutex = &deflate_mutex,
-	.decomp_mutex = &inflate_mutex,
+	.comp_pool = &zlib_pool,
+	.decomp_pool = &zlib_pool,
 	.name = "zlib",
 	.capi_name = "deflate",
 };
@@ -74,6 +74,58 @@ static struct ubifs_compressor zlib_compr = {
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
+/**
+ * pool_grab - try to take an idle handle from a compressor pool.
+ * @pool: the pool
+ *
+ * The handle belonging to the current CPU is preferred, so that as long as
+ * tasks do not migrate each CPU keeps using the same (cache-hot) workspace.
+ * Returns the index of the grabbed handle or %-1 if all handles are busy.
+ */
+static int pool_grab(struct ubifs_compr_pool *pool)
+{
+	int idx;
+
+	spin_lock(&pool->lock);
+	idx = raw_smp_processor_id() % pool->cnt;
+	if (!test_bit(idx, pool->idle))
+		idx = find_first_bit(pool->idle, pool->cnt);
+	if (idx < pool->cnt)
+		__clear_bit(idx, pool->idle);
+	else
+		idx = -1;
+	spin_unlock(&pool->lock);
+
+	return idx;
+}
+
+/**
+ * pool_get - get a compressor handle from a pool.
+ * @pool: the pool
+ * @idx: index of the handle is returned here
+ *
+ * This function waits until a handle becomes idle and returns it. The handle
+ * has to be given back with 'pool_put()'.
+ */
+static struct crypto_comp *pool_get(struct ubifs_compr_pool *pool, int *idx)
+{
+	wait_event(pool->wait, (*idx = pool_grab(pool)) >= 0);
+	return pool->cc[*idx];
+}
+
+/**
+ * pool_put - return a compressor handle to its pool.
+ * @pool: the pool
+ * @idx: index of the handle
+ */
+static void pool_put(struct ubifs_compr_pool *pool, int idx)
+{
+	spin_lock(&pool->lock);
+	__set_bit(idx, pool->idle);
+	spin_unlock(&pool->lock);
+	wake_up(&pool->wait);
+}
+
 /**
  * ubifs_compress - compress data.
  * @in_buf: data to compress
@@ -95,8 +147,9 @@ struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 		    int *compr_type)
 {
-	int err;
+	int err, idx = 0;
 	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
+	struct crypto_comp *cc;
 
 	if (*compr_type == UBIFS_COMPR_NONE)
 		goto no_compr;
@@ -105,12 +158,11 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 	if (in_len < UBIFS_MIN_COMPR_LEN)
 		goto no_compr;
 
-	if (compr->comp_mutex)
-		mutex_lock(compr->comp_mutex);
-	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
+	cc = compr->comp_pool ? pool_get(compr->comp_pool, &idx) : compr->cc;
+	err = crypto_comp_compress(cc, in_buf, in_len, out_buf,
 				   (unsigned int *)out_len);
-	if (compr->comp_mutex)
-		mutex_unlock(compr->comp_mutex);
+	if (compr->comp_pool)
+		pool_put(compr->comp_pool, idx);
 	if (unlikely(err)) {
 		ubifs_warn("cannot compress %d bytes, compressor %s, "
 			   "error %d, leave data uncompressed",
@@ -148,8 +200,9 @@ no_compr:
 int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 		     int *out_len, int compr_type)
 {
-	int err;
+	int err, idx = 0;
 	struct ubifs_compressor *compr;
+	struct crypto_comp *cc;
 
 	if (unlikely(compr_type < 0 || compr_type >= UBIFS_COMPR_TYPES_CNT)) {
 		ubifs_err("invalid compression type %d", compr_type);
@@ -169,12 +222,12 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 		return 0;
 	}
 
-	if (compr->decomp_mutex)
-		mutex_lock(compr->decomp_mutex);
-	err = crypto_comp_decompress(compr->cc, in_buf, in_len, out_buf,
+	cc = compr->decomp_pool ? pool_get(compr->decomp_pool, &idx) :
+				  compr->cc;
+	err = crypto_comp_decompress(cc, in_buf, in_len, out_buf,
 				     (unsigned int *)out_len);
-	if (compr->decomp_mutex)
-		mutex_unlock(compr->decomp_mutex);
+	if (compr->decomp_pool)
+		pool_put(compr->decomp_pool, idx);
 	if (err)
 		ubifs_err("cannot decompress %d bytes, compressor %s, "
 			  "error %d", in_len, compr->name, err);
@@ -183,25 +236,65 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 }
 
 /**
- * compr_init - initialize a compressor.
+ * pool_exit - free a compressor pool.
+ * @pool: the pool to free
+ */
+static void pool_exit(struct ubifs_compr_pool *pool)
+{
+	int i;
+
+	if (!pool || !pool->cc)
+		return;
+
+	for (i = 0; i < pool->cnt; i++)
+		if (!IS_ERR_OR_NULL(pool->cc[i]))
+			crypto_free_comp(pool->cc[i]);
+	kfree(pool->cc);
+	kfree(pool->idle);
+	pool->cc = NULL;
+	pool->idle = NULL;
+}
+
+/**
+ * pool_init - allocate handles for a compressor pool.
  * @compr: compressor description object
+ * @pool: the pool to initialize
  *
- * This function initializes the requested compressor and returns zero in case
- * of success or a negative error code in case of failure.
+ * This function allocates one cryptoapi handle per possible CPU. Returns zero
+ * in case of success and a negative error code in case of failure.
  */
-static int __init compr_init(struct ubifs_compressor *compr)
+static int __init pool_init(struct ubifs_compressor *compr,
+			    struct ubifs_compr_pool *pool)
 {
-	if (compr->capi_name) {
-		compr->cc = crypto_alloc_comp(compr->capi_name, 0, 0);
-		if (IS_ERR(compr->cc)) {
-			ubifs_err("cannot initialize compressor %s, error %ld",
-				  compr->name, PTR_ERR(compr->cc));
-			return PTR_ERR(compr->cc);
+	int i, err = -ENOMEM;
+
+	spin_lock_init(&pool->lock);
+	init_waitqueue_head(&pool->wait);
+	pool->cnt = num_possible_cpus();
+
+	pool->idle = kcalloc(BITS_TO_LONGS(pool->cnt), sizeof(long),
+			     GFP_KERNEL);
+	pool->cc = kcalloc(pool->cnt, sizeof(struct crypto_comp *),
+			   GFP_KERNEL);
+	if (!pool->idle || !pool->cc)
+		goto out;
+
+	for (i = 0; i < pool->cnt; i++) {
+		pool->cc[i] = crypto_alloc_comp(compr->capi_name, 0, 0);
+		if (IS_ERR(pool->cc[i])) {
+			err = PTR_ERR(pool->cc[i]);
+			goto out;
 		}
+		__set_bit(i, pool->idle);
 	}
 
-	ubifs_compressors[compr->compr_type] = compr;
 	return 0;
+
+out:
+	ubifs_err("cannot initialize %s compressor pool, error %d",
+		  compr->name, err);
+	pool_exit(pool);
+	return err;
 }
 
 /**
@@ -210,11 +303,61 @@ static int __init compr_init(struct ubifs_compressor *compr)
  */
 static void compr_exit(struct ubifs_compressor *compr)
 {
-	if (compr->capi_name)
-		crypto_free_comp(compr->cc);
+	if (compr->capi_name) {
+		pool_exit(compr->comp_pool);
+		pool_exit(compr->decomp_pool);
+		if (!IS_ERR_OR_NULL(compr->cc))
+			crypto_free_comp(compr->cc);
+	}
 	return;
 }
 
+/**
+ * compr_init - initialize a compressor.
+ * @compr: compressor description object
+ *
+ * This function initializes the requested compressor and returns zero in case
+ * of success or a negative error code in case of failure. Stateful directions
+ * of the compressor get a pool of handles, which both directions may share,
+ * the stateless ones share @compr->cc.
+ */
+static int __init compr_init(struct ubifs_compressor *compr)
+{
+	int err;
+
+	if (compr->capi_name) {
+		if (!compr->comp_pool || !compr->decomp_pool) {
+			compr->cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+			if (IS_ERR(compr->cc)) {
+				ubifs_err("cannot initialize compressor %s, "
+					  "error %ld", compr->name,
+					  PTR_ERR(compr->cc));
+				return PTR_ERR(compr->cc);
+			}
+		}
+
+		if (compr->comp_pool) {
+			err = pool_init(compr, compr->comp_pool);
+			if (err)
+				goto out;
+		}
+
+		if (compr->decomp_pool &&
+		    compr->decomp_pool != compr->comp_pool) {
+			err = pool_init(compr, compr->decomp_pool);
+			if (err)
+				goto out;
+		}
+	}
+
+	ubifs_compressors[compr->compr_type] = compr;
+	return 0;
+
+out:
+	compr_exit(compr);
+	return err;
+}
+
 /**
  * ubifs_compressors_init - initialize UBIFS compressors.
  *
@@ -212,6 +212,8 @@ const char *dbg_jhead(int jhead)
 		return "1 (base)";
 	case DATAHD:
 		return "2 (data)";
+	case COLDHD:
+		return "3 (cold data)";
 	default:
 		return "unknown journal head";
 	}
@@ -2903,6 +2905,110 @@ static const struct file_operations dfs_fops = {
 	.llseek = no_llseek,
 };
 
+static ssize_t dfs_stats_read(struct file *file, char __user *u, size_t count,
+			      loff_t *ppos)
+{
+	struct ubifs_info *c = file->private_data;
+	long long data_bytes = atomic64_read(&c->data_bytes);
+	long long flash_bytes = atomic64_read(&c->flash_bytes);
+	char buf[512];
+	int len;
+
+	len = snprintf(buf, sizeof(buf),
+		       "data bytes written:   %lld\n"
+		       "flash bytes written:  %lld\n"
+		       "bytes moved by GC:    %lld\n"
+		       "LEBs GC'ed:           %d\n"
+		       "LEBs GC'ed in bg:     %d\n"
+		       "foreground GC runs:   %d\n"
+		       "foreground GC ms:     %u\n",
+		       data_bytes, flash_bytes,
+		       (long long)atomic64_read(&c->gc_bytes),
+		       c->gc_seq, atomic_read(&c->bg_gc_cnt),
+		       atomic_read(&c->fg_gc_cnt),
+		       jiffies_to_msecs(atomic_long_read(&c->fg_gc_jiffies)));
+	if (data_bytes) {
+		/* In hundredths */
+		u64 wa = div64_u64(flash_bytes * 100, data_bytes);
+
+		len += snprintf(buf + len, sizeof(buf) - len,
+				"write amplification:  %llu.%02llu\n",
+				div_u64(wa, 100), wa - div_u64(wa, 100) * 100);
+	}
+
+	return simple_read_from_buffer(u, count, ppos, buf, len);
+}
+
+static const struct file_operations dfs_stats_fops = {
+	.open = dfs_file_open,
+	.read = dfs_stats_read,
+	.owner = THIS_MODULE,
+	.llseek = no_llseek,
+};
+
+/* Returns the background GC knob behind debugfs file @dent */
+static u32 *dfs_bg_gc_knob(struct ubifs_info *c, struct dentry *dent)
+{
+	struct ubifs_debug_info *d = c->dbg;
+
+	if (dent == d->dfs_bg_gc_lebs)
+		return &c->bg_gc_lebs;
+	if (dent == d->dfs_bg_gc_idle)
+		return &c->bg_gc_idle;
+	if (dent == d->dfs_bg_gc_interval)
+		return &c->bg_gc_interval;
+	return NULL;
+}
+
+static ssize_t dfs_bg_gc_read(struct file *file, char __user *u, size_t count,
+			      loff_t *ppos)
+{
+	struct ubifs_info *c = file->private_data;
+	u32 *knob = dfs_bg_gc_knob(c, file->f_path.dentry);
+	char buf[16];
+	int len;
+
+	if (!knob)
+		return -EINVAL;
+
+	len = snprintf(buf, sizeof(buf), "%u\n", *knob);
+	return simple_read_from_buffer(u, count, ppos, buf, len);
+}
+
+static ssize_t dfs_bg_gc_write(struct file *file, const char __user *u,
+			       size_t count, loff_t *ppos)
+{
+	struct ubifs_info *c = file->private_data;
+	u32 *knob = dfs_bg_gc_knob(c, file->f_path.dentry);
+	unsigned int val;
+	int err;
+
+	if (!knob)
+		return -EINVAL;
+
+	err = kstrtouint_from_user(u, count, 0, &val);
+	if (err)
+		return err;
+	*knob = val;
+
+	/*
+	 * The background thread may sleep until it is woken up, make it
+	 * recalculate when background GC has to run.
+	 */
+	c->bg_gc_done = 0;
+	ubifs_wake_up_bgt(c);
+
+	return count;
+}
+
+static const struct file_operations dfs_bg_gc_fops = {
+	.open = dfs_file_open,
+	.read = dfs_bg_gc_read,
+	.write = dfs_bg_gc_write,
+	.owner = THIS_MODULE,
+	.llseek = no_llseek,
+};
+
 /**
  * dbg_debugfs_init_fs - initialize debugfs for UBIFS instance.
  * @c: UBIFS file-system description object
@@ -3007,6 +3113,34 @@ int dbg_debugfs_init_fs(struct ubifs_info *c)
 		goto out_remove;
 	d->dfs_ro_error = dent;
 
+	fname = "stats";
+	dent = debugfs_create_file(fname, S_IRUSR, d->dfs_dir, c,
+				   &dfs_stats_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_stats = dent;
+
+	fname = "bg_gc_lebs";
+	dent = debugfs_create_file(fname, S_IRUSR | S_IWUSR, d->dfs_dir, c,
+				   &dfs_bg_gc_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_bg_gc_lebs = dent;
+
+	fname = "bg_gc_idle_ms";
+	dent = debugfs_create_file(fname, S_IRUSR | S_IWUSR, d->dfs_dir, c,
+				   &dfs_bg_gc_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_bg_gc_idle = dent;
+
+	fname = "bg_gc_interval_ms";
+	dent = debugfs_create_file(fname, S_IRUSR | S_IWUSR, d->dfs_dir, c,
+				   &dfs_bg_gc_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_bg_gc_interval = dent;
+
 	return 0;
 
 out_remove:
@@ -83,6 +83,10 @@ typedef int (*dbg_znode_callback)(struct ubifs_info *c,
  *                re-mounting to R/O mode because it does not flush any buffers
  *                and UBIFS just starts returning -EROFS on all write
  *               operations)
+ * @dfs_stats: write amplification and garbage collection statistics
+ * @dfs_bg_gc_lebs: debugfs knob for @c->bg_gc_lebs
+ * @dfs_bg_gc_idle: debugfs knob for @c->bg_gc_idle
+ * @dfs_bg_gc_interval: debugfs knob for @c->bg_gc_interval
  */
 struct ubifs_debug_info {
 	struct ubifs_zbranch old_zroot;
@@ -127,6 +131,10 @@ struct ubifs_debug_info {
 	struct dentry *dfs_chk_fs;
 	struct dentry *dfs_tst_rcvry;
 	struct dentry *dfs_ro_error;
+	struct dentry *dfs_stats;
+	struct dentry *dfs_bg_gc_lebs;
+	struct dentry *dfs_bg_gc_idle;
+	struct dentry *dfs_bg_gc_interval;
 };
 
 /**
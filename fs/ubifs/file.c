@@ -608,7 +608,7 @@ out:
 static int populate_page(struct ubifs_info *c, struct page *page,
 			 struct bu_info *bu, int *n)
 {
-	int i = 0, nn = *n, offs = bu->zbranch[0].offs, hole = 0, read = 0;
+	int i = 0, nn = *n, hole = 0, read = 0;
 	struct inode *inode = page->mapping->host;
 	loff_t i_size = i_size_read(inode);
 	unsigned int page_block;
@@ -637,7 +637,7 @@ static int populate_page(struct ubifs_info *c, struct page *page,
 		} else if (key_block(c, &bu->zbranch[nn].key) == page_block) {
 			struct ubifs_data_node *dn;
 
-			dn = bu->buf + (bu->zbranch[nn].offs - offs);
+			dn = bu->buf + bu->buf_offs[nn];
 
 			ubifs_assert(le64_to_cpu(dn->ch.sqnum) >
 				     ubifs_inode(inode)->creat_sqnum);
@@ -707,6 +707,10 @@ out_err:
  * @bu: bulk-read information
  * @page1: first page to read
  *
+ * The data nodes are read run by run (see 'struct bu_info'), and the page
+ * cache pages are populated as soon as all the data nodes they need have been
+ * read, rather than after the whole bulk-read has completed.
+ *
  * This function returns %1 if the bulk-read is done, otherwise %0 is returned.
  */
 static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
@@ -716,7 +720,7 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 	struct address_space *mapping = page1->mapping;
 	struct inode *inode = mapping->host;
 	struct ubifs_inode *ui = ubifs_inode(inode);
-	int err, page_idx, page_cnt, ret = 0, n = 0;
+	int err, page_idx = 0, page_cnt, ret = 0, n = 0, run = 0;
 	int allocate = bu->buf ? 0 : 1;
 	loff_t isize;
 
@@ -741,57 +745,83 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 		goto out_bu_off;
 	}
 
-	if (bu->cnt) {
-		if (allocate) {
-			/*
-			 * Allocate bulk-read buffer depending on how many data
-			 * nodes we are going to read.
-			 */
-			bu->buf_len = bu->zbranch[bu->cnt - 1].offs +
-				      bu->zbranch[bu->cnt - 1].len -
-				      bu->zbranch[0].offs;
-			ubifs_assert(bu->buf_len > 0);
-			ubifs_assert(bu->buf_len <= c->leb_size);
-			bu->buf = kmalloc(bu->buf_len, GFP_NOFS | __GFP_NOWARN);
-			if (!bu->buf)
-				goto out_bu_off;
-		}
+	if (bu->cnt && allocate) {
+		/*
+		 * Allocate bulk-read buffer depending on how many data nodes we
+		 * are going to read.
+		 */
+		bu->buf_len = bu->buf_offs[bu->cnt - 1] +
+			      bu->zbranch[bu->cnt - 1].len;
+		ubifs_assert(bu->buf_len > 0);
+		ubifs_assert(bu->buf_len <= c->max_bu_buf_len);
+		bu->buf = kmalloc(bu->buf_len, GFP_NOFS | __GFP_NOWARN);
+		if (!bu->buf)
+			goto out_bu_off;
+	}
 
-		err = ubifs_tnc_bulk_read(c, bu);
-		if (err)
-			goto out_warn;
+	/* Do not go beyond the end of the file, except for the first page */
+	isize = i_size_read(inode);
+	if (isize == 0)
+		page_cnt = 1;
+	else {
+		end_index = ((isize - 1) >> PAGE_CACHE_SHIFT);
+		if (end_index <= offset)
+			page_cnt = 1;
+		else if (end_index - offset + 1 < page_cnt)
+			page_cnt = end_index - offset + 1;
 	}
 
-	err = populate_page(c, page1, bu, &n);
-	if (err)
-		goto out_warn;
+	do {
+		int limit = page_cnt;
 
-	unlock_page(page1);
-	ret = 1;
+		if (run < bu->run_cnt) {
+			err = ubifs_tnc_bulk_read(c, bu, run);
+			if (err)
+				goto out_warn;
+			run += 1;
+		}
 
-	isize = i_size_read(inode);
-	if (isize == 0)
-		goto out_free;
-	end_index = ((isize - 1) >> PAGE_CACHE_SHIFT);
+		/*
+		 * Pages which end before the first block of the next run have
+		 * all their data nodes read, so they may be populated now.
+		 */
+		if (run < bu->run_cnt) {
+			struct ubifs_zbranch *zbr;
+			unsigned int block;
+
+			zbr = &bu->zbranch[bu->runs[run].first];
+			block = key_block(c, &zbr->key);
+			block >>= UBIFS_BLOCKS_PER_PAGE_SHIFT;
+			if (block - offset < limit)
+				limit = block - offset;
+		}
 
-	for (page_idx = 1; page_idx < page_cnt; page_idx++) {
-		pgoff_t page_offset = offset + page_idx;
-		struct page *page;
+		for (; page_idx < limit; page_idx++) {
+			struct page *page;
 
-		if (page_offset > end_index)
-			break;
-		page = find_or_create_page(mapping, page_offset,
-					   GFP_NOFS | __GFP_COLD);
-		if (!page)
-			break;
-		if (!PageUptodate(page))
-			err = populate_page(c, page, bu, &n);
-		unlock_page(page);
-		page_cache_release(page);
-		if (err)
-			break;
-	}
+			if (page_idx == 0) {
+				err = populate_page(c, page1, bu, &n);
+				if (err)
+					goto out_warn;
+				unlock_page(page1);
+				ret = 1;
+				continue;
+			}
+
+			page = find_or_create_page(mapping, offset + page_idx,
+						   GFP_NOFS | __GFP_COLD);
+			if (!page)
+				goto out_done;
+			if (!PageUptodate(page))
+				err = populate_page(c, page, bu, &n);
+			unlock_page(page);
+			page_cache_release(page);
+			if (err)
+				goto out_done;
+		}
+	} while (run < bu->run_cnt);
 
+out_done:
 	ui->last_page_read = offset + page_idx - 1;
 
 out_free:
@@ -801,6 +831,9 @@ out_free:
 
 out_warn:
 	ubifs_warn("ignoring error %d and skipping bulk-read", err);
+	if (ret)
+		/* The first page is done, the rest will be read page by page */
+		goto out_done;
 	goto out_free;
 
 out_bu_off:
@@ -814,8 +847,10 @@ out_bu_off:
  *
  * Some flash media are capable of reading sequentially at faster rates. UBIFS
  * bulk-read facility is designed to take advantage of that, by reading in one
- * go consecutive data nodes that are also located consecutively in the same
- * LEB. This function returns %1 if a bulk-read is done and %0 otherwise.
+ * go consecutive data nodes that are also located consecutively on the flash.
+ * A bulk-read may span several LEBs, in which case each group of consecutive
+ * data nodes is read separately. This function returns %1 if a bulk-read is
+ * done and %0 otherwise.
  */
 static int ubifs_bulk_read(struct page *page)
 {
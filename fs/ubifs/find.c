@@ -198,6 +198,58 @@ static const struct ubifs_lprops *scan_for_dirty(struct ubifs_info *c,
 	return lprops;
 }
 
+/**
+ * cost_benefit - calculate the cost-benefit ratio of garbage collecting a LEB.
+ * @c: the UBIFS file-system description object
+ * @lp: LEB properties
+ * @now: current time in seconds
+ *
+ * Garbage collecting a LEB with utilization u (used space / LEB size) frees
+ * 1 - u of a LEB at the cost of reading the LEB and writing u of it. The free
+ * space is worth more the older the data in the LEB are, because old data are
+ * cold and are unlikely to become dirty by themselves. So the LEB with the
+ * highest (1 - u) * age / (1 + u) is the best to garbage collect.
+ */
+static unsigned long long cost_benefit(const struct ubifs_info *c,
+				       const struct ubifs_lprops *lp, u32 now)
+{
+	unsigned long long age = now - c->leb_wtime[lp->lnum - c->main_first];
+	int space = lp->free + lp->dirty;
+
+	return div_u64((age + 1) * space, 2 * c->leb_size - space);
+}
+
+/**
+ * best_dirty_leb - find the LEB with the best cost-benefit on the dirty heap.
+ * @c: the UBIFS file-system description object
+ * @min_space: minimum amount free plus dirty space the LEB has to have
+ *
+ * This function returns the LEB on the dirty heap with the highest
+ * cost-benefit ratio, or %NULL if no LEB has @min_space free and dirty space.
+ */
+static const struct ubifs_lprops *best_dirty_leb(struct ubifs_info *c,
+						 int min_space)
+{
+	struct ubifs_lpt_heap *heap = &c->lpt_heap[LPROPS_DIRTY - 1];
+	const struct ubifs_lprops *lp, *best = NULL;
+	unsigned long long cb, best_cb = 0;
+	u32 now = ubifs_leb_time();
+	int i;
+
+	for (i = 0; i < heap->cnt; i++) {
+		lp = heap->arr[i];
+		if (lp->free + lp->dirty < min_space)
+			continue;
+		cb = cost_benefit(c, lp, now);
+		if (!best || cb > best_cb) {
+			best = lp;
+			best_cb = cb;
+		}
+	}
+
+	return best;
+}
+
 /**
  * ubifs_find_dirty_leb - find a dirty LEB for the Garbage Collector.
  * @c: the UBIFS file-system description object
@@ -226,6 +278,9 @@ static const struct ubifs_lprops *scan_for_dirty(struct ubifs_info *c,
  * In addition @pick_free is set to %2 by the recovery process in order to
  * recover gc_lnum in which case an index LEB must not be returned.
  *
+ * With hot/cold data separation, the LEB with the best cost-benefit ratio is
+ * taken from the dirty heap rather than the one with the most space.
+ *
  * This function returns zero and the LEB properties of found dirty LEB in case
  * of success, %-ENOSPC if no dirty LEB was found and a negative error code in
  * case of other failures. The returned LEB is marked as "taken".
@@ -301,7 +356,9 @@ int ubifs_find_dirty_leb(struct ubifs_info *c, struct ubifs_lprops *ret_lp,
 			idx_lp = NULL;
 	}
 
-	if (heap->cnt) {
+	if (c->hot_cold)
+		lp = best_dirty_leb(c, min_space);
+	else if (heap->cnt) {
 		lp = heap->arr[0];
 		if (lp->dirty + lp->free < min_space)
 			lp = NULL;
@@ -107,6 +107,9 @@ static int switch_gc_head(struct ubifs_info *c)
 	err = ubifs_add_bud_to_log(c, GCHD, gc_lnum, 0);
 	if (err)
 		return err;
+	/* The time is raised by 'move_node()' as data are moved there */
+	if (c->leb_wtime)
+		c->leb_wtime[gc_lnum - c->main_first] = 0;
 
 	c->gc_lnum = -1;
 	err = ubifs_wbuf_seek_nolock(wbuf, gc_lnum, 0);
@@ -315,8 +318,10 @@ static int sort_nodes(struct ubifs_info *c, struct ubifs_scan_leb *sleb,
  * @wbuf: write-buffer to move node to
  *
  * This function moves node @snod to @wbuf, changes TNC correspondingly, and
- * destroys @snod. Returns zero in case of success and a negative error code in
- * case of failure.
+ * destroys @snod. The write time of the GC head LEB becomes that of the
+ * youngest data moved to it, so that moved data are not taken for new data by
+ * cost-benefit garbage collection. Returns zero in case of success and a
+ * negative error code in case of failure.
  */
 static int move_node(struct ubifs_info *c, struct ubifs_scan_leb *sleb,
 		     struct ubifs_scan_node *snod, struct ubifs_wbuf *wbuf)
@@ -327,6 +332,13 @@ static int move_node(struct ubifs_info *c, struct ubifs_scan_leb *sleb,
 	err = ubifs_wbuf_write_nolock(wbuf, snod->node, snod->len);
 	if (err)
 		return err;
+	atomic64_add(snod->len, &c->gc_bytes);
+
+	if (c->leb_wtime) {
+		u32 *wtime = &c->leb_wtime[new_lnum - c->main_first];
+
+		*wtime = max(*wtime, c->leb_wtime[sleb->lnum - c->main_first]);
+	}
 
 	err = ubifs_tnc_replace(c, &snod->key, sleb->lnum,
 				snod->offs, new_lnum, new_offs,
@@ -610,44 +622,18 @@ out_inc_seq:
 }
 
 /**
- * ubifs_garbage_collect - UBIFS garbage collector.
+ * do_garbage_collect - garbage collect LEBs with enough free and dirty space.
  * @c: UBIFS file-system description object
  * @anyway: do GC even if there are free LEBs
+ * @min_floor: only pick LEBs with at least this much free and dirty space
  *
- * This function does out-of-place garbage collection. The return codes are:
- *   o positive LEB number if the LEB has been freed and may be used;
- *   o %-EAGAIN if the caller has to run commit;
- *   o %-ENOSPC if GC failed to make any progress;
- *   o other negative error codes in case of other errors.
- *
- * Garbage collector writes data to the journal when GC'ing data LEBs, and just
- * marking indexing nodes dirty when GC'ing indexing LEBs. Thus, at some point
- * commit may be required. But commit cannot be run from inside GC, because the
- * caller might be holding the commit lock, so %-EAGAIN is returned instead;
- * And this error code means that the caller has to run commit, and re-run GC
- * if there is still no free space.
- *
- * There are many reasons why this function may return %-EAGAIN:
- * o the log is full and there is no space to write an LEB reference for
- *   @c->gc_lnum;
- * o the journal is too large and exceeds size limitations;
- * o GC moved indexing LEBs, but they can be used only after the commit;
- * o the shrinker fails to find clean znodes to free and requests the commit;
- * o etc.
- *
- * Note, if the file-system is close to be full, this function may return
- * %-EAGAIN infinitely, so the caller has to limit amount of re-invocations of
- * the function. E.g., this happens if the limits on the journal size are too
- * tough and GC writes too much to the journal before an LEB is freed. This
- * might also mean that the journal is too large, and the TNC becomes to big,
- * so that the shrinker is constantly called, finds not clean znodes to free,
- * and requests commit. Well, this may also happen if the journal is all right,
- * but another kernel process consumes too much memory. Anyway, infinite
- * %-EAGAIN may happen, but in some extreme/misconfiguration cases.
+ * This is the body of 'ubifs_garbage_collect()', see there for the return
+ * codes. It never picks LEBs with less than @min_floor free and dirty space,
+ * 'ubifs_garbage_collect()' passes @c->dead_wm.
  */
-int ubifs_garbage_collect(struct ubifs_info *c, int anyway)
+static int do_garbage_collect(struct ubifs_info *c, int anyway, int min_floor)
 {
-	int i, err, ret, min_space = c->dead_wm;
+	int i, err, ret, min_space = min_floor;
 	struct ubifs_lprops lp;
 	struct ubifs_wbuf *wbuf = &c->jheads[GCHD].wbuf;
 
@@ -765,8 +751,8 @@ int ubifs_garbage_collect(struct ubifs_info *c, int anyway)
 		if (space_after > space_before) {
 			/* GC makes progress, keep working */
 			min_space >>= 1;
-			if (min_space < c->dead_wm)
-				min_space = c->dead_wm;
+			if (min_space < min_floor)
+				min_space = min_floor;
 			continue;
 		}
 
@@ -794,8 +780,8 @@ int ubifs_garbage_collect(struct ubifs_info *c, int anyway)
 		}
 
 		min_space <<= 1;
-		if (min_space > c->dark_wm)
-			min_space = c->dark_wm;
+		if (min_space > max(c->dark_wm, min_floor))
+			min_space = max(c->dark_wm, min_floor);
 		dbg_gc("set min. space to %d", min_space);
 	}
 
@@ -826,6 +812,102 @@ out:
 	return ret;
 }
 
+/**
+ * ubifs_garbage_collect - UBIFS garbage collector.
+ * @c: UBIFS file-system description object
+ * @anyway: do GC even if there are free LEBs
+ *
+ * This function does out-of-place garbage collection. The return codes are:
+ *   o positive LEB number if the LEB has been freed and may be used;
+ *   o %-EAGAIN if the caller has to run commit;
+ *   o %-ENOSPC if GC failed to make any progress;
+ *   o other negative error codes in case of other errors.
+ *
+ * Garbage collector writes data to the journal when GC'ing data LEBs, and just
+ * marking indexing nodes dirty when GC'ing indexing LEBs. Thus, at some point
+ * commit may be required. But commit cannot be run from inside GC, because the
+ * caller might be holding the commit lock, so %-EAGAIN is returned instead;
+ * And this error code means that the caller has to run commit, and re-run GC
+ * if there is still no free space.
+ *
+ * There are many reasons why this function may return %-EAGAIN:
+ * o the log is full and there is no space to write an LEB reference for
+ *   @c->gc_lnum;
+ * o the journal is too large and exceeds size limitations;
+ * o GC moved indexing LEBs, but they can be used only after the commit;
+ * o the shrinker fails to find clean znodes to free and requests the commit;
+ * o etc.
+ *
+ * Note, if the file-system is close to be full, this function may return
+ * %-EAGAIN infinitely, so the caller has to limit amount of re-invocations of
+ * the function. E.g., this happens if the limits on the journal size are too
+ * tough and GC writes too much to the journal before an LEB is freed. This
+ * might also mean that the journal is too large, and the TNC becomes to big,
+ * so that the shrinker is constantly called, finds not clean znodes to free,
+ * and requests commit. Well, this may also happen if the journal is all right,
+ * but another kernel process consumes too much memory. Anyway, infinite
+ * %-EAGAIN may happen, but in some extreme/misconfiguration cases.
+ */
+int ubifs_garbage_collect(struct ubifs_info *c, int anyway)
+{
+	return do_garbage_collect(c, anyway, c->dead_wm);
+}
+
+/**
+ * ubifs_bg_gc - garbage collect in background.
+ * @c: UBIFS file-system description object
+ *
+ * This function is called by the background thread when the journal has been
+ * idle for a while. If there are fewer clean LEBs than @c->bg_gc_lebs, it
+ * garbage collects dirty LEBs until one LEB is freed, so that writers find a
+ * clean LEB when they need one instead of running GC themselves. Only LEBs
+ * which are at least half free and dirty are garbage collected, because
+ * collecting fuller LEBs costs more than it is worth while there is no
+ * pressure. Returns %1 if a LEB has been cleaned and there may be more work to
+ * do, %0 if there is nothing to do, and a negative error code in case of
+ * failure.
+ */
+int ubifs_bg_gc(struct ubifs_info *c)
+{
+	int err, lnum, clean, worth_it;
+	const struct ubifs_lpt_heap *heap;
+
+	if (!c->bg_gc_lebs || c->ro_error)
+		return 0;
+
+	ubifs_get_lprops(c);
+	clean = c->lst.empty_lebs - c->lst.taken_empty_lebs + c->freeable_cnt;
+	heap = &c->lpt_heap[LPROPS_DIRTY - 1];
+	worth_it = heap->cnt &&
+		   heap->arr[0]->free + heap->arr[0]->dirty >= c->leb_size / 2;
+	ubifs_release_lprops(c);
+
+	if (clean >= c->bg_gc_lebs || !worth_it)
+		return 0;
+
+	dbg_gc("%d clean LEBs, want %u, run GC", clean, c->bg_gc_lebs);
+	down_read(&c->commit_sem);
+	lnum = do_garbage_collect(c, 1, c->leb_size / 2);
+	up_read(&c->commit_sem);
+	if (lnum == -EAGAIN) {
+		/* Let the background thread commit and try again later */
+		ubifs_request_bg_commit(c);
+		return 1;
+	}
+	if (lnum == -ENOSPC)
+		return 0;
+	if (lnum < 0)
+		return lnum;
+
+	err = ubifs_return_leb(c, lnum);
+	if (err)
+		return err;
+
+	atomic_inc(&c->bg_gc_cnt);
+	dbg_gc("LEB %d cleaned in background", lnum);
+	return 1;
+}
+
 /**
  * ubifs_gc_start_commit - garbage collection at start of commit.
  * @c: UBIFS file-system description object
@@ -72,6 +72,7 @@
 
 #include <linux/crc32.h>
 #include <linux/slab.h>
+#include <crypto/hash.h>
 #include "ubifs.h"
 
 /**
@@ -131,8 +132,10 @@ int ubifs_leb_write(struct ubifs_info *c, int lnum, const void *buf, int offs,
 			  len, lnum, offs, err);
 		ubifs_ro_mode(c, err);
 		dump_stack();
+		return err;
 	}
-	return err;
+	atomic64_add(len, &c->flash_bytes);
+	return 0;
 }
 
 int ubifs_leb_change(struct ubifs_info *c, int lnum, const void *buf, int len)
@@ -151,8 +154,10 @@ int ubifs_leb_change(struct ubifs_info *c, int lnum, const void *buf, int len)
 			  len, lnum, err);
 		ubifs_ro_mode(c, err);
 		dump_stack();
+		return err;
 	}
-	return err;
+	atomic64_add(len, &c->flash_bytes);
+	return 0;
 }
 
 int ubifs_leb_unmap(struct ubifs_info *c, int lnum)
@@ -206,6 +211,86 @@ int ubifs_is_mapped(const struct ubifs_info *c, int lnum)
 	return err;
 }
 
+#ifdef CONFIG_UBIFS_FS_CRYPTO_CRC32
+/**
+ * ubifs_crc_init - set up accelerated CRC32 calculation.
+ * @c: UBIFS file-system description object
+ *
+ * UBIFS checks the CRC32 of every node it reads, and this dominates the scan,
+ * replay and recovery time. If an architecture-specific implementation of the
+ * "crc32" hash is registered with the crypto API, this function sets it up
+ * for @c. Otherwise the library 'crc32()' function stays in use, because it is
+ * what the generic "crc32" hash would call anyway, just without the indirect
+ * calls.
+ */
+void ubifs_crc_init(struct ubifs_info *c)
+{
+	struct crypto_shash *tfm;
+	__le32 seed = cpu_to_le32(UBIFS_CRC32_INIT);
+	const char *drv;
+
+	tfm = crypto_alloc_shash("crc32", 0, 0);
+	if (IS_ERR(tfm))
+		return;
+
+	drv = crypto_tfm_alg_driver_name(crypto_shash_tfm(tfm));
+	if (!strcmp(drv, "crc32-generic") ||
+	    crypto_shash_setkey(tfm, (u8 *)&seed, sizeof(seed))) {
+		crypto_free_shash(tfm);
+		return;
+	}
+
+	dbg_gen("using \"%s\" for CRC32", drv);
+	c->crc_tfm = tfm;
+}
+
+/**
+ * ubifs_crc_exit - release accelerated CRC32 calculation.
+ * @c: UBIFS file-system description object
+ */
+void ubifs_crc_exit(struct ubifs_info *c)
+{
+	if (c->crc_tfm)
+		crypto_free_shash(c->crc_tfm);
+	c->crc_tfm = NULL;
+}
+
+/**
+ * ubifs_crc32 - calculate the CRC32 of a node.
+ * @c: UBIFS file-system description object
+ * @buf: data to calculate the CRC32 of
+ * @len: length of the data
+ *
+ * This function returns the same as 'crc32(UBIFS_CRC32_INIT, buf, len)', but
+ * uses the accelerated "crc32" hash when there is one.
+ */
+uint32_t ubifs_crc32(const struct ubifs_info *c, const void *buf, int len)
+{
+	struct crypto_shash *tfm = c->crc_tfm;
+	__le32 crc;
+	int err;
+
+	if (!tfm)
+		return crc32(UBIFS_CRC32_INIT, buf, len);
+
+	{
+		struct {
+			struct shash_desc shash;
+			char ctx[crypto_shash_descsize(tfm)];
+		} desc;
+
+		desc.shash.tfm = tfm;
+		desc.shash.flags = 0;
+		err = crypto_shash_digest(&desc.shash, buf, len, (u8 *)&crc);
+	}
+	if (unlikely(err))
+		/* Should never happen, fall back to the library function */
+		return crc32(UBIFS_CRC32_INIT, buf, len);
+
+	return le32_to_cpu(crc);
+}
+#endif
+
 /**
  * ubifs_check_node - check node.
  * @c: UBIFS file-system description object
@@ -275,7 +360,7 @@ int ubifs_check_node(const struct ubifs_info *c, const void *buf, int lnum,
 	    !c->remounting_rw && c->no_chk_data_crc)
 		return 0;
 
-	crc = crc32(UBIFS_CRC32_INIT, buf + 8, node_len - 8);
+	crc = ubifs_crc32(c, buf + 8, node_len - 8);
 	node_crc = le32_to_cpu(ch->crc);
 	if (crc != node_crc) {
 		if (!quiet)
@@ -333,7 +418,7 @@ void ubifs_pad(const struct ubifs_info *c, void *buf, int pad)
 		ch->len = cpu_to_le32(UBIFS_PAD_NODE_SZ);
 		pad -= UBIFS_PAD_NODE_SZ;
 		pad_node->pad_len = cpu_to_le32(pad);
-		crc = crc32(UBIFS_CRC32_INIT, buf + 8, UBIFS_PAD_NODE_SZ - 8);
+		crc = ubifs_crc32(c, buf + 8, UBIFS_PAD_NODE_SZ - 8);
 		ch->crc = cpu_to_le32(crc);
 		memset(buf + UBIFS_PAD_NODE_SZ, 0, pad);
 	} else if (pad > 0)
@@ -389,7 +474,7 @@ void ubifs_prepare_node(struct ubifs_info *c, void *node, int len, int pad)
 	ch->group_type = UBIFS_NO_NODE_GROUP;
 	ch->sqnum = cpu_to_le64(sqnum);
 	ch->padding[0] = ch->padding[1] = 0;
-	crc = crc32(UBIFS_CRC32_INIT, node + 8, len - 8);
+	crc = ubifs_crc32(c, node + 8, len - 8);
 	ch->crc = cpu_to_le32(crc);
 
 	if (pad) {
@@ -425,7 +510,7 @@ void ubifs_prep_grp_node(struct ubifs_info *c, void *node, int len, int last)
 		ch->group_type = UBIFS_IN_NODE_GROUP;
 	ch->sqnum = cpu_to_le64(sqnum);
 	ch->padding[0] = ch->padding[1] = 0;
-	crc = crc32(UBIFS_CRC32_INIT, node + 8, len - 8);
+	crc = ubifs_crc32(c, node + 8, len - 8);
 	ch->crc = cpu_to_le32(crc);
 }
 
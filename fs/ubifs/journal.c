@@ -116,6 +116,7 @@ static int reserve_space(struct ubifs_info *c, int jhead, int len)
 {
 	int err = 0, err1, retries = 0, avail, lnum, offs, squeeze;
 	struct ubifs_wbuf *wbuf = &c->jheads[jhead].wbuf;
+	unsigned long start;
 
 	/*
 	 * Typically, the base head has smaller nodes written to it, so it is
@@ -156,7 +157,9 @@ again:
 	dbg_jnl("no free space in jhead %s, run GC", dbg_jhead(jhead));
 	mutex_unlock(&wbuf->io_mutex);
 
+	start = jiffies;
 	lnum = ubifs_garbage_collect(c, 0);
+	ubifs_fg_gc_done(c, start);
 	if (lnum < 0) {
 		err = lnum;
 		if (err != -ENOSPC)
@@ -324,6 +327,17 @@ static int make_reservation(struct ubifs_info *c, int jhead, int len)
 {
 	int err, cmt_retries = 0, nospc_retries = 0;
 
+	/* Tell background GC that the journal is busy */
+	c->jnl_time = jiffies;
+	if (unlikely(c->bg_gc_done) && c->bgt) {
+		/*
+		 * Background GC found nothing to do, and the background
+		 * thread sleeps until it is woken up. New data may make
+		 * background GC worth it again.
+		 */
+		c->bg_gc_done = 0;
+		wake_up_process(c->bgt);
+	}
 again:
 	down_read(&c->commit_sem);
 	err = reserve_space(c, jhead, len);
@@ -678,6 +692,47 @@ out_ro:
 	return err;
 }
 
+/**
+ * data_jhead - select the journal head for a data node.
+ * @c: UBIFS file-system description object
+ * @inode: inode the data node belongs to
+ * @key: data node key
+ *
+ * With hot/cold separation, data which overwrites data of an inode which was
+ * overwritten often recently is "hot" and goes to the data journal head, and
+ * the rest is "cold" and goes to the cold data journal head. This way, hot
+ * and cold data end up in different LEBs: hot LEBs become dirty soon and are
+ * cheap to garbage collect, and cold LEBs stay full, so the garbage collector
+ * does not have to move the cold data over and over again.
+ *
+ * The temperature of an inode is increased by every block written below the
+ * synchronized inode size, and halves every %UBIFS_TEMP_HALFLIFE seconds.
+ */
+static int data_jhead(struct ubifs_info *c, const struct inode *inode,
+		      const union ubifs_key *key)
+{
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	loff_t pos = (loff_t)key_block(c, key) << UBIFS_BLOCK_SHIFT;
+	unsigned long shift;
+	int hot;
+
+	if (!c->hot_cold)
+		return DATAHD;
+
+	spin_lock(&ui->ui_lock);
+	shift = (jiffies - ui->temp_time) / (UBIFS_TEMP_HALFLIFE * HZ);
+	if (shift) {
+		ui->temp = shift < 32 ? ui->temp >> shift : 0;
+		ui->temp_time = jiffies;
+	}
+	if (pos < ui->synced_i_size)
+		ui->temp += 1;
+	hot = ui->temp >= UBIFS_HOT_TEMP;
+	spin_unlock(&ui->ui_lock);
+
+	return hot ? DATAHD : COLDHD;
+}
+
 /**
  * ubifs_jnl_write_data - write a data node to the journal.
  * @c: UBIFS file-system description object
@@ -693,7 +748,7 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len)
 {
 	struct ubifs_data_node *data;
-	int err, lnum, offs, compr_type, out_len;
+	int err, lnum, offs, compr_type, out_len, jhead;
 	int dlen = COMPRESSED_DATA_NODE_BUF_SZ, allocated = 1;
 	struct ubifs_inode *ui = ubifs_inode(inode);
 
@@ -734,15 +789,17 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 	data->compr_type = cpu_to_le16(compr_type);
 
 	/* Make reservation before allocating sequence numbers */
-	err = make_reservation(c, DATAHD, dlen);
+	jhead = data_jhead(c, inode, key);
+	err = make_reservation(c, jhead, dlen);
 	if (err)
 		goto out_free;
 
-	err = write_node(c, DATAHD, data, dlen, &lnum, &offs);
+	err = write_node(c, jhead, data, dlen, &lnum, &offs);
 	if (err)
 		goto out_release;
-	ubifs_wbuf_add_ino_nolock(&c->jheads[DATAHD].wbuf, key_inum(c, key));
-	release_head(c, DATAHD);
+	ubifs_wbuf_add_ino_nolock(&c->jheads[jhead].wbuf, key_inum(c, key));
+	release_head(c, jhead);
+	atomic64_add(len, &c->data_bytes);
 
 	err = ubifs_tnc_add(c, key, lnum, offs, dlen);
 	if (err)
@@ -756,7 +813,7 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 	return 0;
 
 out_release:
-	release_head(c, DATAHD);
+	release_head(c, jhead);
 out_ro:
 	ubifs_ro_mode(c, err);
 	finish_reservation(c);
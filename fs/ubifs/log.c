@@ -273,6 +273,9 @@ int ubifs_add_bud_to_log(struct ubifs_info *c, int jhead, int lnum, int offs)
 	c->lhead_offs += c->ref_node_alsz;
 
 	ubifs_add_bud(c, bud);
+	/* GC head LEBs take the times of the data moved there, see gc.c */
+	if (c->leb_wtime && jhead != GCHD)
+		c->leb_wtime[lnum - c->main_first] = ubifs_leb_time();
 
 	mutex_unlock(&c->log_mutex);
 	kfree(ref);
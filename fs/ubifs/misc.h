@@ -61,6 +61,17 @@ static inline int ubifs_zn_cow(const struct ubifs_znode *znode)
 	return !!test_bit(COW_ZNODE, &znode->flags);
 }
 
+/**
+ * ubifs_fg_gc_done - account garbage collection run by a writer.
+ * @c: UBIFS file-system description object
+ * @start: when garbage collection started (jiffies)
+ */
+static inline void ubifs_fg_gc_done(struct ubifs_info *c, unsigned long start)
+{
+	atomic_inc(&c->fg_gc_cnt);
+	atomic_long_add(jiffies - start, &c->fg_gc_jiffies);
+}
+
 /**
  * ubifs_wake_up_bgt - wake up background thread.
  * @c: UBIFS file-system description object
@@ -239,6 +250,21 @@ static inline struct timespec ubifs_current_time(struct inode *inode)
 		current_fs_time(inode->i_sb) : CURRENT_TIME_SEC;
 }
 
+/**
+ * ubifs_leb_time - current time for LEB ages.
+ *
+ * This helper function returns the seconds since boot. Unlike the wall-clock
+ * time, it never goes backwards, so LEB ages stay meaningful when the clock is
+ * set.
+ */
+static inline u32 ubifs_leb_time(void)
+{
+	struct timespec ts;
+
+	get_monotonic_boottime(&ts);
+	return ts.tv_sec;
+}
+
 /**
  * ubifs_tnc_lookup - look up a file-system node.
  * @c: UBIFS file-system description object
@@ -1462,7 +1462,7 @@ static int fix_size_in_place(struct ubifs_info *c, struct size_entry *e)
 	ino = c->sbuf + offs;
 	ino->size = cpu_to_le64(e->d_size);
 	len = le32_to_cpu(ino->ch.len);
-	crc = crc32(UBIFS_CRC32_INIT, (void *)ino + 8, len - 8);
+	crc = ubifs_crc32(c, (void *)ino + 8, len - 8);
 	ino->ch.crc = cpu_to_le32(crc);
 	/* Work out where data in the LEB ends and free space begins */
 	p = c->sbuf;
@@ -22,7 +22,7 @@
 
 /*
  * This file contains journal replay code. It runs when the file-system is being
- * mounted and requires no locking.
+ * mounted and requires no locking, except for the bud scanner threads below.
  *
  * The larger is the journal, the longer it takes to scan it, so the longer it
  * takes to mount UBIFS. This is why the journal has limited size which may be
@@ -30,10 +30,22 @@
  * faster I/O speed because it writes the index less frequently. So this is a
  * trade-off. Also, the journal is indexed by the in-memory index (TNC), so the
  * larger is the journal, the more memory its index may consume.
+ *
+ * Most of the replay time is spent reading and checking the buds, so when
+ * there are several CPUs, buds are scanned by a few scanner threads in
+ * parallel. Each thread scans one bud at a time into its own LEB-sized buffer,
+ * while the replaying thread takes the scanned buds in the log order and adds
+ * their nodes to the replay list, which keeps the order-dependent part of the
+ * replay sequential.
  */
 
 #include "ubifs.h"
 #include <linux/list_sort.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+
+/* Maximum number of bud scanner threads */
+#define MAX_REPLAY_SCANNERS 4
 
 /**
  * struct replay_entry - replay list entry.
@@ -76,6 +88,10 @@ struct replay_entry {
  * @sqnum: reference node sequence number
  * @free: free bytes in the bud
  * @dirty: dirty bytes in the bud
+ * @recover: non-zero if the bud has to be recovered rather than scanned
+ * @sleb: the bud scanned by a scanner thread
+ * @scanner: the scanner thread which scanned the bud
+ * @scanned: completed when @sleb has been set by the scanner thread
  */
 struct bud_entry {
 	struct list_head list;
@@ -83,6 +99,42 @@ struct bud_entry {
 	unsigned long long sqnum;
 	int free;
 	int dirty;
+	unsigned int recover:1;
+	struct ubifs_scan_leb *sleb;
+	struct replay_scanner *scanner;
+	struct completion scanned;
+};
+
+/**
+ * struct replay_scanner - bud scanner thread.
+ * @rs: the replay scan this thread belongs to
+ * @sbuf: LEB-sized buffer the buds are scanned into
+ * @buf_free: completed when @sbuf may be re-used for the next bud
+ * @exited: completed when the thread exits
+ */
+struct replay_scanner {
+	struct replay_scan *rs;
+	void *sbuf;
+	struct completion buf_free;
+	struct completion exited;
+};
+
+/**
+ * struct replay_scan - parallel bud scanning state.
+ * @c: UBIFS file-system description object
+ * @lock: protects @next
+ * @next: the last bud taken by a scanner thread
+ * @abort: non-zero if the scanner threads have to stop
+ * @cnt: count of scanner threads
+ * @scanners: the scanner threads
+ */
+struct replay_scan {
+	struct ubifs_info *c;
+	spinlock_t lock;
+	struct bud_entry *next;
+	int abort;
+	int cnt;
+	struct replay_scanner scanners[MAX_REPLAY_SCANNERS];
 };
 
 /**
@@ -530,36 +582,50 @@ static int is_last_bud(struct ubifs_info *c, struct ubifs_bud *bud)
 }
 
 /**
- * replay_bud - replay a bud logical eraseblock.
+ * scan_bud - scan a bud logical eraseblock.
  * @c: UBIFS file-system description object
  * @b: bud entry which describes the bud
+ * @sbuf: LEB-sized buffer to scan the bud into
  *
- * This function replays bud @bud, recovers it if needed, and adds all nodes
- * from this bud to the replay list. Returns zero in case of success and a
- * negative error code in case of failure.
+ * This function scans bud @b, or recovers it if needed. Only the replaying
+ * thread may recover buds. Returns the scanned information in case of success
+ * and an error code in case of failure.
  */
-static int replay_bud(struct ubifs_info *c, struct bud_entry *b)
+static struct ubifs_scan_leb *scan_bud(struct ubifs_info *c,
+				       struct bud_entry *b, void *sbuf)
 {
-	int is_last = is_last_bud(c, b->bud);
-	int err = 0, used = 0, lnum = b->bud->lnum, offs = b->bud->start;
-	struct ubifs_scan_leb *sleb;
-	struct ubifs_scan_node *snod;
-
-	dbg_mnt("replay bud LEB %d, head %d, offs %d, is_last %d",
-		lnum, b->bud->jhead, offs, is_last);
+	int lnum = b->bud->lnum, offs = b->bud->start;
 
-	if (c->need_recovery && is_last)
+	if (b->recover)
 		/*
 		 * Recover only last LEBs in the journal heads, because power
 		 * cuts may cause corruptions only in these LEBs, because only
 		 * these LEBs could possibly be written to at the power cut
 		 * time.
 		 */
-		sleb = ubifs_recover_leb(c, lnum, offs, c->sbuf, b->bud->jhead);
-	else
-		sleb = ubifs_scan(c, lnum, offs, c->sbuf, 0);
-	if (IS_ERR(sleb))
-		return PTR_ERR(sleb);
+		return ubifs_recover_leb(c, lnum, offs, sbuf, b->bud->jhead);
+
+	return ubifs_scan(c, lnum, offs, sbuf, 0);
+}
+
+/**
+ * replay_bud - replay a bud logical eraseblock.
+ * @c: UBIFS file-system description object
+ * @b: bud entry which describes the bud
+ * @sleb: the scanned bud
+ *
+ * This function adds all nodes from the scanned bud @b to the replay list and
+ * frees @sleb. Returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int replay_bud(struct ubifs_info *c, struct bud_entry *b,
+		      struct ubifs_scan_leb *sleb)
+{
+	int err = 0, used = 0, lnum = b->bud->lnum, offs = b->bud->start;
+	struct ubifs_scan_node *snod;
+
+	dbg_mnt("replay bud LEB %d, head %d, offs %d, recover %d",
+		lnum, b->bud->jhead, offs, b->recover);
 
 	/*
 	 * The bud does not have to start from offset zero - the beginning of
@@ -690,6 +756,149 @@ out_dump:
 	return -EINVAL;
 }
 
+/**
+ * next_scan_bud - find the next bud a scanner thread may scan.
+ * @c: UBIFS file-system description object
+ * @b: bud to start searching after
+ *
+ * Buds which have to be recovered are skipped, because they are taken care of
+ * by the replaying thread. Returns %NULL if there are no more buds to scan.
+ */
+static struct bud_entry *next_scan_bud(struct ubifs_info *c,
+				       struct bud_entry *b)
+{
+	list_for_each_entry_continue(b, &c->replay_buds, list)
+		if (!b->recover)
+			return b;
+	return NULL;
+}
+
+/**
+ * replay_scanner_thread - bud scanner thread function.
+ * @arg: the scanner thread description object
+ *
+ * Each time its buffer is free, the thread takes the next bud to scan and
+ * scans it into the buffer. The replaying thread frees the buffer once it has
+ * added the nodes of the bud to the replay list.
+ */
+static int replay_scanner_thread(void *arg)
+{
+	struct replay_scanner *s = arg;
+	struct replay_scan *rs = s->rs;
+	struct ubifs_info *c = rs->c;
+	struct bud_entry *b;
+
+	while (1) {
+		wait_for_completion(&s->buf_free);
+
+		spin_lock(&rs->lock);
+		if (rs->abort || !rs->next) {
+			spin_unlock(&rs->lock);
+			break;
+		}
+		b = rs->next;
+		rs->next = next_scan_bud(c, b);
+		spin_unlock(&rs->lock);
+
+		b->scanner = s;
+		b->sleb = scan_bud(c, b, s->sbuf);
+		complete(&b->scanned);
+	}
+
+	complete_and_exit(&s->exited, 0);
+}
+
+/**
+ * start_scanners - start bud scanner threads.
+ * @c: UBIFS file-system description object
+ * @rs: parallel bud scanning state to initialize
+ *
+ * This function starts up to %MAX_REPLAY_SCANNERS scanner threads, depending
+ * on the number of CPUs and buds. Failing to start a thread is not an error,
+ * the buds are then scanned by fewer threads or by the replaying thread
+ * itself. Returns the number of started threads.
+ */
+static int start_scanners(struct ubifs_info *c, struct replay_scan *rs)
+{
+	struct bud_entry *b, *first;
+	int i, cnt = 0, max;
+
+	first = next_scan_bud(c, list_entry(&c->replay_buds,
+					     struct bud_entry, list));
+	for (b = first; b; b = next_scan_bud(c, b))
+		cnt += 1;
+
+	max = min_t(int, num_online_cpus(), MAX_REPLAY_SCANNERS);
+	max = min(max, cnt);
+	/* Scanning a single bud in another thread would gain nothing */
+	if (max < 2)
+		return 0;
+
+	rs->c = c;
+	spin_lock_init(&rs->lock);
+	rs->next = first;
+	rs->abort = 0;
+	rs->cnt = 0;
+
+	for (i = 0; i < max; i++) {
+		struct replay_scanner *s = &rs->scanners[i];
+		struct task_struct *thread;
+
+		s->sbuf = vmalloc(c->leb_size);
+		if (!s->sbuf)
+			break;
+		s->rs = rs;
+		init_completion(&s->buf_free);
+		init_completion(&s->exited);
+		complete(&s->buf_free);
+
+		thread = kthread_run(replay_scanner_thread, s,
+				     "ubifs_rs%d_%d_%d", c->vi.ubi_num,
+				     c->vi.vol_id, i);
+		if (IS_ERR(thread)) {
+			vfree(s->sbuf);
+			break;
+		}
+		rs->cnt += 1;
+	}
+
+	if (rs->cnt < max)
+		ubifs_warn("cannot start %d bud scanner threads, using %d",
+			   max, rs->cnt);
+	dbg_mnt("%d bud scanner threads", rs->cnt);
+	return rs->cnt;
+}
+
+/**
+ * stop_scanners - stop bud scanner threads.
+ * @c: UBIFS file-system description object
+ * @rs: parallel bud scanning state
+ *
+ * This function waits for the scanner threads to exit, and frees the buds they
+ * have scanned but which were not replayed because of an error.
+ */
+static void stop_scanners(struct ubifs_info *c, struct replay_scan *rs)
+{
+	struct bud_entry *b;
+	int i;
+
+	spin_lock(&rs->lock);
+	rs->abort = 1;
+	spin_unlock(&rs->lock);
+
+	for (i = 0; i < rs->cnt; i++) {
+		complete(&rs->scanners[i].buf_free);
+		wait_for_completion(&rs->scanners[i].exited);
+		vfree(rs->scanners[i].sbuf);
+	}
+
+	list_for_each_entry(b, &c->replay_buds, list)
+		if (b->sleb && !IS_ERR(b->sleb)) {
+			ubifs_scan_destroy(b->sleb);
+			b->sleb = NULL;
+		}
+}
+
 /**
  * replay_buds - replay all buds.
  * @c: UBIFS file-system description object
@@ -699,20 +908,47 @@ out_dump:
  */
 static int replay_buds(struct ubifs_info *c)
 {
+	struct replay_scan *rs;
 	struct bud_entry *b;
-	int err;
+	int err = 0, parallel = 0;
 	unsigned long long prev_sqnum = 0;
 
+	list_for_each_entry(b, &c->replay_buds, list)
+		b->recover = c->need_recovery && is_last_bud(c, b->bud);
+
+	rs = kmalloc(sizeof(struct replay_scan), GFP_KERNEL);
+	if (rs)
+		parallel = start_scanners(c, rs);
+
 	list_for_each_entry(b, &c->replay_buds, list) {
-		err = replay_bud(c, b);
+		struct ubifs_scan_leb *sleb;
+
+		if (parallel && !b->recover) {
+			wait_for_completion(&b->scanned);
+			sleb = b->sleb;
+			b->sleb = NULL;
+		} else
+			sleb = scan_bud(c, b, c->sbuf);
+		if (IS_ERR(sleb)) {
+			err = PTR_ERR(sleb);
+			break;
+		}
+
+		err = replay_bud(c, b, sleb);
+		if (parallel && !b->recover)
+			/* The scanner thread may re-use its buffer now */
+			complete(&b->scanner->buf_free);
 		if (err)
-			return err;
+			break;
 
 		ubifs_assert(b->sqnum > prev_sqnum);
 		prev_sqnum = b->sqnum;
 	}
 
-	return 0;
+	if (parallel)
+		stop_scanners(c, rs);
+	kfree(rs);
+	return err;
 }
 
 /**
@@ -766,6 +1002,10 @@ static int add_replay_bud(struct ubifs_info *c, int lnum, int offs, int jhead,
 
 	b->bud = bud;
 	b->sqnum = sqnum;
+	b->recover = 0;
+	b->sleb = NULL;
+	b->scanner = NULL;
+	init_completion(&b->scanned);
 	list_add_tail(&b->list, &c->replay_buds);
 
 	return 0;
@@ -515,6 +515,39 @@ int ubifs_write_sb_node(struct ubifs_info *c, struct ubifs_sb_node *sup)
 	return ubifs_leb_change(c, UBIFS_SB_LNUM, sup, len);
 }
 
+/**
+ * add_cold_jhead - add the cold data journal head to the file-system.
+ * @c: UBIFS file-system description object
+ * @sup: superblock node
+ *
+ * Hot/cold data separation needs a second data journal head, which this
+ * function adds by increasing the journal head count in the superblock. Note,
+ * older UBIFS implementations support only one data journal head and refuse
+ * to mount the file-system afterwards. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static int add_cold_jhead(struct ubifs_info *c, struct ubifs_sb_node *sup)
+{
+	int err, min_leb_cnt;
+
+	/* The same as in 'validate_sb()', with one more journal head */
+	min_leb_cnt = UBIFS_SB_LEBS + UBIFS_MST_LEBS + c->log_lebs;
+	min_leb_cnt += c->lpt_lebs + c->orph_lebs + c->jhead_cnt + 1 + 6;
+	if (c->leb_cnt < min_leb_cnt) {
+		ubifs_warn("too few LEBs for the cold data journal head");
+		return 0;
+	}
+
+	ubifs_msg("adding the cold data journal head");
+	sup->jhead_cnt = cpu_to_le32(c->jhead_cnt + 1 - NONDATA_JHEADS_CNT);
+	err = ubifs_write_sb_node(c, sup);
+	if (err)
+		return err;
+
+	c->jhead_cnt += 1;
+	return 0;
+}
+
 /**
  * ubifs_read_superblock - read superblock.
  * @c: UBIFS file-system description object
@@ -651,6 +684,9 @@ int ubifs_read_superblock(struct ubifs_info *c)
 	c->main_first = c->leb_cnt - c->main_lebs;
 
 	err = validate_sb(c, sup);
+	if (!err && c->mount_opts.hot_cold == 2 && !c->ro_mount &&
+	    c->jhead_cnt <= COLDHD)
+		err = add_cold_jhead(c, sup);
 out:
 	kfree(sup);
 	return err;
@@ -433,6 +433,14 @@ static int ubifs_show_options(struct seq_file *s, struct dentry *root)
 	else if (c->mount_opts.bulk_read == 1)
 		seq_printf(s, ",no_bulk_read");
 
+	if (c->mount_opts.hot_cold == 2)
+		seq_printf(s, ",hot_cold");
+	else if (c->mount_opts.hot_cold == 1)
+		seq_printf(s, ",no_hot_cold");
+
+	if (c->bg_gc_lebs)
+		seq_printf(s, ",bg_gc=%u", c->bg_gc_lebs);
+
 	if (c->mount_opts.chk_data_crc == 2)
 		seq_printf(s, ",chk_data_crc");
 	else if (c->mount_opts.chk_data_crc == 1)
@@ -931,6 +939,9 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_norm_unmount: run a journal commit before un-mounting
  * Opt_bulk_read: enable bulk-reads
  * Opt_no_bulk_read: disable bulk-reads
+ * Opt_hot_cold: separate hot and cold data
+ * Opt_no_hot_cold: do not separate hot and cold data
+ * Opt_bg_gc: how many clean LEBs background garbage collection keeps ready
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
  * Opt_override_compr: override default compressor
@@ -941,6 +952,9 @@ enum {
 	Opt_norm_unmount,
 	Opt_bulk_read,
 	Opt_no_bulk_read,
+	Opt_hot_cold,
+	Opt_no_hot_cold,
+	Opt_bg_gc,
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
 	Opt_override_compr,
@@ -952,6 +966,9 @@ static const match_table_t tokens = {
 	{Opt_norm_unmount, "norm_unmount"},
 	{Opt_bulk_read, "bulk_read"},
 	{Opt_no_bulk_read, "no_bulk_read"},
+	{Opt_hot_cold, "hot_cold"},
+	{Opt_no_hot_cold, "no_hot_cold"},
+	{Opt_bg_gc, "bg_gc=%u"},
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
 	{Opt_override_compr, "compr=%s"},
@@ -1024,6 +1041,26 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->mount_opts.bulk_read = 1;
 			c->bulk_read = 0;
 			break;
+		case Opt_hot_cold:
+			c->mount_opts.hot_cold = 2;
+			break;
+		case Opt_no_hot_cold:
+			c->mount_opts.hot_cold = 1;
+			break;
+		case Opt_bg_gc:
+		{
+			int lebs;
+
+			if (match_int(&args[0], &lebs) || lebs < 0) {
+				ubifs_err("bad background GC LEB count \"%s\"",
+					  p);
+				return -EINVAL;
+			}
+			c->bg_gc_lebs = lebs;
+			c->bg_gc_done = 0;
+			ubifs_wake_up_bgt(c);
+			break;
+		}
 		case Opt_chk_data_crc:
 			c->mount_opts.chk_data_crc = 2;
 			c->no_chk_data_crc = 0;
@@ -1104,6 +1141,52 @@ static void destroy_journal(struct ubifs_info *c)
 	free_buds(c);
 }
 
+/**
+ * set_hot_cold - enable or disable hot/cold data separation.
+ * @c: UBIFS file-system description object
+ *
+ * Hot/cold data separation is enabled by the "hot_cold" mount option. It
+ * needs the cold data journal head, which is added to the file-system when it
+ * is mounted R/W with this option (see 'ubifs_read_superblock()'). The LEB
+ * write times used to pick cold LEBs for garbage collection are allocated when
+ * it is first enabled, and kept until the file-system is unmounted.
+ */
+static void set_hot_cold(struct ubifs_info *c)
+{
+	u32 *leb_wtime, now;
+	int i;
+
+	c->hot_cold = 0;
+	if (c->mount_opts.hot_cold != 2)
+		return;
+
+	if (c->jhead_cnt <= COLDHD) {
+		ubifs_warn("no cold data journal head, hot/cold data "
+			   "separation is disabled");
+		return;
+	}
+
+	if (!c->leb_wtime) {
+		leb_wtime = vmalloc(c->main_lebs * sizeof(u32));
+		if (!leb_wtime) {
+			ubifs_warn("cannot allocate LEB write times, hot/cold "
+				   "data separation is disabled");
+			return;
+		}
+
+		/* LEBs written before are considered written now */
+		now = ubifs_leb_time();
+		for (i = 0; i < c->main_lebs; i++)
+			leb_wtime[i] = now;
+
+		mutex_lock(&c->log_mutex);
+		c->leb_wtime = leb_wtime;
+		mutex_unlock(&c->log_mutex);
+	}
+
+	c->hot_cold = 1;
+}
+
 /**
  * bu_init - initialize bulk-read information.
  * @c: UBIFS file-system description object
@@ -1173,6 +1256,8 @@ static int mount_ubifs(struct ubifs_info *c)
 	if (err)
 		return err;
 
+	ubifs_crc_init(c);
+
 	err = check_volume_empty(c);
 	if (err)
 		goto out_free;
@@ -1245,6 +1330,8 @@ static int mount_ubifs(struct ubifs_info *c)
 	if (err)
 		goto out_free;
 
+	set_hot_cold(c);
+
 	sz = ALIGN(c->max_idx_node_sz, c->min_io_size);
 	sz = ALIGN(sz + c->max_idx_node_sz, c->min_io_size);
 	c->cbuf = kmalloc(sz, GFP_NOFS);
@@ -1508,6 +1595,8 @@ out_free:
 	vfree(c->ileb_buf);
 	vfree(c->sbuf);
 	kfree(c->bottom_up_buf);
+	vfree(c->leb_wtime);
+	ubifs_crc_exit(c);
 	ubifs_debugging_exit(c);
 	return err;
 }
@@ -1547,6 +1636,8 @@ static void ubifs_umount(struct ubifs_info *c)
 	vfree(c->ileb_buf);
 	vfree(c->sbuf);
 	kfree(c->bottom_up_buf);
+	vfree(c->leb_wtime);
+	ubifs_crc_exit(c);
 	ubifs_debugging_exit(c);
 }
 
@@ -1876,6 +1967,7 @@ static int ubifs_remount_fs(struct super_block *sb, int *flags, char *data)
 		ubifs_remount_ro(c);
 	}
 
+	set_hot_cold(c);
 	if (c->bulk_read == 1)
 		bu_init(c);
 	else {
@@ -2000,6 +2092,9 @@ static struct ubifs_info *alloc_ubifs_info(struct ubi_volume_desc *ubi)
 		INIT_LIST_HEAD(&c->orph_list);
 		INIT_LIST_HEAD(&c->orph_new);
 		c->no_chk_data_crc = 1;
+		c->bg_gc_idle = BG_GC_IDLE_MS;
+		c->bg_gc_interval = BG_GC_INTERVAL_MS;
+		c->bg_gc_time = c->jnl_time = jiffies;
 
 		c->highest_inum = UBIFS_FIRST_INO;
 		c->lhead_lnum = c->ltail_lnum = UBIFS_LOG_LNUM;
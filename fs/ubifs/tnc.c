@@ -482,7 +482,7 @@ static int try_read_node(const struct ubifs_info *c, void *buf, int type,
 	    !c->remounting_rw)
 		return 1;
 
-	crc = crc32(UBIFS_CRC32_INIT, buf + 8, node_len - 8);
+	crc = ubifs_crc32(c, buf + 8, node_len - 8);
 	node_crc = le32_to_cpu(ch->crc);
 	if (crc != node_crc)
 		return 0;
@@ -1504,13 +1504,59 @@ out:
 	return err;
 }
 
+/**
+ * bu_add_zbr - add a data node to bulk-read.
+ * @bu: bulk-read parameters and results
+ * @zbr: zbranch of the data node to add
+ *
+ * This is a helper function for 'ubifs_tnc_get_bu_keys()' which appends @zbr
+ * to the bulk-read. If the data node immediately follows the last run on the
+ * flash, the run is extended, otherwise a new run is started. Returns %0 if
+ * the node was added and %1 if it does not fit in the bulk-read buffer or if
+ * there are too many runs already.
+ */
+static int bu_add_zbr(struct bu_info *bu, const struct ubifs_zbranch *zbr)
+{
+	struct bu_run *run = NULL;
+	int buf_offs = 0;
+
+	if (bu->cnt) {
+		run = &bu->runs[bu->run_cnt - 1];
+		buf_offs = ALIGN(bu->buf_offs[bu->cnt - 1] +
+				 bu->zbranch[bu->cnt - 1].len, 8);
+	}
+	/* Must not exceed buffer length */
+	if (buf_offs + zbr->len > bu->buf_len)
+		return 1;
+
+	if (run && zbr->lnum == run->lnum &&
+	    zbr->offs == ALIGN(run->offs + run->len, 8)) {
+		run->len = zbr->offs + zbr->len - run->offs;
+		run->last = bu->cnt;
+	} else {
+		if (bu->run_cnt >= UBIFS_MAX_BULK_READ_RUNS)
+			return 1;
+		run = &bu->runs[bu->run_cnt++];
+		run->lnum = zbr->lnum;
+		run->offs = zbr->offs;
+		run->len = zbr->len;
+		run->first = run->last = bu->cnt;
+	}
+
+	bu->buf_offs[bu->cnt] = buf_offs;
+	bu->zbranch[bu->cnt++] = *zbr;
+	return 0;
+}
+
 /**
  * ubifs_tnc_get_bu_keys - lookup keys for bulk-read.
  * @c: UBIFS file-system description object
  * @bu: bulk-read parameters and results
  *
- * Lookup consecutive data node keys for the same inode that reside
- * consecutively in the same LEB. This function returns zero in case of success
+ * Lookup consecutive data node keys for the same inode. The data nodes do not
+ * have to be in the same LEB: they are grouped in up to
+ * %UBIFS_MAX_BULK_READ_RUNS runs of nodes which reside consecutively on the
+ * flash (see 'struct bu_info'). This function returns zero in case of success
  * and a negative error code in case of failure.
  *
  * Note, if the bulk-read buffer length (@bu->buf_len) is known, this function
@@ -1519,12 +1565,12 @@ out:
  */
 int ubifs_tnc_get_bu_keys(struct ubifs_info *c, struct bu_info *bu)
 {
-	int n, err = 0, lnum = -1, uninitialized_var(offs);
-	int uninitialized_var(len);
+	int n, err = 0;
 	unsigned int block = key_block(c, &bu->key);
 	struct ubifs_znode *znode;
 
 	bu->cnt = 0;
+	bu->run_cnt = 0;
 	bu->blk_cnt = 0;
 	bu->eof = 0;
 
@@ -1534,18 +1580,12 @@ int ubifs_tnc_get_bu_keys(struct ubifs_info *c, struct bu_info *bu)
 	if (err < 0)
 		goto out;
 	if (err) {
-		/* Key found */
-		len = znode->zbranch[n].len;
-		/* The buffer must be big enough for at least 1 node */
-		if (len > bu->buf_len) {
+		/* Key found, the buffer must be big enough for at least 1 node */
+		if (bu_add_zbr(bu, &znode->zbranch[n])) {
 			err = -EINVAL;
 			goto out;
 		}
-		/* Add this key */
-		bu->zbranch[bu->cnt++] = znode->zbranch[n];
 		bu->blk_cnt += 1;
-		lnum = znode->zbranch[n].lnum;
-		offs = ALIGN(znode->zbranch[n].offs + len, 8);
 	}
 	while (1) {
 		struct ubifs_zbranch *zbr;
@@ -1564,28 +1604,6 @@ int ubifs_tnc_get_bu_keys(struct ubifs_info *c, struct bu_info *bu)
 			err = -ENOENT;
 			goto out;
 		}
-		if (lnum < 0) {
-			/* First key found */
-			lnum = zbr->lnum;
-			offs = ALIGN(zbr->offs + zbr->len, 8);
-			len = zbr->len;
-			if (len > bu->buf_len) {
-				err = -EINVAL;
-				goto out;
-			}
-		} else {
-			/*
-			 * The data nodes must be in consecutive positions in
-			 * the same LEB.
-			 */
-			if (zbr->lnum != lnum || zbr->offs != offs)
-				goto out;
-			offs += ALIGN(zbr->len, 8);
-			len = ALIGN(len, 8) + zbr->len;
-			/* Must not exceed buffer length */
-			if (len > bu->buf_len)
-				goto out;
-		}
 		/* Allow for holes */
 		next_block = key_block(c, key);
 		bu->blk_cnt += (next_block - block - 1);
@@ -1593,7 +1611,12 @@ int ubifs_tnc_get_bu_keys(struct ubifs_info *c, struct bu_info *bu)
 			goto out;
 		block = next_block;
 		/* Add this key */
-		bu->zbranch[bu->cnt++] = *zbr;
+		if (bu_add_zbr(bu, zbr)) {
+			/* The buffer must be big enough for at least 1 node */
+			if (!bu->cnt)
+				err = -EINVAL;
+			goto out;
+		}
 		bu->blk_cnt += 1;
 		/* See if we have room for more */
 		if (bu->cnt >= UBIFS_MAX_BULK_READ)
@@ -1636,6 +1659,16 @@ out:
 			break;
 		bu->cnt -= 1;
 	}
+	/* And trim the runs accordingly */
+	while (bu->run_cnt && bu->runs[bu->run_cnt - 1].first >= bu->cnt)
+		bu->run_cnt -= 1;
+	if (bu->run_cnt) {
+		struct bu_run *run = &bu->runs[bu->run_cnt - 1];
+		struct ubifs_zbranch *zbr = &bu->zbranch[bu->cnt - 1];
+
+		run->last = bu->cnt - 1;
+		run->len = zbr->offs + zbr->len - run->offs;
+	}
 	return 0;
 }
 
@@ -1739,34 +1772,36 @@ out:
 }
 
 /**
- * ubifs_tnc_bulk_read - read a number of data nodes in one go.
+ * ubifs_tnc_bulk_read - read a run of data nodes in one go.
  * @c: UBIFS file-system description object
  * @bu: bulk-read parameters and results
+ * @run: index of the run to read
  *
- * This functions reads and validates the data nodes that were identified by the
- * 'ubifs_tnc_get_bu_keys()' function. This functions returns %0 on success,
- * -EAGAIN to indicate a race with GC, or another negative error code on
- * failure.
+ * This functions reads and validates the data nodes of run @run, which was
+ * identified by the 'ubifs_tnc_get_bu_keys()' function. The runs are read
+ * one by one so that the caller may use the data nodes of a run before the
+ * next one is read. This functions returns %0 on success, -EAGAIN to indicate
+ * a race with GC, or another negative error code on failure.
  */
-int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu)
+int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu, int run)
 {
-	int lnum = bu->zbranch[0].lnum, offs = bu->zbranch[0].offs, len, err, i;
+	struct bu_run *r = &bu->runs[run];
+	int lnum = r->lnum, offs = r->offs, len = r->len, err, i;
 	struct ubifs_wbuf *wbuf;
-	void *buf;
+	void *buf = bu->buf + bu->buf_offs[r->first];
 
-	len = bu->zbranch[bu->cnt - 1].offs;
-	len += bu->zbranch[bu->cnt - 1].len - offs;
-	if (len > bu->buf_len) {
-		ubifs_err("buffer too small %d vs %d", bu->buf_len, len);
+	if (bu->buf_offs[r->first] + len > bu->buf_len) {
+		ubifs_err("buffer too small %d vs %d", bu->buf_len,
+			  bu->buf_offs[r->first] + len);
 		return -EINVAL;
 	}
 
 	/* Do the read */
 	wbuf = ubifs_get_wbuf(c, lnum);
 	if (wbuf)
-		err = read_wbuf(wbuf, bu->buf, len, lnum, offs);
+		err = read_wbuf(wbuf, buf, len, lnum, offs);
 	else
-		err = ubifs_leb_read(c, lnum, bu->buf, offs, len, 0);
+		err = ubifs_leb_read(c, lnum, buf, offs, len, 0);
 
 	/* Check for a race with GC */
 	if (maybe_leb_gced(c, lnum, bu->gc_seq))
@@ -1781,12 +1816,11 @@ int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu)
 	}
 
 	/* Validate the nodes read */
-	buf = bu->buf;
-	for (i = 0; i < bu->cnt; i++) {
-		err = validate_data_node(c, buf, &bu->zbranch[i]);
+	for (i = r->first; i <= r->last; i++) {
+		err = validate_data_node(c, bu->buf + bu->buf_offs[i],
+					 &bu->zbranch[i]);
 		if (err)
 			return err;
-		buf = buf + ALIGN(bu->zbranch[i].len, 8);
 	}
 
 	return 0;
@@ -36,6 +36,7 @@
 #include <linux/mtd/ubi.h>
 #include <linux/pagemap.h>
 #include <linux/backing-dev.h>
+#include <linux/crc32.h>
 #include "ubifs-media.h"
 
 /* Version of this UBIFS implementation */
@@ -97,6 +98,14 @@
 #define WBUF_TIMEOUT_SOFTLIMIT 3
 #define WBUF_TIMEOUT_HARDLIMIT 5
 
+/*
+ * Default background garbage collection tunables: how long in milliseconds
+ * the journal has to be idle before background GC starts, and the minimum
+ * interval in milliseconds between two LEBs cleaned in background
+ */
+#define BG_GC_IDLE_MS 500
+#define BG_GC_INTERVAL_MS 100
+
 /* Maximum possible inode number (only 32-bit inodes are supported now) */
 #define MAX_INUM 0xFFFFFFFF
 
@@ -107,6 +116,14 @@
 #define GCHD   UBIFS_GC_HEAD
 #define BASEHD UBIFS_BASE_HEAD
 #define DATAHD UBIFS_DATA_HEAD
+#define COLDHD UBIFS_COLD_HEAD
+
+/*
+ * Temperature of the data of an inode above which its data is hot, and the
+ * interval in seconds in which the temperature halves (see 'data_jhead()')
+ */
+#define UBIFS_HOT_TEMP 4
+#define UBIFS_TEMP_HALFLIFE 30
 
 /* 'No change' value for 'ubifs_change_lp()' */
 #define LPROPS_NC 0x80000001
@@ -160,6 +177,9 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/* Maximum number of separately read runs of data nodes in one bulk-read */
+#define UBIFS_MAX_BULK_READ_RUNS 8
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -350,7 +370,7 @@ struct ubifs_gced_idx_leb {
  * @ui_mutex: serializes inode write-back with the rest of VFS operations,
  *            serializes "clean <-> dirty" state changes, serializes bulk-read,
  *            protects @dirty, @bulk_read, @ui_size, and @xattr_size
- * @ui_lock: protects @synced_i_size
+ * @ui_lock: protects @synced_i_size, @temp and @temp_time
  * @synced_i_size: synchronized size of inode, i.e. the value of inode size
  *                 currently stored on the flash; used only for regular file
  *                 inodes
@@ -359,6 +379,8 @@ struct ubifs_gced_idx_leb {
  * @compr_type: default compression type used for this inode
  * @last_page_read: page number of last page read (for bulk read)
  * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
+ * @temp: how often the data of the inode has been overwritten recently
+ * @temp_time: when @temp was last decayed (jiffies)
  * @data_len: length of the data attached to the inode
  * @data: inode's data
  *
@@ -409,6 +431,8 @@ struct ubifs_inode {
 	int flags;
 	pgoff_t last_page_read;
 	pgoff_t read_in_a_row;
+	unsigned int temp;
+	unsigned long temp_time;
 	int data_len;
 	void *data;
 };
@@ -778,24 +802,52 @@ struct ubifs_znode {
 	struct ubifs_zbranch zbranch[];
 };
 
+/**
+ * struct bu_run - a run of data nodes stored consecutively in one LEB.
+ * @lnum: LEB number
+ * @offs: offset of the first data node of the run in the LEB
+ * @len: length of the run in bytes
+ * @first: index of the first zbranch of the run in @bu_info->zbranch
+ * @last: index of the last zbranch of the run in @bu_info->zbranch
+ *
+ * Each run is read from the flash by one I/O operation.
+ */
+struct bu_run {
+	int lnum;
+	int offs;
+	int len;
+	int first;
+	int last;
+};
+
 /**
  * struct bu_info - bulk-read information.
  * @key: first data node key
  * @zbranch: zbranches of data nodes to bulk read
+ * @buf_offs: offsets of the data nodes in the bulk-read buffer
+ * @runs: runs of consecutive data nodes which make up the bulk-read
  * @buf: buffer to read into
  * @buf_len: buffer length
  * @gc_seq: GC sequence number to detect races with GC
  * @cnt: number of data nodes for bulk read
+ * @run_cnt: number of runs in @runs
  * @blk_cnt: number of data blocks including holes
  * @oef: end of file reached
+ *
+ * The data nodes of a bulk-read do not have to be in the same LEB. They are
+ * split into runs of nodes which are stored consecutively on the flash, and
+ * each run is placed into @buf right after the previous one (8-byte aligned).
  */
 struct bu_info {
 	union ubifs_key key;
 	struct ubifs_zbranch zbranch[UBIFS_MAX_BULK_READ];
+	int buf_offs[UBIFS_MAX_BULK_READ];
+	struct bu_run runs[UBIFS_MAX_BULK_READ_RUNS];
 	void *buf;
 	int buf_len;
 	int gc_seq;
 	int cnt;
+	int run_cnt;
 	int blk_cnt;
 	int eof;
 };
@@ -816,20 +868,42 @@ struct ubifs_node_range {
 	int max_len;
 };
 
+/**
+ * struct ubifs_compr_pool - a pool of cryptoapi compressor handles.
+ * @lock: protects @idle
+ * @wait: wait queue for tasks waiting for an idle handle
+ * @idle: bitmap of handles which are not in use
+ * @cnt: number of handles in the pool
+ * @cc: the handles
+ *
+ * Cryptoapi compressors keep their working state in the handle, so one handle
+ * cannot be used by several tasks at a time. Instead of serializing all users
+ * on one handle, stateful compressors allocate a pool of handles, one per
+ * possible CPU, and a task borrows an idle one for the duration of the
+ * operation.
+ */
+struct ubifs_compr_pool {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	unsigned long *idle;
+	int cnt;
+	struct crypto_comp **cc;
+};
+
 /**
  * struct ubifs_compressor - UBIFS compressor description structure.
  * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
- * @cc: cryptoapi compressor handle
- * @comp_mutex: mutex used during compression
- * @decomp_mutex: mutex used during decompression
+ * @cc: cryptoapi compressor handle used when there is no pool
+ * @comp_pool: pool of handles used during compression
+ * @decomp_pool: pool of handles used during decompression, may be @comp_pool
  * @name: compressor name
  * @capi_name: cryptoapi compressor name
  */
 struct ubifs_compressor {
 	int compr_type;
 	struct crypto_comp *cc;
-	struct mutex *comp_mutex;
-	struct mutex *decomp_mutex;
+	struct ubifs_compr_pool *comp_pool;
+	struct ubifs_compr_pool *decomp_pool;
 	const char *name;
 	const char *capi_name;
 };
@@ -920,6 +994,8 @@ struct ubifs_orphan {
  * struct ubifs_mount_opts - UBIFS-specific mount options information.
  * @unmount_mode: selected unmount mode (%0 default, %1 normal, %2 fast)
  * @bulk_read: enable/disable bulk-reads (%0 default, %1 disabe, %2 enable)
+ * @hot_cold: enable/disable hot/cold data separation (%0 default, %1 disable,
+ *            %2 enable)
  * @chk_data_crc: enable/disable CRC data checking when reading data nodes
  *                (%0 default, %1 disabe, %2 enable)
  * @override_compr: override default compressor (%0 - do not override and use
@@ -931,6 +1007,7 @@ struct ubifs_orphan {
 struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
 	unsigned int bulk_read:2;
+	unsigned int hot_cold:2;
 	unsigned int chk_data_crc:2;
 	unsigned int override_compr:1;
 	unsigned int compr_type:2;
@@ -1017,6 +1094,8 @@ struct ubifs_debug_info;
  * @no_chk_data_crc: do not check CRCs when reading data nodes (except during
  *                   recovery)
  * @bulk_read: enable bulk-reads
+ * @hot_cold: separate hot and cold data, only set if there is the cold data
+ *            journal head
  * @default_compr: default compression algorithm (%UBIFS_COMPR_LZO, etc)
  * @rw_incompat: the media is not R/W compatible
  *
@@ -1135,13 +1214,35 @@ struct ubifs_debug_info;
  * @bgt_name: background thread name
  * @need_bgt: if background thread should run
  * @need_wbuf_sync: if write-buffers have to be synchronized
+ * @bg_gc_lebs: how many clean LEBs background GC keeps ready (%0 if background
+ *              GC is disabled)
+ * @bg_gc_idle: how long the journal has to be idle before background GC
+ *              starts (milliseconds)
+ * @bg_gc_interval: minimum interval between two LEBs cleaned in background
+ *                  (milliseconds)
+ * @bg_gc_done: non-zero if the last background GC run found nothing to do
+ * @bg_gc_time: when background GC last ran (jiffies)
+ * @jnl_time: when the journal was last written to (jiffies)
+ * @bg_gc_cnt: number of LEBs cleaned by background GC
+ * @fg_gc_cnt: number of times writers had to run GC themselves
+ * @fg_gc_jiffies: total time writers spent in GC
  *
  * @gc_lnum: LEB number used for garbage collection
  * @sbuf: a buffer of LEB size used by GC and replay for scanning
+ * @crc_tfm: accelerated "crc32" transform used for node CRCs, %NULL if the
+ *           library 'crc32()' function is used
  * @idx_gc: list of index LEBs that have been garbage collected
  * @idx_gc_cnt: number of elements on the idx_gc list
  * @gc_seq: incremented for every non-index LEB garbage collected
  * @gced_lnum: last non-index LEB that was garbage collected
+ * @leb_wtime: when each main area LEB was last added to the journal (see
+ *             'ubifs_leb_time()'), or for GC head LEBs, when the youngest
+ *             data moved there were written; the LEB age used by
+ *             cost-benefit GC, only allocated once hot/cold data separation
+ *             is enabled
+ * @data_bytes: amount of file data written by users (uncompressed)
+ * @flash_bytes: amount of bytes written to the flash
+ * @gc_bytes: amount of bytes moved by the garbage collector
  *
  * @infos_list: links all 'ubifs_info' objects
  * @umount_mutex: serializes shrinker and un-mount
@@ -1258,6 +1359,7 @@ struct ubifs_info {
 	unsigned int space_fixup:1;
 	unsigned int no_chk_data_crc:1;
 	unsigned int bulk_read:1;
+	unsigned int hot_cold:1;
 	unsigned int default_compr:2;
 	unsigned int rw_incompat:1;
 
@@ -1367,13 +1469,27 @@ struct ubifs_info {
 	char bgt_name[sizeof(BGT_NAME_PATTERN) + 9];
 	int need_bgt;
 	int need_wbuf_sync;
+	u32 bg_gc_lebs;
+	u32 bg_gc_idle;
+	u32 bg_gc_interval;
+	int bg_gc_done;
+	unsigned long bg_gc_time;
+	unsigned long jnl_time;
+	atomic_t bg_gc_cnt;
+	atomic_t fg_gc_cnt;
+	atomic_long_t fg_gc_jiffies;
 
 	int gc_lnum;
 	void *sbuf;
+	struct crypto_shash *crc_tfm;
 	struct list_head idx_gc;
 	int idx_gc_cnt;
 	int gc_seq;
 	int gced_lnum;
+	u32 *leb_wtime;
+	atomic64_t data_bytes;
+	atomic64_t flash_bytes;
+	atomic64_t gc_bytes;
 
 	struct list_head infos_list;
 	struct mutex umount_mutex;
@@ -1493,6 +1609,19 @@ int ubifs_wbuf_sync_nolock(struct ubifs_wbuf *wbuf);
 int ubifs_bg_wbufs_sync(struct ubifs_info *c);
 void ubifs_wbuf_add_ino_nolock(struct ubifs_wbuf *wbuf, ino_t inum);
 int ubifs_sync_wbufs_by_inode(struct ubifs_info *c, struct inode *inode);
+#ifdef CONFIG_UBIFS_FS_CRYPTO_CRC32
+void ubifs_crc_init(struct ubifs_info *c);
+void ubifs_crc_exit(struct ubifs_info *c);
+uint32_t ubifs_crc32(const struct ubifs_info *c, const void *buf, int len);
+#else
+static inline void ubifs_crc_init(struct ubifs_info *c) {}
+static inline void ubifs_crc_exit(struct ubifs_info *c) {}
+static inline uint32_t ubifs_crc32(const struct ubifs_info *c,
+				   const void *buf, int len)
+{
+	return crc32(UBIFS_CRC32_INIT, buf, len);
+}
+#endif
 
 /* scan.c */
 struct ubifs_scan_leb *ubifs_scan(const struct ubifs_info *c, int lnum,
@@ -1599,7 +1728,7 @@ int is_idx_node_in_tnc(struct ubifs_info *c, union ubifs_key *key, int level,
 		       int lnum, int offs);
 int insert_old_idx_znode(struct ubifs_info *c, struct ubifs_znode *znode);
 int ubifs_tnc_get_bu_keys(struct ubifs_info *c, struct bu_info *bu);
-int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu);
+int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu, int run);
 
 /* tnc_misc.c */
 struct ubifs_znode *ubifs_tnc_levelorder_next(struct ubifs_znode *zr,
@@ -1649,6 +1778,7 @@ int ubifs_replay_journal(struct ubifs_info *c);
 
 /* gc.c */
 int ubifs_garbage_collect(struct ubifs_info *c, int anyway);
+int ubifs_bg_gc(struct ubifs_info *c);
 int ubifs_gc_start_commit(struct ubifs_info *c);
 int ubifs_gc_end_commit(struct ubifs_info *c);
 void ubifs_destroy_idx_gc(struct ubifs_info *c);
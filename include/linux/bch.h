@@ -42,6 +42,9 @@
  * @ecc_buf2:   ecc parity words buffer
  * @xi_tab:     GF(2^m) base for solving degree 2 polynomial roots
  * @syn:        syndrome buffer
+ * @syn_tab:    byte-wise remainder and evaluation tables for odd syndromes
+ * @syn_deg:    degree of the polynomial used to reduce each odd syndrome
+ * @syn_corr:   log of the alignment correction factor of each odd syndrome
  * @cache:      log-based polynomial representation buffer
  * @elp:        error locator polynomial
  * @poly_2t:    temporary polynomials of degree 2t
@@ -60,6 +63,9 @@ struct bch_control {
 	uint32_t       *ecc_buf2;
 	unsigned int   *xi_tab;
 	unsigned int   *syn;
+	uint16_t       *syn_tab;
+	unsigned int   *syn_deg;
+	unsigned int   *syn_corr;
 	int            *cache;
 	struct gf_poly *elp;
 	struct gf_poly *poly_2t[4];
@@ -24,6 +24,7 @@
 #include <linux/uio.h>
 #include <linux/notifier.h>
 #include <linux/device.h>
+#include <linux/workqueue.h>
 
 #include <mtd/mtd-abi.h>
 
@@ -60,6 +61,44 @@ struct erase_info {
 	struct erase_info *next;
 };
 
+/* Types of asynchronous I/O requests */
+enum {
+	MTD_IO_READ,
+	MTD_IO_WRITE,
+	MTD_IO_ERASE,
+};
+
+/**
+ * struct mtd_io_req - asynchronous I/O request, see mtd_submit_io()
+ * @type: %MTD_IO_READ, %MTD_IO_WRITE or %MTD_IO_ERASE
+ * @addr: offset to read, write or erase at
+ * @len: number of bytes
+ * @buf: the data buffer, not used for erase
+ * @done: called when the request completed, possibly in another thread
+ * @priv: for the submitter
+ * @retlen: set on completion, number of bytes transferred or erased
+ * @error: set on completion, what mtd_read(), mtd_write() or mtd_erase()
+ *	would have returned (%-EIO if the erase failed)
+ * @mtd: the device the request was submitted to, set by mtd_submit_io()
+ * @work: for drivers which execute the requests in a workqueue; submitters
+ *	of requests on the stack have to set it up with INIT_WORK_ONSTACK() and
+ *	release it with destroy_work_on_stack() once the request completed
+ */
+struct mtd_io_req {
+	int type;
+	loff_t addr;
+	size_t len;
+	u_char *buf;
+	void (*done)(struct mtd_io_req *req);
+	void *priv;
+
+	size_t retlen;
+	int error;
+
+	struct mtd_info *mtd;
+	struct work_struct work;
+};
+
 struct mtd_erase_region_info {
 	uint64_t offset;		/* At which this region starts, from the beginning of the MTD */
 	uint32_t erasesize;		/* For this region */
@@ -226,6 +265,7 @@ struct mtd_info {
 	int (*_block_markbad) (struct mtd_info *mtd, loff_t ofs);
 	int (*_suspend) (struct mtd_info *mtd);
 	void (*_resume) (struct mtd_info *mtd);
+	int (*_submit_io) (struct mtd_info *mtd, struct mtd_io_req *req);
 	/*
 	 * If the driver is something smart, like UBI, it may need to maintain
 	 * its own reference counting. The below functions are only for driver.
@@ -264,6 +304,14 @@ int mtd_write(struct mtd_info *mtd, loff_t to, size_t len, size_t *retlen,
 	      const u_char *buf);
 int mtd_panic_write(struct mtd_info *mtd, loff_t to, size_t len, size_t *retlen,
 		    const u_char *buf);
+int mtd_submit_io(struct mtd_info *mtd, struct mtd_io_req *req);
+void mtd_io_execute(struct mtd_io_req *req);
+
+/* Whether mtd_submit_io() returns before the request completed */
+static inline int mtd_has_async_io(const struct mtd_info *mtd)
+{
+	return mtd->_submit_io != NULL;
+}
 
 static inline int mtd_read_oob(struct mtd_info *mtd, loff_t from,
 			       struct mtd_oob_ops *ops)
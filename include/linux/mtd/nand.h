@@ -91,6 +91,7 @@ extern int nand_unlock(struct mtd_info *mtd, loff_t ofs, uint64_t len);
 #define NAND_CMD_RNDIN		0x85
 #define NAND_CMD_READID		0x90
 #define NAND_CMD_ERASE2		0xd0
+#define NAND_CMD_MULTIERASE	0xd1
 #define NAND_CMD_PARAM		0xec
 #define NAND_CMD_RESET		0xff
 
@@ -100,6 +101,8 @@ extern int nand_unlock(struct mtd_info *mtd, loff_t ofs, uint64_t len);
 
 /* Extended commands for large page devices */
 #define NAND_CMD_READSTART	0x30
+#define NAND_CMD_READCACHESEQ	0x31
+#define NAND_CMD_READCACHEEND	0x3f
 #define NAND_CMD_RNDOUTSTART	0xE0
 #define NAND_CMD_CACHEDPROG	0x15
 
@@ -200,6 +203,12 @@ typedef enum {
 /* Device behaves just like nand, but is readonly */
 #define NAND_ROM		0x00000800
 
+/* Chip has cache read (sequential) function */
+#define NAND_CACHERD		0x00001000
+
+/* Chip can erase two blocks in different planes at once */
+#define NAND_MULTIPLANE		0x00002000
+
 /* Options valid for Samsung large page devices */
 #define NAND_SAMSUNG_LP_OPTIONS \
 	(NAND_NO_PADDING | NAND_CACHEPRG | NAND_COPYBACK)
@@ -207,7 +216,9 @@ typedef enum {
 /* Macros to identify the above */
 #define NAND_MUST_PAD(chip) (!(chip->options & NAND_NO_PADDING))
 #define NAND_HAS_CACHEPROG(chip) ((chip->options & NAND_CACHEPRG))
+#define NAND_HAS_CACHEREAD(chip) ((chip->options & NAND_CACHERD))
 #define NAND_HAS_COPYBACK(chip) ((chip->options & NAND_COPYBACK))
+#define NAND_HAS_MULTIPLANE(chip) ((chip->options & NAND_MULTIPLANE))
 /* Large page NAND with SOFT_ECC should support subpage reads */
 #define NAND_SUBPAGE_READ(chip) ((chip->ecc.mode == NAND_ECC_SOFT) \
 					&& (chip->page_shift > 9))
@@ -222,6 +233,17 @@ typedef enum {
 #define NAND_OWN_BUFFERS	0x00020000
 /* Chip may not exist, so silence any errors in scan */
 #define NAND_SCAN_SILENT_NODEV	0x00040000
+/*
+ * The chips of an array can program and erase concurrently. Their status is
+ * read with NAND_CMD_STATUS rather than a ready/busy line they may share.
+ */
+#define NAND_INTERLEAVE		0x00080000
+/*
+ * Use cache program for multi-page writes. Set by nand scan for ONFI chips
+ * which support it. NAND_CACHEPRG alone is not enough, the ID table sets it
+ * for all Samsung large page chips.
+ */
+#define NAND_USE_CACHEPRG	0x00100000
 
 /* Options set by nand scan */
 /* Nand scan has allocated controller struct */
@@ -298,6 +320,14 @@ struct nand_onfi_params {
 
 #define ONFI_CRC_BASE	0x4F4E
 
+/* ONFI optional commands (nand_onfi_params.opt_cmd) */
+#define ONFI_OPT_CMD_PROG_CACHE		(1 << 0)
+#define ONFI_OPT_CMD_READ_CACHE		(1 << 1)
+
+/* ONFI features (nand_onfi_params.features) */
+#define ONFI_FEATURE_16_BIT_BUS		(1 << 0)
+#define ONFI_FEATURE_INTERLEAVED	(1 << 3)
+
 /**
  * struct nand_hw_control - Control structure for hardware controller (e.g ECC generator) shared among independent devices
  * @lock:               protection lock
@@ -428,6 +458,14 @@ struct nand_buffers {
  * @chip_delay:		[BOARDSPECIFIC] chip dependent delay for transferring
  *			data from array to read regs (tR).
  * @state:		[INTERN] the current state of the NAND device
+ * @die_state:		[INTERN] with NAND_INTERLEAVE, the operation each chip
+ *			is busy with, FL_READY if none
+ * @die_status:		[INTERN] where the status of that operation goes
+ * @cur_die:		[INTERN] the chip selected for the current operation
+ * @io_wq:		[INTERN] with NAND_INTERLEAVE, workqueue executing
+ *			asynchronous I/O requests
+ * @prev_cached:	[INTERN] the previous page was written with cache
+ *			program, its result comes with the next status
  * @oob_poi:		"poison value buffer," used for laying out OOB data
  *			before writing
  * @page_shift:		[INTERN] number of address bits in a page (column
@@ -525,6 +563,11 @@ struct nand_chip {
 	struct nand_onfi_params	onfi_params;
 
 	flstate_t state;
+	flstate_t die_state[NAND_MAX_CHIPS];
+	int *die_status[NAND_MAX_CHIPS];
+	int cur_die;
+	struct workqueue_struct *io_wq;
+	int prev_cached;
 
 	uint8_t *oob_poi;
 	struct nand_hw_control *controller;
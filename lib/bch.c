@@ -50,6 +50,13 @@
  * b. Error locator polynomial computation using Berlekamp-Massey algorithm
  * c. Error locator root finding (by far the most expensive step)
  *
+ * Step a is performed one ecc byte at a time: for each odd syndrome index j,
+ * the ecc polynomial is reduced modulo a multiple of the minimal polynomial of
+ * a^j using a 256-entry remainder table, and the resulting remainder (at most
+ * 16 bits) is evaluated at a^j with two more table lookups. Even syndromes are
+ * obtained by squaring. Error-free codewords are detected before computing any
+ * syndrome.
+ *
  * In this implementation, step c is not performed using the usual Chien search.
  * Instead, an alternative approach described in [1] is used. It consists in
  * factoring the error locator polynomial using the Berlekamp Trace algorithm
@@ -337,31 +344,35 @@ static inline int a_ilog(struct bch_control *bch, unsigned int x)
 static void compute_syndromes(struct bch_control *bch, uint32_t *ecc,
 			      unsigned int *syn)
 {
-	int i, j, s;
-	unsigned int m;
-	uint32_t poly;
+	int i, j, k;
+	unsigned int m, d, r, v, mask;
+	const uint16_t *tab;
 	const int t = GF_T(bch);
+	const int nbytes = BCH_ECC_BYTES(bch);
 
-	s = bch->ecc_bits;
-
-	/* make sure extra bits in last ecc word are cleared */
-	m = ((unsigned int)s) & 31;
+	/* make sure extra bits in last ecc words are cleared */
+	m = bch->ecc_bits & 31;
+	i = bch->ecc_bits/32;
 	if (m)
-		ecc[s/32] &= ~((1u << (32-m))-1);
-	memset(syn, 0, 2*t*sizeof(*syn));
-
-	/* compute v(a^j) for j=1 .. 2t-1 */
-	do {
-		poly = *ecc++;
-		s -= 32;
-		while (poly) {
-			i = deg(poly);
-			for (j = 0; j < 2*t; j += 2)
-				syn[j] ^= a_pow(bch, (j+1)*(i+s));
-
-			poly ^= (1 << i);
+		ecc[i++] &= ~((1u << (32-m))-1);
+	for (; i < (int)BCH_ECC_WORDS(bch); i++)
+		ecc[i] = 0;
+
+	/* compute v(a^j) for j=1 .. 2t-1, see build_syn_tables() */
+	for (j = 0; j < t; j++) {
+		tab = bch->syn_tab+768*j;
+		d = bch->syn_deg[j];
+		mask = (1u << d)-1;
+		/* reduce v(X) modulo p_j(X), one byte at a time */
+		for (k = 0, r = 0; k < nbytes; k++) {
+			v = (ecc[k/4] >> (24-8*(k & 3))) & 0xff;
+			r = ((r << 8) & mask)^v^tab[r >> (d-8)];
 		}
-	} while (s > 0);
+		/* evaluate remainder and correct for ecc bits alignment */
+		v = tab[256+(r & 0xff)]^tab[512+(r >> 8)];
+		syn[2*j] = v ? bch->a_pow_tab[mod_s(bch, bch->a_log_tab[v]+
+						    bch->syn_corr[j])] : 0;
+	}
 
 	/* v(a^(2j)) = v(a^j)^2 */
 	for (j = 0; j < t; j++)
@@ -1008,17 +1019,17 @@ int decode_bch(struct bch_control *bch, const uint8_t *data, unsigned int len,
 			load_ecc8(bch, bch->ecc_buf, calc_ecc);
 		}
 		/* load received ecc or assume it was XORed in calc_ecc */
-		if (recv_ecc) {
+		if (recv_ecc)
 			load_ecc8(bch, bch->ecc_buf2, recv_ecc);
+		for (i = 0, sum = 0; i < (int)ecc_words; i++) {
 			/* XOR received and calculated ecc */
-			for (i = 0, sum = 0; i < (int)ecc_words; i++) {
+			if (recv_ecc)
 				bch->ecc_buf[i] ^= bch->ecc_buf2[i];
-				sum |= bch->ecc_buf[i];
-			}
-			if (!sum)
-				/* no error found */
-				return 0;
+			sum |= bch->ecc_buf[i];
 		}
+		if (!sum)
+			/* no error found, skip syndrome computation */
+			return 0;
 		compute_syndromes(bch, bch->ecc_buf, bch->syn);
 		syn = bch->syn;
 	}
@@ -1158,6 +1169,81 @@ static void *bch_alloc(size_t size, int *err)
 	return ptr;
 }
 
+/*
+ * build tables for computing odd syndromes one ecc byte at a time: for each
+ * j = 2i+1, p_j(X) is the minimal polynomial of a^j, multiplied by a power of X
+ * if needed to get a degree d >= 8. Since p_j(a^j) = 0, v(a^j) = r(a^j) where
+ * r(X) = v(X) mod p_j(X). Table entries are:
+ * tab[b]     = b(X).X^d mod p_j(X)
+ * tab[256+b] = b(a^j)
+ * tab[512+b] = b(a^j).a^(8j)
+ * Ecc bytes are left-justified, hence the last byte contributes v(X).X^pad
+ * which is corrected by a constant factor a^(-j.pad).
+ */
+static int build_syn_tables(struct bch_control *bch)
+{
+	const unsigned int m = GF_M(bch);
+	const unsigned int t = GF_T(bch);
+	const unsigned int pad = 8*BCH_ECC_BYTES(bch)-bch->ecc_bits;
+	int err = 0;
+	unsigned int i, j, k, b, d, r, p, v, w;
+	struct gf_poly *g;
+	uint16_t *tab;
+
+	g = bch_alloc(GF_POLY_SZ(m), &err);
+	if (err)
+		return -ENOMEM;
+
+	for (i = 0; i < t; i++) {
+		j = 2*i+1;
+		/* minimal polynomial: product of (X+a^r), r in coset of j */
+		g->deg = 0;
+		g->c[0] = 1;
+		r = j;
+		do {
+			v = bch->a_pow_tab[r];
+			g->c[g->deg+1] = 1;
+			for (k = g->deg; k > 0; k--)
+				g->c[k] = gf_mul(bch, g->c[k], v)^g->c[k-1];
+
+			g->c[0] = gf_mul(bch, g->c[0], v);
+			g->deg++;
+			r = mod_s(bch, 2*r);
+		} while (r != j);
+
+		/* coefficients are binary, store p_j(X) as a bit field */
+		for (k = 0, p = 0; k <= g->deg; k++)
+			if (g->c[k])
+				p |= 1u << k;
+		d = g->deg;
+		if (d < 8) {
+			p <<= 8-d;
+			d = 8;
+		}
+
+		tab = bch->syn_tab+768*i;
+		for (b = 0; b < 256; b++) {
+			v = b << d;
+			for (k = d+7; k >= d; k--)
+				if (v & (1u << k))
+					v ^= p << (k-d);
+			tab[b] = v;
+
+			for (k = 0, v = 0, w = 0; k < 8; k++)
+				if (b & (1u << k)) {
+					v ^= a_pow(bch, j*k);
+					w ^= a_pow(bch, j*(k+8));
+				}
+			tab[256+b] = v;
+			tab[512+b] = w;
+		}
+		bch->syn_deg[i] = d;
+		bch->syn_corr[i] = mod_s(bch, GF_N(bch)-modulo(bch, j*pad));
+	}
+	kfree(g);
+	return 0;
+}
+
 /*
  * compute generator polynomial for given (m,t) parameters.
  */
@@ -1303,6 +1389,9 @@ struct bch_control *init_bch(int m, int t, unsigned int prim_poly)
 	bch->ecc_buf2  = bch_alloc(words*sizeof(*bch->ecc_buf2), &err);
 	bch->xi_tab    = bch_alloc(m*sizeof(*bch->xi_tab), &err);
 	bch->syn       = bch_alloc(2*t*sizeof(*bch->syn), &err);
+	bch->syn_tab   = bch_alloc(768*t*sizeof(*bch->syn_tab), &err);
+	bch->syn_deg   = bch_alloc(t*sizeof(*bch->syn_deg), &err);
+	bch->syn_corr  = bch_alloc(t*sizeof(*bch->syn_corr), &err);
 	bch->cache     = bch_alloc(2*t*sizeof(*bch->cache), &err);
 	bch->elp       = bch_alloc((t+1)*sizeof(struct gf_poly_deg1), &err);
 
@@ -1324,6 +1413,10 @@ struct bch_control *init_bch(int m, int t, unsigned int prim_poly)
 	build_mod8_tables(bch, genpoly);
 	kfree(genpoly);
 
+	err = build_syn_tables(bch);
+	if (err)
+		goto fail;
+
 	err = build_deg2_base(bch);
 	if (err)
 		goto fail;
@@ -1352,6 +1445,9 @@ void free_bch(struct bch_control *bch)
 		kfree(bch->ecc_buf2);
 		kfree(bch->xi_tab);
 		kfree(bch->syn);
+		kfree(bch->syn_tab);
+		kfree(bch->syn_deg);
+		kfree(bch->syn_corr);
 		kfree(bch->cache);
 		kfree(bch->elp);
 
@@ -0,0 +1,306 @@
+/*
+ * swap-stress: push anonymous memory through swap and report the cost
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * A number of worker processes each map an anonymous region and repeatedly
+ * write and read it back. When the total size exceeds the free memory, the
+ * pages go through swap, which makes this a stress test for swap devices like
+ * zram. Page contents are a mix of zero pages, pages filled with one repeated
+ * word and pages which compress to about one half. With -i, a quarter of the
+ * pages is made incompressible instead.
+ *
+ * At the end, the swap traffic (from /proc/vmstat) is reported together with
+ * the throughput and the CPU time (from /proc/stat, all CPUs, all modes but
+ * idle and iowait) spent per swapped page. With -z, the given zram device is
+ * sampled while the workers run, and its peak memory use is reported along
+ * with the pages written back to its backing device, if it has one.
+ *
+ * Typical use with zram:
+ *	echo $((512 << 20)) > /sys/block/zram0/disksize
+ *	mkswap /dev/zram0 && swapon /dev/zram0
+ *	swap-stress -m 1024 -p 8 -n 4 -z zram0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+struct sample {
+	unsigned long long pswpin;
+	unsigned long long pswpout;
+	unsigned long long busy;	/* clock ticks */
+	struct timespec ts;
+};
+
+static unsigned long long vmstat(const char *name)
+{
+	char key[64];
+	unsigned long long val, ret = 0;
+	FILE *f = fopen("/proc/vmstat", "r");
+
+	if (!f) {
+		perror("/proc/vmstat");
+		exit(1);
+	}
+	while (fscanf(f, "%63s %llu", key, &val) == 2)
+		if (!strcmp(key, name)) {
+			ret = val;
+			break;
+		}
+	fclose(f);
+	return ret;
+}
+
+static unsigned long long busy_ticks(void)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq;
+	FILE *f = fopen("/proc/stat", "r");
+
+	if (!f) {
+		perror("/proc/stat");
+		exit(1);
+	}
+	if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice,
+		   &sys, &idle, &iowait, &irq, &softirq) != 7) {
+		fprintf(stderr, "cannot parse /proc/stat\n");
+		exit(1);
+	}
+	fclose(f);
+	return user + nice + sys + irq + softirq;
+}
+
+static void take_sample(struct sample *s)
+{
+	s->pswpin = vmstat("pswpin");
+	s->pswpout = vmstat("pswpout");
+	s->busy = busy_ticks();
+	clock_gettime(CLOCK_MONOTONIC, &s->ts);
+}
+
+static int incompressible;
+
+/*
+ * Fill a page: 1/4 zero, 1/4 same-filled, 1/2 compressible to about 50%, or
+ * 1/4 compressible and 1/4 random with -i. The first word of the last two
+ * kinds is always the page number.
+ */
+static void fill_page(uint64_t *p, size_t words, unsigned long n, int pass)
+{
+	uint64_t x = n * 0x9e3779b97f4a7c15ULL + pass;
+	int noise = incompressible && (n & 3) == 3;
+	size_t i;
+
+	switch (n & 3) {
+	case 0:
+		memset(p, 0, words * sizeof(*p));
+		break;
+	case 1:
+		for (i = 0; i < words; i++)
+			p[i] = x;
+		break;
+	default:
+		for (i = 0; i < words; i++) {
+			if ((i & 1) || (noise && i)) {
+				/* xorshift, incompressible words */
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+				p[i] = x;
+			} else
+				p[i] = n;
+		}
+		break;
+	}
+}
+
+static int worker(size_t size, int passes, long page_size)
+{
+	size_t words = page_size / sizeof(uint64_t);
+	unsigned long npages = size / page_size, n;
+	char *mem;
+	int pass;
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	for (pass = 0; pass < passes; pass++) {
+		for (n = 0; n < npages; n++)
+			fill_page((uint64_t *)(mem + n * page_size), words, n,
+				  pass);
+		/* Read everything back, faulting swapped pages in */
+		for (n = 0; n < npages; n++) {
+			uint64_t *p = (uint64_t *)(mem + n * page_size);
+			uint64_t expect = 0;
+
+			if ((n & 3) == 1)
+				expect = n * 0x9e3779b97f4a7c15ULL + pass;
+			else if ((n & 3) > 1)
+				expect = n;
+			if (p[0] != expect) {
+				fprintf(stderr, "page %lu: data mismatch\n", n);
+				return 1;
+			}
+		}
+	}
+
+	munmap(mem, size);
+	return 0;
+}
+
+/* Read a zram sysfs node, returns 0 if it does not exist */
+static unsigned long long zram_stat(const char *dev, const char *name)
+{
+	char path[256];
+	unsigned long long val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", dev, name);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%llu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+struct zram_peak {
+	unsigned long long mem_used;	/* bytes */
+	unsigned long long orig_size;	/* bytes */
+	unsigned long long wb_pages;
+};
+
+static void zram_sample(const char *dev, struct zram_peak *peak)
+{
+	unsigned long long val;
+
+	val = zram_stat(dev, "mem_used_total");
+	if (val > peak->mem_used)
+		peak->mem_used = val;
+	val = zram_stat(dev, "orig_data_size");
+	if (val > peak->orig_size)
+		peak->orig_size = val;
+	val = zram_stat(dev, "wb_pages");
+	if (val > peak->wb_pages)
+		peak->wb_pages = val;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-m MiB] [-n processes] [-p passes] [-i] "
+		"[-z zramN]\n"
+		"  -m  total memory to cycle through swap (default 512)\n"
+		"  -n  number of worker processes (default 4)\n"
+		"  -p  number of write/read passes (default 4)\n"
+		"  -i  make a quarter of the pages incompressible\n"
+		"  -z  report peak memory use of this zram device\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	long page_size = sysconf(_SC_PAGESIZE), hz = sysconf(_SC_CLK_TCK);
+	unsigned long long pages, mib = 512;
+	int i, c, status, nproc = 4, passes = 4, failed = 0;
+	const char *zram = NULL;
+	struct zram_peak peak = { 0, 0, 0 };
+	struct sample a, b;
+	pid_t pid;
+	double secs;
+
+	while ((c = getopt(argc, argv, "m:n:p:iz:h")) != -1) {
+		switch (c) {
+		case 'm':
+			mib = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			nproc = atoi(optarg);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		case 'i':
+			incompressible = 1;
+			break;
+		case 'z':
+			zram = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!mib || nproc < 1 || passes < 1)
+		usage(argv[0]);
+
+	take_sample(&a);
+	for (i = 0; i < nproc; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid)
+			exit(worker((mib << 20) / nproc, passes, page_size));
+	}
+	for (;;) {
+		pid = waitpid(-1, &status, zram ? WNOHANG : 0);
+		if (pid < 0 && errno == ECHILD)
+			break;
+		if (pid > 0) {
+			if (!WIFEXITED(status) || WEXITSTATUS(status))
+				failed = 1;
+			continue;
+		}
+		/* Sample while the workers still hold their memory */
+		zram_sample(zram, &peak);
+		usleep(100000);
+	}
+	take_sample(&b);
+
+	secs = (b.ts.tv_sec - a.ts.tv_sec) +
+	       (b.ts.tv_nsec - a.ts.tv_nsec) / 1e9;
+	pages = (b.pswpin - a.pswpin) + (b.pswpout - a.pswpout);
+
+	printf("processes %d, passes %d, memory %llu MiB, time %.2f s\n",
+	       nproc, passes, mib, secs);
+	printf("swapped out %llu pages, swapped in %llu pages\n",
+	       b.pswpout - a.pswpout, b.pswpin - a.pswpin);
+	if (pages) {
+		printf("swap throughput %.1f MiB/s, %.0f pages/s\n",
+		       pages * page_size / secs / (1 << 20), pages / secs);
+		printf("CPU time per swapped page %.2f us\n",
+		       (double)(b.busy - a.busy) * 1e6 / hz / pages);
+	} else
+		printf("no swap traffic, increase -m\n");
+	if (zram) {
+		printf("%s peak: data %llu KiB, memory used %llu KiB\n", zram,
+		       peak.orig_size >> 10, peak.mem_used >> 10);
+		printf("%s peak: %llu KiB on backing device, "
+		       "%llu pages read back\n", zram,
+		       peak.wb_pages * page_size >> 10,
+		       zram_stat(zram, "bd_reads"));
+	}
+
+	return failed;
+}